@@ -25,13 +25,17 @@
 #include <arpa/inet.h>
 
 #include "miscadmin.h"
+#include "pgstat.h"
 #include "storage/backendid.h"
+#include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "storage/pmsignal.h"
 #include "storage/shmem.h"
 #include "storage/sinvaladt.h"
+#include "utils/timestamp.h"
 
 #include "dbgcomm.h"
+#include "globalbp.h"
 #include "pldebugger.h"
 
 #if (PG_VERSION_NUM < 90200)
@@ -55,7 +59,10 @@
  * and sets the port to the port it's connecting from. When the target backend
  * accept()s the connection, it checks that the remote port of the connection
  * matches the one in the slot. This makes the communication secure, because
- * only a legitimate proxy backend can access shared memory.
+ * only a legitimate proxy backend can access shared memory. The proxy also
+ * leaves the role it runs as in 'proxyRole', so that the target can tell
+ * what the proxy is allowed to do (see PLDBG_QUERY); a target that connects
+ * to a proxy gets the role from the global breakpoint instead.
  *
  * Target backend connecting to a proxy (when a global breakpoint is hit) works
  * similarly, except that the LISTENING step is not needed. The backend sets
@@ -63,11 +70,25 @@
  * The proxy accept()s the connection, and scans all the slots for a match
  * on the port number the connection came from. If it finds the port number
  * in one of the slots, the connection came from a legitimate target backend.
+ *
+ * A paused target that loses its proxy can wait for a new one to reattach
+ * (see dbgcomm_wait_for_reattach()). That works like LISTENING_FOR_PROXY,
+ * except that the status is WAITING_FOR_REATTACH and the proxy finds the
+ * slot by the session token that the old proxy was given, rather than by
+ * backend ID.
+ *
+ * A target whose debugger has offered read-only access to observers
+ * advertises an OBSERVABLE slot, with the port it accepts observers on and
+ * the observer token. Observers aren't authenticated by port number;
+ * instead, the proxy sends the token as the first thing on the connection,
+ * so that any number of them can connect at the same time.
  */
 #define DBGCOMM_IDLE				0
 #define DBGCOMM_LISTENING_FOR_PROXY	1	/* target is listening for a proxy */
 #define DBGCOMM_PROXY_CONNECTING	2	/* proxy is connecting to our port */
 #define DBGCOMM_CONNECTING_TO_PROXY	3	/* target is connecting to a proxy */
+#define DBGCOMM_WAITING_FOR_REATTACH 4	/* target lost its proxy, waiting for another */
+#define DBGCOMM_OBSERVABLE			5	/* target accepts read-only observers */
 
 typedef struct
 {
@@ -75,10 +96,15 @@ typedef struct
 	int			status;
 	int			pid;
 	int			port;
+	uint64		token;		/* session or observer token, see above */
+	Oid			proxyRole;	/* role of the proxy that is connecting */
 } dbgcomm_target_slot_t;
 
 static dbgcomm_target_slot_t *dbgcomm_slots = NULL;
 
+/* Our OBSERVABLE slot, if we have one (see dbgcomm_listen_for_observers()) */
+static int observerSlot = -1;
+
 /*
  * Each in-progress connection attempt between proxy and target require
  * a slot. 50 should be plenty.
@@ -92,6 +118,11 @@ static void dbgcomm_init(void);
 static uint32 resolveHostName(const char *hostName);
 static int findFreeTargetSlot(void);
 static int findTargetSlot(BackendId backendid);
+static int findReattachSlot(uint64 token);
+static int findObservableSlot(uint64 token);
+static void releaseTargetSlot(int slot);
+static int createTargetListener(int *port);
+static int connectToTarget(BackendId targetBackend, uint64 token, int *targetPid);
 
 /**********************************************************************
  * Initialization routines
@@ -130,6 +161,7 @@ dbgcomm_init(void)
 		{
 			dbgcomm_slots[i].backendid = InvalidBackendId;
 			dbgcomm_slots[i].status = DBGCOMM_IDLE;
+			dbgcomm_slots[i].token = 0;
 		}
 	}
 	LWLockRelease(getPLDebuggerLock());
@@ -252,62 +284,163 @@ dbgcomm_connect_to_proxy(int proxyPort)
  * dbcomm_connect_to_proxy
  *
  * This does listen() + accept(), to wait for a proxy to connect to us.
+ * funcOid and lineNumber identify the breakpoint that we stopped at, for
+ * the benefit of anyone listening for breakpoint hits. The role that the
+ * proxy runs as is returned in *proxyRole.
+ *
+ * We wait on our latch rather than blocking in accept(), so that the wait
+ * can be canceled, and so that pldbg_disarm_all() can send us on our way;
+ * in that case we return -1.
  */
 int
-dbgcomm_listen_for_proxy(void)
+dbgcomm_listen_for_proxy(Oid funcOid, int lineNumber, Oid *proxyRole)
 {
 	struct sockaddr_in   remoteaddr = {0};
-	struct sockaddr_in   localaddr = {0};
-	socklen_t	addrlen 	= sizeof( remoteaddr );
+	socklen_t	addrlen;
 	int			sockfd;
-	int			serverSocket;
+	volatile int serverSocket = -1;
 	int			localport;
-	bool		done;
+	volatile bool done;
 	int			slot;
 
 	dbgcomm_init();
 
-	sockfd = socket( AF_INET, SOCK_STREAM, 0 );
+	sockfd = createTargetListener(&localport);
 	if (sockfd < 0)
+		return -1;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+	slot = findFreeTargetSlot();
+	if (slot < 0)
 	{
+		closesocket(sockfd);
+		LWLockRelease(getPLDebuggerLock());
 		ereport(COMMERROR,
 				(errcode_for_socket_access(),
-				 errmsg("could not create socket for connecting to proxy: %m")));
+				 errmsg("could not find a free target slot")));
 		return -1;
 	}
-	/* Sockets seem to be non-blocking by default on Windows.. */
-	if (!pg_set_block(sockfd))
+	dbgcomm_slots[slot].port = localport;
+	dbgcomm_slots[slot].status = DBGCOMM_LISTENING_FOR_PROXY;
+	dbgcomm_slots[slot].backendid = MyBackendId;
+	dbgcomm_slots[slot].pid = MyProcPid;
+	LWLockRelease(getPLDebuggerLock());
+
+	/* Notify the client application that this backend is waiting for a proxy. */
+	elog(NOTICE, "PLDBGBREAK:%d", MyBackendId);
+	notifyBreakpointHit(funcOid, lineNumber, -1);
+
+	/* wait for the other end to connect to us */
+	done = false;
+
+	PG_TRY();
+	{
+		while (!done)
+		{
+			int			rc;
+
+#if (PG_VERSION_NUM >= 100000)
+			rc = WaitLatchOrSocket(MyLatch,
+								   WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH,
+								   sockfd, -1L, PG_WAIT_EXTENSION);
+#else
+			rc = WaitLatchOrSocket(MyLatch,
+								   WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH,
+								   sockfd, -1L);
+#endif
+
+			if (rc & WL_POSTMASTER_DEATH)
+				ereport(FATAL,
+						(errmsg("canceling debugging session because postmaster died")));
+
+			if (rc & WL_LATCH_SET)
+			{
+				ResetLatch(MyLatch);
+				CHECK_FOR_INTERRUPTS();
+
+				if (BreakpointsDisarmed())
+					break;
+			}
+
+			if (!(rc & WL_SOCKET_READABLE))
+				continue;
+
+			addrlen = sizeof(remoteaddr);
+			serverSocket = accept(sockfd, (struct sockaddr *) &remoteaddr, &addrlen);
+			if (serverSocket < 0)
+				ereport(ERROR,
+						(errmsg("could not accept connection from debugging proxy")));
+
+			/*
+			 * Authenticate the connection. We do this by checking that the remote
+			 * end's port number matches what's posted in the shared memory slot.
+			 */
+			LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+			if (dbgcomm_slots[slot].status == DBGCOMM_PROXY_CONNECTING &&
+				dbgcomm_slots[slot].port == ntohs(remoteaddr.sin_port))
+			{
+				*proxyRole = dbgcomm_slots[slot].proxyRole;
+				dbgcomm_slots[slot].backendid = InvalidBackendId;
+				dbgcomm_slots[slot].status = DBGCOMM_IDLE;
+				done = true;
+			}
+			else
+			{
+				closesocket(serverSocket);
+				serverSocket = -1;
+			}
+			LWLockRelease(getPLDebuggerLock());
+		}
+	}
+	PG_CATCH();
 	{
+		releaseTargetSlot(slot);
 		closesocket(sockfd);
-		ereport(COMMERROR,
-			(errmsg("could not set socket to blocking mode: %m")));
-		return -1;
+		PG_RE_THROW();
 	}
+	PG_END_TRY();
 
-	/* Bind the listener socket to any available port */
-	localaddr.sin_family	  = AF_INET;
-	localaddr.sin_port		  = htons( 0 );
-	localaddr.sin_addr.s_addr = resolveHostName( "127.0.0.1" );
-	if (bind( sockfd, (struct sockaddr *) &localaddr, sizeof(localaddr)) < 0)
+	closesocket(sockfd);
+
+	if (!done)
 	{
-		ereport(COMMERROR,
-				(errcode_for_socket_access(),
-				 errmsg("could not bind socket for listening for proxy: %m")));
+		/* Disarmed while we were waiting */
+		releaseTargetSlot(slot);
 		return -1;
 	}
 
-	/* Get the port number selected by the TCP/IP stack */
-	getsockname(sockfd, (struct sockaddr *) &localaddr, &addrlen);
-	localport = ntohs(localaddr.sin_port);
+	return serverSocket;
+}
 
-	/* Get ready to wait for a client. */
-	if (listen(sockfd, 2) < 0)
-	{
-		ereport(COMMERROR,
-				(errcode_for_socket_access(),
-				 errmsg("could not listen() for proxy: %m")));
+/*
+ * dbgcomm_wait_for_reattach
+ *
+ * Called by a paused target that has lost the connection to its proxy.
+ * Listens for a new proxy that presents the given session token (see
+ * dbgcomm_reattach_to_target()) for up to timeout_ms milliseconds. Returns
+ * the socket of the new connection, and the role the new proxy runs as in
+ * *proxyRole, or -1 if nobody reattached in time.
+ *
+ * Like dbgcomm_listen_for_proxy(), we wait on our latch rather than
+ * blocking in accept(), so that the wait can be canceled, and here also so
+ * that it ends when the grace period does.
+ */
+int
+dbgcomm_wait_for_reattach(uint64 token, int timeout_ms, Oid *proxyRole)
+{
+	struct sockaddr_in remoteaddr = {0};
+	socklen_t	addrlen;
+	int			sockfd;
+	volatile int serverSocket = -1;
+	int			localport;
+	int			slot;
+	TimestampTz	deadline;
+
+	dbgcomm_init();
+
+	sockfd = createTargetListener(&localport);
+	if (sockfd < 0)
 		return -1;
-	}
 
 	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
 	slot = findFreeTargetSlot();
@@ -321,45 +454,281 @@ dbgcomm_listen_for_proxy(void)
 		return -1;
 	}
 	dbgcomm_slots[slot].port = localport;
-	dbgcomm_slots[slot].status = DBGCOMM_LISTENING_FOR_PROXY;
+	dbgcomm_slots[slot].status = DBGCOMM_WAITING_FOR_REATTACH;
 	dbgcomm_slots[slot].backendid = MyBackendId;
 	dbgcomm_slots[slot].pid = MyProcPid;
+	dbgcomm_slots[slot].token = token;
 	LWLockRelease(getPLDebuggerLock());
 
-	/* Notify the client application that this backend is waiting for a proxy. */
-	elog(NOTICE, "PLDBGBREAK:%d", MyBackendId);
+	deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout_ms);
 
-	/* wait for the other end to connect to us */
-	done = false;
-	while (!done)
+	PG_TRY();
 	{
-		serverSocket = accept(sockfd, (struct sockaddr *) &remoteaddr, &addrlen);
-		if (serverSocket < 0)
-			ereport(ERROR,
-					(errmsg("could not accept connection from debugging proxy")));
-
-		/*
-		 * Authenticate the connection. We do this by checking that the remote
-		 * end's port number matches what's posted in the shared memory slot.
-		 */
-		LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
-		if (dbgcomm_slots[slot].status == DBGCOMM_PROXY_CONNECTING &&
-			dbgcomm_slots[slot].port == ntohs(remoteaddr.sin_port))
+		for (;;)
 		{
-			dbgcomm_slots[slot].backendid = InvalidBackendId;
-			dbgcomm_slots[slot].status = DBGCOMM_IDLE;
-			done = true;
+			long		secs;
+			int			usecs;
+			long		remaining;
+			int			rc;
+			bool		done = false;
+
+			TimestampDifference(GetCurrentTimestamp(), deadline, &secs, &usecs);
+			remaining = secs * 1000 + usecs / 1000;
+			if (remaining <= 0)
+				break;
+
+#if (PG_VERSION_NUM >= 100000)
+			rc = WaitLatchOrSocket(MyLatch,
+								   WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+								   sockfd, remaining, PG_WAIT_EXTENSION);
+#else
+			rc = WaitLatchOrSocket(MyLatch,
+								   WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+								   sockfd, remaining);
+#endif
+
+			if (rc & WL_POSTMASTER_DEATH)
+				ereport(FATAL,
+						(errmsg("canceling debugging session because postmaster died")));
+
+			if (rc & WL_LATCH_SET)
+			{
+				ResetLatch(MyLatch);
+				CHECK_FOR_INTERRUPTS();
+
+				/* pldbg_disarm_all() says nobody is coming back for us */
+				if (BreakpointsDisarmed())
+					break;
+			}
+
+			if (!(rc & WL_SOCKET_READABLE))
+				continue;
+
+			addrlen = sizeof(remoteaddr);
+			serverSocket = accept(sockfd, (struct sockaddr *) &remoteaddr, &addrlen);
+			if (serverSocket < 0)
+				continue;
+
+			/*
+			 * Authenticate the connection, just like dbgcomm_listen_for_proxy()
+			 * does. The proxy had to know our token to find the slot.
+			 */
+			LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+			if (dbgcomm_slots[slot].status == DBGCOMM_PROXY_CONNECTING &&
+				dbgcomm_slots[slot].port == ntohs(remoteaddr.sin_port))
+			{
+				*proxyRole = dbgcomm_slots[slot].proxyRole;
+				done = true;
+			}
+			LWLockRelease(getPLDebuggerLock());
+
+			if (done)
+				break;
+
+			closesocket(serverSocket);
+			serverSocket = -1;
 		}
-		else
+	}
+	PG_CATCH();
+	{
+		releaseTargetSlot(slot);
+		closesocket(sockfd);
+		if (serverSocket >= 0)
 			closesocket(serverSocket);
-		LWLockRelease(getPLDebuggerLock());
+		PG_RE_THROW();
 	}
+	PG_END_TRY();
 
+	releaseTargetSlot(slot);
 	closesocket(sockfd);
 
 	return serverSocket;
 }
 
+/*
+ * dbgcomm_listen_for_observers
+ *
+ * Creates a socket for read-only observers of this target to connect to,
+ * and advertises it under the given observer token. Returns the listener
+ * socket, or -1 on failure. Connections are accepted with
+ * dbgcomm_accept_observer(), and dbgcomm_stop_observers() withdraws the
+ * offer.
+ */
+int
+dbgcomm_listen_for_observers(uint64 token)
+{
+	int			sockfd;
+	int			localport;
+	int			slot;
+
+	dbgcomm_init();
+
+	sockfd = createTargetListener(&localport);
+	if (sockfd < 0)
+		return -1;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+	slot = findFreeTargetSlot();
+	if (slot < 0)
+	{
+		closesocket(sockfd);
+		LWLockRelease(getPLDebuggerLock());
+		ereport(COMMERROR,
+				(errcode_for_socket_access(),
+				 errmsg("could not find a free target slot")));
+		return -1;
+	}
+	dbgcomm_slots[slot].port = localport;
+	dbgcomm_slots[slot].status = DBGCOMM_OBSERVABLE;
+	dbgcomm_slots[slot].backendid = MyBackendId;
+	dbgcomm_slots[slot].pid = MyProcPid;
+	dbgcomm_slots[slot].token = token;
+	LWLockRelease(getPLDebuggerLock());
+
+	observerSlot = slot;
+
+	return sockfd;
+}
+
+/*
+ * dbgcomm_accept_observer
+ *
+ * Accepts a pending connection on the observer listener, and checks that
+ * the other end knows the observer token. Returns the socket, or -1 if the
+ * connection didn't check out. Call this only when the listener is
+ * readable, or it will block.
+ */
+int
+dbgcomm_accept_observer(int listener, uint64 token)
+{
+	struct sockaddr_in remoteaddr = {0};
+	socklen_t	addrlen = sizeof(remoteaddr);
+	int			sockfd;
+	uint32		netToken[2];
+	char	   *buffer = (char *) netToken;
+	size_t		remaining = sizeof(netToken);
+
+	sockfd = accept(listener, (struct sockaddr *) &remoteaddr, &addrlen);
+	if (sockfd < 0)
+		return -1;
+
+	/*
+	 * The proxy sends the token right after connecting. Don't let a
+	 * connection that never sends it hang the target.
+	 */
+	while (remaining > 0)
+	{
+		fd_set		rmask;
+		struct timeval timeout;
+		ssize_t		bytesRead;
+
+		FD_ZERO(&rmask);
+		FD_SET(sockfd, &rmask);
+		timeout.tv_sec  = 5;
+		timeout.tv_usec = 0;
+
+		if (select(sockfd + 1, &rmask, NULL, NULL, &timeout) <= 0)
+			break;
+
+		bytesRead = recv(sockfd, buffer, remaining, 0);
+		if (bytesRead <= 0)
+			break;
+
+		remaining -= bytesRead;
+		buffer    += bytesRead;
+	}
+
+	if (remaining > 0 ||
+		(((uint64) ntohl(netToken[0])) << 32 | ntohl(netToken[1])) != token)
+	{
+		ereport(COMMERROR,
+				(errmsg("rejected debugger observer connection: bad token")));
+		closesocket(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+/*
+ * dbgcomm_stop_observers
+ *
+ * Closes the observer listener and gives up our OBSERVABLE slot.
+ */
+void
+dbgcomm_stop_observers(int listener)
+{
+	if (listener > 0)
+		closesocket(listener);
+
+	if (observerSlot >= 0)
+	{
+		releaseTargetSlot(observerSlot);
+		observerSlot = -1;
+	}
+}
+
+/*
+ * createTargetListener
+ *
+ * Creates a socket listening on an unused local port, for a proxy to
+ * connect to. Returns the socket and sets *port, or returns -1 (after
+ * logging the reason) on failure.
+ */
+static int
+createTargetListener(int *port)
+{
+	struct sockaddr_in   localaddr = {0};
+	socklen_t	addrlen 	= sizeof( localaddr );
+	int			sockfd;
+
+	sockfd = socket( AF_INET, SOCK_STREAM, 0 );
+	if (sockfd < 0)
+	{
+		ereport(COMMERROR,
+				(errcode_for_socket_access(),
+				 errmsg("could not create socket for connecting to proxy: %m")));
+		return -1;
+	}
+	/* Sockets seem to be non-blocking by default on Windows.. */
+	if (!pg_set_block(sockfd))
+	{
+		closesocket(sockfd);
+		ereport(COMMERROR,
+			(errmsg("could not set socket to blocking mode: %m")));
+		return -1;
+	}
+
+	/* Bind the listener socket to any available port */
+	localaddr.sin_family	  = AF_INET;
+	localaddr.sin_port		  = htons( 0 );
+	localaddr.sin_addr.s_addr = resolveHostName( "127.0.0.1" );
+	if (bind( sockfd, (struct sockaddr *) &localaddr, sizeof(localaddr)) < 0)
+	{
+		ereport(COMMERROR,
+				(errcode_for_socket_access(),
+				 errmsg("could not bind socket for listening for proxy: %m")));
+		closesocket(sockfd);
+		return -1;
+	}
+
+	/* Get the port number selected by the TCP/IP stack */
+	getsockname(sockfd, (struct sockaddr *) &localaddr, &addrlen);
+	*port = ntohs(localaddr.sin_port);
+
+	/* Get ready to wait for a client. */
+	if (listen(sockfd, 2) < 0)
+	{
+		ereport(COMMERROR,
+				(errcode_for_socket_access(),
+				 errmsg("could not listen() for proxy: %m")));
+		closesocket(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
 /**********************************************************************
  * Routines called by debugging proxy
  **********************************************************************/
@@ -368,10 +737,43 @@ dbgcomm_listen_for_proxy(void)
  * dbgcomm_connect_to_target
  *
  * Connect to given target backend that's waiting for us. Returns a socket
- * that is open for communication. Uses ereport(ERROR) on error.
+ * that is open for communication, and the target's pid in *targetPid. Uses
+ * ereport(ERROR) on error.
  */
 int
-dbgcomm_connect_to_target(BackendId targetBackend)
+dbgcomm_connect_to_target(BackendId targetBackend, int *targetPid)
+{
+	return connectToTarget(targetBackend, 0, targetPid);
+}
+
+/*
+ * dbgcomm_reattach_to_target
+ *
+ * Connect to a target that lost its proxy and is waiting for another one to
+ * reattach with the given session token. Returns a socket that is open for
+ * communication, and the target's pid in *targetPid. Uses ereport(ERROR) on
+ * error.
+ */
+int
+dbgcomm_reattach_to_target(uint64 token, int *targetPid)
+{
+	if (token == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid session token")));
+
+	return connectToTarget(InvalidBackendId, token, targetPid);
+}
+
+/*
+ * connectToTarget
+ *
+ * Workhorse of dbgcomm_connect_to_target() and dbgcomm_reattach_to_target().
+ * If token is 0, connects to the given backend's LISTENING_FOR_PROXY slot,
+ * otherwise to the WAITING_FOR_REATTACH slot with that token.
+ */
+static int
+connectToTarget(BackendId targetBackend, uint64 token, int *targetPid)
 {
 	int			sockfd;
 	struct sockaddr_in   remoteaddr = {0};
@@ -423,15 +825,31 @@ dbgcomm_connect_to_target(BackendId targetBackend)
 	 * let it know we're connecting to it from this port.
 	 */
 	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
-	slot = findTargetSlot(targetBackend);
-	if (slot < 0 || dbgcomm_slots[slot].status != DBGCOMM_LISTENING_FOR_PROXY)
+	if (token != 0)
 	{
-		closesocket(sockfd);
-		ereport(ERROR,
-				(errmsg("target backend is not listening for a connection")));
+		slot = findReattachSlot(token);
+		if (slot < 0)
+		{
+			closesocket(sockfd);
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("no debugging target is waiting to be reattached with that token")));
+		}
+	}
+	else
+	{
+		slot = findTargetSlot(targetBackend);
+		if (slot < 0 || dbgcomm_slots[slot].status != DBGCOMM_LISTENING_FOR_PROXY)
+		{
+			closesocket(sockfd);
+			ereport(ERROR,
+					(errmsg("target backend is not listening for a connection")));
+		}
 	}
 	remoteport = dbgcomm_slots[slot].port;
+	*targetPid = dbgcomm_slots[slot].pid;
 	dbgcomm_slots[slot].port = localport;
+	dbgcomm_slots[slot].proxyRole = GetUserId();
 	dbgcomm_slots[slot].status = DBGCOMM_PROXY_CONNECTING;
 	LWLockRelease(getPLDebuggerLock());
 
@@ -450,6 +868,90 @@ dbgcomm_connect_to_target(BackendId targetBackend)
 	return sockfd;
 }
 
+/*
+ * dbgcomm_connect_as_observer
+ *
+ * Connect to the target that offers read-only access under the given
+ * observer token, and present the token. Returns a socket that is open for
+ * communication, and the target's pid in *targetPid. Uses ereport(ERROR) on
+ * error.
+ */
+int
+dbgcomm_connect_as_observer(uint64 token, int *targetPid)
+{
+	int			sockfd;
+	struct sockaddr_in   remoteaddr = {0};
+	int			remoteport;
+	int			slot;
+	uint32		netToken[2];
+	char	   *buffer = (char *) netToken;
+	size_t		remaining = sizeof(netToken);
+
+	dbgcomm_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+	slot = (token != 0) ? findObservableSlot(token) : -1;
+	if (slot < 0)
+	{
+		LWLockRelease(getPLDebuggerLock());
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("no debugging target accepts observers with that token")));
+	}
+	remoteport = dbgcomm_slots[slot].port;
+	*targetPid = dbgcomm_slots[slot].pid;
+	LWLockRelease(getPLDebuggerLock());
+
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sockfd < 0)
+		ereport(ERROR,
+				(errcode_for_socket_access(),
+				 errmsg("could not create socket for connecting to target: %m")));
+	/* Sockets seem to be non-blocking by default on Windows.. */
+	if (!pg_set_block(sockfd))
+	{
+		int save_errno = errno;
+		closesocket(sockfd);
+		errno = save_errno;
+		ereport(ERROR,
+				(errmsg("could not set socket to blocking mode: %m")));
+	}
+
+	remoteaddr.sin_family 	   = AF_INET;
+	remoteaddr.sin_port        = htons(remoteport);
+	remoteaddr.sin_addr.s_addr = resolveHostName( "127.0.0.1" );
+	if (connect(sockfd, (struct sockaddr *) &remoteaddr,
+				sizeof(remoteaddr)) < 0)
+	{
+		int save_errno = errno;
+		closesocket(sockfd);
+		errno = save_errno;
+		ereport(ERROR,
+				(errmsg("could not connect to target backend: %m")));
+	}
+
+	netToken[0] = htonl((uint32) (token >> 32));
+	netToken[1] = htonl((uint32) token);
+
+	while (remaining > 0)
+	{
+		ssize_t		bytesWritten = send(sockfd, buffer, remaining, 0);
+
+		if (bytesWritten <= 0)
+		{
+			closesocket(sockfd);
+			ereport(ERROR,
+					(errcode(ERRCODE_CONNECTION_FAILURE),
+					 errmsg("could not send observer token to target backend")));
+		}
+
+		remaining -= bytesWritten;
+		buffer    += bytesWritten;
+	}
+
+	return sockfd;
+}
+
 /*
  * dbgcomm_accept_target
  *
@@ -616,6 +1118,9 @@ findFreeTargetSlot(void)
 
 	for (i = 0; i < NumTargetSlots; i++)
 	{
+		/* Our OBSERVABLE slot stays put while we connect to proxies */
+		if (i == observerSlot)
+			continue;
 		if (dbgcomm_slots[i].backendid == InvalidBackendId)
 			return i;
 		if (dbgcomm_slots[i].backendid == MyBackendId)
@@ -634,7 +1139,61 @@ findFreeTargetSlot(void)
 
 
 /*
- * Find target slot belonging to given backend.
+ * Find the slot of the target waiting to be reattached with given token.
+ *
+ * Note: Caller must be holding the lock.
+ */
+static int
+findReattachSlot(uint64 token)
+{
+	int		i;
+
+	for (i = 0; i < NumTargetSlots; i++)
+	{
+		if (dbgcomm_slots[i].status == DBGCOMM_WAITING_FOR_REATTACH &&
+			dbgcomm_slots[i].token == token)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Find the OBSERVABLE slot with given observer token.
+ *
+ * Note: Caller must be holding the lock.
+ */
+static int
+findObservableSlot(uint64 token)
+{
+	int		i;
+
+	for (i = 0; i < NumTargetSlots; i++)
+	{
+		if (dbgcomm_slots[i].status == DBGCOMM_OBSERVABLE &&
+			dbgcomm_slots[i].token == token)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Give up our target slot.
+ */
+static void
+releaseTargetSlot(int slot)
+{
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+	dbgcomm_slots[slot].status = DBGCOMM_IDLE;
+	dbgcomm_slots[slot].backendid = InvalidBackendId;
+	dbgcomm_slots[slot].port = 0;
+	dbgcomm_slots[slot].token = 0;
+	LWLockRelease(getPLDebuggerLock());
+}
+
+/*
+ * Find target slot belonging to given backend. A target that accepts
+ * observers has a second slot for them (see dbgcomm_listen_for_observers()),
+ * which we skip.
  *
  * Note: Caller must be holding the lock.
  */
@@ -645,7 +1204,8 @@ findTargetSlot(BackendId backendid)
 
 	for (i = 0; i < NumTargetSlots; i++)
 	{
-		if (dbgcomm_slots[i].backendid == backendid)
+		if (dbgcomm_slots[i].backendid == backendid &&
+			dbgcomm_slots[i].status != DBGCOMM_OBSERVABLE)
 			return i;
 	}
 	return -1;
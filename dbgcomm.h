@@ -16,10 +16,16 @@
 extern void dbgcomm_reserve(void);
 
 extern int dbgcomm_connect_to_proxy(int proxyPort);
-extern int dbgcomm_listen_for_proxy(void);
+extern int dbgcomm_listen_for_proxy(Oid funcOid, int lineNumber, Oid *proxyRole);
+extern int dbgcomm_wait_for_reattach(uint64 token, int timeout_ms, Oid *proxyRole);
+extern int dbgcomm_listen_for_observers(uint64 token);
+extern int dbgcomm_accept_observer(int listener, uint64 token);
+extern void dbgcomm_stop_observers(int listener);
 
 extern int dbgcomm_listen_for_target(int *port);
 extern int dbgcomm_accept_target(int sockfd, int *targetPid);
-extern int dbgcomm_connect_to_target(BackendId targetBackend);
+extern int dbgcomm_connect_to_target(BackendId targetBackend, int *targetPid);
+extern int dbgcomm_reattach_to_target(uint64 token, int *targetPid);
+extern int dbgcomm_connect_as_observer(uint64 token, int *targetPid);
 
 #endif
@@ -30,6 +30,7 @@ typedef struct BreakpointData
 	bool		busy;		/* is this session already in use by a target? */
 	int			proxyPort;	/* port number of the proxy listener */
 	int			proxyPid;	/* process id of the proxy process */
+	Oid			proxyRole;	/* role the proxy runs as (InvalidOid if local) */
 } BreakpointData;
 
 /*
@@ -61,4 +62,7 @@ extern void			BreakpointGetList(eBreakpointScope scope, HASH_SEQ_STATUS *scan);
 extern void			BreakpointReleaseList(eBreakpointScope scope);
 extern void 		BreakpointBusySession(int pid);
 extern void 		BreakpointFreeSession(int pid);
+extern int			BreakpointDisarmAll(void);
+extern bool			BreakpointsDisarmed(void);
+extern void			BreakpointAcknowledgeDisarm(void);
 #endif
@@ -0,0 +1,80 @@
+-- pldbgapi--1.1--1.2.sql
+--  This script upgrades the PL debugger API from version 1.1 to 1.2
+--
+-- Licensed under the Artistic License v2.0, see
+--		https://opensource.org/licenses/artistic-license-2.0
+-- for full details
+
+\echo Use "ALTER EXTENSION pldbgapi UPDATE TO '1.2'" to load this file. \quit
+
+CREATE FUNCTION pldbg_get_session_token( session INTEGER ) RETURNS BIGINT AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_reattach( token BIGINT ) RETURNS INTEGER AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_get_observer_token( session INTEGER ) RETURNS BIGINT AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_attach_observer( token BIGINT ) RETURNS INTEGER AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE var_binary AS ( name TEXT, varClass "char", lineNumber INTEGER, isUnique bool, isConst bool, isNotNull bool, dtype OID, value BYTEA, isBinary bool );
+CREATE FUNCTION pldbg_get_variables_binary( session INTEGER ) RETURNS SETOF var_binary AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE typeinfo AS ( dtype OID, typeName TEXT, typMod INTEGER, elemType OID );
+CREATE FUNCTION pldbg_get_types( session INTEGER ) RETURNS SETOF typeinfo AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE FUNCTION pldbg_get_variables( session INTEGER, names TEXT[], inScopeOnly BOOLEAN DEFAULT false ) RETURNS SETOF var AS '$libdir/plugin_debugger', 'pldbg_get_variables_filtered' LANGUAGE C;
+CREATE FUNCTION pldbg_get_frame_variables( session INTEGER, frame INTEGER ) RETURNS SETOF var AS '$libdir/plugin_debugger', 'pldbg_get_variables_frame' LANGUAGE C STRICT;
+
+CREATE FUNCTION pldbg_explain_current( session INTEGER, analyze BOOLEAN DEFAULT false ) RETURNS TEXT AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE value_count AS ( value TEXT, count BIGINT, maxError BIGINT );
+CREATE FUNCTION pldbg_profile_values( func OID, linenumber INTEGER, varName TEXT, sampleEvery INTEGER DEFAULT 1 ) RETURNS boolean AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_get_value_profile( func OID, linenumber INTEGER, varName TEXT ) RETURNS SETOF value_count AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_drop_value_profile( func OID, linenumber INTEGER, varName TEXT ) RETURNS boolean AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE slow_call AS ( duration INTERVAL, ended TIMESTAMPTZ, pid INTEGER, args TEXT, callers TEXT );
+CREATE FUNCTION pldbg_capture_slow_calls( func OID, keep INTEGER DEFAULT 10 ) RETURNS boolean AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_get_slow_calls( func OID ) RETURNS SETOF slow_call AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_drop_slow_calls( func OID ) RETURNS boolean AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE workload_call AS ( called TIMESTAMPTZ, role NAME, call TEXT );
+CREATE FUNCTION pldbg_start_workload_capture( func OID ) RETURNS TEXT AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_stop_workload_capture( func OID ) RETURNS boolean AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_get_workload( func OID ) RETURNS SETOF workload_call AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE profile_line AS ( func OID, lineNumber INTEGER, count BIGINT, totalTime DOUBLE PRECISION, maxTime DOUBLE PRECISION, blksHit BIGINT, blksRead BIGINT, exceptions BIGINT );
+CREATE TYPE profile_delta AS ( func OID, lineNumber INTEGER, countA BIGINT, countB BIGINT, meanTimeA DOUBLE PRECISION, meanTimeB DOUBLE PRECISION, regression DOUBLE PRECISION );
+CREATE FUNCTION pldbg_get_profile() RETURNS SETOF profile_line AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_reset_profile() RETURNS VOID AS '$libdir/plugin_debugger' LANGUAGE C;
+CREATE FUNCTION pldbg_profile_snapshot( name TEXT ) RETURNS INTEGER AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_profile_diff( a TEXT, b TEXT DEFAULT NULL ) RETURNS SETOF profile_delta AS '$libdir/plugin_debugger' LANGUAGE C;
+
+CREATE TYPE annotated_line AS ( lineNumber INTEGER, source TEXT, count BIGINT, totalTime DOUBLE PRECISION, maxTime DOUBLE PRECISION, blksHit BIGINT, blksRead BIGINT, exceptions BIGINT );
+CREATE FUNCTION pldbg_annotate( func OID ) RETURNS SETOF annotated_line AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE exported_line AS ( func TEXT, lineNumber INTEGER, count BIGINT, totalTime DOUBLE PRECISION, maxTime DOUBLE PRECISION, blksHit BIGINT, blksRead BIGINT, exceptions BIGINT );
+CREATE FUNCTION pldbg_export_profile( name TEXT ) RETURNS INTEGER AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_merge_profiles( name TEXT, sources TEXT[] ) RETURNS INTEGER AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_read_profile( name TEXT ) RETURNS SETOF exported_line AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE action_result AS ( hit BIGINT, hitTime TIMESTAMPTZ, pid INTEGER, action TEXT, result TEXT );
+CREATE FUNCTION pldbg_drop_breakpoint_actions( func OID, linenumber INTEGER ) RETURNS boolean AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_get_breakpoint_results( func OID, linenumber INTEGER ) RETURNS SETOF action_result AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+CREATE FUNCTION pldbg_set_breakpoint_actions( func OID, linenumber INTEGER, actions TEXT[], keep INTEGER DEFAULT 20 ) RETURNS boolean AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE step_result AS ( func OID, linenumber INTEGER, targetName TEXT, steps INTEGER, trace INTEGER[] );
+CREATE FUNCTION pldbg_step_many( session INTEGER, steps INTEGER, untilLine INTEGER DEFAULT NULL, trace BOOLEAN DEFAULT false ) RETURNS step_result AS '$libdir/plugin_debugger' LANGUAGE C;
+
+CREATE FUNCTION pldbg_query_in_target( session INTEGER, sql TEXT, maxRows INTEGER DEFAULT 1000, maxBytes INTEGER DEFAULT 1048576 ) RETURNS SETOF json AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE FUNCTION pldbg_export_snapshot( session INTEGER ) RETURNS TEXT AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE debug_session AS ( pid INTEGER, kind TEXT, peerPid INTEGER, state TEXT, database OID, userId OID, func OID, linenumber INTEGER, stateSince TIMESTAMPTZ, pausedSince TIMESTAMPTZ );
+CREATE FUNCTION pldbg_sessions() RETURNS SETOF debug_session AS '$libdir/plugin_debugger' LANGUAGE C;
+
+CREATE FUNCTION pldbg_disarm_all() RETURNS INTEGER AS '$libdir/plugin_debugger' LANGUAGE C;
+
+CREATE TYPE loop_query AS (func OID, loopLine INTEGER, sqlLine INTEGER, loopEntries BIGINT, executions BIGINT, avgPerEntry DOUBLE PRECISION, totalTime DOUBLE PRECISION);
+CREATE FUNCTION pldbg_get_loop_queries( threshold DOUBLE PRECISION DEFAULT 10 ) RETURNS SETOF loop_query AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE plan_stats AS (func OID, linenumber INTEGER, planBuilds BIGINT, customPlans BIGINT, genericPlans BIGINT, invalidations BIGINT, planTime DOUBLE PRECISION);
+CREATE FUNCTION pldbg_get_plan_stats() RETURNS SETOF plan_stats AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
+
+CREATE TYPE wait_stats AS (func OID, linenumber INTEGER, lockWait DOUBLE PRECISION, lwlockWait DOUBLE PRECISION, ioWait DOUBLE PRECISION);
+CREATE FUNCTION pldbg_get_wait_stats() RETURNS SETOF wait_stats AS '$libdir/plugin_debugger' LANGUAGE C STRICT;
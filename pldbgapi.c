@@ -76,6 +76,12 @@
  *	The focus is important because many functions (such as
  *	pldbg_get_variables()) work against the stack frame that has the focus.
  *
+ *	Other people can watch a debugging session: pldbg_get_observer_token()
+ *	returns a token that you can hand to pldbg_attach_observer() (from
+ *	another connection) to open a read-only session on the same target.
+ *	Observers see the same stops, and can look at the stack, variables,
+ *	source and breakpoints, but can't step, continue or change anything.
+ *
  *	Any of the proxy functions may throw an error - in particular, a proxy
  *	function will throw an error if the target process ends.  You're most
  *	likely to encounter an error when you call pldbg_continue() and the
@@ -93,6 +99,9 @@
 #include "funcapi.h"
 #include "utils/memutils.h"
 #include "utils/builtins.h"
+#include "utils/array.h"
+#include "utils/tuplestore.h"
+#include "lib/stringinfo.h"
 #include "storage/ipc.h"					/* For on_shmem_exit()  		*/
 #include "storage/proc.h"					/* For MyProc		   			*/
 #include "libpq/libpq-be.h"					/* For Port						*/
@@ -110,6 +119,7 @@
 
 #include "globalbp.h"
 #include "dbgcomm.h"
+#include "sessions.h"
 
 /* Include header for GETSTRUCT */
 #if (PG_VERSION_NUM >= 90300)
@@ -142,21 +152,34 @@ PG_FUNCTION_INFO_V1( pldbg_attach_to_port );		/* Attach to debugger server at th
 PG_FUNCTION_INFO_V1( pldbg_wait_for_breakpoint );  	/* Wait for the target to reach a breakpoint	*/
 PG_FUNCTION_INFO_V1( pldbg_step_into );				/* Steop into a function/procedure call			*/
 PG_FUNCTION_INFO_V1( pldbg_step_over );				/* Step over a function/procedure call			*/
+PG_FUNCTION_INFO_V1( pldbg_step_many );				/* Step over several statements at once			*/
 PG_FUNCTION_INFO_V1( pldbg_continue );				/* Continue execution until next breakpoint		*/
 PG_FUNCTION_INFO_V1( pldbg_get_source );			/* Get the source code for a function/procedure	*/
 PG_FUNCTION_INFO_V1( pldbg_get_breakpoints );		/* SHOW BREAKPOINTS equivalent (deprecated)		*/
 PG_FUNCTION_INFO_V1( pldbg_get_variables );			/* Get a list of variable names/types/values	*/
+PG_FUNCTION_INFO_V1( pldbg_get_variables_filtered );	/* Same, but only the named/in-scope variables	*/
+PG_FUNCTION_INFO_V1( pldbg_get_variables_frame );	/* Same, but for any frame, keeping the focus	*/
+PG_FUNCTION_INFO_V1( pldbg_get_variables_binary );	/* Same, with values in binary (typsend) format	*/
+PG_FUNCTION_INFO_V1( pldbg_get_types );				/* Describe the data types of those variables	*/
 PG_FUNCTION_INFO_V1( pldbg_get_stack );				/* Get the call stack from the target			*/
 PG_FUNCTION_INFO_V1( pldbg_set_breakpoint );		/* CREATE BREAKPOINT equivalent (deprecated)	*/
 PG_FUNCTION_INFO_V1( pldbg_drop_breakpoint );		/* DROP BREAKPOINT equivalent (deprecated)		*/
 PG_FUNCTION_INFO_V1( pldbg_select_frame );			/* Change the focus to a different stack frame	*/
+PG_FUNCTION_INFO_V1( pldbg_explain_current );		/* EXPLAIN the statement the target is paused at	*/
+PG_FUNCTION_INFO_V1( pldbg_query_in_target );		/* Run a read-only query in the target's xact	*/
+PG_FUNCTION_INFO_V1( pldbg_export_snapshot );		/* Export the target's snapshot for other sessions */
 PG_FUNCTION_INFO_V1( pldbg_deposit_value );		 	/* Change the value of an in-scope variable		*/
 PG_FUNCTION_INFO_V1( pldbg_abort_target );			/* Abort execution of the target - throws error */
 PG_FUNCTION_INFO_V1( pldbg_get_proxy_info );		/* Get server version, proxy API version, ...   */
+PG_FUNCTION_INFO_V1( pldbg_get_session_token );		/* Get the token needed to reattach to a target	*/
+PG_FUNCTION_INFO_V1( pldbg_reattach );				/* Reattach to a target that lost its proxy		*/
+PG_FUNCTION_INFO_V1( pldbg_get_observer_token );	/* Let read-only observers watch this session	*/
+PG_FUNCTION_INFO_V1( pldbg_attach_observer );		/* Watch another proxy's session, read-only		*/
 
 PG_FUNCTION_INFO_V1( pldbg_create_listener );		/* Create a listener for global breakpoints		*/
 PG_FUNCTION_INFO_V1( pldbg_wait_for_target );		/* Wait for a global breakpoint to fire			*/
 PG_FUNCTION_INFO_V1( pldbg_set_global_breakpoint );	/* Create a global breakpoint					*/
+PG_FUNCTION_INFO_V1( pldbg_disarm_all );			/* Drop all breakpoints, release all targets	*/
 
 /*******************************************************************************
  * Structure debugSession
@@ -175,7 +198,10 @@ typedef struct
 	int			serverSocket;	/* Socket connected to the debugger server */
 	int			serverPort;		/* Port number where debugger server is listening */
 	int			listener;		/* Socket where we wait for global breakpoints */
+	bool		observer;		/* Read-only session, see pldbg_attach_observer() */
+	List	   *types;			/* Type descriptions, see pldbg_get_types() */
 	char	   *breakpointString;
+	int			registrySlot;	/* Our entry in pldbg_sessions(), or -1 */
 } debugSession;
 
 /*******************************************************************************
@@ -207,10 +233,13 @@ static HTAB			* sessionHash;
  */
 
 #define PLDBG_GET_VARIABLES		"i\n"
+#define PLDBG_GET_VARIABLES_BINARY	"I\n"
+#define PLDBG_GET_TYPES			"T"			/* Followed by number of types we know	*/
 #define PLDBG_GET_BREAKPOINTS 	"l\n"
 #define PLDBG_GET_STACK       	"$\n"
 #define PLDBG_STEP_INTO			"s\n"
 #define PLDBG_STEP_OVER			"o\n"
+#define PLDBG_STEP_MANY			"n"			/* Followed by steps:untilLine:trace		*/
 #define PLDBG_CONTINUE			"c\n"
 #define PLDBG_ABORT				"x"
 #define PLDBG_SELECT_FRAME		"^"			/* Followed by frame number 				*/
@@ -218,10 +247,16 @@ static HTAB			* sessionHash;
 #define PLDBG_CLEAR_BREAKPOINT	"f"			/* Followed by pkgoid:funcoid:linenumber 	*/
 #define PLDBG_GET_SOURCE			"#" 		/* Followed by pkgoid:funcoid				*/
 #define PLDBG_DEPOSIT				"d"			/* Followed by var.line=value				*/
+#define PLDBG_EXPLAIN				"e"			/* Followed by t (analyze) or f				*/
+#define PLDBG_QUERY				"q"			/* Followed by maxRows:maxBytes:sql			*/
+#define PLDBG_EXPORT_SNAPSHOT		"S\n"
+#define PLDBG_GET_TOKEN			"k\n"
+#define PLDBG_GET_OBSERVER_TOKEN	"w\n"
+#define PLDBG_WAIT_FOR_STOP		"W\n"
 
 #define PLDBG_STRING_MAX_LEN   128
 
-#define PROXY_API_VERSION		3			/* API version number						*/
+#define PROXY_API_VERSION		4			/* API version number						*/
 
 /*******************************************************************************
  * We currently define three PostgreSQL data types (all tuples) - the following
@@ -231,6 +266,9 @@ static HTAB			* sessionHash;
 #define	TYPE_NAME_BREAKPOINT	"breakpoint"	/* May change to pldbg.breakpoint later	*/
 #define TYPE_NAME_FRAME			"frame"			/* May change to pldbg.frame later		*/
 #define TYPE_NAME_VAR			"var"			/* May change to pldbg.var later		*/
+#define TYPE_NAME_VAR_BINARY	"var_binary"
+#define TYPE_NAME_TYPEINFO		"typeinfo"
+#define TYPE_NAME_STEP_RESULT	"step_result"
 
 #define GET_STR( textp ) 		DatumGetCString( DirectFunctionCall1( textout, PointerGetDatum( textp )))
 #define PG_GETARG_SESSION( n )  (sessionHandle)PG_GETARG_UINT32( n )
@@ -240,21 +278,34 @@ Datum pldbg_attach_to_port( PG_FUNCTION_ARGS );
 Datum pldbg_get_source( PG_FUNCTION_ARGS );
 Datum pldbg_get_breakpoints( PG_FUNCTION_ARGS );
 Datum pldbg_get_variables( PG_FUNCTION_ARGS );
+Datum pldbg_get_variables_filtered( PG_FUNCTION_ARGS );
+Datum pldbg_get_variables_frame( PG_FUNCTION_ARGS );
+Datum pldbg_get_variables_binary( PG_FUNCTION_ARGS );
+Datum pldbg_get_types( PG_FUNCTION_ARGS );
 Datum pldbg_get_stack( PG_FUNCTION_ARGS );
 Datum pldbg_wait_for_breakpoint( PG_FUNCTION_ARGS );
 Datum pldbg_set_breakpoint( PG_FUNCTION_ARGS );
 Datum pldbg_drop_breakpoint( PG_FUNCTION_ARGS );
 Datum pldbg_step_into( PG_FUNCTION_ARGS );
 Datum pldbg_step_over( PG_FUNCTION_ARGS );
+Datum pldbg_step_many( PG_FUNCTION_ARGS );
 Datum pldbg_continue(  PG_FUNCTION_ARGS );
 Datum pldbg_deposit_value( PG_FUNCTION_ARGS );
+Datum pldbg_explain_current( PG_FUNCTION_ARGS );
+Datum pldbg_query_in_target( PG_FUNCTION_ARGS );
+Datum pldbg_export_snapshot( PG_FUNCTION_ARGS );
 Datum pldbg_get_proxy_info( PG_FUNCTION_ARGS );
 Datum pldbg_get_pkg_cons( PG_FUNCTION_ARGS );
 Datum pldbg_abort_target( PG_FUNCTION_ARGS );
+Datum pldbg_get_session_token( PG_FUNCTION_ARGS );
+Datum pldbg_reattach( PG_FUNCTION_ARGS );
+Datum pldbg_get_observer_token( PG_FUNCTION_ARGS );
+Datum pldbg_attach_observer( PG_FUNCTION_ARGS );
 
 Datum pldbg_create_listener( PG_FUNCTION_ARGS );
 Datum pldbg_wait_for_target( PG_FUNCTION_ARGS );
 Datum pldbg_set_global_breakpoint( PG_FUNCTION_ARGS );
+Datum pldbg_disarm_all( PG_FUNCTION_ARGS );
 
 /************************************************************
  * Local function forward declarations
@@ -268,13 +319,17 @@ static void   		  	 sendString( debugSession * session, char * src );
 static bool   		  	 getBool( debugSession * session );
 static uint32 		  	 getUInt32( debugSession * session );
 static char 		   * getNString( debugSession * session );
+static char 		   * getNBytes( debugSession * session, uint32 * len );
+static void				 throwTargetError( char * reply );
 static void 		  	 initializeModule( void );
 static void 		  	 cleanupAtExit( int code, Datum arg );
 static void 			 initSessionHash();
 static debugSession    * defaultSession( sessionHandle handle );
+static debugSession    * driverSession( sessionHandle handle );
 static sessionHandle     addSession( debugSession * session );
 static debugSession    * findSession( sessionHandle handle );
 static TupleDesc	  	 getResultTupleDesc( FunctionCallInfo fcinfo );
+static Datum			 getVariables( FunctionCallInfo fcinfo, debugSession * session, char * command );
 
 
 /*******************************************************************************
@@ -301,19 +356,22 @@ Datum pldbg_attach_to_port( PG_FUNCTION_ARGS )
 {
 	int32		targetBackend = PG_GETARG_INT32( 0 );
 	debugSession *session;
+	int			targetPid;
 
 	initializeModule();
 
 	session = MemoryContextAllocZero( TopMemoryContext, sizeof( *session ));
 	session->listener   = -1;
 
-	session->serverSocket = dbgcomm_connect_to_target(targetBackend);
+	session->serverSocket = dbgcomm_connect_to_target(targetBackend, &targetPid);
 
 	if (session->serverSocket < 0)
 		ereport(ERROR,
 				(errcode_for_socket_access(),
 				 errmsg("could not connect to debug target")));
 
+	session->registrySlot = sessions_add_proxy( SESSION_ATTACHED, targetPid );
+
 	/*
 	 * After the handshake, the target process will send us information about
 	 * the local breakpoint that it hit. Read it. We will hand it to the client
@@ -332,6 +390,140 @@ Datum pldbg_attach_to_port( PG_FUNCTION_ARGS )
 	PG_RETURN_INT32(addSession(session));
 }
 
+/*******************************************************************************
+ * pldbg_reattach( token BIGINT ) RETURNS INTEGER
+ *
+ *	This function attaches to a debugging target that lost the connection to
+ *	its previous proxy while it was paused, and is now waiting (for up to
+ *	pldebugger.reattach_timeout seconds) for another proxy to take over.  The
+ *	token is the one returned by pldbg_get_session_token() on the old
+ *	session - a debugger client should fetch it as soon as it attaches.
+ *
+ *	Returns a session handle, just like pldbg_attach_to_port().  The target
+ *	is still paused where it was; call pldbg_wait_for_breakpoint() to find
+ *	out where that is.
+ */
+
+Datum pldbg_reattach( PG_FUNCTION_ARGS )
+{
+	uint64		  token = (uint64) PG_GETARG_INT64( 0 );
+	debugSession *session;
+	int			  targetPid;
+
+	initializeModule();
+
+	session = MemoryContextAllocZero( TopMemoryContext, sizeof( *session ));
+	session->listener   = -1;
+
+	session->serverSocket = dbgcomm_reattach_to_target( token, &targetPid );
+
+	if (session->serverSocket < 0)
+		ereport(ERROR,
+				(errcode_for_socket_access(),
+				 errmsg("could not reattach to debug target")));
+
+	session->registrySlot = sessions_add_proxy( SESSION_ATTACHED, targetPid );
+
+	/* The target reports the line it's paused at, just like after a breakpoint */
+	session->breakpointString = MemoryContextStrdup(TopMemoryContext,
+													getNString(session));
+
+	mostRecentSession = session;
+
+	PG_RETURN_INT32(addSession(session));
+}
+
+/*******************************************************************************
+ * pldbg_get_session_token( sessionID INTEGER ) RETURNS BIGINT
+ *
+ *	This function returns the token that a new proxy can give to
+ *	pldbg_reattach() if the connection to this session's target drops.
+ *	Anyone holding the token can take over the session, so treat it like a
+ *	password.
+ */
+
+Datum pldbg_get_session_token( PG_FUNCTION_ARGS )
+{
+	debugSession * session = driverSession( PG_GETARG_SESSION( 0 ));
+	char		 * tokenString;
+
+	sendString( session, PLDBG_GET_TOKEN );
+
+	tokenString = getNString( session );
+
+	if( tokenString == NULL )
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("debugger protocol error: session token expected")));
+
+	PG_RETURN_INT64( (int64) strtoull( tokenString, NULL, 10 ));
+}
+
+/*******************************************************************************
+ * pldbg_get_observer_token( sessionID INTEGER ) RETURNS BIGINT
+ *
+ *	This function asks the target to accept read-only observers, and returns
+ *	the token that an observer must give to pldbg_attach_observer().
+ */
+
+Datum pldbg_get_observer_token( PG_FUNCTION_ARGS )
+{
+	debugSession * session = driverSession( PG_GETARG_SESSION( 0 ));
+	char		 * tokenString;
+	uint64		   token;
+
+	sendString( session, PLDBG_GET_OBSERVER_TOKEN );
+
+	tokenString = getNString( session );
+
+	if( tokenString == NULL )
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("debugger protocol error: observer token expected")));
+
+	token = strtoull( tokenString, NULL, 10 );
+
+	if( token == 0 )
+		ereport(ERROR,
+				(errmsg("debugging target could not accept observers")));
+
+	PG_RETURN_INT64( (int64) token );
+}
+
+/*******************************************************************************
+ * pldbg_attach_observer( token BIGINT ) RETURNS INTEGER
+ *
+ *	This function attaches to another proxy's debugging session, read-only.
+ *	An observer session gets the same stop notifications as the session it's
+ *	watching (call pldbg_wait_for_breakpoint() to wait for the next one) and
+ *	can call pldbg_get_stack(), pldbg_get_variables(), pldbg_get_source() and
+ *	pldbg_get_breakpoints() while the target is paused.  Anything that would
+ *	change the target's state is refused.
+ *
+ *	Returns a session handle.
+ */
+
+Datum pldbg_attach_observer( PG_FUNCTION_ARGS )
+{
+	uint64		  token = (uint64) PG_GETARG_INT64( 0 );
+	debugSession *session;
+	int			  targetPid;
+
+	initializeModule();
+
+	session = MemoryContextAllocZero( TopMemoryContext, sizeof( *session ));
+	session->listener = -1;
+	session->observer = TRUE;
+
+	session->serverSocket = dbgcomm_connect_as_observer( token, &targetPid );
+
+	session->registrySlot = sessions_add_proxy( SESSION_OBSERVING, targetPid );
+
+	mostRecentSession = session;
+
+	PG_RETURN_INT32(addSession(session));
+}
+
 Datum pldbg_create_listener( PG_FUNCTION_ARGS )
 {
 	debugSession * session = MemoryContextAllocZero( TopMemoryContext, sizeof( *session ));
@@ -341,6 +533,8 @@ Datum pldbg_create_listener( PG_FUNCTION_ARGS )
 	session->listener = dbgcomm_listen_for_target(&session->serverPort);
 	session->serverSocket = -1;
 
+	session->registrySlot = sessions_add_proxy( SESSION_LISTENING, 0 );
+
 	mostRecentSession = session;
 
 	PG_RETURN_INT32( addSession( session ));
@@ -380,6 +574,15 @@ Datum pldbg_wait_for_target( PG_FUNCTION_ARGS )
 
 	session->serverSocket = serverSocket;
 
+	/*
+	 * The types we fetched belonged to the last target; this one numbers
+	 * its own from scratch (see pldbg_get_types()).
+	 */
+	list_free_deep( session->types );
+	session->types = NIL;
+
+	sessions_set_proxy( session->registrySlot, SESSION_ATTACHED, serverPID );
+
 	/*
 	 * After the handshake, the target process will send us information about
 	 * the local breakpoint that it hit. Read it. We will hand it to the client
@@ -429,6 +632,7 @@ Datum pldbg_set_global_breakpoint( PG_FUNCTION_ARGS )
 	breakpoint.data.isTmp     = TRUE;
 	breakpoint.data.proxyPort = session->serverPort;
 	breakpoint.data.proxyPid  = MyProc->pid;
+	breakpoint.data.proxyRole = GetUserId();
 
 	if( !BreakpointInsert( BP_GLOBAL, &breakpoint.key, &breakpoint.data ))
 		ereport(ERROR,
@@ -438,6 +642,31 @@ Datum pldbg_set_global_breakpoint( PG_FUNCTION_ARGS )
 	PG_RETURN_BOOL( true );
 }
 
+/*******************************************************************************
+ * pldbg_disarm_all() RETURNS INTEGER
+ *
+ *	This function is the emergency brake for debugging on a production
+ *	server: it drops every global breakpoint and tells every backend to drop
+ *	its local breakpoints, too, and every target that's paused (or waiting
+ *	for a proxy) to abandon its debugging session and carry on.  Backends
+ *	notice the next time they look for a breakpoint; paused targets notice
+ *	within a second or so.  Proxies find that their targets have hung up.
+ *
+ *	Returns the number of targets that were told to let go.
+ */
+
+Datum pldbg_disarm_all( PG_FUNCTION_ARGS )
+{
+	if( !superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be a superuser to disarm the debugger")));
+
+	(void) BreakpointDisarmAll();
+
+	PG_RETURN_INT32( sessions_wake_targets());
+}
+
 /*******************************************************************************
  * pldbg_wait_for_breakpoint( sessionID INTEGER ) RETURNS breakpoint
  *
@@ -473,6 +702,17 @@ Datum pldbg_wait_for_breakpoint( PG_FUNCTION_ARGS )
 	debugSession * session           = defaultSession( PG_GETARG_SESSION( 0 ));
 	char         * breakpointString;
 
+	/*
+	 * An observer asks the target where it's paused, waiting for the next
+	 * stop if it has already been told about this one.
+	 */
+	if( session->observer )
+	{
+		sendString( session, PLDBG_WAIT_FOR_STOP );
+
+		PG_RETURN_DATUM( buildBreakpointDatum( getNString( session )));
+	}
+
 	if (!session->breakpointString)
 		PG_RETURN_NULL();
 
@@ -495,7 +735,7 @@ Datum pldbg_wait_for_breakpoint( PG_FUNCTION_ARGS )
 
 Datum pldbg_step_into( PG_FUNCTION_ARGS )
 {
-	debugSession * session = defaultSession( PG_GETARG_SESSION( 0 ));
+	debugSession * session = driverSession( PG_GETARG_SESSION( 0 ));
 
 	sendString( session, PLDBG_STEP_INTO );
 
@@ -517,13 +757,75 @@ Datum pldbg_step_into( PG_FUNCTION_ARGS )
 
 Datum pldbg_step_over( PG_FUNCTION_ARGS )
 {
-	debugSession * session = defaultSession( PG_GETARG_SESSION( 0 ));
+	debugSession * session = driverSession( PG_GETARG_SESSION( 0 ));
 
 	sendString( session, PLDBG_STEP_OVER );
 
 	PG_RETURN_DATUM( buildBreakpointDatum( getNString( session )));
 }
 
+/*******************************************************************************
+ * pldbg_step_many( sessionID INTEGER, steps INTEGER, untilLine INTEGER, trace BOOLEAN ) RETURNS step_result
+ *
+ *	This function does what 'steps' calls to pldbg_step_over() would, in a
+ *	single round trip: the target counts the steps down itself and only
+ *	reports where it ends up.  It stops early if it reaches untilLine (if
+ *	not NULL) in the current function, or a breakpoint.
+ *
+ *	This function returns a tuple of type 'step_result' that contains the
+ *	function OID and line number where the target is currently stopped, the
+ *	number of statements it stepped to get there, and, if trace is TRUE,
+ *	the lines it passed on the way (the first 1000 of them).
+ */
+
+Datum pldbg_step_many( PG_FUNCTION_ARGS )
+{
+	debugSession * session;
+	int32		   steps;
+	char		   stepString[PLDBG_STRING_MAX_LEN];
+	char		 * breakpointString;
+	char		 * traceString;
+	char		 * values[5];
+	char         * ctx = NULL;
+	TupleDesc	   tupleDesc;
+
+	if( PG_ARGISNULL( 0 ) || PG_ARGISNULL( 1 ))
+		PG_RETURN_NULL();
+
+	session = driverSession( PG_GETARG_SESSION( 0 ));
+	steps   = PG_GETARG_INT32( 1 );
+
+	if( steps < 1 )
+		ereport( ERROR,
+				 ( errcode( ERRCODE_INVALID_PARAMETER_VALUE ),
+				   errmsg( "steps must be at least 1" )));
+
+	snprintf( stepString, PLDBG_STRING_MAX_LEN, "%s %d:%d:%c", PLDBG_STEP_MANY, steps,
+			  PG_ARGISNULL( 2 ) ? 0 : PG_GETARG_INT32( 2 ),
+			  !PG_ARGISNULL( 3 ) && PG_GETARG_BOOL( 3 ) ? 't' : 'f' );
+
+	sendString( session, stepString );
+
+	/* Where we stopped, then "steps:line,line,..." */
+	breakpointString = getNString( session );
+	traceString      = getNString( session );
+
+	values[0] = tokenize( breakpointString, ":", &ctx );  	/* function OID		*/
+	values[1] = tokenize( NULL, ":", &ctx );  				/* linenumber		*/
+	values[2] = tokenize( NULL, ":", &ctx );				/* targetName		*/
+
+	ctx = NULL;
+	values[3] = tokenize( traceString, ":", &ctx );			/* steps			*/
+	values[4] = NULL;										/* trace			*/
+
+	if( !PG_ARGISNULL( 3 ) && PG_GETARG_BOOL( 3 ))
+		values[4] = psprintf( "{%s}", tokenize( NULL, ":", &ctx ));
+
+	tupleDesc = RelationNameGetTupleDesc( TYPE_NAME_STEP_RESULT );
+
+	PG_RETURN_DATUM( HeapTupleGetDatum( BuildTupleFromCStrings( TupleDescGetAttInMetadata( tupleDesc ), values )));
+}
+
 /*******************************************************************************
  * pldbg_continue( sessionID INTEGER ) RETURNS breakpoint
  *
@@ -536,7 +838,7 @@ Datum pldbg_step_over( PG_FUNCTION_ARGS )
 
 Datum pldbg_continue( PG_FUNCTION_ARGS )
 {
-	debugSession * session = defaultSession( PG_GETARG_SESSION( 0 ));
+	debugSession * session = driverSession( PG_GETARG_SESSION( 0 ));
 
 	sendString( session, PLDBG_CONTINUE );
 
@@ -552,7 +854,7 @@ Datum pldbg_continue( PG_FUNCTION_ARGS )
 
 Datum pldbg_abort_target( PG_FUNCTION_ARGS )
 {
-	debugSession * session = defaultSession( PG_GETARG_SESSION( 0 ));
+	debugSession * session = driverSession( PG_GETARG_SESSION( 0 ));
 
 	sendString( session, PLDBG_ABORT );
 
@@ -587,7 +889,7 @@ Datum pldbg_select_frame( PG_FUNCTION_ARGS )
 		PG_RETURN_NULL();
 	else
 	{
-		debugSession * session 	   = defaultSession( PG_GETARG_SESSION( 0 ));
+		debugSession * session 	   = driverSession( PG_GETARG_SESSION( 0 ));
 		int32		   frameNumber = PG_GETARG_INT32( 1 );
 		char		   frameString[PLDBG_STRING_MAX_LEN];
 		char         * resultString;
@@ -708,9 +1010,109 @@ Datum pldbg_get_breakpoints( PG_FUNCTION_ARGS )
 
 Datum pldbg_get_variables( PG_FUNCTION_ARGS )
 {
-	FuncCallContext * srf;
+	debugSession * session = defaultSession( PG_GETARG_SESSION( 0 ));
+
+	return( getVariables( fcinfo, session, PLDBG_GET_VARIABLES ));
+}
 
+/*******************************************************************************
+ * pldbg_get_variables( sessionID INTEGER, names TEXT[], inScopeOnly BOOLEAN )
+ *	RETURNS SETOF var
+ *
+ *	Like pldbg_get_variables( sessionID ), but only returns the variables
+ *	whose names appear in names (all of them, if names is NULL) and, if
+ *	inScopeOnly is TRUE, only the variables that are in scope at the current
+ *	line of the frame that has the focus.  The PL/pgSQL compiler lumps the
+ *	variables of every block together, so without inScopeOnly you also see
+ *	the variables declared in blocks that the current line isn't in.
+ */
+
+Datum pldbg_get_variables_filtered( PG_FUNCTION_ARGS )
+{
+	debugSession  * session = defaultSession( PG_ARGISNULL( 0 ) ? 0 : PG_GETARG_SESSION( 0 ));
+	StringInfoData	command;
+	char		  * commandString = NULL;
+
+	if( SRF_IS_FIRSTCALL())
+	{
+		bool	inScopeOnly = PG_ARGISNULL( 2 ) ? false : PG_GETARG_BOOL( 2 );
+
+		initStringInfo( &command );
+		appendStringInfo( &command, "%c %c", PLDBG_GET_VARIABLES[0], inScopeOnly ? 's' : 'a' );
+
+		if( !PG_ARGISNULL( 1 ))
+		{
+			Datum	   *names;
+			bool	   *nulls;
+			int			nameCount;
+			int			nameSent = 0;
+			int			i;
+
+			deconstruct_array( PG_GETARG_ARRAYTYPE_P( 1 ), TEXTOID, -1, false, 'i', &names, &nulls, &nameCount );
+
+			for( i = 0; i < nameCount; i++ )
+			{
+				char   *name;
+
+				if( nulls[i] )
+					continue;
+
+				name = TextDatumGetCString( names[i] );
+
+				if( strchr( name, ':' ) != NULL || strchr( name, '\n' ) != NULL )
+					ereport( ERROR,
+							 (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							  errmsg( "invalid variable name \"%s\"", name )));
+
+				appendStringInfo( &command, ":%s", name );
+				nameSent++;
+			}
+
+			/* An empty list can't match anything, but don't let it mean "all" */
+			if( nameSent == 0 )
+				appendStringInfoChar( &command, ':' );
+		}
+
+		appendStringInfoChar( &command, '\n' );
+		commandString = command.data;
+	}
+
+	return( getVariables( fcinfo, session, commandString ));
+}
+
+/*******************************************************************************
+ * pldbg_get_frame_variables( sessionID INTEGER, frameNumber INTEGER ) RETURNS SETOF var
+ *
+ *	Like pldbg_get_variables( sessionID ), but returns the variables (and
+ *	arguments) of the given stack frame (as numbered by pldbg_get_stack())
+ *	without moving the debugger's focus, so you don't need to call
+ *	pldbg_select_frame() there and back again.  Returns an empty set if
+ *	there is no such frame.  (This has a name of its own, rather than
+ *	being another pldbg_get_variables(), so that pldbg_get_variables(s,
+ *	NULL) still picks the filtered variant unambiguously.)
+ */
+
+Datum pldbg_get_variables_frame( PG_FUNCTION_ARGS )
+{
 	debugSession * session = defaultSession( PG_GETARG_SESSION( 0 ));
+	char		   command[PLDBG_STRING_MAX_LEN];
+
+	snprintf( command, PLDBG_STRING_MAX_LEN, "%c a@%d\n", PLDBG_GET_VARIABLES[0], PG_GETARG_INT32( 1 ));
+
+	return( getVariables( fcinfo, session, command ));
+}
+
+/*******************************************************************************
+ * getVariables()
+ *
+ *	Does the work for pldbg_get_variables() and friends: sends the given
+ *	command to the target on the first call, then returns one var tuple per
+ *	variable that the target sends back.
+ */
+
+static Datum getVariables( FunctionCallInfo fcinfo, debugSession * session, char * command )
+{
+	FuncCallContext * srf;
 	char         * variableString;
 
 	if( SRF_IS_FIRSTCALL())
@@ -723,7 +1125,7 @@ Datum pldbg_get_variables( PG_FUNCTION_ARGS )
 		srf->attinmeta = TupleDescGetAttInMetadata( RelationNameGetTupleDesc( TYPE_NAME_VAR ));
 		MemoryContextSwitchTo( oldContext );
 
-		sendString( session, PLDBG_GET_VARIABLES );
+		sendString( session, command );
 	}
 	else
 	{
@@ -759,6 +1161,173 @@ Datum pldbg_get_variables( PG_FUNCTION_ARGS )
 	}
 }
 
+/*******************************************************************************
+ * pldbg_get_variables_binary( sessionID INTEGER ) RETURNS SETOF var_binary
+ *
+ *	Like pldbg_get_variables(), but each value comes back as a bytea holding
+ *	the output of the type's send function (the same format COPY BINARY and
+ *	the binary wire protocol use) instead of its text form, which saves both
+ *	ends a text conversion for types with a bulky text representation.
+ *
+ *	isBinary is FALSE for the (rare) types that have no send function: value
+ *	then holds the variable's text representation instead.  A NULL variable
+ *	has a NULL value.
+ */
+
+Datum pldbg_get_variables_binary( PG_FUNCTION_ARGS )
+{
+	FuncCallContext * srf;
+
+	debugSession * session = defaultSession( PG_GETARG_SESSION( 0 ));
+	char         * variableString;
+	uint32		   len;
+
+	if( SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldContext;
+
+		srf = SRF_FIRSTCALL_INIT();
+
+		oldContext = MemoryContextSwitchTo( srf->multi_call_memory_ctx );
+		srf->tuple_desc = BlessTupleDesc( CreateTupleDescCopy( RelationNameGetTupleDesc( TYPE_NAME_VAR_BINARY )));
+		MemoryContextSwitchTo( oldContext );
+
+		sendString( session, PLDBG_GET_VARIABLES_BINARY );
+	}
+	else
+	{
+		srf = SRF_PERCALL_SETUP();
+	}
+
+	if(( variableString = getNBytes( session, &len )) != NULL )
+	{
+		Datum		values[9];
+		bool		nulls[9] = {0};
+		char      * ctx = NULL;
+		char		format;
+		HeapTuple   result;
+
+		/*
+		 * variableString points to a header like:
+		 *	varName:class:lineNumber:unique:isConst:notNull:dataTypeOID:format:
+		 * followed by the value bytes (see send_binary_var() in the target)
+		 */
+		values[0] = CStringGetTextDatum( tokenize( variableString, ":", &ctx ));			/* variable name	*/
+		values[1] = CharGetDatum( tokenize( NULL, ":", &ctx )[0] );						/* var class		*/
+		values[2] = Int32GetDatum( atoi( tokenize( NULL, ":", &ctx )));					/* line number		*/
+		values[3] = BoolGetDatum( tokenize( NULL, ":", &ctx )[0] == 't' );				/* unique			*/
+		values[4] = BoolGetDatum( tokenize( NULL, ":", &ctx )[0] == 't' );				/* isConst			*/
+		values[5] = BoolGetDatum( tokenize( NULL, ":", &ctx )[0] == 't' );				/* notNull			*/
+		values[6] = ObjectIdGetDatum( (Oid) strtoul( tokenize( NULL, ":", &ctx ), NULL, 10 ));	/* data type OID	*/
+		format    = tokenize( NULL, ":", &ctx )[0];
+
+		if( format == 'n' )
+		{
+			nulls[7]  = true;
+			values[8] = BoolGetDatum( false );
+		}
+		else
+		{
+			size_t	valueLen = len - ( ctx - variableString );
+			bytea  *value    = (bytea *) palloc( valueLen + VARHDRSZ );
+
+			SET_VARSIZE( value, valueLen + VARHDRSZ );
+			memcpy( VARDATA( value ), ctx, valueLen );
+
+			values[7] = PointerGetDatum( value );
+			values[8] = BoolGetDatum( format == 'b' );
+		}
+
+		result = heap_form_tuple( srf->tuple_desc, values, nulls );
+
+		SRF_RETURN_NEXT( srf, HeapTupleGetDatum( result ));
+	}
+	else
+	{
+		SRF_RETURN_DONE( srf );
+	}
+}
+
+/*******************************************************************************
+ * pldbg_get_types( sessionID INTEGER ) RETURNS SETOF typeinfo
+ *
+ *	This function returns a SETOF typeinfo tuples, one for each data type
+ *	used by the variables that pldbg_get_variables() returns (and for every
+ *	type we've seen earlier in this session).  Each tuple contains the OID of
+ *	the type, its name (as format_type() would print it), its typmod and
+ *	its element type (for an array).  The typmod is the one a variable was
+ *	declared with (so a type shows up once for each typmod in use, such as
+ *	varchar(10) and varchar(20)), or the type's own for a domain.
+ *
+ *	We remember every type the target has described for us, and only ask
+ *	it for the ones we haven't seen yet, so a client can call this after
+ *	each pldbg_get_variables() instead of querying pg_type itself.
+ */
+
+Datum pldbg_get_types( PG_FUNCTION_ARGS )
+{
+	FuncCallContext * srf;
+
+	debugSession * session = defaultSession( PG_GETARG_SESSION( 0 ));
+
+	if( SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldContext;
+		char		  typesString[PLDBG_STRING_MAX_LEN];
+		char		* typeString;
+
+		srf = SRF_FIRSTCALL_INIT();
+
+		oldContext = MemoryContextSwitchTo( srf->multi_call_memory_ctx );
+		srf->attinmeta = TupleDescGetAttInMetadata( RelationNameGetTupleDesc( TYPE_NAME_TYPEINFO ));
+		MemoryContextSwitchTo( oldContext );
+
+		snprintf( typesString, PLDBG_STRING_MAX_LEN, "%s %d", PLDBG_GET_TYPES, list_length( session->types ));
+
+		sendString( session, typesString );
+
+		while(( typeString = getNString( session )) != NULL )
+		{
+			oldContext = MemoryContextSwitchTo( TopMemoryContext );
+			session->types = lappend( session->types, pstrdup( typeString ));
+			MemoryContextSwitchTo( oldContext );
+
+			pfree( typeString );
+		}
+
+		srf->max_calls = list_length( session->types );
+	}
+	else
+	{
+		srf = SRF_PERCALL_SETUP();
+	}
+
+	if( srf->call_cntr < srf->max_calls )
+	{
+		char	  * values[4];
+		char      * ctx = NULL;
+		char	  * typeString = pstrdup( (char *) list_nth( session->types, srf->call_cntr ));
+		HeapTuple   result;
+
+		/*
+		 * typeString points to a string like:
+		 *	typeOID:elementTypeOID:typmod:typeName
+		 */
+		values[0] = tokenize( typeString, ":", &ctx );	/* type OID					*/
+		values[3] = tokenize( NULL, ":", &ctx );		/* element type OID			*/
+		values[2] = tokenize( NULL, ":", &ctx );		/* typmod					*/
+		values[1] = tokenize( NULL, NULL, &ctx );		/* type name - rest of string	*/
+
+		result = BuildTupleFromCStrings( srf->attinmeta, values );
+
+		SRF_RETURN_NEXT( srf, HeapTupleGetDatum( result ));
+	}
+	else
+	{
+		SRF_RETURN_DONE( srf );
+	}
+}
+
 /*******************************************************************************
  * pldbg_get_stack( sessionID INTEGER ) RETURNS SETOF frame
  *
@@ -863,7 +1432,7 @@ Datum pldbg_get_proxy_info( PG_FUNCTION_ARGS )
 
 Datum pldbg_set_breakpoint( PG_FUNCTION_ARGS )
 {
-	debugSession * session    = defaultSession( PG_GETARG_SESSION( 0 ));
+	debugSession * session    = driverSession( PG_GETARG_SESSION( 0 ));
 	Oid			   funcOID    = PG_GETARG_OID( 1 );
 	int			   lineNumber = PG_GETARG_INT32( 2 );
 	char		   breakpointString[PLDBG_STRING_MAX_LEN];
@@ -885,7 +1454,7 @@ Datum pldbg_set_breakpoint( PG_FUNCTION_ARGS )
 
 Datum pldbg_drop_breakpoint( PG_FUNCTION_ARGS )
 {
-	debugSession * session    = defaultSession( PG_GETARG_SESSION( 0 ));
+	debugSession * session    = driverSession( PG_GETARG_SESSION( 0 ));
 	Oid			   funcOID    = PG_GETARG_OID( 1 );
 	int			   lineNumber = PG_GETARG_INT32( 2 );
 	char		   breakpointString[PLDBG_STRING_MAX_LEN];
@@ -912,7 +1481,7 @@ Datum pldbg_drop_breakpoint( PG_FUNCTION_ARGS )
 
 Datum pldbg_deposit_value( PG_FUNCTION_ARGS )
 {
-	debugSession * session 	     = defaultSession( PG_GETARG_SESSION( 0 ));
+	debugSession * session 	     = driverSession( PG_GETARG_SESSION( 0 ));
 	char         * varName 		 = GET_STR( PG_GETARG_TEXT_P( 1 ));
 	int			   lineNumber 	 = PG_GETARG_INT32( 2 );
 	char		 * value       	 = GET_STR( PG_GETARG_TEXT_P( 3 ));
@@ -930,10 +1499,190 @@ Datum pldbg_deposit_value( PG_FUNCTION_ARGS )
 
 }
 
+/*******************************************************************************
+ * pldbg_explain_current( sessionID INT, analyze BOOLEAN ) RETURNS TEXT
+ *
+ *	This function returns EXPLAIN output for the query run by the statement
+ *	that the target is paused at (in the frame that has the focus), planned
+ *	through that statement's plan cache entry with the current values of the
+ *	variables it refers to.  The first line says whether the plan is generic
+ *	or custom and how many times the statement has been planned.
+ *
+ *	If analyze is TRUE, the target runs the statement (inside a subtransaction
+ *	that it rolls back) and the output is EXPLAIN ANALYZE output.
+ */
+
+Datum pldbg_explain_current( PG_FUNCTION_ARGS )
+{
+	debugSession * session = driverSession( PG_GETARG_SESSION( 0 ));
+	bool		   analyze = PG_GETARG_BOOL( 1 );
+	char		   explainString[PLDBG_STRING_MAX_LEN];
+	char		 * result;
+
+	snprintf( explainString, PLDBG_STRING_MAX_LEN, "%s %c", PLDBG_EXPLAIN, analyze ? 't' : 'f' );
+
+	sendString( session, explainString );
+
+	if(( result = getNString( session )) == NULL )
+		PG_RETURN_NULL();
+
+	PG_RETURN_TEXT_P( cstring_to_text( result ));
+}
+
+/*******************************************************************************
+ * pldbg_query_in_target( sessionID INT, sql TEXT, maxRows INT, maxBytes INT ) RETURNS SETOF JSON
+ *
+ *	This function runs the given query inside the (paused) target, in a
+ *	subtransaction of the target's own transaction, so that it sees the
+ *	target's temporary tables, uncommitted changes and session settings.
+ *	The query runs read-only, and the subtransaction is always rolled back.
+ *
+ *	The query runs as the target's current role, so the target only runs it
+ *	for a proxy that runs as that same role, or as a superuser.  It must be
+ *	a single SELECT (without INTO, FOR UPDATE/SHARE or a data-modifying
+ *	WITH); the target rejects anything else.
+ *
+ *	Each row comes back as a JSON object (see row_to_json()).  The target
+ *	sends the rows in batches as it fetches them, but stops after maxRows
+ *	rows or maxBytes bytes of them; if it had to stop early, we say so in a
+ *	NOTICE.
+ */
+
+Datum pldbg_query_in_target( PG_FUNCTION_ARGS )
+{
+	debugSession	* session  = driverSession( PG_GETARG_SESSION( 0 ));
+	char			* sql      = text_to_cstring( PG_GETARG_TEXT_PP( 1 ));
+	int32			  maxRows  = PG_GETARG_INT32( 2 );
+	int32			  maxBytes = PG_GETARG_INT32( 3 );
+	ReturnSetInfo	* rsinfo   = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate * tupstore;
+	TupleDesc		  tupdesc;
+	MemoryContext	  oldContext;
+	char			* rowString;
+	char			* error = NULL;
+
+	if( maxRows < 0 || maxBytes < 0 )
+		ereport( ERROR,
+				 ( errcode( ERRCODE_INVALID_PARAMETER_VALUE ),
+				   errmsg( "maxRows and maxBytes must not be negative" )));
+
+	if( rsinfo == NULL || !IsA( rsinfo, ReturnSetInfo ) || !( rsinfo->allowedModes & SFRM_Materialize ))
+		ereport( ERROR,
+				 ( errcode( ERRCODE_FEATURE_NOT_SUPPORTED ),
+				   errmsg( "set-valued function called in context that cannot accept a set" )));
+
+	/*
+	 * We read the whole reply, even if the caller only wants some of it,
+	 * so that the next command doesn't find the rest of it waiting.
+	 */
+	oldContext = MemoryContextSwitchTo( rsinfo->econtext->ecxt_per_query_memory );
+
+#if (PG_VERSION_NUM >= 120000)
+	tupdesc  = CreateTemplateTupleDesc( 1 );
+#else
+	tupdesc  = CreateTemplateTupleDesc( 1, false );
+#endif
+	TupleDescInitEntry( tupdesc, (AttrNumber) 1, "row", JSONOID, -1, 0 );
+	tupstore = tuplestore_begin_heap( true, false, work_mem );
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+
+	MemoryContextSwitchTo( oldContext );
+
+	sendString( session, psprintf( "%s %d:%d:%s", PLDBG_QUERY, maxRows, maxBytes, sql ));
+
+	while(( rowString = getNString( session )) != NULL )
+	{
+		switch( rowString[0] )
+		{
+			case 'r':
+			{
+				Datum	value  = CStringGetTextDatum( rowString + 1 );
+				bool	isnull = false;
+
+				tuplestore_putvalues( tupstore, tupdesc, &value, &isnull );
+				break;
+			}
+
+			case 't':
+				ereport( NOTICE,
+						 ( errmsg( "query result truncated after %s rows", rowString + 1 ),
+						   errhint( "Raise maxRows or maxBytes to see more." )));
+				break;
+
+			case 'x':
+				/* "x" SQLSTATE ":" message - we throw it once we've read the end of the list */
+				error = rowString;
+				break;
+
+			default:
+				elog( ERROR, "debugger protocol error: unexpected query reply" );
+		}
+	}
+
+	if( error != NULL )
+		throwTargetError( error );
+
+	return (Datum) 0;
+}
+
+/*******************************************************************************
+ * pldbg_export_snapshot( sessionID INT ) RETURNS TEXT
+ *
+ *	This function asks the (paused) target to export the snapshot that the
+ *	current statement runs with, and returns its id.  Any other session can
+ *	then run
+ *
+ *		BEGIN ISOLATION LEVEL REPEATABLE READ;
+ *		SET TRANSACTION SNAPSHOT 'id';
+ *
+ *	and query exactly the committed data that the target sees, without
+ *	putting any load on the target.  (Changes that the target has made but
+ *	not committed stay invisible to other sessions; pldbg_query_in_target()
+ *	can see those.)  The snapshot can be imported until the target's
+ *	transaction ends.
+ */
+
+Datum pldbg_export_snapshot( PG_FUNCTION_ARGS )
+{
+	debugSession * session = driverSession( PG_GETARG_SESSION( 0 ));
+	char		 * reply;
+
+	sendString( session, PLDBG_EXPORT_SNAPSHOT );
+
+	reply = getNString( session );
+
+	if( reply == NULL || reply[0] != 's' )
+		throwTargetError( reply ? reply : "x" );
+
+	PG_RETURN_TEXT_P( cstring_to_text( reply + 1 ));
+}
+
 /*******************************************************************************
  * Local supporting (static) functions
  *******************************************************************************/
 
+/*******************************************************************************
+ * throwTargetError()
+ *
+ *	Re-throws an error that the target reported to us as "x", the SQLSTATE,
+ *	a colon and the message.
+ */
+
+static void throwTargetError( char * reply )
+{
+	char   * message = strchr( reply, ':' );
+	int		 sqlerrcode = ERRCODE_INTERNAL_ERROR;
+
+	if( message != NULL && message - reply == 6 )
+		sqlerrcode = MAKE_SQLSTATE( reply[1], reply[2], reply[3], reply[4], reply[5] );
+
+	ereport( ERROR,
+			 ( errcode( sqlerrcode ),
+			   errmsg( "debugger target reported an error: %s", message ? message + 1 : "unknown error" )));
+}
+
 /*******************************************************************************
  * initializeModule()
  *
@@ -999,6 +1748,24 @@ static debugSession * defaultSession( sessionHandle handle )
 	return( NULL );	  /* keep the compiler happy */
 }
 
+/*******************************************************************************
+ * driverSession()
+ *
+ *	Like defaultSession(), but for proxy functions that change the target's
+ *	state (stepping, breakpoints, deposits...). Those are refused for
+ *	observer sessions (see pldbg_attach_observer()).
+ */
+
+static debugSession * driverSession( sessionHandle handle )
+{
+	debugSession * session = defaultSession( handle );
+
+	if( session->observer )
+		ereport( ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE), errmsg( "observer sessions are read-only" )));
+
+	return( session );
+}
+
 /*******************************************************************************
  * initSessionHash()
  *
@@ -1358,17 +2125,32 @@ static uint32 getUInt32( debugSession * session )
 
 static char * getNString( debugSession * session )
 {
-	uint32 len = getUInt32( session );
+	uint32 len;
+
+	return( getNBytes( session, &len ));
+}
 
-	if( len == 0 )
+/******************************************************************************
+ * getNBytes()
+ *
+ *	Like getNString(), but for messages that may contain binary data: also
+ *	returns the number of bytes read (not counting the null-terminator that we
+ *	tack on anyway) in *len.
+ */
+
+static char * getNBytes( debugSession * session, uint32 * len )
+{
+	*len = getUInt32( session );
+
+	if( *len == 0 )
 		return( NULL );
 	else
 	{
-		char * result = palloc( len + 1 );
+		char * result = palloc( *len + 1 );
 
-		readn( session->serverSocket, result, len );
+		readn( session->serverSocket, result, *len );
 
-		result[len] = '\0';
+		result[*len] = '\0';
 
 		return( result );
 	}
@@ -1392,6 +2174,10 @@ static void closeSession( debugSession * session )
 	if( session->breakpointString )
 		pfree( session->breakpointString );
 
+	list_free_deep( session->types );
+
+	sessions_drop_proxy( session->registrySlot );
+
 	pfree( session );
 }
 
@@ -1,8 +1,12 @@
 #ifndef PLDEBUGGER_H
 #define PLDEBUGGER_H
 
+#include "access/htup.h"
+#include "access/tupdesc.h"
+#include "fmgr.h"
 #include "globalbp.h"
 #include "storage/lwlock.h"
+#include "utils/tuplestore.h"
 
 /*
  * We keep one per_session_ctx structure per backend. This structure holds all
@@ -13,6 +17,11 @@ typedef struct
 	bool	 step_into_next_func;	/* Should we step into the next function?				 */
 	int		 client_r;				/* Read stream connected to client						 */
 	int		 client_w;				/* Write stream connected to client						 */
+	uint64	 session_token;			/* Lets a new proxy reattach if the connection drops	 */
+	uint64	 observer_token;		/* Lets read-only observers attach (0 if not offered)	 */
+	int		 observer_listener;		/* Socket that observers connect to (0 if none)			 */
+	int		 steps_left;			/* Statements to step over before we stop (see skipStep()) */
+	Oid		 proxy_role;			/* Role the proxy runs as (InvalidOid if not connected)	 */
 } per_session_ctx_t;
 
 extern per_session_ctx_t per_session_ctx;
@@ -43,25 +52,50 @@ extern errorHandlerCtx client_lost;
 #define PLDBG_LIST_BREAKPOINTS 	'l'
 #define PLDBG_STEP_INTO			's'
 #define PLDBG_STEP_OVER			'o'
+#define PLDBG_STEP_MANY			'n'
 #define PLDBG_LIST				'#'
 #define PLDBG_INFO_VARS			'i'
+#define PLDBG_INFO_VARS_BINARY	'I'
+#define PLDBG_GET_TYPES			'T'
+#define PLDBG_EXPLAIN				'e'
+#define PLDBG_QUERY				'q'
+#define PLDBG_EXPORT_SNAPSHOT		'S'
 #define PLDBG_SELECT_FRAME		'^'
 #define PLDBG_DEPOSIT				'd'
 #define PLDBG_RESTART				'r'
 #define PLDBG_STOP				'x'
+#define PLDBG_GET_TOKEN			'k'
+#define PLDBG_GET_OBSERVER_TOKEN	'w'
+#define PLDBG_WAIT_FOR_STOP		'W'			/* Observers only */
+
+/*
+ * Which variables send_vars() should send, and how.  See parseVarFilter()
+ * for the way a filter is spelled on the wire.
+ */
+typedef struct
+{
+	bool	binary;			/* Send values in binary (typsend) format */
+	bool	inScopeOnly;	/* Only variables in scope at the current line */
+	int		frameNo;		/* Stack frame to look at, -1 for the focus */
+	int		nameCount;		/* If > 0, only the variables named in names[] */
+	char  **names;
+} var_filter;
 
 typedef struct
 {
 	void	(* initialize)(void);
 	bool	(* frame_belongs_to_me)(ErrorContextCallback *frame);
 	void	(* send_stack_frame)(ErrorContextCallback *frame);
-	void	(* send_vars)(ErrorContextCallback *frame);
+	void	(* send_vars)(ErrorContextCallback *frame, const var_filter *filter);
 	void	(* select_frame)(ErrorContextCallback *frame);
 	void	(* print_var)(ErrorContextCallback *frame, const char *var_name, int lineno);
 	bool	(* do_deposit)(ErrorContextCallback *frame, const char *var_name,
 						   int line_number, const char *value);
 	Oid		(* get_func_oid)(ErrorContextCallback *frame);
 	void	(* send_cur_line)(ErrorContextCallback *frame);
+	void	(* collect_types)(ErrorContextCallback *frame);
+	void	(* explain_current)(ErrorContextCallback *frame, bool analyze);
+	void	(* query_in_target)(ErrorContextCallback *frame, const char *sql, int maxRows, int maxBytes);
 } debugger_language_t;
 
 /* in plugin_debugger.c */
@@ -69,10 +103,15 @@ extern void initGlobalBreakpoints(void);
 extern bool plugin_debugger_main_loop(void);
 
 extern bool breakAtThisLine( Breakpoint ** dst, eBreakpointScope * scope, Oid funcOid, int lineNumber );
+extern bool skipStep( Oid funcOid, int lineNumber, bool atBreakpoint );
 extern bool attach_to_proxy( Breakpoint * breakpoint );
+extern bool reattach_to_proxy( void );
 extern void setBreakpoint( char * command );
 extern void clearBreakpoint( char * command );
 extern bool breakpointsForFunction( Oid funcOid );
+extern void notifyBreakpointHit( Oid funcOid, int lineNumber, int proxyPid );
+extern uint32 getFunctionVersion( Oid funcOid );
+extern void dbg_note_type( Oid typoid, int32 typmod );
 
 extern void	dbg_send( const char *fmt, ... )
 #ifdef PG_PRINTF_ATTRIBUTE
@@ -81,10 +120,17 @@ extern void	dbg_send( const char *fmt, ... )
 __attribute__((format(PG_PRINTF_ATTRIBUTE, 1, 2)))
 #endif
 ;
+extern void	dbg_send_bytes( const char *header, const char *data, size_t len );
 extern char 	   * dbg_read_str(void);
 
 extern LWLockId  getPLDebuggerLock(void);
 
+extern char 	   * findSource( Oid oid, HeapTuple * tup );
+extern char 	  ** splitSourceLines( char *source, int *lineCount );
+
+/* in profiler.c */
+extern Tuplestorestate * beginMaterialize( FunctionCallInfo fcinfo, const char *typeName, TupleDesc *tupdesc );
+
 /* in plpgsql_debugger.c */
 extern void plpgsql_debugger_fini(void);
 
@@ -93,6 +139,11 @@ extern debugger_language_t plpgsql_debugger_lang;
 extern debugger_language_t spl_debugger_lang;
 #endif
 
+#if (PG_VERSION_NUM < 90600)
+#define ALLOCSET_DEFAULT_SIZES	ALLOCSET_DEFAULT_MINSIZE, ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE
+#define ALLOCSET_SMALL_SIZES	ALLOCSET_SMALL_MINSIZE, ALLOCSET_SMALL_INITSIZE, ALLOCSET_SMALL_MAXSIZE
+#endif
+
 #if PG_VERSION_NUM >= 110000
 	#ifndef TRUE
 		#define TRUE true
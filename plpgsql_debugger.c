@@ -17,15 +17,36 @@
 #include <errno.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <limits.h>
 
+#include "access/xact.h"
 #include "lib/stringinfo.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
+#include "commands/explain.h"
+#include "executor/instrument.h"
+#include "funcapi.h"
+#if (PG_VERSION_NUM >= 130000)
+#include "common/hashfn.h"
+#endif
 #include "globalbp.h"
+#include "nodes/makefuncs.h"
+#include "parser/parse_node.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/plancache.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
 #include "utils/syscache.h"
 #include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "tcop/tcopprot.h"
+#if (PG_VERSION_NUM < 100000)
+#include "utils/json.h"
+#endif
 
 #if INCLUDE_PACKAGE_SUPPORT
 #include "spl.h"
@@ -35,6 +56,8 @@
 #endif
 
 #include "pldebugger.h"
+#include "profiler.h"
+#include "spans.h"
 
 /* Include header for GETSTRUCT */
 #if (PG_VERSION_NUM >= 90300)
@@ -53,6 +76,39 @@ typedef struct
 	bool		duplicate_name;	/* Is this one of many vars with same name? */
 } var_value;
 
+/*
+ * A usage_mark records what a function or statement had used up when it
+ * started, so that we can tell the line profile what it used in the end.
+ * For a statement with a cached plan, it also records where the plan's
+ * counters stood (see mark_plan()).
+ */
+
+typedef struct
+{
+	instr_time			time;
+	int64				blksHit;	/* Shared and local buffer hits */
+	int64				blksRead;	/* Shared and local buffer reads */
+	wait_usage_t		waits;		/* Waits sampled */
+	uint64				planUsecs;	/* Time this backend has spent planning */
+	int					planBuilds;	/* Plans built from the statement's query */
+	int64				customPlans;  /* Custom plans chosen for it */
+	int64				genericPlans; /* Times its generic plan was chosen */
+	bool				planInvalid; /* Had its plan been invalidated? */
+} usage_mark;
+
+/*
+ * Where the loops are that run SQL statements, so that the line profile can
+ * count how many times each statement runs per entry into the loop around
+ * it (see fetchLoopMap() and profiler_count_loop_query()). Both arrays are
+ * indexed by stmtid. Like stmtStart, we build one for each call that goes
+ * into the line profile: it only takes a walk over the statement tree.
+ */
+typedef struct
+{
+	int				  * loopLines;	/* Line of the innermost loop around a SQL statement, or 0 */
+	bool			  * hasQueries;	/* Is this a loop with SQL statements directly in it? */
+} loop_map;
+
 /*
  * When the debugger decides that it needs to step through (or into) a
  * particular function invocation, it allocates a dbg_ctx and records the
@@ -67,6 +123,18 @@ typedef struct
 {
 	PLpgSQL_function *	func;		/* Function definition */
 	bool				stepping;	/* If TRUE, stop at next statement */
+	bool				debugging;	/* If FALSE, we're only here for the profiler */
+	bool				profiled;	/* If TRUE, tell the profiler about each line */
+	bool				timed;		/* If TRUE, tell the profiler how long we took */
+	bool				linesProfiled; /* If TRUE, add to the line profile */
+	usage_mark			start;		/* When we started (if timed or linesProfiled) */
+	usage_mark		  * stmtStart;	/* When each statement started, by stmtid */
+	loop_map		  * loops;		/* Loops that run SQL (if linesProfiled) */
+	ErrorContextCallback exceptionCallback; /* Notes errors (if linesProfiled or traced) */
+	bool				hasActions;	/* If TRUE, some lines have breakpoint actions */
+	bool				traced;		/* If TRUE, report a span for this call */
+	span_t				span;		/* The span of this call (if traced) */
+	span_t			  * stmtSpans;	/* Span of each statement, by stmtid (or NULL) */
 	var_value	     *  symbols;	/* Extra debugger-private info about variables */
 	char			 ** argNames;	/* Argument names */
 	int					argNameCount; /* Number of names pointed to by argNames */
@@ -77,11 +145,99 @@ typedef struct
 #endif
 } dbg_ctx;
 
+/*
+ * We cache a few things about each function that cost a catalog lookup
+ * to compute and don't change from one invocation to the next.  Each entry
+ * remembers the getFunctionVersion() it was built at and is rebuilt, the
+ * next time somebody asks for it, after the function is redefined.
+ */
+
+/*
+ * The range of lines in which a variable is in scope: the lines spanned by
+ * the block that declares it (see fetchVarScopes()).
+ */
+typedef struct
+{
+	int					start;		/* First line of the declaring block */
+	int					end;		/* Last line of the declaring block */
+} var_scope;
+
+typedef struct
+{
+	Oid					fn_oid;		/* Hash key */
+	bool				valid;		/* FALSE until the entry has been built */
+	uint32				version;	/* getFunctionVersion() when built */
+	MemoryContext		cxt;		/* Holds everything below */
+	char			 ** argNames;	/* Argument names (see fetchArgNames()) */
+	int					argNameCount; /* Number of names pointed to by argNames */
+	PLpgSQL_function  * scopeFunc;	/* Compiled function that scopes describes */
+	var_scope		  * scopes;		/* Scope of each datum, built on demand */
+} func_cache;
+
+static HTAB			   * funcCacheHash = NULL;
+
+/*
+ * We also cache the output (and, if the type has one, the binary send)
+ * function of each data type we've had to display, so that rendering a
+ * variable doesn't cost a catalog lookup and an fmgr_info() every time.
+ * Entries are marked invalid by a syscache callback when the pg_type row
+ * changes and are rebuilt the next time somebody asks for them.
+ */
+
+typedef struct
+{
+	Oid					typoid;		/* Hash key */
+	bool				valid;		/* FALSE until the entry has been built */
+	MemoryContext		cxt;		/* Holds what the I/O functions cache */
+	uint32				hashValue;	/* TYPEOID syscache hash of typoid */
+	Oid					typelem;	/* Passed along to the output function */
+	FmgrInfo			output;		/* typoutput */
+	bool				hasSend;	/* FALSE if the type has no typsend */
+	FmgrInfo			send;		/* typsend (only if hasSend) */
+} type_io_cache;
+
+static HTAB			   * typeIOHash = NULL;
+
+/*
+ * TRUE while we run a statement on somebody else's behalf: the debugger
+ * client's (see plpgsql_explain_current() and plpgsql_query_in_target())
+ * or a breakpoint action list's (see evaluate_action()).  See dbg_startup().
+ */
+static bool				 runningForDebugger = FALSE;
+
+/*
+ * The counters on a plan source that planning it for EXPLAIN would bump
+ * (see save_plan_counters()).
+ */
+typedef struct
+{
+	int					generation;
+	int64				numCustomPlans;
+	int64				numGenericPlans;
+	double				totalCustomCost;
+	uint64				planningUsecs;
+} plan_counters;
+
 static void 		 dbg_startup( PLpgSQL_execstate * estate, PLpgSQL_function * func );
 static void 		 dbg_newstmt( PLpgSQL_execstate * estate, PLpgSQL_stmt * stmt );
+static void 		 dbg_endstmt( PLpgSQL_execstate * estate, PLpgSQL_stmt * stmt );
+static void 		 dbg_funcbeg( PLpgSQL_execstate * estate, PLpgSQL_function * func );
+static void 		 dbg_funcend( PLpgSQL_execstate * estate, PLpgSQL_function * func );
 static void 		 initialize_plugin_info( PLpgSQL_execstate * estate, PLpgSQL_function * func );
 
 static char       ** fetchArgNames( PLpgSQL_function * func, int * nameCount );
+static func_cache  * get_func_cache( PLpgSQL_function * func );
+static char       ** lookupArgNames( PLpgSQL_function * func, int * nameCount );
+static var_scope   * fetchVarScopes( PLpgSQL_function * func );
+static var_scope   * lookupVarScopes( PLpgSQL_function * func );
+static int			 scan_scopes( PLpgSQL_stmt * stmt, var_scope * scopes );
+static int			 scan_scope_list( List * stmts, var_scope * scopes );
+#if (PG_VERSION_NUM >= 120000)
+static loop_map    * fetchLoopMap( PLpgSQL_function * func );
+static void			 scan_loops( PLpgSQL_stmt * stmt, PLpgSQL_stmt * loop, loop_map * map );
+static void			 scan_loop_list( List * stmts, PLpgSQL_stmt * loop, loop_map * map );
+#endif
+static bool			 var_is_wanted( PLpgSQL_execstate * estate, int varNo, const char * name, const var_filter * filter, var_scope * scopes );
 static PLpgSQL_var * find_var_by_name( const PLpgSQL_execstate * estate, const char * var_name, int lineno, int * index );
 
 static bool 		 is_datum_visible( PLpgSQL_datum * datum );
@@ -89,6 +245,23 @@ static bool			 is_var_visible( PLpgSQL_execstate * frame, int var_no );
 static bool			 datumIsNull(PLpgSQL_datum *datum);
 static bool          varIsArgument(const PLpgSQL_execstate *estate, PLpgSQL_function *func, int varNo, char **p_argname);
 static char		   * get_text_val( PLpgSQL_var * var, char ** name, char ** type );
+static bytea		   * get_binary_val( PLpgSQL_var * var );
+static type_io_cache * get_type_io( Oid typoid );
+static void			 typeIOInvalidated( Datum arg, int cacheid, uint32 hashValue );
+static void			 send_binary_var( const char * name, char varClass, bool duplicate, PLpgSQL_var * var );
+static char		   * profile_value( void * arg, const char * varName, bool * isnull );
+static void			 describe_call( void * arg, char ** args, char ** callers );
+static int			 append_call_args( void * arg, StringInfo buf );
+static void			 append_frame_args( StringInfo result, PLpgSQL_execstate * estate, PLpgSQL_function * func );
+static void			 mark_usage( usage_mark * mark );
+static uint64		 count_usage( Oid funcOid, int lineNumber, usage_mark * mark );
+#if (PG_VERSION_NUM >= 120000)
+static CachedPlanSource * stmt_plan_source( PLpgSQL_stmt * stmt );
+static void			 mark_plan( PLpgSQL_stmt * stmt, usage_mark * mark );
+static void			 count_plan( Oid funcOid, PLpgSQL_stmt * stmt, usage_mark * mark );
+#endif
+static void			 note_exception( void * arg );
+static span_t	   * caller_span( PLpgSQL_execstate * estate );
 
 #if INCLUDE_PACKAGE_SUPPORT
 static const char * plugin_name  = "spl_plugin";
@@ -96,7 +269,7 @@ static const char * plugin_name  = "spl_plugin";
 static const char * plugin_name  = "PLpgSQL_plugin";
 #endif
 
-static PLpgSQL_plugin plugin_funcs = { dbg_startup, NULL, NULL, dbg_newstmt, NULL };
+static PLpgSQL_plugin plugin_funcs = { dbg_startup, dbg_funcbeg, dbg_funcend, dbg_newstmt, dbg_endstmt };
 
 /*
  * pldebugger_language_t interface.
@@ -104,12 +277,20 @@ static PLpgSQL_plugin plugin_funcs = { dbg_startup, NULL, NULL, dbg_newstmt, NUL
 static void plpgsql_debugger_init(void);
 static bool plpgsql_frame_belongs_to_me(ErrorContextCallback *frame);
 static void plpgsql_send_stack_frame(ErrorContextCallback *frame);
-static void plpgsql_send_vars(ErrorContextCallback *frame);
+static void plpgsql_send_vars(ErrorContextCallback *frame, const var_filter *filter);
 static void plpgsql_select_frame(ErrorContextCallback *frame);
 static void plpgsql_print_var(ErrorContextCallback *frame, const char *var_name, int lineno);
 static bool plpgsql_do_deposit(ErrorContextCallback *frame, const char *var_name, int line_number, const char *value);
 static Oid plpgsql_get_func_oid(ErrorContextCallback *frame);
 static void plpgsql_send_cur_line(ErrorContextCallback *frame);
+static void plpgsql_collect_types(ErrorContextCallback *frame);
+static void plpgsql_explain_current(ErrorContextCallback *frame, bool analyze);
+#if (PG_VERSION_NUM >= 140000) && !defined(INCLUDE_PACKAGE_SUPPORT)
+static void save_plan_counters(CachedPlanSource *plansource, plan_counters *saved);
+static void restore_plan_counters(CachedPlanSource *plansource, plan_counters *saved);
+#endif
+static void plpgsql_query_in_target(ErrorContextCallback *frame, const char *sql, int maxRows, int maxBytes);
+static void check_target_query(const char *sql);
 
 #if INCLUDE_PACKAGE_SUPPORT
 debugger_language_t spl_debugger_lang =
@@ -125,7 +306,10 @@ debugger_language_t plpgsql_debugger_lang =
 	plpgsql_print_var,
 	plpgsql_do_deposit,
 	plpgsql_get_func_oid,
-	plpgsql_send_cur_line
+	plpgsql_send_cur_line,
+	plpgsql_collect_types,
+	plpgsql_explain_current,
+	plpgsql_query_in_target
 };
 
 /* Install this module as an PL/pgSQL instrumentation plugin */
@@ -166,11 +350,7 @@ plpgsql_send_stack_frame(ErrorContextCallback *frame)
 	PLpgSQL_function  * func     = estate->err_func;
 #endif
 	PLpgSQL_stmt	  * stmt 	 = estate->err_stmt;
-	int					argNameCount;
-	char             ** argNames = fetchArgNames( func, &argNameCount );
 	StringInfo		    result   = makeStringInfo();
-	char              * delimiter = "";
-	int				    arg;
 
 	/*
 	 * Send the name, function OID, and line number for this frame
@@ -189,6 +369,25 @@ plpgsql_send_stack_frame(ErrorContextCallback *frame)
 	 * Now assemble a string that shows the argument names and value for this frame
 	 */
 
+	append_frame_args( result, estate, func );
+
+	dbg_send( "%s", result->data );
+}
+
+/*
+ * append_frame_args()
+ *
+ * Appends the names and values of the arguments of the given frame to
+ * result, in the form "name=value, $2=value, ...".
+ */
+static void
+append_frame_args(StringInfo result, PLpgSQL_execstate *estate, PLpgSQL_function *func)
+{
+	int					argNameCount = 0;
+	char             ** argNames = lookupArgNames( func, &argNameCount );
+	char              * delimiter = "";
+	int				    arg;
+
 	for( arg = 0; arg < func->fn_nargs; ++arg )
 	{
 		int					index   = func->fn_argvarnos[arg];
@@ -210,8 +409,6 @@ plpgsql_send_stack_frame(ErrorContextCallback *frame)
 
 		delimiter = ", ";
 	}
-
-	dbg_send( "%s", result->data );
 }
 
 /*
@@ -294,14 +491,24 @@ varIsArgument(const PLpgSQL_execstate *estate, PLpgSQL_function *func,
  * This function sends a list of variables (names, types, values...) to
  * the proxy process.  We send information about the variables defined in
  * the given frame (local variables) and parameter values.
+ *
+ * The filter may restrict the list to the variables with the given names
+ * and/or to the variables in scope at the current line.  If filter->binary
+ * is TRUE, each value is sent in its type's binary (typsend) format instead
+ * - see send_binary_var().
  */
 static void
-plpgsql_send_vars(ErrorContextCallback *frame)
+plpgsql_send_vars(ErrorContextCallback *frame, const var_filter *filter)
 {
 	PLpgSQL_execstate *estate = (PLpgSQL_execstate *) frame->arg;
 	dbg_ctx * dbg_info = (dbg_ctx *) estate->plugin_info;
+	bool	  binary = filter->binary;
+	var_scope * scopes = NULL;
 	int       i;
 
+	if( filter->inScopeOnly )
+		scopes = lookupVarScopes( dbg_info->func );
+
 	for( i = 0; i < estate->ndatums; i++ )
 	{
 		if( is_var_visible( estate, i ))
@@ -320,6 +527,15 @@ plpgsql_send_vars(ErrorContextCallback *frame)
 
 					isArg = varIsArgument(estate, dbg_info->func, i, &name);
 
+					if( !var_is_wanted( estate, i, name, filter, scopes ))
+						break;
+
+					if( binary )
+					{
+						send_binary_var( name, isArg ? 'A' : 'L', dbg_info->symbols[i].duplicate_name, var );
+						break;
+					}
+
 					if( datumIsNull((PLpgSQL_datum *)var ))
 						val = "NULL";
 					else
@@ -399,6 +615,16 @@ plpgsql_send_vars(ErrorContextCallback *frame)
 					char        * val;
 					char		* name = var->refname;
 
+					/* Package variables are always in scope */
+					if( !var_is_wanted( estate, -1, name, filter, NULL ))
+						break;
+
+					if( binary )
+					{
+						send_binary_var( name, 'P', TRUE, var );	/* sent as not unique, like below */
+						break;
+					}
+
 					if( datumIsNull((PLpgSQL_datum *)var ))
 						val = "NULL";
 					else
@@ -424,6 +650,354 @@ plpgsql_send_vars(ErrorContextCallback *frame)
 	dbg_send( "%s", "" );	/* empty string indicates end of list */
 }
 
+/*
+ * var_is_wanted()
+ *
+ * Returns TRUE if the given variable passes the filter.  scopes is the
+ * result of lookupVarScopes(), or NULL if we don't care about scope.
+ */
+static bool
+var_is_wanted(PLpgSQL_execstate *estate, int varNo, const char *name,
+			  const var_filter *filter, var_scope *scopes)
+{
+	if( filter->nameCount > 0 )
+	{
+		int		i;
+
+		for( i = 0; i < filter->nameCount; i++ )
+		{
+			if( strcmp( filter->names[i], name ) == 0 )
+				break;
+		}
+
+		if( i == filter->nameCount )
+			return( FALSE );
+	}
+
+	if( scopes != NULL && varNo >= 0 && estate->err_stmt != NULL )
+	{
+		int		line = estate->err_stmt->lineno;
+
+		if( line < scopes[varNo].start || line > scopes[varNo].end )
+			return( FALSE );
+	}
+
+	return( TRUE );
+}
+
+/*
+ * send_binary_var()
+ *
+ * Sends a single variable in the form used by the binary variable list:
+ *
+ *	name:class:line:unique:const:notnull:typoid:format:<value bytes>
+ *
+ * where format is 'b' if the value bytes are the output of the type's send
+ * function, 't' if the type has no send function (so we fell back to its
+ * text output), or 'n' if the value is NULL (and no bytes follow).
+ */
+static void
+send_binary_var(const char *name, char varClass, bool duplicate, PLpgSQL_var *var)
+{
+	StringInfoData	header;
+	bytea		  * binval = NULL;
+	char		  * textval = NULL;
+	char			format = 'n';
+
+	if( !datumIsNull((PLpgSQL_datum *) var ))
+	{
+		if(( binval = get_binary_val( var )) != NULL )
+			format = 'b';
+		else if(( textval = get_text_val( var, NULL, NULL )) != NULL )
+			format = 't';
+	}
+
+	initStringInfo( &header );
+	appendStringInfo( &header, "%s:%c:%d:%c:%c:%c:%u:%c:",
+					  name,
+					  varClass,
+					  var->lineno,
+					  duplicate ? 'f' : 't',
+					  var->isconst ? 't':'f',
+					  var->notnull ? 't':'f',
+					  var->datatype ? var->datatype->typoid : InvalidOid,
+					  format );
+
+	if( format == 'b' )
+		dbg_send_bytes( header.data, VARDATA_ANY( binval ), VARSIZE_ANY_EXHDR( binval ));
+	else if( format == 't' )
+		dbg_send_bytes( header.data, textval, strlen( textval ));
+	else
+		dbg_send_bytes( header.data, NULL, 0 );
+
+	pfree( header.data );
+
+	if( binval )
+		pfree( binval );
+	if( textval )
+		pfree( textval );
+}
+
+/*
+ * find_scoped_var()
+ *
+ * Returns the (scalar) variable with the given name in the given frame, or
+ * NULL if there's no such variable.  If the name is declared more than once,
+ * we want the innermost declaration in scope at the current line.
+ */
+static PLpgSQL_var *
+find_scoped_var( PLpgSQL_execstate *frame, const char *varName )
+{
+	dbg_ctx			  * dbg_info = (dbg_ctx *) frame->plugin_info;
+	var_scope		  * scopes   = lookupVarScopes( dbg_info->func );
+	PLpgSQL_var		  * found    = NULL;
+	int					i;
+
+	for( i = 0; i < frame->ndatums; i++ )
+	{
+		PLpgSQL_var * var = (PLpgSQL_var *) frame->datums[i];
+
+		if( var->dtype != PLPGSQL_DTYPE_VAR || strcmp( var->refname, varName ) != 0 )
+			continue;
+
+		if( scopes != NULL && frame->err_stmt != NULL &&
+			( frame->err_stmt->lineno < scopes[i].start || frame->err_stmt->lineno > scopes[i].end ))
+			continue;
+
+		found = var;
+	}
+
+	return( found );
+}
+
+/*
+ * profile_value()
+ *
+ * Called by the profiler (see profiler_sample_line()) to fetch the value of
+ * the named variable in the given frame, as text.  Returns NULL if there's
+ * no such (scalar) variable.
+ */
+static char *
+profile_value(void *arg, const char *varName, bool *isnull)
+{
+	PLpgSQL_var		  * found = find_scoped_var( (PLpgSQL_execstate *) arg, varName );
+
+	if( found == NULL )
+		return( NULL );
+
+	*isnull = found->isnull;
+
+	if( found->isnull )
+		return( pstrdup( "" ));
+
+	return( get_text_val( found, NULL, NULL ));
+}
+
+/*
+ * describe_call()
+ *
+ * Called by the profiler (see profiler_record_call()) to describe an
+ * invocation that was slow enough to keep: its arguments, the way
+ * plpgsql_send_stack_frame() shows them, and the PL/pgSQL functions that
+ * called it (innermost first, "signature:line" separated by " <- ").
+ */
+static void
+describe_call(void *arg, char **args, char **callers)
+{
+	PLpgSQL_execstate	 * estate   = (PLpgSQL_execstate *) arg;
+	StringInfoData		   argBuf;
+	StringInfoData		   callerBuf;
+	ErrorContextCallback * frame;
+	char				 * delimiter = "";
+
+	initStringInfo( &argBuf );
+	append_frame_args( &argBuf, estate, estate->func );
+
+	/*
+	 * The function's own error context is still on the stack, so skip
+	 * everything up to and including that one.
+	 */
+	initStringInfo( &callerBuf );
+
+	for( frame = error_context_stack; frame != NULL; frame = frame->previous )
+	{
+		if( frame->callback == plugin_funcs.error_callback && frame->arg == estate )
+			break;
+	}
+
+	for( frame = frame ? frame->previous : NULL; frame != NULL; frame = frame->previous )
+	{
+		PLpgSQL_execstate * caller;
+
+		if( frame->callback != plugin_funcs.error_callback )
+			continue;
+
+		caller = (PLpgSQL_execstate *) frame->arg;
+
+		appendStringInfo( &callerBuf, "%s%s:%d", delimiter,
+#if (PG_VERSION_NUM >= 90200)
+						  caller->func->fn_signature,
+#else
+						  caller->func->fn_name,
+#endif
+						  caller->err_stmt ? caller->err_stmt->lineno : 0 );
+
+		delimiter = " <- ";
+	}
+
+	*args    = argBuf.data;
+	*callers = callerBuf.data;
+}
+
+/*
+ * append_call_args()
+ *
+ * Called by the profiler (see profiler_record_workload()) to record the
+ * arguments of an invocation, in binary form where the type allows it.
+ * We can only record scalar arguments; row and record arguments are
+ * recorded as NULLs of no particular type.
+ */
+static int
+append_call_args(void *arg, StringInfo buf)
+{
+	PLpgSQL_execstate * estate = (PLpgSQL_execstate *) arg;
+	PLpgSQL_function  * func   = estate->func;
+	int					i;
+
+	for( i = 0; i < func->fn_nargs; i++ )
+	{
+		PLpgSQL_var * var = (PLpgSQL_var *) estate->datums[func->fn_argvarnos[i]];
+
+		if( var->dtype != PLPGSQL_DTYPE_VAR )
+			profiler_append_arg( buf, InvalidOid, TRUE, NULL, NULL );
+		else if( var->isnull )
+			profiler_append_arg( buf, var->datatype->typoid, TRUE, NULL, NULL );
+		else
+		{
+			bytea * binval = get_binary_val( var );
+
+			profiler_append_arg( buf, var->datatype->typoid, FALSE, binval, binval ? NULL : get_text_val( var, NULL, NULL ));
+		}
+	}
+
+	return( func->fn_nargs );
+}
+
+/*
+ * action_columnref_hook()
+ *
+ * Resolves a column reference in an expression that evaluate_action() runs
+ * to the value of the variable by that name in the frame, if there is one
+ * (and the name doesn't refer to a column of the query).
+ */
+static Node *
+action_columnref_hook( ParseState *pstate, ColumnRef *cref, Node *var )
+{
+	PLpgSQL_execstate * frame = (PLpgSQL_execstate *) pstate->p_ref_hook_state;
+	PLpgSQL_var		  * found;
+	Node			  * field;
+
+	if( var != NULL || list_length( cref->fields ) != 1 )
+		return( NULL );
+
+	field = (Node *) linitial( cref->fields );
+
+	if( !IsA( field, String ))
+		return( NULL );
+
+	if(( found = find_scoped_var( frame, strVal( field ))) == NULL )
+		return( NULL );
+
+	return((Node *) makeConst( found->datatype->typoid, found->datatype->atttypmod,
+							   found->datatype->collation, found->datatype->typlen,
+							   found->isnull ? (Datum) 0 : datumCopy( found->value, found->datatype->typbyval, found->datatype->typlen ),
+							   found->isnull, found->datatype->typbyval ));
+}
+
+static void
+action_parser_setup( ParseState *pstate, void *arg )
+{
+	pstate->p_post_columnref_hook = action_columnref_hook;
+	pstate->p_ref_hook_state = arg;
+}
+
+/*
+ * evaluate_action()
+ *
+ * Called by the profiler (see profiler_run_actions()) to evaluate the SQL
+ * expression of an 'eval' action in the given frame.  The expression can
+ * refer to the frame's variables by name.  It runs in a subtransaction that
+ * we always roll back, so it can't change anything, and an error in it is
+ * returned as the result rather than thrown at the target.
+ */
+static char *
+evaluate_action(void *arg, const char *expression)
+{
+	PLpgSQL_execstate * frame      = (PLpgSQL_execstate *) arg;
+	MemoryContext		curContext = CurrentMemoryContext;
+	ResourceOwner		curOwner   = CurrentResourceOwner;
+	char			  * query      = psprintf( "SELECT (%s)", expression );
+	char			  * result     = NULL;
+
+	BeginInternalSubTransaction( NULL );
+	MemoryContextSwitchTo( curContext );
+	runningForDebugger = TRUE;
+
+	PG_TRY();
+	{
+		SPIPlanPtr	plan;
+
+		if( SPI_connect() != SPI_OK_CONNECT )
+			elog( ERROR, "SPI_connect failed" );
+
+		plan = SPI_prepare_params( query, action_parser_setup, frame, 0 );
+
+		if( plan == NULL )
+			elog( ERROR, "could not prepare \"%s\": %s", query, SPI_result_code_string( SPI_result ));
+
+		if( SPI_execute_plan( plan, NULL, NULL, true, 1 ) != SPI_OK_SELECT )
+			elog( ERROR, "expression must be a plain value" );
+
+		if( SPI_processed > 0 )
+		{
+			char * value = SPI_getvalue( SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1 );
+
+			/* SPI_finish() throws away everything SPI allocated */
+			if( value != NULL )
+				result = MemoryContextStrdup( curContext, value );
+		}
+
+		SPI_finish();
+
+		runningForDebugger = FALSE;
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo( curContext );
+		CurrentResourceOwner = curOwner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		runningForDebugger = FALSE;
+
+		MemoryContextSwitchTo( curContext );
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo( curContext );
+		CurrentResourceOwner = curOwner;
+
+		result = psprintf( "ERROR:  %s", edata->message );
+		FreeErrorData( edata );
+	}
+	PG_END_TRY();
+
+	pfree( query );
+
+	return( result );
+}
+
 static void
 plpgsql_select_frame(ErrorContextCallback *frame)
 {
@@ -603,9 +1177,7 @@ print_var(const PLpgSQL_execstate *frame, const char *var_name, int lineno,
 		  const PLpgSQL_var *tgt)
 {
 	char	     	 * extval;
-	HeapTuple	       typeTup;
-	Form_pg_type       typeStruct;
-	FmgrInfo	       finfo_output;
+	type_io_cache	 * typeIO;
 	dbg_ctx 		 * dbg_info = (dbg_ctx *)frame->plugin_info;
 
 	if( tgt->isnull )
@@ -619,21 +1191,17 @@ print_var(const PLpgSQL_execstate *frame, const char *var_name, int lineno,
 
 	/* Find the output function for this data type */
 
-	typeTup = SearchSysCache( TYPEOID, ObjectIdGetDatum( tgt->datatype->typoid ), 0, 0, 0 );
+	typeIO = get_type_io( tgt->datatype->typoid );
 
-	if( !HeapTupleIsValid( typeTup ))
+	if( typeIO == NULL )
 	{
 		dbg_send( "v:%s(%d):***can't find type\n", var_name, lineno );
 		return;
 	}
 
-	typeStruct = (Form_pg_type)GETSTRUCT( typeTup );
-
 	/* Now invoke the output function to convert the variable into a null-terminated string */
 
-	fmgr_info( typeStruct->typoutput, &finfo_output );
-
-	extval = DatumGetCString( FunctionCall3( &finfo_output, tgt->value, ObjectIdGetDatum(typeStruct->typelem), Int32GetDatum(-1)));
+	extval = DatumGetCString( FunctionCall3( &typeIO->output, tgt->value, ObjectIdGetDatum(typeIO->typelem), Int32GetDatum(-1)));
 
 	/* Send the name:value to the debugger client */
 
@@ -643,7 +1211,6 @@ print_var(const PLpgSQL_execstate *frame, const char *var_name, int lineno,
 		dbg_send( "v:%s:%s\n", var_name, extval );
 
 	pfree( extval );
-	ReleaseSysCache( typeTup );
 }
 
 static void
@@ -828,6 +1395,7 @@ completeFrame(PLpgSQL_execstate *frame)
 {
 	dbg_ctx 		 * dbg_info = (dbg_ctx *)frame->plugin_info;
 	PLpgSQL_function * func     = dbg_info->func;
+	char			** argNames;
 	int		           i;
 
 	if( dbg_info->symbols == NULL )
@@ -852,21 +1420,441 @@ completeFrame(PLpgSQL_execstate *frame)
 		for( i = 0; i < func->ndatums; ++i )
 			mark_duplicate_names( frame, i );
 
-		dbg_info->argNames = fetchArgNames( func, &dbg_info->argNameCount );
+		/*
+		 * Take our own copy of the argument names - the cached copy goes
+		 * away if the function is redefined while this invocation is
+		 * still running.
+		 */
+		dbg_info->argNames     = NULL;
+		dbg_info->argNameCount = 0;
+		argNames = lookupArgNames( func, &dbg_info->argNameCount );
+
+		if( argNames )
+		{
+			dbg_info->argNames = (char **) palloc( sizeof( char * ) * dbg_info->argNameCount );
+
+			for( i = 0; i < dbg_info->argNameCount; i++ )
+				dbg_info->argNames[i] = argNames[i] ? pstrdup( argNames[i] ) : NULL;
+		}
 	}
 }
 
-
 /* ------------------------------------------------------------------
- * fetchArgNames()
- *
- *   This function returns the name of each argument for the given
- *   function or procedure. If the function/procedure does not have
- *	 named arguments, this function returns NULL
+ * get_func_cache()
  *
- *	 The argument names are returned as an array of string pointers
+ *   Returns the cache entry for the given function, (re)building it
+ *   if this is the first time we've seen the function or if it has
+ *   been redefined since.  Inline code blocks have no OID (and can't
+ *   be redefined), so we don't cache anything for them and return
+ *   NULL instead.
  */
-static char **
+static func_cache *
+get_func_cache(PLpgSQL_function *func)
+{
+	func_cache	  * entry;
+	bool			found;
+	uint32			version;
+	MemoryContext	oldcxt;
+
+	if( !OidIsValid( func->fn_oid ))
+		return( NULL );
+
+	if( funcCacheHash == NULL )
+	{
+		HASHCTL	ctl = {0};
+
+		ctl.keysize   = sizeof( Oid );
+		ctl.entrysize = sizeof( func_cache );
+		ctl.hash      = tag_hash;
+
+		funcCacheHash = hash_create( "pldebugger function cache", 64, &ctl, HASH_ELEM | HASH_FUNCTION );
+	}
+
+	version = getFunctionVersion( func->fn_oid );
+
+	entry = (func_cache *) hash_search( funcCacheHash, &func->fn_oid, HASH_ENTER, &found );
+
+	if( !found )
+	{
+		entry->valid = FALSE;
+		entry->cxt   = AllocSetContextCreate( TopMemoryContext, "pldebugger function cache", ALLOCSET_SMALL_SIZES );
+	}
+	else if( entry->valid && entry->version == version )
+		return( entry );
+
+	entry->valid = FALSE;
+	MemoryContextReset( entry->cxt );
+
+	oldcxt = MemoryContextSwitchTo( entry->cxt );
+
+	entry->argNameCount = 0;
+	entry->argNames     = fetchArgNames( func, &entry->argNameCount );
+	entry->scopeFunc    = NULL;
+	entry->scopes       = NULL;
+
+	MemoryContextSwitchTo( oldcxt );
+
+	entry->version = version;
+	entry->valid   = TRUE;
+
+	return( entry );
+}
+
+/* ------------------------------------------------------------------
+ * lookupArgNames()
+ *
+ *   Like fetchArgNames(), but served from the function cache. The
+ *   result belongs to the cache: don't free it, and don't hang on to
+ *   it past the next call.
+ */
+static char **
+lookupArgNames(PLpgSQL_function *func, int *nameCount)
+{
+	func_cache	*entry = get_func_cache( func );
+
+	if( entry == NULL )
+		return( fetchArgNames( func, nameCount ));
+
+	*nameCount = entry->argNameCount;
+	return( entry->argNames );
+}
+
+
+/* ------------------------------------------------------------------
+ * lookupVarScopes()
+ *
+ *   Like fetchVarScopes(), but served from the function cache (and
+ *   built the first time somebody asks).  The result belongs to the
+ *   cache (unless func is an inline code block): don't free it.
+ */
+static var_scope *
+lookupVarScopes(PLpgSQL_function *func)
+{
+	func_cache	  * entry = get_func_cache( func );
+	MemoryContext	oldcxt;
+
+	if( entry == NULL )
+		return( fetchVarScopes( func ));
+
+	/*
+	 * The entry outlives any one compiled copy of the function, so make sure
+	 * the scopes we have describe this copy's statement tree.
+	 */
+	if( entry->scopes == NULL || entry->scopeFunc != func )
+	{
+		oldcxt = MemoryContextSwitchTo( entry->cxt );
+
+		if( entry->scopes != NULL )
+			pfree( entry->scopes );
+
+		entry->scopes    = fetchVarScopes( func );
+		entry->scopeFunc = func;
+
+		MemoryContextSwitchTo( oldcxt );
+	}
+
+	return( entry->scopes );
+}
+
+/* ------------------------------------------------------------------
+ * fetchVarScopes()
+ *
+ *   The PL/pgSQL compiler puts every variable in one flat array, no
+ *   matter which block declares it.  This function walks the statement
+ *   tree to find the range of lines in which each variable is in scope
+ *   (the lines spanned by the block that declares it) and returns an
+ *   array with one entry per datum.  Arguments and other variables that
+ *   no block declares are in scope everywhere.
+ */
+static var_scope *
+fetchVarScopes(PLpgSQL_function *func)
+{
+	var_scope  *scopes = (var_scope *) palloc( sizeof( var_scope ) * func->ndatums );
+	int			i;
+
+	for( i = 0; i < func->ndatums; i++ )
+	{
+		scopes[i].start = 0;
+		scopes[i].end   = INT_MAX;
+	}
+
+	if( func->action != NULL )
+		scan_scopes( (PLpgSQL_stmt *) func->action, scopes );
+
+	return( scopes );
+}
+
+/* ------------------------------------------------------------------
+ * scan_scopes()
+ *
+ *   Records the scope of the variables declared by the given statement
+ *   (and any statements nested inside of it) and returns the last line
+ *   spanned by the statement.
+ */
+static int
+scan_scopes(PLpgSQL_stmt *stmt, var_scope *scopes)
+{
+	int		last = stmt->lineno;
+
+	switch( stmt->cmd_type )
+	{
+		case PLPGSQL_STMT_BLOCK:
+		{
+			PLpgSQL_stmt_block *block = (PLpgSQL_stmt_block *) stmt;
+			int					i;
+
+			last = Max( last, scan_scope_list( block->body, scopes ));
+
+			if( block->exceptions != NULL )
+			{
+				ListCell   *lc;
+
+				foreach( lc, block->exceptions->exc_list )
+				{
+					PLpgSQL_exception *exc = (PLpgSQL_exception *) lfirst( lc );
+
+					last = Max( last, scan_scope_list( exc->action, scopes ));
+				}
+			}
+
+			for( i = 0; i < block->n_initvars; i++ )
+			{
+				scopes[block->initvarnos[i]].start = stmt->lineno;
+				scopes[block->initvarnos[i]].end   = last;
+			}
+			break;
+		}
+
+		case PLPGSQL_STMT_IF:
+		{
+			PLpgSQL_stmt_if *ifStmt = (PLpgSQL_stmt_if *) stmt;
+#if (PG_VERSION_NUM >= 90100)
+			ListCell		*lc;
+#endif
+
+			last = Max( last, scan_scope_list( ifStmt->then_body, scopes ));
+#if (PG_VERSION_NUM >= 90100)
+			foreach( lc, ifStmt->elsif_list )
+				last = Max( last, scan_scope_list( ((PLpgSQL_if_elsif *) lfirst( lc ))->stmts, scopes ));
+#endif
+			last = Max( last, scan_scope_list( ifStmt->else_body, scopes ));
+			break;
+		}
+
+		case PLPGSQL_STMT_CASE:
+		{
+			PLpgSQL_stmt_case *caseStmt = (PLpgSQL_stmt_case *) stmt;
+			ListCell		  *lc;
+
+			foreach( lc, caseStmt->case_when_list )
+				last = Max( last, scan_scope_list( ((PLpgSQL_case_when *) lfirst( lc ))->stmts, scopes ));
+
+			last = Max( last, scan_scope_list( caseStmt->else_stmts, scopes ));
+			break;
+		}
+
+		case PLPGSQL_STMT_LOOP:
+			last = Max( last, scan_scope_list( ((PLpgSQL_stmt_loop *) stmt)->body, scopes ));
+			break;
+
+		case PLPGSQL_STMT_WHILE:
+			last = Max( last, scan_scope_list( ((PLpgSQL_stmt_while *) stmt)->body, scopes ));
+			break;
+
+		case PLPGSQL_STMT_FORI:
+		{
+			PLpgSQL_stmt_fori *fori = (PLpgSQL_stmt_fori *) stmt;
+
+			last = Max( last, scan_scope_list( fori->body, scopes ));
+
+			/* The loop variable only exists inside the loop */
+			scopes[fori->var->dno].start = stmt->lineno;
+			scopes[fori->var->dno].end   = last;
+			break;
+		}
+
+		case PLPGSQL_STMT_FORS:
+			last = Max( last, scan_scope_list( ((PLpgSQL_stmt_fors *) stmt)->body, scopes ));
+			break;
+
+		case PLPGSQL_STMT_FORC:
+			last = Max( last, scan_scope_list( ((PLpgSQL_stmt_forc *) stmt)->body, scopes ));
+			break;
+
+		case PLPGSQL_STMT_DYNFORS:
+			last = Max( last, scan_scope_list( ((PLpgSQL_stmt_dynfors *) stmt)->body, scopes ));
+			break;
+
+#if (PG_VERSION_NUM >= 90100)
+		case PLPGSQL_STMT_FOREACH_A:
+			last = Max( last, scan_scope_list( ((PLpgSQL_stmt_foreach_a *) stmt)->body, scopes ));
+			break;
+#endif
+
+		default:
+			break;
+	}
+
+	return( last );
+}
+
+static int
+scan_scope_list(List *stmts, var_scope *scopes)
+{
+	ListCell   *lc;
+	int			last = 0;
+
+	foreach( lc, stmts )
+		last = Max( last, scan_scopes( (PLpgSQL_stmt *) lfirst( lc ), scopes ));
+
+	return( last );
+}
+
+#if (PG_VERSION_NUM >= 120000)
+/* ------------------------------------------------------------------
+ * fetchLoopMap()
+ *
+ *   Walks the statement tree to find, for each statement that runs a
+ *   query (including a FOR loop over one), the innermost loop around
+ *   it, if any.  A query that runs once per iteration of a loop is the
+ *   classic N+1 problem: see pldbg_get_loop_queries().
+ */
+static loop_map *
+fetchLoopMap(PLpgSQL_function *func)
+{
+	loop_map   *map = (loop_map *) palloc( sizeof( loop_map ));
+
+	map->loopLines  = (int *) palloc0( sizeof( int ) * ( func->nstatements + 1 ));
+	map->hasQueries = (bool *) palloc0( sizeof( bool ) * ( func->nstatements + 1 ));
+
+	if( func->action != NULL )
+		scan_loops( (PLpgSQL_stmt *) func->action, NULL, map );
+
+	return( map );
+}
+
+/* ------------------------------------------------------------------
+ * scan_loops()
+ *
+ *   Records the innermost loop around the given statement (and the
+ *   statements nested inside of it), if the statement runs a query.
+ *   loop is the innermost loop we're in, or NULL.
+ */
+static void
+scan_loops(PLpgSQL_stmt *stmt, PLpgSQL_stmt *loop, loop_map *map)
+{
+	switch( stmt->cmd_type )
+	{
+		case PLPGSQL_STMT_EXECSQL:
+		case PLPGSQL_STMT_DYNEXECUTE:
+		case PLPGSQL_STMT_PERFORM:
+		case PLPGSQL_STMT_RETURN_QUERY:
+		case PLPGSQL_STMT_OPEN:
+			if( loop != NULL )
+			{
+				map->loopLines[stmt->stmtid]  = loop->lineno;
+				map->hasQueries[loop->stmtid] = TRUE;
+			}
+			break;
+
+		case PLPGSQL_STMT_BLOCK:
+		{
+			PLpgSQL_stmt_block *block = (PLpgSQL_stmt_block *) stmt;
+
+			scan_loop_list( block->body, loop, map );
+
+			if( block->exceptions != NULL )
+			{
+				ListCell   *lc;
+
+				foreach( lc, block->exceptions->exc_list )
+					scan_loop_list( ((PLpgSQL_exception *) lfirst( lc ))->action, loop, map );
+			}
+			break;
+		}
+
+		case PLPGSQL_STMT_IF:
+		{
+			PLpgSQL_stmt_if *ifStmt = (PLpgSQL_stmt_if *) stmt;
+			ListCell		*lc;
+
+			scan_loop_list( ifStmt->then_body, loop, map );
+			foreach( lc, ifStmt->elsif_list )
+				scan_loop_list( ((PLpgSQL_if_elsif *) lfirst( lc ))->stmts, loop, map );
+			scan_loop_list( ifStmt->else_body, loop, map );
+			break;
+		}
+
+		case PLPGSQL_STMT_CASE:
+		{
+			PLpgSQL_stmt_case *caseStmt = (PLpgSQL_stmt_case *) stmt;
+			ListCell		  *lc;
+
+			foreach( lc, caseStmt->case_when_list )
+				scan_loop_list( ((PLpgSQL_case_when *) lfirst( lc ))->stmts, loop, map );
+			scan_loop_list( caseStmt->else_stmts, loop, map );
+			break;
+		}
+
+		case PLPGSQL_STMT_LOOP:
+			scan_loop_list( ((PLpgSQL_stmt_loop *) stmt)->body, stmt, map );
+			break;
+
+		case PLPGSQL_STMT_WHILE:
+			scan_loop_list( ((PLpgSQL_stmt_while *) stmt)->body, stmt, map );
+			break;
+
+		case PLPGSQL_STMT_FORI:
+			scan_loop_list( ((PLpgSQL_stmt_fori *) stmt)->body, stmt, map );
+			break;
+
+		case PLPGSQL_STMT_FOREACH_A:
+			scan_loop_list( ((PLpgSQL_stmt_foreach_a *) stmt)->body, stmt, map );
+			break;
+
+		/* These run a query of their own, as well as being loops */
+		case PLPGSQL_STMT_FORS:
+		case PLPGSQL_STMT_FORC:
+		case PLPGSQL_STMT_DYNFORS:
+			if( loop != NULL )
+			{
+				map->loopLines[stmt->stmtid]  = loop->lineno;
+				map->hasQueries[loop->stmtid] = TRUE;
+			}
+
+			if( stmt->cmd_type == PLPGSQL_STMT_FORS )
+				scan_loop_list( ((PLpgSQL_stmt_fors *) stmt)->body, stmt, map );
+			else if( stmt->cmd_type == PLPGSQL_STMT_FORC )
+				scan_loop_list( ((PLpgSQL_stmt_forc *) stmt)->body, stmt, map );
+			else
+				scan_loop_list( ((PLpgSQL_stmt_dynfors *) stmt)->body, stmt, map );
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void
+scan_loop_list(List *stmts, PLpgSQL_stmt *loop, loop_map *map)
+{
+	ListCell   *lc;
+
+	foreach( lc, stmts )
+		scan_loops( (PLpgSQL_stmt *) lfirst( lc ), loop, map );
+}
+#endif
+
+/* ------------------------------------------------------------------
+ * fetchArgNames()
+ *
+ *   This function returns the name of each argument for the given
+ *   function or procedure. If the function/procedure does not have
+ *	 named arguments, this function returns NULL
+ *
+ *	 The argument names are returned as an array of string pointers
+ */
+static char **
 fetchArgNames(PLpgSQL_function *func, int *nameCount)
 {
 #if INCLUDE_PACKAGE_SUPPORT && (PG_VERSION_NUM >= 90600)
@@ -917,25 +1905,17 @@ fetchArgNames(PLpgSQL_function *func, int *nameCount)
 static char *
 get_text_val(PLpgSQL_var *var, char **name, char **type)
 {
-	HeapTuple	       typeTup;
-	Form_pg_type       typeStruct;
-	FmgrInfo	       finfo_output;
+	type_io_cache	*  typeIO;
 	char            *  text_value = NULL;
 
 	/* Find the output function for this data type */
-	typeTup = SearchSysCache( TYPEOID, ObjectIdGetDatum( var->datatype->typoid ), 0, 0, 0 );
+	typeIO = get_type_io( var->datatype->typoid );
 
-	if( !HeapTupleIsValid( typeTup ))
+	if( typeIO == NULL )
 		return( NULL );
 
-	typeStruct = (Form_pg_type)GETSTRUCT( typeTup );
-
 	/* Now invoke the output function to convert the variable into a null-terminated string */
-	fmgr_info( typeStruct->typoutput, &finfo_output );
-
-	text_value = DatumGetCString( FunctionCall3( &finfo_output, var->value, ObjectIdGetDatum(typeStruct->typelem), Int32GetDatum(-1)));
-
-	ReleaseSysCache( typeTup );
+	text_value = DatumGetCString( FunctionCall3( &typeIO->output, var->value, ObjectIdGetDatum(typeIO->typelem), Int32GetDatum(-1)));
 
 	if( name )
 		*name = var->refname;
@@ -946,6 +1926,122 @@ get_text_val(PLpgSQL_var *var, char **name, char **type)
 	return( text_value );
 }
 
+/* ------------------------------------------------------------------
+ * get_binary_val()
+ *
+ *   Returns the value of the given variable in its type's binary
+ *   (typsend) format, or NULL if the type doesn't have a send function.
+ */
+static bytea *
+get_binary_val(PLpgSQL_var *var)
+{
+	type_io_cache	*typeIO = get_type_io( var->datatype->typoid );
+
+	if( typeIO == NULL || !typeIO->hasSend )
+		return( NULL );
+
+	return( SendFunctionCall( &typeIO->send, var->value ));
+}
+
+/* ------------------------------------------------------------------
+ * get_type_io()
+ *
+ *   Returns the I/O cache entry for the given type, (re)building it if
+ *   this is the first time we've seen the type or if its pg_type row
+ *   has changed since.  Returns NULL if the type doesn't exist.
+ */
+static type_io_cache *
+get_type_io(Oid typoid)
+{
+	type_io_cache * entry;
+	HeapTuple		typeTup;
+	Form_pg_type	typeStruct;
+	bool			found;
+
+	if( typeIOHash == NULL )
+	{
+		HASHCTL	ctl = {0};
+
+		ctl.keysize   = sizeof( Oid );
+		ctl.entrysize = sizeof( type_io_cache );
+		ctl.hash      = tag_hash;
+
+		typeIOHash = hash_create( "pldebugger type I/O cache", 32, &ctl, HASH_ELEM | HASH_FUNCTION );
+
+		CacheRegisterSyscacheCallback( TYPEOID, typeIOInvalidated, (Datum) 0 );
+	}
+
+	entry = (type_io_cache *) hash_search( typeIOHash, &typoid, HASH_ENTER, &found );
+
+	if( !found )
+	{
+		entry->valid = FALSE;
+		entry->cxt   = AllocSetContextCreate( TopMemoryContext, "pldebugger type I/O cache", ALLOCSET_SMALL_SIZES );
+	}
+	else if( entry->valid )
+		return( entry );
+
+	entry->valid = FALSE;
+	MemoryContextReset( entry->cxt );
+
+	typeTup = SearchSysCache( TYPEOID, ObjectIdGetDatum( typoid ), 0, 0, 0 );
+
+	if( !HeapTupleIsValid( typeTup ))
+	{
+		MemoryContextDelete( entry->cxt );
+		hash_search( typeIOHash, &typoid, HASH_REMOVE, NULL );
+		return( NULL );
+	}
+
+	typeStruct = (Form_pg_type)GETSTRUCT( typeTup );
+
+	/*
+	 * The FmgrInfo's live as long as the entry does, so any fn_extra
+	 * the I/O functions cache for themselves goes in the entry's own
+	 * context, which we reset whenever the entry is rebuilt.
+	 */
+	entry->hashValue = GetSysCacheHashValue1( TYPEOID, ObjectIdGetDatum( typoid ));
+	entry->typelem   = typeStruct->typelem;
+	entry->hasSend   = OidIsValid( typeStruct->typsend );
+
+	fmgr_info_cxt( typeStruct->typoutput, &entry->output, entry->cxt );
+
+	if( entry->hasSend )
+		fmgr_info_cxt( typeStruct->typsend, &entry->send, entry->cxt );
+
+	ReleaseSysCache( typeTup );
+
+	entry->valid = TRUE;
+
+	return( entry );
+}
+
+/* ------------------------------------------------------------------
+ * typeIOInvalidated()
+ *
+ *   Syscache callback, invoked whenever a pg_type row changes (or the
+ *   whole cache is reset).  We can't do catalog access here, so just
+ *   mark the matching entries invalid and let get_type_io() rebuild
+ *   them on demand.
+ */
+static void
+typeIOInvalidated(Datum arg, int cacheid, uint32 hashValue)
+{
+	HASH_SEQ_STATUS	status;
+	type_io_cache * entry;
+
+	if( typeIOHash == NULL )
+		return;
+
+	hash_seq_init( &status, typeIOHash );
+
+	while(( entry = (type_io_cache *) hash_seq_search( &status )) != NULL )
+	{
+		if( hashValue == 0 || entry->hashValue == hashValue )
+			entry->valid = FALSE;
+	}
+}
+
 static Oid
 plpgsql_get_func_oid(ErrorContextCallback *frame)
 {
@@ -958,6 +2054,12 @@ plpgsql_get_func_oid(ErrorContextCallback *frame)
 static void
 dbg_startup(PLpgSQL_execstate *estate, PLpgSQL_function *func)
 {
+	bool	profiled;
+	bool	timed;
+	bool	linesProfiled;
+	bool	traced;
+	bool	hasActions;
+
 	if( func == NULL )
 	{
 		/*
@@ -966,14 +2068,402 @@ dbg_startup(PLpgSQL_execstate *estate, PLpgSQL_function *func)
 		 */
 		estate->plugin_info = NULL;
 		return;
-	}
+	}
+
+	/*
+	 * Don't stop in (or profile) functions called by a statement that we're
+	 * running on the debugger's behalf (EXPLAIN ANALYZE, or an expression in
+	 * a breakpoint action list) - we're already stopped, or we'd recurse.
+	 */
+	if( runningForDebugger )
+	{
+		estate->plugin_info = NULL;
+		return;
+	}
+
+	profiled = profiler_wants_function( func->fn_oid );
+	timed    = profiler_times_function( func->fn_oid );
+	linesProfiled = profileLines;
+	traced   = ( traceSpans != SPANS_OFF );
+	hasActions = profiler_has_actions( func->fn_oid );
+
+	if( breakpointsForFunction( func->fn_oid ) || per_session_ctx.step_into_next_func )
+	{
+		initialize_plugin_info(estate, func);
+	}
+	else if( profiled || timed || linesProfiled || traced || hasActions )
+	{
+		/*
+		 * Somebody is profiling this function (or has given it breakpoint
+		 * actions) - we only need to tell the profiler about it, there's
+		 * no need to check for breakpoints.
+		 */
+		initialize_plugin_info(estate, func);
+		((dbg_ctx *) estate->plugin_info)->debugging = FALSE;
+	}
+	else
+	{
+		estate->plugin_info = NULL;
+		return;
+	}
+
+	((dbg_ctx *) estate->plugin_info)->profiled = profiled;
+	((dbg_ctx *) estate->plugin_info)->timed    = timed;
+	((dbg_ctx *) estate->plugin_info)->linesProfiled = linesProfiled;
+	((dbg_ctx *) estate->plugin_info)->traced   = traced;
+	((dbg_ctx *) estate->plugin_info)->hasActions = hasActions;
+
+#if (PG_VERSION_NUM >= 120000)
+	if( linesProfiled )
+	{
+		((dbg_ctx *) estate->plugin_info)->stmtStart = (usage_mark *) palloc0( sizeof( usage_mark ) * ( func->nstatements + 1 ));
+		((dbg_ctx *) estate->plugin_info)->loops = fetchLoopMap( func );
+	}
+
+	if( traceSpans == SPANS_STATEMENTS )
+		((dbg_ctx *) estate->plugin_info)->stmtSpans = (span_t *) palloc0( sizeof( span_t ) * ( func->nstatements + 1 ));
+#endif
+
+	if( linesProfiled )
+		profiler_prepare_lines();
+
+	if( timed || linesProfiled )
+		mark_usage( &((dbg_ctx *) estate->plugin_info)->start );
+}
+
+/*
+ * mark_usage()
+ *
+ * Records the time, and the buffers this backend has used and the waits it
+ * has sampled so far, in *mark.
+ */
+static void
+mark_usage( usage_mark *mark )
+{
+	INSTR_TIME_SET_CURRENT( mark->time );
+	mark->blksHit  = pgBufferUsage.shared_blks_hit + pgBufferUsage.local_blks_hit;
+	mark->blksRead = pgBufferUsage.shared_blks_read + pgBufferUsage.local_blks_read;
+	mark->waits.lockUsecs	= waitUsage.lockUsecs;
+	mark->waits.lwlockUsecs = waitUsage.lwlockUsecs;
+	mark->waits.ioUsecs		= waitUsage.ioUsecs;
+}
+
+/*
+ * count_usage()
+ *
+ * Adds one execution of the given line, and what it has used since *mark,
+ * to the line profile. Returns the time it took, in microseconds.
+ */
+static uint64
+count_usage( Oid funcOid, int lineNumber, usage_mark *mark )
+{
+	instr_time	elapsed;
+
+	INSTR_TIME_SET_CURRENT( elapsed );
+	INSTR_TIME_SUBTRACT( elapsed, mark->time );
+
+	profiler_count_line( funcOid, lineNumber, INSTR_TIME_GET_MICROSEC( elapsed ),
+						 pgBufferUsage.shared_blks_hit + pgBufferUsage.local_blks_hit - mark->blksHit,
+						 pgBufferUsage.shared_blks_read + pgBufferUsage.local_blks_read - mark->blksRead );
+
+	return( INSTR_TIME_GET_MICROSEC( elapsed ));
+}
+
+#if (PG_VERSION_NUM >= 120000)
+/*
+ * stmt_plan_source()
+ *
+ * Returns the cached plan source of the SQL statement (or expression) the
+ * given statement runs, or NULL if it doesn't run one, or hasn't been
+ * prepared yet. For a FOR loop over a query, that's the loop's query.
+ */
+static CachedPlanSource *
+stmt_plan_source( PLpgSQL_stmt *stmt )
+{
+	PLpgSQL_expr   *expr;
+	List		   *sources;
+
+	switch( stmt->cmd_type )
+	{
+		case PLPGSQL_STMT_EXECSQL:
+			expr = ((PLpgSQL_stmt_execsql *) stmt)->sqlstmt;
+			break;
+
+		case PLPGSQL_STMT_PERFORM:
+			expr = ((PLpgSQL_stmt_perform *) stmt)->expr;
+			break;
+
+		case PLPGSQL_STMT_ASSIGN:
+			expr = ((PLpgSQL_stmt_assign *) stmt)->expr;
+			break;
+
+		case PLPGSQL_STMT_RETURN:
+			expr = ((PLpgSQL_stmt_return *) stmt)->expr;
+			break;
+
+		case PLPGSQL_STMT_RETURN_NEXT:
+			expr = ((PLpgSQL_stmt_return_next *) stmt)->expr;
+			break;
+
+		case PLPGSQL_STMT_RETURN_QUERY:
+			expr = ((PLpgSQL_stmt_return_query *) stmt)->query;
+			break;
+
+		case PLPGSQL_STMT_OPEN:
+			expr = ((PLpgSQL_stmt_open *) stmt)->query;
+			break;
+
+		case PLPGSQL_STMT_FORS:
+			expr = ((PLpgSQL_stmt_fors *) stmt)->query;
+			break;
+
+		default:
+			expr = NULL;
+			break;
+	}
+
+	if( expr == NULL || expr->plan == NULL )
+		return( NULL );
+
+	sources = SPI_plan_get_plan_sources( expr->plan );
+
+	if( list_length( sources ) != 1 )
+		return( NULL );
+
+	return( (CachedPlanSource *) linitial( sources ));
+}
+
+/*
+ * mark_plan()
+ *
+ * Records where the statement's cached plan counters, and the time this
+ * backend has spent planning, stand in *mark. A statement that hasn't been
+ * prepared yet starts from zero.
+ */
+static void
+mark_plan( PLpgSQL_stmt *stmt, usage_mark *mark )
+{
+	CachedPlanSource *source = stmt_plan_source( stmt );
+
+	mark->planUsecs = planningUsecs;
+
+	if( source == NULL )
+	{
+		mark->planBuilds   = 0;
+		mark->customPlans  = 0;
+		mark->genericPlans = 0;
+		mark->planInvalid  = FALSE;
+		return;
+	}
+
+	mark->planBuilds  = source->generation;
+	mark->customPlans = source->num_custom_plans;
+#if (PG_VERSION_NUM >= 140000)
+	mark->genericPlans = source->num_generic_plans;
+#else
+	mark->genericPlans = 0;
+#endif
+	mark->planInvalid = !source->is_valid || ( source->gplan != NULL && !source->gplan->is_valid );
+}
+
+/*
+ * count_plan()
+ *
+ * Adds what the statement's cached plan did since *mark to the line
+ * profile. The planning time is everything planned while the statement
+ * ran, which for a FOR loop includes the statements in its body.
+ */
+static void
+count_plan( Oid funcOid, PLpgSQL_stmt *stmt, usage_mark *mark )
+{
+	CachedPlanSource *source = stmt_plan_source( stmt );
+	int64			  builds;
+	int64			  customPlans;
+	int64			  genericPlans = 0;
+
+	if( source == NULL )
+		return;
+
+	builds		= source->generation - mark->planBuilds;
+	customPlans = source->num_custom_plans - mark->customPlans;
+#if (PG_VERSION_NUM >= 140000)
+	genericPlans = source->num_generic_plans - mark->genericPlans;
+#endif
+
+	/* The statement was prepared again from scratch: count from zero */
+	if( builds < 0 || customPlans < 0 || genericPlans < 0 )
+	{
+		builds		= source->generation;
+		customPlans = source->num_custom_plans;
+#if (PG_VERSION_NUM >= 140000)
+		genericPlans = source->num_generic_plans;
+#endif
+	}
+
+	profiler_count_plan( funcOid, stmt->lineno, builds, customPlans, genericPlans,
+						 mark->planInvalid, planningUsecs - mark->planUsecs );
+}
+#endif
+
+/*
+ * note_exception()
+ *
+ * An error context callback that we push for each function that goes into
+ * the line profile, so that we can count the errors raised at each line
+ * (including those that an EXCEPTION block catches), or that we report
+ * spans for, so that the spans an error passes through end as failed if
+ * it throws their call out (see spans_fail()).  This gets called for
+ * notices and warnings too, which we ignore.
+ */
+static void
+note_exception( void *arg )
+{
+	PLpgSQL_execstate * estate   = (PLpgSQL_execstate *) arg;
+	dbg_ctx			  * dbg_info = (dbg_ctx *) estate->plugin_info;
+	int					sqlerrcode = geterrcode();
+	int					category = ERRCODE_TO_CATEGORY( sqlerrcode );
+
+	if( dbg_info == NULL )
+		return;
+
+	if( category == ERRCODE_SUCCESSFUL_COMPLETION || category == ERRCODE_WARNING || category == ERRCODE_NO_DATA )
+		return;
+
+	if( dbg_info->traced )
+	{
+		spans_fail( &dbg_info->span, sqlerrcode );
+
+#if (PG_VERSION_NUM >= 120000)
+		if( dbg_info->stmtSpans != NULL && estate->err_stmt != NULL )
+			spans_fail( &dbg_info->stmtSpans[estate->err_stmt->stmtid], sqlerrcode );
+#endif
+	}
+
+	if( dbg_info->linesProfiled && estate->err_stmt != NULL )
+		profiler_count_exception( dbg_info->func->fn_oid, estate->err_stmt->lineno );
+}
+
+/*
+ * caller_span()
+ *
+ * Returns the span that a traced call should be a child of: that of the
+ * statement (or, failing that, the invocation) of the nearest traced
+ * PL/pgSQL function that called it, if any.
+ */
+static span_t *
+caller_span( PLpgSQL_execstate *estate )
+{
+	ErrorContextCallback * frame;
+
+	for( frame = error_context_stack; frame != NULL; frame = frame->previous )
+	{
+		PLpgSQL_execstate * caller;
+		dbg_ctx			  * caller_info;
+
+		if( frame->callback != plugin_funcs.error_callback || frame->arg == estate )
+			continue;
+
+		caller		= (PLpgSQL_execstate *) frame->arg;
+		caller_info = (dbg_ctx *) caller->plugin_info;
+
+		if( caller_info == NULL || !caller_info->traced )
+			continue;
+
+#if (PG_VERSION_NUM >= 120000)
+		if( caller_info->stmtSpans != NULL && caller->err_stmt != NULL &&
+			caller_info->stmtSpans[caller->err_stmt->stmtid].start != 0 )
+			return( &caller_info->stmtSpans[caller->err_stmt->stmtid] );
+#endif
+
+		return( &caller_info->span );
+	}
+
+	return( NULL );
+}
+
+/*
+ * dbg_funcbeg()
+ *
+ * This function is invoked by the PL executor once a function's arguments
+ * have been set up.  If somebody is capturing the workload of this function,
+ * we record the call.  If we're keeping a line profile or reporting spans,
+ * we start noting errors (the PL executor pops our callback, along with its
+ * own, when the function returns).  If we're keeping a line profile, we
+ * start sampling waits, and if we're reporting spans, this call's span
+ * starts now.
+ */
+static void
+dbg_funcbeg(PLpgSQL_execstate *estate, PLpgSQL_function *func)
+{
+	dbg_ctx * dbg_info = (dbg_ctx *) estate->plugin_info;
+
+	if( dbg_info != NULL && ( dbg_info->linesProfiled || dbg_info->traced ))
+	{
+		dbg_info->exceptionCallback.callback = note_exception;
+		dbg_info->exceptionCallback.arg		 = estate;
+		dbg_info->exceptionCallback.previous = error_context_stack;
+		error_context_stack = &dbg_info->exceptionCallback;
+	}
+
+	if( dbg_info != NULL && dbg_info->linesProfiled )
+		profiler_begin_wait_sampling( dbg_info );
+
+	if( dbg_info != NULL && dbg_info->traced )
+	{
+		StringInfoData	args;
+
+		initStringInfo( &args );
+		append_frame_args( &args, estate, func );
+
+#if (PG_VERSION_NUM >= 90200)
+		spans_begin( &dbg_info->span, caller_span( estate ), args.data, "function", func->fn_signature, func->fn_oid, 0 );
+#else
+		spans_begin( &dbg_info->span, caller_span( estate ), args.data, "function", func->fn_name, func->fn_oid, 0 );
+#endif
+
+		pfree( args.data );
+	}
+
+	if( runningForDebugger || !profiler_records_function( func->fn_oid ))
+		return;
+
+	profiler_record_workload( func->fn_oid, append_call_args, estate );
+}
+
+/*
+ * dbg_funcend()
+ *
+ * This function is invoked by the PL executor when a function returns
+ * (but not when it throws an error).  If we're timing the function, we
+ * tell the profiler how long this invocation took, and if we're reporting
+ * spans, this call's span ends.
+ */
+static void
+dbg_funcend(PLpgSQL_execstate *estate, PLpgSQL_function *func)
+{
+	dbg_ctx	  * dbg_info = (dbg_ctx *) estate->plugin_info;
+	instr_time	elapsed;
+
+	if( dbg_info == NULL )
+		return;
 
-	if( !breakpointsForFunction( func->fn_oid ) && !per_session_ctx.step_into_next_func)
-	{
-		estate->plugin_info = NULL;
+	if( dbg_info->traced )
+		spans_end( &dbg_info->span );
+
+	if( !( dbg_info->timed || dbg_info->linesProfiled ))
 		return;
+
+	if( dbg_info->linesProfiled )
+	{
+		count_usage( func->fn_oid, 0, &dbg_info->start );
+		profiler_end_wait_sampling( dbg_info );
 	}
-	initialize_plugin_info(estate, func);
+
+	INSTR_TIME_SET_CURRENT( elapsed );
+	INSTR_TIME_SUBTRACT( elapsed, dbg_info->start.time );
+
+	if( dbg_info->timed )
+		profiler_record_call( func->fn_oid, INSTR_TIME_GET_MICROSEC( elapsed ), describe_call, estate );
 }
 
 static void
@@ -991,6 +2481,16 @@ initialize_plugin_info(PLpgSQL_execstate *estate, PLpgSQL_function *func)
 	 */
 	dbg_info->symbols  		 = NULL;
 	dbg_info->stepping 		 = FALSE;
+	dbg_info->debugging		 = TRUE;
+	dbg_info->profiled		 = FALSE;
+	dbg_info->timed			 = FALSE;
+	dbg_info->linesProfiled	 = FALSE;
+	dbg_info->stmtStart		 = NULL;
+	dbg_info->loops			 = NULL;
+	dbg_info->traced		 = FALSE;
+	dbg_info->span.start	 = 0;
+	dbg_info->stmtSpans		 = NULL;
+	dbg_info->hasActions	 = FALSE;
 	dbg_info->func     		 = func;
 
 	/*
@@ -1335,6 +2835,483 @@ plpgsql_send_cur_line(ErrorContextCallback *frame)
 		);
 }
 
+/*
+ * ---------------------------------------------------------------------
+ * plpgsql_collect_types()
+ *
+ *	Notes the type of each variable that plpgsql_send_vars() would send
+ *	for the given frame (see dbg_note_type()).
+ */
+static void
+plpgsql_collect_types(ErrorContextCallback *frame)
+{
+	PLpgSQL_execstate *estate = (PLpgSQL_execstate *) frame->arg;
+	int			i;
+#if INCLUDE_PACKAGE_SUPPORT
+	dbg_ctx	   *dbg_info = (dbg_ctx *) estate->plugin_info;
+#endif
+
+	for( i = 0; i < estate->ndatums; i++ )
+	{
+		PLpgSQL_var *var = (PLpgSQL_var *) estate->datums[i];
+
+		if( !is_var_visible( estate, i ))
+			continue;
+
+		if( var->dtype != PLPGSQL_DTYPE_VAR
+#if (PG_VERSION_NUM >= 110000)
+			&& var->dtype != PLPGSQL_DTYPE_PROMISE
+#endif
+			)
+			continue;
+
+		if( var->datatype )
+			dbg_note_type( var->datatype->typoid, var->datatype->atttypmod );
+	}
+
+#if INCLUDE_PACKAGE_SUPPORT
+	if( dbg_info->package != NULL )
+	{
+		PLpgSQL_package *package = dbg_info->package;
+
+		for( i = 0; i < package->ndatums; i++ )
+		{
+			PLpgSQL_var *var = (PLpgSQL_var *) package->datums[i];
+
+			if( var->dtype == PLPGSQL_DTYPE_VAR && var->datatype )
+				dbg_note_type( var->datatype->typoid, var->datatype->atttypmod );
+		}
+	}
+#endif
+}
+
+#if (PG_VERSION_NUM >= 140000) && !defined(INCLUDE_PACKAGE_SUPPORT)
+/*
+ * ---------------------------------------------------------------------
+ * save_plan_counters()
+ * restore_plan_counters()
+ *
+ *	Save and put back the counters that GetCachedPlan() bumps on a plan
+ *	source, along with this backend's planning time (see planningUsecs).
+ */
+static void
+save_plan_counters(CachedPlanSource *plansource, plan_counters *saved)
+{
+	saved->generation		= plansource->generation;
+	saved->numCustomPlans	= plansource->num_custom_plans;
+	saved->numGenericPlans	= plansource->num_generic_plans;
+	saved->totalCustomCost	= plansource->total_custom_cost;
+	saved->planningUsecs	= planningUsecs;
+}
+
+static void
+restore_plan_counters(CachedPlanSource *plansource, plan_counters *saved)
+{
+	plansource->generation		  = saved->generation;
+	plansource->num_custom_plans  = saved->numCustomPlans;
+	plansource->num_generic_plans = saved->numGenericPlans;
+	plansource->total_custom_cost = saved->totalCustomCost;
+	planningUsecs				  = saved->planningUsecs;
+}
+#endif
+
+/*
+ * ---------------------------------------------------------------------
+ * plpgsql_explain_current()
+ *
+ *	Sends the debugger client EXPLAIN output for the SQL statement that
+ *	the given frame is about to execute, planned the way PL/pgSQL would
+ *	plan it right now: through the statement's plan cache entry, with the
+ *	frame's current variable values as parameters.  The output starts with
+ *	a line that says whether we got a generic or a custom plan and how many
+ *	times the statement has been planned so far.
+ *
+ *	With analyze, the statement is actually executed, inside a
+ *	subtransaction that we always roll back.  Note that asking for a plan
+ *	counts as a planning cycle as far as the plan cache is concerned (a
+ *	custom plan is built and thrown away, just as an execution would).
+ */
+static void
+plpgsql_explain_current(ErrorContextCallback *frame, bool analyze)
+{
+#if (PG_VERSION_NUM >= 140000) && !defined(INCLUDE_PACKAGE_SUPPORT)
+	PLpgSQL_execstate *estate = (PLpgSQL_execstate *) frame->arg;
+	PLpgSQL_stmt   *stmt = estate->err_stmt;
+	PLpgSQL_expr   *expr = NULL;
+	ParamListInfo	paramLI = NULL;
+	void		   *saveSetupArg = NULL;
+	MemoryContext	oldcontext = CurrentMemoryContext;
+	ResourceOwner	oldowner = CurrentResourceOwner;
+	StringInfoData	result;
+	ListCell	   *lc;
+	CachedPlanSource *volatile current = NULL;
+	plan_counters  *saved = (plan_counters *) palloc( sizeof( plan_counters ));
+
+	switch( stmt->cmd_type )
+	{
+		case PLPGSQL_STMT_EXECSQL:
+			expr = ((PLpgSQL_stmt_execsql *) stmt)->sqlstmt;
+			break;
+		case PLPGSQL_STMT_PERFORM:
+			expr = ((PLpgSQL_stmt_perform *) stmt)->expr;
+			break;
+		case PLPGSQL_STMT_ASSIGN:
+			expr = ((PLpgSQL_stmt_assign *) stmt)->expr;
+			break;
+		case PLPGSQL_STMT_FORS:
+			expr = ((PLpgSQL_stmt_fors *) stmt)->query;
+			break;
+		case PLPGSQL_STMT_RETURN_QUERY:
+			expr = ((PLpgSQL_stmt_return_query *) stmt)->query;
+			break;
+		default:
+			break;
+	}
+
+	if( expr == NULL )
+	{
+		dbg_send( "%s", "the current statement does not run a static SQL query" );
+		return;
+	}
+
+	if( expr->plan == NULL )
+	{
+		dbg_send( "%s", "the current statement has not been planned yet" );
+		return;
+	}
+
+	/*
+	 * This is what setup_param_list() in pl_exec.c does: the frame's
+	 * ParamListInfo fetches the current value of each variable the
+	 * expression refers to.
+	 */
+	if( expr->paramnos )
+	{
+		paramLI = estate->paramLI;
+		saveSetupArg = paramLI->parserSetupArg;
+		paramLI->parserSetupArg = (void *) expr;
+		expr->func = estate->func;
+	}
+
+	initStringInfo( &result );
+
+	BeginInternalSubTransaction( NULL );
+	MemoryContextSwitchTo( oldcontext );
+	runningForDebugger = TRUE;
+
+	PG_TRY();
+	{
+		foreach( lc, SPI_plan_get_plan_sources( expr->plan ))
+		{
+			CachedPlanSource *plansource = (CachedPlanSource *) lfirst( lc );
+			int			customPlans  = plansource->num_custom_plans;
+			int			genericPlans = (int) plansource->num_generic_plans;
+			int			generation   = plansource->generation;
+			CachedPlan *cplan;
+			ExplainState *es;
+			ListCell   *lc2;
+
+			/*
+			 * GetCachedPlan() counts the plan it hands us as if the
+			 * statement had run, which would sway the choice between custom
+			 * and generic plans (and show up in the line profile), so we
+			 * put the counters back afterwards.
+			 */
+			save_plan_counters( plansource, saved );
+			current = plansource;
+
+			cplan = GetCachedPlan( plansource, paramLI, CurrentResourceOwner, NULL );
+
+			appendStringInfo( &result, "%s plan (planned %d times: %d custom, %d generic)\n",
+							  cplan == plansource->gplan ? "Generic" : "Custom",
+							  generation, customPlans, genericPlans );
+
+			es = NewExplainState();
+			es->analyze = analyze;
+			es->timing  = analyze;
+			es->summary = analyze;
+
+			ExplainBeginOutput( es );
+
+			foreach( lc2, cplan->stmt_list )
+			{
+				PlannedStmt *pstmt = lfirst_node( PlannedStmt, lc2 );
+
+				if( pstmt->commandType == CMD_UTILITY )
+				{
+					appendStringInfoString( es->str, "Utility statement\n" );
+					continue;
+				}
+
+				PushActiveSnapshot( GetTransactionSnapshot());
+				ExplainOnePlan( pstmt, NULL, es, plansource->query_string, paramLI, NULL, NULL,
+#if (PG_VERSION_NUM >= 170000)
+								NULL,
+#endif
+								NULL );
+				PopActiveSnapshot();
+			}
+
+			ExplainEndOutput( es );
+
+			appendBinaryStringInfo( &result, es->str->data, es->str->len );
+
+			ReleaseCachedPlan( cplan, CurrentResourceOwner );
+
+			restore_plan_counters( plansource, saved );
+			current = NULL;
+		}
+
+		runningForDebugger = FALSE;
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo( oldcontext );
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		runningForDebugger = FALSE;
+
+		MemoryContextSwitchTo( oldcontext );
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo( oldcontext );
+		CurrentResourceOwner = oldowner;
+
+		if( current != NULL )
+			restore_plan_counters( current, saved );
+
+		resetStringInfo( &result );
+		appendStringInfo( &result, "ERROR:  %s", edata->message );
+		FreeErrorData( edata );
+	}
+	PG_END_TRY();
+
+	if( paramLI )
+		paramLI->parserSetupArg = saveSetupArg;
+
+	dbg_send( "%s", result.data );
+	pfree( result.data );
+	pfree( saved );
+#else
+	dbg_send( "%s", "EXPLAIN of the current statement requires PostgreSQL 14 or later" );
+#endif
+}
+
+/*
+ * ---------------------------------------------------------------------
+ * plpgsql_query_in_target()
+ *
+ *	Runs a query for the debugger client in our own transaction, so that
+ *	it sees what the target sees: its temporary tables, the rows it has
+ *	changed but not committed, and its session settings.  The query runs
+ *	read-only, in a subtransaction that we always roll back, and it has to
+ *	be a single SELECT (see check_target_query()).  None of that stops a
+ *	function that the query calls from reading files or talking to other
+ *	servers, which is why plugin_debugger.c only lets a proxy that runs as
+ *	our current role (or as a superuser) ask for a query at all.
+ *
+ *	We send each row as "r" followed by the row as JSON, fetching them
+ *	QueryBatchRows at a time, and stop once we've sent maxRows rows or
+ *	maxBytes bytes of them.  Then we send "t" and the number of rows sent
+ *	if we stopped early, or "x", the SQLSTATE and the message (separated by
+ *	a colon) if the query failed, and an empty string to end the list.
+ */
+#define QueryBatchRows	100
+
+static void
+plpgsql_query_in_target(ErrorContextCallback *frame, const char *sql, int maxRows, int maxBytes)
+{
+	MemoryContext	oldcontext = CurrentMemoryContext;
+	ResourceOwner	oldowner = CurrentResourceOwner;
+	bool			saveReadOnly = XactReadOnly;
+	sigjmp_buf	   *saveExceptionStack = PG_exception_stack;
+	ErrorContextCallback *saveContextStack = error_context_stack;
+	errorHandlerCtx	saveClientLost = client_lost;
+	volatile int	rows = 0;
+	volatile int	bytes = 0;
+	volatile bool	truncated = FALSE;
+	ErrorData	   *edata = NULL;
+
+	BeginInternalSubTransaction( NULL );
+	MemoryContextSwitchTo( oldcontext );
+	runningForDebugger = TRUE;
+	XactReadOnly = TRUE;
+
+	/*
+	 * If we lose the proxy while we're sending rows, we have to get out of
+	 * the subtransaction before we let dbg_newstmt() deal with that.
+	 */
+	if( sigsetjmp( client_lost.m_savepoint, 1 ) != 0 )
+	{
+		client_lost = saveClientLost;
+		PG_exception_stack = saveExceptionStack;
+		error_context_stack = saveContextStack;
+
+		runningForDebugger = FALSE;
+		XactReadOnly = saveReadOnly;
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo( oldcontext );
+		CurrentResourceOwner = oldowner;
+
+		siglongjmp( client_lost.m_savepoint, 1 );
+	}
+
+	PG_TRY();
+	{
+		Portal		portal;
+
+		check_target_query( sql );
+
+		if( SPI_connect() != SPI_OK_CONNECT )
+			elog( ERROR, "SPI_connect failed" );
+
+		portal = SPI_cursor_open_with_args( NULL, sql, 0, NULL, NULL, NULL, true, 0 );
+
+		while( !truncated )
+		{
+			uint64		i;
+			TupleDesc	tupdesc;
+
+			SPI_cursor_fetch( portal, true, QueryBatchRows );
+
+			if( SPI_processed == 0 )
+				break;
+
+			/* row_to_json() has to be able to look up the (anonymous) row type */
+			tupdesc = BlessTupleDesc( SPI_tuptable->tupdesc );
+
+			for( i = 0; i < SPI_processed; i++ )
+			{
+				Datum	rowDatum = heap_copy_tuple_as_datum( SPI_tuptable->vals[i], tupdesc );
+				char   *row = TextDatumGetCString( DirectFunctionCall1( row_to_json, rowDatum ));
+				int		len = strlen( row );
+
+				pfree( DatumGetPointer( rowDatum ));
+
+				if( rows >= maxRows || bytes + len > maxBytes )
+				{
+					truncated = TRUE;
+					break;
+				}
+
+				dbg_send( "r%s", row );
+				rows++;
+				bytes += len;
+
+				pfree( row );
+			}
+
+			SPI_freetuptable( SPI_tuptable );
+		}
+
+		SPI_cursor_close( portal );
+		SPI_finish();
+
+		runningForDebugger = FALSE;
+		XactReadOnly = saveReadOnly;
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo( oldcontext );
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		runningForDebugger = FALSE;
+		XactReadOnly = saveReadOnly;
+
+		MemoryContextSwitchTo( oldcontext );
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo( oldcontext );
+		CurrentResourceOwner = oldowner;
+	}
+	PG_END_TRY();
+
+	client_lost = saveClientLost;
+
+	if( edata != NULL )
+	{
+		dbg_send( "x%s:%s", unpack_sql_state( edata->sqlerrcode ), edata->message );
+		FreeErrorData( edata );
+	}
+	else if( truncated )
+		dbg_send( "t%d", rows );
+
+	dbg_send( "%s", "" );	/* empty string indicates end of list */
+}
+
+/*
+ * ---------------------------------------------------------------------
+ * check_target_query()
+ *
+ *	Throws an error unless the given text is a single SELECT that only
+ *	reads: no SELECT INTO, no FOR UPDATE/SHARE, and no data-modifying
+ *	statement in its WITH clause (the parser only allows those at the top
+ *	level).  UNION and friends are fine.  We check the raw parse tree
+ *	rather than pasting the text into a query of our own, so that nothing
+ *	in the text can change what we run.
+ */
+static void
+check_target_query( const char *sql )
+{
+	List	   *parsetree = pg_parse_query( sql );
+	Node	   *stmt;
+	SelectStmt *select;
+	ListCell   *cell;
+
+	if( list_length( parsetree ) != 1 )
+		ereport( ERROR,
+				 ( errcode( ERRCODE_FEATURE_NOT_SUPPORTED ),
+				   errmsg( "a query in the target must be a single SELECT" )));
+
+#if (PG_VERSION_NUM >= 100000)
+	stmt = ((RawStmt *) linitial( parsetree ))->stmt;
+#else
+	stmt = (Node *) linitial( parsetree );
+#endif
+
+	if( !IsA( stmt, SelectStmt ))
+		ereport( ERROR,
+				 ( errcode( ERRCODE_FEATURE_NOT_SUPPORTED ),
+				   errmsg( "a query in the target must be a single SELECT" )));
+
+	select = (SelectStmt *) stmt;
+
+	if( select->lockingClause != NIL )
+		ereport( ERROR,
+				 ( errcode( ERRCODE_FEATURE_NOT_SUPPORTED ),
+				   errmsg( "a query in the target cannot use INTO or FOR UPDATE/SHARE" )));
+
+	/* Of a UNION (and so on), only the leftmost SELECT can have an INTO */
+	for( select = (SelectStmt *) stmt; select->op != SETOP_NONE; select = select->larg )
+		;
+
+	if( select->intoClause != NULL )
+		ereport( ERROR,
+				 ( errcode( ERRCODE_FEATURE_NOT_SUPPORTED ),
+				   errmsg( "a query in the target cannot use INTO or FOR UPDATE/SHARE" )));
+
+	select = (SelectStmt *) stmt;
+
+	if( select->withClause != NULL )
+	{
+		foreach( cell, select->withClause->ctes )
+		{
+			CommonTableExpr	*cte = (CommonTableExpr *) lfirst( cell );
+
+			if( !IsA( cte->ctequery, SelectStmt ))
+				ereport( ERROR,
+						 ( errcode( ERRCODE_FEATURE_NOT_SUPPORTED ),
+						   errmsg( "a query in the target cannot have a data-modifying statement in WITH" )));
+		}
+	}
+}
+
 /*
  * ---------------------------------------------------------------------
  * isFirstStmt()
@@ -1395,6 +3372,37 @@ dbg_newstmt(PLpgSQL_execstate *estate, PLpgSQL_stmt *stmt)
 		if( stmt->lineno == -1 )
 			return;
 
+#if (PG_VERSION_NUM >= 120000)
+		if( dbg_info->linesProfiled )
+		{
+			mark_usage( &dbg_info->stmtStart[stmt->stmtid] );
+			mark_plan( stmt, &dbg_info->stmtStart[stmt->stmtid] );
+
+			if( dbg_info->loops->hasQueries[stmt->stmtid] )
+				profiler_count_loop_entry( dbg_info->func->fn_oid, stmt->lineno );
+		}
+
+		if( dbg_info->stmtSpans != NULL )
+			spans_begin( &dbg_info->stmtSpans[stmt->stmtid], &dbg_info->span, NULL,
+						 "statement", dbg_info->func->fn_signature, dbg_info->func->fn_oid, stmt->lineno );
+#endif
+
+		if( dbg_info->profiled )
+			profiler_sample_line( dbg_info->func->fn_oid, stmt->lineno, profile_value, frame );
+
+		/*
+		 * An action list that ends in 'continue' means that a breakpoint at
+		 * this line doesn't stop us (though we still stop here if we're
+		 * stepping).
+		 */
+		if( dbg_info->hasActions &&
+			profiler_run_actions( dbg_info->func->fn_oid, stmt->lineno, profile_value, describe_call, evaluate_action, frame ) &&
+			!dbg_info->stepping )
+			return;
+
+		if( !dbg_info->debugging )
+			return;
+
 		/*
 		 * Now set up an error handler context so we can intercept any
 		 * networking errors (errors communicating with the proxy).
@@ -1418,9 +3426,17 @@ dbg_newstmt(PLpgSQL_execstate *estate, PLpgSQL_stmt *stmt)
 			 *		  that's not the behavior you're looking for, you can
 			 *		  drop the breakpoint, or call free_function_breakpoints()
 			 *		  here to get rid of all breakpoints in this backend.
+			 *
+			 *		  The exception is pldebugger.reattach_timeout: if that's
+			 *		  set, we stay paused for a while in case a new proxy
+			 *		  reattaches.  If one does, we're still stepping, so we
+			 *		  fall through and report this line to the new proxy.
 			 */
-			per_session_ctx.client_w = 0; 		/* No client connection */
-			dbg_info->stepping 		 = FALSE; 	/* No longer stepping   */
+			if( !reattach_to_proxy())
+			{
+				per_session_ctx.client_w = 0; 		/* No client connection */
+				dbg_info->stepping 		 = FALSE; 	/* No longer stepping   */
+			}
 		}
 
 		if(( dbg_info->stepping ) || breakAtThisLine( &breakpoint, &breakpointScope, dbg_info->func->fn_oid, isFirstStmt( stmt, dbg_info->func ) ? -1 : stmt->lineno ))
@@ -1483,6 +3499,16 @@ dbg_newstmt(PLpgSQL_execstate *estate, PLpgSQL_stmt *stmt)
 
 		if( dbg_info->stepping )
 		{
+			/*
+			 * In the middle of a multi-step command, we only stop at the end
+			 * of it (or at a breakpoint).
+			 */
+			if( per_session_ctx.steps_left > 0 &&
+				skipStep( dbg_info->func->fn_oid, stmt->lineno,
+						  breakpoint != NULL ||
+						  breakAtThisLine( &breakpoint, &breakpointScope, dbg_info->func->fn_oid, isFirstStmt( stmt, dbg_info->func ) ? -1 : stmt->lineno )))
+				return;
+
 			/*
 			 * Make sure that we have all of the debug info that we need in this stack frame
 			 */
@@ -1500,6 +3526,49 @@ dbg_newstmt(PLpgSQL_execstate *estate, PLpgSQL_stmt *stmt)
 	}
 }
 
+/*
+ * dbg_endstmt()
+ *
+ * This function is invoked by the PL executor after it runs each statement
+ * (but not if the statement throws an error).  If we're keeping a line
+ * profile, we add the time the statement took to it (and, for a query in a
+ * loop, to the loop's count of queries, and for a query with a cached plan,
+ * what the plan did, along with any waits sampled while it ran), and if
+ * we're reporting statement spans, the statement's span ends.
+ */
+static void
+dbg_endstmt(PLpgSQL_execstate *estate, PLpgSQL_stmt *stmt)
+{
+#if (PG_VERSION_NUM >= 120000)
+	dbg_ctx	  * dbg_info = (dbg_ctx *) estate->plugin_info;
+	uint64		usecs;
+
+	if( dbg_info == NULL || stmt->lineno == -1 )
+		return;
+
+	if( dbg_info->stmtSpans != NULL )
+		spans_end( &dbg_info->stmtSpans[stmt->stmtid] );
+
+	if( !dbg_info->linesProfiled )
+		return;
+
+	if( INSTR_TIME_IS_ZERO( dbg_info->stmtStart[stmt->stmtid].time ))
+		return;
+
+	usecs = count_usage( dbg_info->func->fn_oid, stmt->lineno, &dbg_info->stmtStart[stmt->stmtid] );
+
+	if( dbg_info->loops->loopLines[stmt->stmtid] != 0 )
+		profiler_count_loop_query( dbg_info->func->fn_oid, dbg_info->loops->loopLines[stmt->stmtid], stmt->lineno, usecs );
+
+	count_plan( dbg_info->func->fn_oid, stmt, &dbg_info->stmtStart[stmt->stmtid] );
+
+	profiler_count_waits( dbg_info->func->fn_oid, stmt->lineno,
+						  waitUsage.lockUsecs - dbg_info->stmtStart[stmt->stmtid].waits.lockUsecs,
+						  waitUsage.lwlockUsecs - dbg_info->stmtStart[stmt->stmtid].waits.lwlockUsecs,
+						  waitUsage.ioUsecs - dbg_info->stmtStart[stmt->stmtid].waits.ioUsecs );
+#endif
+}
+
 /* ---------------------------------------------------------------------
  *	datumIsNull()
  *
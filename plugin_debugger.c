@@ -12,7 +12,9 @@
 #include "postgres.h"
 
 #include <stdio.h>
+#include <ctype.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
 #include <setjmp.h>
@@ -24,9 +26,14 @@
 	#include <netinet/in.h>
 	#include <sys/socket.h>
 	#include <arpa/inet.h>
+	#ifdef HAVE_SYS_SELECT_H
+		#include <sys/select.h>
+	#endif
 #endif
 
 #include "access/xact.h"
+#include "access/xlog.h"
+#include "commands/async.h"
 #include "lib/stringinfo.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
@@ -36,15 +43,25 @@
 #include "parser/parser.h"
 #include "parser/parse_func.h"
 #include "globalbp.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
 #include "storage/proc.h"							/* For MyProc		   */
 #include "storage/procarray.h"						/* For BackendPidGetProc */
 #include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 #include "miscadmin.h"
 
 #include "pldebugger.h"
 #include "dbgcomm.h"
+#include "profiler.h"
+#include "sessions.h"
+#include "spans.h"
 
 /* Include header for GETSTRUCT */
 #if (PG_VERSION_NUM >= 90300)
@@ -95,8 +112,28 @@ typedef struct
 #else
 	LWLockId	lockid;
 #endif
+	pg_atomic_uint32 armedGeneration;	/* Bumped by pldbg_disarm_all() */
 } GlobalBreakpointData;
 
+/*
+ * BreakpointHitEvent
+ *
+ *	When pldebugger.notify_hits is on, a target that hits a breakpoint hands
+ *	one of these to a short-lived background worker (in bgw_extra), and the
+ *	worker publishes it with NOTIFY.  We can't NOTIFY from the target itself
+ *	because notifications are only delivered when the sending transaction
+ *	commits, and the target is sitting in the middle of its transaction.
+ */
+typedef struct
+{
+	Oid			databaseId;		/* database the target is connected to	*/
+	int			proxyPid;		/* proxy waiting for us, or -1 if local	*/
+	int			targetPid;		/* process id of the target				*/
+	Oid			functionId;		/* function that hit the breakpoint		*/
+	int			lineNumber;		/* line number of the breakpoint		*/
+	int			backendId;		/* slot to give to pldbg_attach_to_port() */
+} BreakpointHitEvent;
+
 /**********************************************************************
  * Local (static) variables
  **********************************************************************/
@@ -118,11 +155,112 @@ static debugger_language_t *debugger_languages[] = {
 static shmem_request_hook_type prev_shmem_request_hook = NULL;
 #endif
 
+/*
+ * Read-only observers of the current debugging session.  Observers get the
+ * same stop notifications as the proxy that drives the session, and may
+ * send read-only commands while the target is paused (see
+ * plugin_debugger_main_loop()).
+ */
+#define MAX_OBSERVERS	8
+
+typedef struct
+{
+	int			sock;			/* Connection to the observer's proxy			*/
+	bool		waiting;		/* Has it asked to be told about the next stop?	*/
+	uint32		lastStop;		/* Last stop we've reported to it				*/
+} observer_t;
+
+static observer_t		observers[MAX_OBSERVERS];
+static int				observerCount = 0;
+static uint32			stopCount = 0;		/* Bumped every time we pause	*/
+static StringInfo		stopLine = NULL;	/* Where we're paused, serialized */
+static char			   *stopSnapshot = NULL;	/* Exported at this stop, or NULL */
+
+/*
+ * Replies to read-only commands are rendered once per stop and replayed to
+ * whoever asks for them, so that adding observers doesn't multiply the work
+ * of walking the stack and formatting variables.  While captureBuf is set,
+ * dbg_send() appends to it instead of writing to the socket.
+ */
+typedef struct
+{
+	char		   *command;
+	StringInfoData	reply;
+} cached_reply_t;
+
+static StringInfo		captureBuf = NULL;
+static List			   *replyCache = NIL;
+static MemoryContext	replyCacheCxt = NULL;
+
+/*
+ * The PL stack frames we're paused in, topmost first, so that commands
+ * that address a frame by number don't have to walk error_context_stack
+ * (see getStopFrame()).  Built on first use after each stop.
+ */
+typedef struct
+{
+	ErrorContextCallback *frame;
+	debugger_language_t  *lang;
+} stop_frame_t;
+
+static stop_frame_t	   *stopFrames = NULL;
+static int				stopFrameCount = -1;	/* -1 means not built yet */
+
+/*
+ * Every data type (and typmod) we've described to a proxy, in the order we
+ * first noted it (see dbg_note_type()).  A type that variables declare with
+ * different typmods, like varchar(10) and varchar(20), is described once
+ * for each.  The list only ever grows, so a proxy that has
+ * already seen the first n entries can ask for "T n" and get just the new
+ * ones (see send_types()).
+ */
+typedef struct
+{
+	Oid			typoid;
+	int32		typmod;
+} known_type_key;
+
+static HTAB			   *knownTypeHash = NULL;	/* Membership test for knownTypes */
+static List			   *knownTypes = NIL;		/* Serialized descriptions */
+
+/*
+ * A multi-step command ("n steps:untilLine:trace", see pldbg_step_many())
+ * steps over up to 'steps' statements, but only stops at the last one (or
+ * at untilLine in the function it was given in, or at a breakpoint,
+ * whichever comes first).  per_session_ctx.steps_left counts down to that
+ * stop, and the lines we pass on the way are collected in stepTrace, if
+ * the proxy asked for them.  When we do stop, the proxy gets the usual
+ * location, followed by "steps:line,line,...", where steps includes the
+ * statement we stopped at.
+ */
+#define MAX_STEP_TRACE	1000		/* Lines we remember in a trace */
+
+/*
+ * pldbg_disarm_all() empties the global breakpoint table and bumps the
+ * armed generation. Each backend notices the next time it looks for a
+ * breakpoint, or while it's paused (we check every DISARM_POLL_SECS
+ * seconds, and whenever our latch is set), and drops its own breakpoints
+ * and its proxy. See checkDisarmed().
+ */
+#define DISARM_POLL_SECS	1
+
+static bool				stepReplyPending = FALSE;
+static Oid				stepUntilFunc = InvalidOid;
+static int				stepUntilLine = 0;		/* 0 means no target line */
+static int				stepsTaken = 0;
+static int				stepTraceCount = 0;
+static StringInfo		stepTrace = NULL;		/* NULL if not wanted */
+
+static bool		notifyHits = false;		/* pldebugger.notify_hits */
+static bool		remapBreakpoints = true;	/* pldebugger.remap_breakpoints */
+static int		reattachTimeout = 0;		/* pldebugger.reattach_timeout, in seconds */
+
 /**********************************************************************
  * Function declarations
  **********************************************************************/
 
 void _PG_init( void );				/* initialize this module when we are dynamically loaded	*/
+PGDLLEXPORT void pldbg_notify_worker_main( Datum main_arg );	/* background worker that publishes breakpoint hits */
 
 /**********************************************************************
  * Local (hidden) function prototypes
@@ -133,20 +271,40 @@ static void			 pldebugger_shmem_request( void );
 #endif
 
 static void        * writen( int peer, void * src, size_t len );
-static bool 		 connectAsServer( void );
+static bool 		 connectAsServer( Breakpoint * breakpoint );
 static bool 		 connectAsClient( Breakpoint * breakpoint );
+static uint64		 newSessionToken( void );
+static void			 beginStop( ErrorContextCallback *frame, debugger_language_t *lang );
+static void			 beginStepMany( char *command, Oid funcOid );
+static void			 cancelStepMany( void );
+static void			 sendSnapshot( void );
+static bool			 checkDisarmed( void );
+static void			 clearLocalBreakpoints( void );
+static char		   * waitForCommand( int *observer );
+static void			 handleObserverCommand( int observer, char *command, ErrorContextCallback *frame, debugger_language_t *lang );
+static StringInfo	 cachedReply( char *command, ErrorContextCallback *frame, debugger_language_t *lang );
+static void			 sendCachedReply( char *command, ErrorContextCallback *frame, debugger_language_t *lang );
+static void			 resetReplyCache( void );
+static void			 offerObservers( void );
+static void			 acceptObserver( void );
+static bool			 sendToObserver( int observer, const char *data, size_t len );
+static char		   * readFromObserver( int sock );
+static void			 dropObserver( int observer );
+static void			 closeObservers( void );
 static bool 		 handle_socket_error(void);
 static bool 		 parseBreakpoint( Oid * funcOID, int * lineNumber, char * breakpointString );
 static bool 		 addLocalBreakpoint( Oid funcOID, int lineNo );
 static void			 reserveBreakpoints( void );
 static debugger_language_t *language_of_frame(ErrorContextCallback *frame);
-static char * findSource( Oid oid, HeapTuple * tup );
 
 static void do_deposit(ErrorContextCallback *frame, debugger_language_t *lang,
 					   char *command);
 static void send_breakpoints(Oid funcOid);
 static void send_stack(void);
+static void send_types(char *command, ErrorContextCallback *frame, debugger_language_t *lang);
+static void parseVarFilter(char *command, var_filter *filter);
 static void select_frame(int frameNo, ErrorContextCallback **frame_p, debugger_language_t **lang_p);
+static bool getStopFrame(int frameNo, ErrorContextCallback **frame_p, debugger_language_t **lang_p);
 
 
 /**********************************************************************
@@ -161,12 +319,90 @@ void _PG_init( void )
 	for (i = 0; debugger_languages[i] != NULL; i++)
 		debugger_languages[i]->initialize();
 
+	DefineCustomBoolVariable("pldebugger.remap_breakpoints",
+							 "Moves local breakpoints when the function they are set in is replaced.",
+							 "A breakpoint follows its line of source code to the closest line with "
+							 "the same text, or is dropped if that line is gone.",
+							 &remapBreakpoints,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pldebugger.reattach_timeout",
+							"Sets how long a paused target waits for a debugger to reattach after losing its connection.",
+							"Zero means the target resumes execution as soon as the connection is lost.",
+							&reattachTimeout,
+							0,
+							0, INT_MAX / 1000,
+							PGC_USERSET,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pldebugger.notify_hits",
+							 "Publishes a notification whenever a breakpoint is hit.",
+							 "The notification is sent on channel pldbg_<proxy pid> for global "
+							 "breakpoints and pldbg_local for local breakpoints.",
+							 &notifyHits,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pldebugger.profile",
+							 "Counts how often each line of PL code runs and how long it takes.",
+							 "See pldbg_get_profile().",
+							 &profileLines,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomEnumVariable("pldebugger.trace_spans",
+							 "Reports each invocation of a PL function as a tracing span.",
+							 "With 'statements', each statement in the function is reported "
+							 "as a span as well.",
+							 &traceSpans,
+							 SPANS_OFF,
+							 traceSpansOptions,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomStringVariable("pldebugger.traceparent",
+							   "Sets the trace context (a W3C traceparent) of the spans this session reports.",
+							   "If empty, each outermost PL function call starts a trace of its own.",
+							   &traceParent,
+							   "",
+							   PGC_USERSET,
+							   0,
+							   spans_check_traceparent, NULL, NULL);
+
+	DefineCustomStringVariable("pldebugger.span_destination",
+							   "Sets the file spans are appended to, or unix: and the path of a datagram socket to send them to.",
+							   "A relative file name is relative to the data directory.",
+							   &spanDestination,
+							   "pldebugger_spans.jsonl",
+							   PGC_SUSET,
+							   0,
+							   NULL, NULL, NULL);
+
+#if (PG_VERSION_NUM >= 150000)
+	MarkGUCPrefixReserved("pldebugger");
+#else
+	EmitWarningsOnPlaceholders("pldebugger");
+#endif
+
+	profiler_install_hooks();
+
 #if (PG_VERSION_NUM >= 150000)
 	prev_shmem_request_hook = shmem_request_hook;
 	shmem_request_hook = pldebugger_shmem_request;
 #else
     reserveBreakpoints();
     dbgcomm_reserve();
+    profiler_reserve();
+    sessions_reserve();
 #endif
 }
 
@@ -178,6 +414,8 @@ static void pldebugger_shmem_request( void )
 
 	reserveBreakpoints();
 	dbgcomm_reserve();
+	profiler_reserve();
+	sessions_reserve();
 }
 #endif
 
@@ -210,6 +448,12 @@ Datum pldbg_oid_debug(PG_FUNCTION_ARGS)
 	if( !superuser() && (GetUserId() != userid))
 		ereport( ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), errmsg( "must be owner or superuser to create a breakpoint" )));
 
+	/*
+	 * Act on any pldbg_disarm_all() we haven't seen yet now, so that it
+	 * clears the breakpoints we had before it, and not this one.
+	 */
+	(void) checkDisarmed();
+
 	addLocalBreakpoint( funcOid, -1 );
 
 	PG_RETURN_INT32( 0 );
@@ -359,7 +603,7 @@ void dbg_send( const char *fmt, ... )
 	size_t			remaining;
 	int				sock = per_session_ctx.client_w;
 
-	if( !sock )
+	if( !sock && !captureBuf )
 		return;
 
 	initStringInfo(&result);
@@ -395,6 +639,17 @@ void dbg_send( const char *fmt, ... )
 	data = result.data;
 	remaining = strlen(data);
 
+	if( captureBuf )
+	{
+		/* Rendering a reply for the cache, see cachedReply() */
+		uint32	netVal = htonl( remaining );
+
+		appendBinaryStringInfo( captureBuf, (char *) &netVal, sizeof( netVal ));
+		appendBinaryStringInfo( captureBuf, data, remaining );
+		pfree( result.data );
+		return;
+	}
+
 	sendUInt32(sock, remaining);
 
 	while( remaining > 0 )
@@ -414,6 +669,42 @@ void dbg_send( const char *fmt, ... )
 	pfree(result.data);
 }
 
+/*
+ * ---------------------------------------------------------------------
+ * dbg_send_bytes()
+ *
+ *	Like dbg_send(), but for messages that may contain arbitrary binary
+ *	data: sends header (a null-terminated string) followed by exactly len
+ *	bytes of data, as a single counted message.
+ */
+
+void dbg_send_bytes( const char *header, const char *data, size_t len )
+{
+	int		sock = per_session_ctx.client_w;
+	size_t	headerLen = strlen( header );
+
+	if( captureBuf )
+	{
+		/* Rendering a reply for the cache, see cachedReply() */
+		uint32	netVal = htonl( headerLen + len );
+
+		appendBinaryStringInfo( captureBuf, (char *) &netVal, sizeof( netVal ));
+		appendBinaryStringInfo( captureBuf, header, headerLen );
+		if( len > 0 )
+			appendBinaryStringInfo( captureBuf, data, len );
+		return;
+	}
+
+	if( !sock )
+		return;
+
+	sendUInt32( sock, headerLen + len );
+	writen( sock, (void *) header, headerLen );
+
+	if( len > 0 )
+		writen( sock, (void *) data, len );
+}
+
 
 /*
  * ---------------------------------------------------------------------
@@ -458,7 +749,7 @@ static void dbg_send_src( char * command  )
  *	you are finished with it).
  */
 
-static char * findSource( Oid oid, HeapTuple * tup )
+char * findSource( Oid oid, HeapTuple * tup )
 {
 	bool	isNull;
 
@@ -524,6 +815,7 @@ bool attach_to_proxy( Breakpoint * breakpoint )
 	if( sigsetjmp( client_lost.m_savepoint, 1 ) != 0 )
 	{
 		client_lost = save;
+		sessions_drop_target();
 		return( FALSE );
 	}
 
@@ -534,7 +826,7 @@ bool attach_to_proxy( Breakpoint * breakpoint )
 		 * create a server socket and wait for the proxy to contact
 		 * us.
 		 */
-		result = connectAsServer();
+		result = connectAsServer( breakpoint );
 	}
 	else
 	{
@@ -553,9 +845,100 @@ bool attach_to_proxy( Breakpoint * breakpoint )
 	 */
 
 	client_lost = save;
+
+	if( result )
+	{
+		per_session_ctx.session_token = newSessionToken();
+		cancelStepMany();
+		sessions_set_target( SESSION_ATTACHED, breakpoint->key.functionId, breakpoint->key.lineNumber );
+	}
+	else
+		sessions_drop_target();
+
 	return( result );
 }
 
+/*
+ * ---------------------------------------------------------------------
+ * reattach_to_proxy()
+ *
+ *	The language handlers call this function when the connection to the
+ *	proxy drops while we're paused.  We close the dead connection and, if
+ *	pldebugger.reattach_timeout allows it, wait for a new proxy to present
+ *	our session token (see pldbg_reattach()).  That way a VPN blip doesn't
+ *	cost the user the state that led up to the stop.
+ *
+ *	Returns TRUE if a proxy reattached, in which case the caller should carry
+ *	on as though it had just stopped at the current line.  Returns FALSE if
+ *	nobody showed up in time; the caller should let the target run.
+ */
+
+bool reattach_to_proxy( void )
+{
+	int		sock;
+
+	if( per_session_ctx.client_w )
+		closesocket( per_session_ctx.client_w );
+
+	per_session_ctx.client_w = per_session_ctx.client_r = 0;
+	per_session_ctx.proxy_role = InvalidOid;
+
+	/* Nobody is waiting for the end of a multi-step command any more */
+	cancelStepMany();
+
+	if( reattachTimeout <= 0 || per_session_ctx.session_token == 0 )
+	{
+		closeObservers();
+		sessions_drop_target();
+		return( FALSE );
+	}
+
+	elog( LOG, "lost connection to debugger proxy, waiting %d seconds for a debugger to reattach", reattachTimeout );
+
+	sessions_set_target( SESSION_LISTENING, InvalidOid, 0 );
+
+	sock = dbgcomm_wait_for_reattach( per_session_ctx.session_token, reattachTimeout * 1000, &per_session_ctx.proxy_role );
+
+	if( sock < 0 )
+	{
+		per_session_ctx.session_token = 0;
+		closeObservers();
+		sessions_drop_target();
+		return( FALSE );
+	}
+
+	per_session_ctx.client_w = sock;
+	per_session_ctx.client_r = sock;
+
+	sessions_set_target( SESSION_PAUSED, InvalidOid, 0 );
+
+	return( TRUE );
+}
+
+/*
+ * ---------------------------------------------------------------------
+ * newSessionToken()
+ *
+ *	Returns a new, unguessable, non-zero session token.  Anyone who knows
+ *	the token can take over the debugging session, so we want it to come
+ *	from a strong random source where we have one.
+ */
+
+static uint64 newSessionToken( void )
+{
+	uint64	token = 0;
+
+#if (PG_VERSION_NUM >= 100000)
+	if( !pg_strong_random( &token, sizeof( token )))
+		token = 0;
+#endif
+
+	while( token == 0 )
+		token = ((uint64) random() << 33) ^ ((uint64) random() << 2) ^ (uint64) GetCurrentTimestamp();
+
+	return( token );
+}
+
 /*
  * ---------------------------------------------------------------------
  * connectAsServer()
@@ -568,11 +951,13 @@ bool attach_to_proxy( Breakpoint * breakpoint )
  *	the port number)
  */
 
-static bool connectAsServer( void )
+static bool connectAsServer( Breakpoint * breakpoint )
 {
 	int			client_sock;
 
-	client_sock = dbgcomm_listen_for_proxy();
+	sessions_set_target( SESSION_LISTENING, breakpoint->key.functionId, breakpoint->key.lineNumber );
+
+	client_sock = dbgcomm_listen_for_proxy( breakpoint->key.functionId, breakpoint->key.lineNumber, &per_session_ctx.proxy_role );
 	if (client_sock < 0)
 	{
 		per_session_ctx.client_w = per_session_ctx.client_r = 0;
@@ -600,6 +985,8 @@ static bool connectAsClient( Breakpoint * breakpoint )
 {
 	int					 proxySocket;
 
+	notifyBreakpointHit( breakpoint->key.functionId, breakpoint->key.lineNumber, breakpoint->data.proxyPid );
+
 	proxySocket = dbgcomm_connect_to_proxy(breakpoint->data.proxyPort);
 
 	if (proxySocket < 0 )
@@ -611,12 +998,105 @@ static bool connectAsClient( Breakpoint * breakpoint )
 	{
 		per_session_ctx.client_w = proxySocket;
 		per_session_ctx.client_r = proxySocket;
+		per_session_ctx.proxy_role = breakpoint->data.proxyRole;
 
 		BreakpointBusySession( breakpoint->data.proxyPid );
 		return true;
 	}
 }
 
+/*
+ * ---------------------------------------------------------------------
+ * notifyBreakpointHit()
+ *
+ *	Publishes a breakpoint hit so that monitoring and GUI clients can react
+ *	to it with LISTEN instead of polling pldbg_wait_for_target() or parsing
+ *	NOTICE messages.  The channel is pldbg_<proxy pid> for a global
+ *	breakpoint, or pldbg_local for a local breakpoint, and the payload is
+ *	"targetPid:funcOID:lineNumber:backendId".
+ *
+ *	The target can't NOTIFY from its own (still open) transaction, so we
+ *	launch a dynamic background worker that connects to our database, sends
+ *	the notification and exits.  Failing to start the worker only costs us
+ *	the notification, so we just log that and carry on.
+ */
+
+void notifyBreakpointHit( Oid funcOid, int lineNumber, int proxyPid )
+{
+#if (PG_VERSION_NUM >= 100000)
+	BackgroundWorker	worker = {0};
+	BreakpointHitEvent	event;
+
+	if( !notifyHits )
+		return;
+
+	StaticAssertStmt(sizeof(BreakpointHitEvent) <= BGW_EXTRALEN,
+					 "BreakpointHitEvent does not fit in bgw_extra");
+
+	event.databaseId = MyProc->databaseId;
+	event.proxyPid   = proxyPid;
+	event.targetPid  = MyProcPid;
+	event.functionId = funcOid;
+	event.lineNumber = lineNumber;
+	event.backendId  = MyBackendId;
+
+	worker.bgw_flags		= BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time	= BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time	= BGW_NEVER_RESTART;
+	worker.bgw_notify_pid	= 0;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "plugin_debugger");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "pldbg_notify_worker_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pldebugger notify for PID %d", MyProcPid);
+#if (PG_VERSION_NUM >= 110000)
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pldebugger notify");
+#endif
+	memcpy(worker.bgw_extra, &event, sizeof(event));
+
+	if( !RegisterDynamicBackgroundWorker( &worker, NULL ))
+		elog(LOG, "pldebugger: could not start a worker to publish breakpoint hit");
+#endif
+}
+
+#if (PG_VERSION_NUM >= 100000)
+/*
+ * ---------------------------------------------------------------------
+ * pldbg_notify_worker_main()
+ *
+ *	Entry point for the background worker started by notifyBreakpointHit().
+ *	Sends a single notification in a transaction of its own and exits.
+ */
+
+void pldbg_notify_worker_main( Datum main_arg )
+{
+	BreakpointHitEvent	event;
+	char				channel[NAMEDATALEN];
+	char				payload[64];
+
+	memcpy(&event, MyBgworkerEntry->bgw_extra, sizeof(event));
+
+	BackgroundWorkerUnblockSignals();
+
+#if (PG_VERSION_NUM >= 110000)
+	BackgroundWorkerInitializeConnectionByOid(event.databaseId, InvalidOid, 0);
+#else
+	BackgroundWorkerInitializeConnectionByOid(event.databaseId, InvalidOid);
+#endif
+
+	if( event.proxyPid == -1 )
+		snprintf(channel, sizeof(channel), "pldbg_local");
+	else
+		snprintf(channel, sizeof(channel), "pldbg_%d", event.proxyPid);
+
+	snprintf(payload, sizeof(payload), "%d:%u:%d:%d",
+			 event.targetPid, event.functionId, event.lineNumber, event.backendId);
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	Async_Notify(channel, payload);
+	CommitTransactionCommand();
+}
+#endif
+
 /*
  * ---------------------------------------------------------------------
  * parseBreakpoint()
@@ -649,13 +1129,19 @@ static bool parseBreakpoint( Oid * funcOID, int * lineNumber, char * breakpointS
  * addLocalBreakpoint()
  *
  *	This function adds a local breakpoint for the given function and
- *	line number
+ *	line number.  The caller must have acted on any pldbg_disarm_all()
+ *	already (see checkDisarmed()), or the next look for breakpoints would
+ *	clear this one along with the older ones.  The command loop does that
+ *	before it reads each command.
  */
 
 static bool addLocalBreakpoint( Oid funcOID, int lineNo )
 {
 	Breakpoint breakpoint;
 
+	/* Remember the source that lineNo refers to, in case the function is replaced */
+	(void) getFunctionVersion( funcOID );
+
 	breakpoint.key.databaseId = MyProc->databaseId;
 	breakpoint.key.functionId = funcOID;
 	breakpoint.key.lineNumber = lineNo;
@@ -663,6 +1149,7 @@ static bool addLocalBreakpoint( Oid funcOID, int lineNo )
 	breakpoint.data.isTmp     = FALSE;
 	breakpoint.data.proxyPort = -1;
 	breakpoint.data.proxyPid  = -1;
+	breakpoint.data.proxyRole = InvalidOid;
 
 	return( BreakpointInsert( BP_LOCAL, &breakpoint.key, &breakpoint.data ));
 }
@@ -746,6 +1233,12 @@ bool breakAtThisLine( Breakpoint ** dst, eBreakpointScope * scope, Oid funcOid,
 	key.functionId = funcOid;
 	key.lineNumber = lineNumber;
 
+	/*
+	 * A disarm removes every global breakpoint there was, so any we find
+	 * after acting on it were set since, and still count.
+	 */
+	(void) checkDisarmed();
+
 	if( per_session_ctx.step_into_next_func )
 	{
 		*dst   = NULL;
@@ -806,8 +1299,18 @@ bool breakAtThisLine( Breakpoint ** dst, eBreakpointScope * scope, Oid funcOid,
 
 bool breakpointsForFunction( Oid funcOid )
 {
+	(void) checkDisarmed();
+
 	if( BreakpointOnId( BP_LOCAL, funcOid ) || BreakpointOnId( BP_GLOBAL, funcOid ))
+	{
+		/*
+		 * Make sure we've noticed any CREATE OR REPLACE of this function
+		 * (and moved our local breakpoints to match) before the caller
+		 * starts looking for breakpoints by line number.
+		 */
+		(void) getFunctionVersion( funcOid );
 		return( TRUE );
+	}
 	else
 		return( FALSE );
 
@@ -988,8 +1491,19 @@ plugin_debugger_main_loop(void)
 		return false;
 	}
 
-	/* Report the current location */
-	lang->send_cur_line(frame);
+	/* Don't stop if we've been disarmed since the last statement */
+	if( checkDisarmed())
+		return false;
+
+	/* Report the current location (to observers, too) */
+	beginStop(frame, lang);
+
+	/* If this is the end of a multi-step command, say how we got here */
+	if( stepReplyPending )
+	{
+		dbg_send( "%d:%s", stepsTaken + 1, stepTrace ? stepTrace->data : "" );
+		cancelStepMany();
+	}
 
 	/*
 	 * Loop through the following chunk of code until we get a command
@@ -997,8 +1511,22 @@ plugin_debugger_main_loop(void)
 	 */
 	while( need_more )
 	{
-		/* Wait for a command from the debugger client */
-		command = dbg_read_str();
+		int		observer;
+
+		/* Wait for a command from the debugger client, or an observer */
+		command = waitForCommand( &observer );
+
+		/* Disarmed while we were waiting: we're on our own now, run */
+		if( command == NULL )
+			return false;
+
+		if( observer >= 0 )
+		{
+			/* Observers can only look, never touch */
+			handleObserverCommand( observer, command, frame, lang );
+			pfree( command );
+			continue;
+		}
 
 		/*
 		 * The debugger client sent us a null-terminated command string
@@ -1021,28 +1549,33 @@ plugin_debugger_main_loop(void)
 			case PLDBG_SET_BREAKPOINT:
 			{
 				setBreakpoint( command );
+				resetReplyCache();
 				break;
 			}
 
 			case PLDBG_CLEAR_BREAKPOINT:
 			{
 				clearBreakpoint( command );
+				resetReplyCache();
 				break;
 			}
 
 			case PLDBG_PRINT_VAR:
+			case PLDBG_LIST_BREAKPOINTS:
+			case PLDBG_LIST:
+			case PLDBG_PRINT_STACK:
+			case PLDBG_INFO_VARS:
+			case PLDBG_INFO_VARS_BINARY:
+			case PLDBG_GET_TYPES:
 			{
 				/*
-				 * Print value of given variable
+				 * Print value of given variable, list breakpoints, send
+				 * source code for given function, send the call stack,
+				 * send list of variables (and their values), or describe
+				 * their types.  Observers may ask for the same, so render
+				 * each reply just once per stop.
 				 */
-
-				lang->print_var( frame, &command[2], -1 );
-				break;
-			}
-
-			case PLDBG_LIST_BREAKPOINTS:
-			{
-				send_breakpoints( lang->get_func_oid(frame) );
+				sendCachedReply( command, frame, lang );
 				break;
 			}
 
@@ -1065,24 +1598,20 @@ plugin_debugger_main_loop(void)
 				break;
 			}
 
-			case PLDBG_LIST:
+			case PLDBG_STEP_MANY:
 			{
 				/*
-				 * Send source code for given function
+				 * Step over several statements, stopping only at the last
 				 */
-				dbg_send_src( command );
-				break;
-			}
-
-			case PLDBG_PRINT_STACK:
-			{
-				send_stack();
+				beginStepMany( command, lang->get_func_oid( frame ));
+				need_more = FALSE;
 				break;
 			}
 
 			case PLDBG_SELECT_FRAME:
 			{
 				select_frame(atoi( &command[2] ), &frame, &lang);
+				resetReplyCache();
 				/* Report the new location */
 				lang->send_cur_line( frame );
 				break;
@@ -1095,15 +1624,77 @@ plugin_debugger_main_loop(void)
 				 * Deposit a new value into the given variable
 				 */
 				do_deposit(frame, lang, command);
+				resetReplyCache();
 				break;
 			}
 
-			case PLDBG_INFO_VARS:
+			case PLDBG_EXPLAIN:
+			{
+				/*
+				 * EXPLAIN (ANALYZE, if the argument is 't') the query that
+				 * the current statement runs
+				 */
+				lang->explain_current( frame, command[1] == ' ' && command[2] == 't' );
+				break;
+			}
+
+			case PLDBG_QUERY:
+			{
+				/*
+				 * Run a read-only query in our transaction, and send the
+				 * rows back (command = "q maxRows:maxBytes:sql").  The query
+				 * runs as our current role, so only a proxy that runs as
+				 * that role (or as a superuser) may ask for one.
+				 */
+				int		maxRows;
+				int		maxBytes;
+				int		sqlStart = 0;
+
+				if( sscanf( command + 2, "%d:%d:%n", &maxRows, &maxBytes, &sqlStart ) < 2 || sqlStart == 0 )
+				{
+					dbg_send( "x%s:%s", unpack_sql_state( ERRCODE_PROTOCOL_VIOLATION ), "malformed query command" );
+					dbg_send( "%s", "" );
+				}
+				else if( per_session_ctx.proxy_role != GetUserId() &&
+						 ( !OidIsValid( per_session_ctx.proxy_role ) || !superuser_arg( per_session_ctx.proxy_role )))
+				{
+					dbg_send( "x%s:%s", unpack_sql_state( ERRCODE_INSUFFICIENT_PRIVILEGE ),
+							  "must be the target's current role or a superuser to run a query in the target" );
+					dbg_send( "%s", "" );
+				}
+				else
+					lang->query_in_target( frame, command + 2 + sqlStart, maxRows, maxBytes );
+				break;
+			}
+
+			case PLDBG_EXPORT_SNAPSHOT:
+			{
+				/*
+				 * Export the snapshot we're running with, so that other
+				 * sessions can see the same data
+				 */
+				sendSnapshot();
+				break;
+			}
+
+			case PLDBG_GET_TOKEN:
+			{
+				/*
+				 * Send the token that a new proxy can use to reattach to us
+				 * if this connection drops
+				 */
+				dbg_send( UINT64_FORMAT, per_session_ctx.session_token );
+				break;
+			}
+
+			case PLDBG_GET_OBSERVER_TOKEN:
 			{
 				/*
-				 * Send list of variables (and their values)
+				 * Start accepting read-only observers (if we aren't
+				 * already), and send the token they need to connect
 				 */
-				lang->send_vars( frame );
+				offerObservers();
+				dbg_send( UINT64_FORMAT, per_session_ctx.observer_token );
 				break;
 			}
 
@@ -1113,6 +1704,8 @@ plugin_debugger_main_loop(void)
 				/* stop the debugging session */
 				dbg_send( "%s", "t" );
 
+				sessions_set_target( SESSION_RUNNING, InvalidOid, 0 );
+
 				ereport(ERROR,
 						(errcode(ERRCODE_QUERY_CANCELED),
 						 errmsg("canceling statement due to user request")));
@@ -1125,44 +1718,710 @@ plugin_debugger_main_loop(void)
 		pfree(command);
 	}
 
+	sessions_set_target( SESSION_RUNNING, InvalidOid, 0 );
+
 	return retval;
 }
 
-static void
-do_deposit(ErrorContextCallback *frame, debugger_language_t *lang,
-		   char *command)
+/* ---------------------------------------------------------------------
+ * checkDisarmed()
+ *
+ *	If pldbg_disarm_all() has been called since we last looked, forgets
+ *	all of our breakpoints, hangs up on our proxy and observers, and
+ *	returns TRUE; the caller should let the target run. Otherwise returns
+ *	FALSE.
+ */
+static bool
+checkDisarmed( void )
 {
-	char    	  *var_name;
-	char      	  *value;
-	char      	  *lineno_s;
-	int			   lineno;
+	if( !BreakpointsDisarmed())
+		return( FALSE );
 
-	/* command = d:var.line=expr */
+	BreakpointAcknowledgeDisarm();
 
-	var_name = command + 2;
-	value  = strchr( var_name, '=' ); /* FIXME: handle quoted identifiers here */
-	if (!value)
-	{
-		dbg_send( "%s", "f" );
-		return;
-	}
-	*value = '\0';
-	value++;
+	clearLocalBreakpoints();
+	per_session_ctx.step_into_next_func = FALSE;
+	cancelStepMany();
 
-	lineno_s = strchr( var_name, '.' ); /* FIXME: handle quoted identifiers here */
-	if (!lineno_s)
+	if( per_session_ctx.client_w )
 	{
-		dbg_send( "%s", "f" );
-		return;
+		elog( LOG, "debugging session abandoned by pldbg_disarm_all()" );
+
+		closesocket( per_session_ctx.client_w );
+		per_session_ctx.client_w = per_session_ctx.client_r = 0;
+		per_session_ctx.proxy_role = InvalidOid;
 	}
-	*lineno_s = '\0';
-	lineno_s++;
-	if (strlen(lineno_s) == 0)
-		lineno = -1;
-	else
-		lineno = atoi(lineno_s);
 
-	if (lang->do_deposit(frame, var_name, lineno, value))
+	per_session_ctx.session_token = 0;
+	closeObservers();
+	sessions_drop_target();
+
+	return( TRUE );
+}
+
+/* ---------------------------------------------------------------------
+ * beginStepMany()
+ *
+ *	Sets up the multi-step command ("n steps:untilLine:trace") that the
+ *	proxy sent us while we're paused in the given function.  untilLine is
+ *	0 if the proxy didn't give one, and trace is 't' if it wants to know
+ *	the lines we pass.
+ */
+static void
+beginStepMany( char *command, Oid funcOid )
+{
+	int		steps = 1;
+	int		untilLine = 0;
+	char	trace = 'f';
+
+	if( sscanf( command + 2, "%d:%d:%c", &steps, &untilLine, &trace ) < 1 || steps < 1 )
+		steps = 1;
+
+	per_session_ctx.steps_left = steps - 1;
+
+	stepReplyPending = TRUE;
+	stepUntilFunc    = funcOid;
+	stepUntilLine    = untilLine;
+	stepsTaken       = 0;
+	stepTraceCount   = 0;
+
+	if( trace == 't' )
+	{
+		if( stepTrace == NULL )
+		{
+			MemoryContext oldcxt = MemoryContextSwitchTo( TopMemoryContext );
+
+			stepTrace = makeStringInfo();
+			MemoryContextSwitchTo( oldcxt );
+		}
+		else
+			resetStringInfo( stepTrace );
+	}
+	else if( stepTrace != NULL )
+	{
+		pfree( stepTrace->data );
+		pfree( stepTrace );
+		stepTrace = NULL;
+	}
+}
+
+/*
+ * ---------------------------------------------------------------------
+ * cancelStepMany()
+ *
+ *	Forgets about any multi-step command in progress.
+ */
+static void
+cancelStepMany( void )
+{
+	per_session_ctx.steps_left = 0;
+	stepReplyPending = FALSE;
+}
+
+/*
+ * ---------------------------------------------------------------------
+ * skipStep()
+ *
+ *	The language plugins call this when a step brings the target to a new
+ *	statement while per_session_ctx.steps_left > 0 (see beginStepMany()).
+ *	Returns TRUE if the multi-step command isn't done yet: we count the
+ *	statement off, and the caller should carry on without stopping.
+ *	Returns FALSE if the caller should stop here, because this is the last
+ *	step, the line the proxy asked for, or a breakpoint.
+ */
+bool
+skipStep( Oid funcOid, int lineNumber, bool atBreakpoint )
+{
+	if( atBreakpoint || ( funcOid == stepUntilFunc && lineNumber == stepUntilLine ))
+	{
+		per_session_ctx.steps_left = 0;
+		return( FALSE );
+	}
+
+	if( stepTrace != NULL && stepTraceCount < MAX_STEP_TRACE )
+	{
+		appendStringInfo( stepTrace, "%s%d", stepTraceCount > 0 ? "," : "", lineNumber );
+		stepTraceCount++;
+	}
+
+	per_session_ctx.steps_left--;
+	stepsTaken++;
+
+	return( TRUE );
+}
+
+/* ---------------------------------------------------------------------
+ * sendSnapshot()
+ *
+ *	Exports the snapshot that the paused statement runs with (as
+ *	pg_export_snapshot() would) and sends its id to the proxy, so that
+ *	other sessions can SET TRANSACTION SNAPSHOT and see exactly the
+ *	committed data that we see.  The snapshot stays valid until our
+ *	transaction ends.  We only export one snapshot per stop; if we can't
+ *	export one at all, we send "x", the SQLSTATE and a message instead.
+ *
+ *	We check for the cases that ExportSnapshot() refuses up front, rather
+ *	than catching its error: it can also fail (writing the snapshot file,
+ *	say) after it has registered the snapshot, and we can't clean up after
+ *	that without a subtransaction, which we couldn't export from.  Those
+ *	errors abort the target's transaction as they would anywhere else.
+ */
+static void
+sendSnapshot( void )
+{
+#if (PG_VERSION_NUM >= 90200)
+	/* Exporting from a subtransaction (an EXCEPTION block) would throw an error */
+	if( IsSubTransaction())
+	{
+		dbg_send( "x%s:%s", unpack_sql_state( ERRCODE_ACTIVE_SQL_TRANSACTION ),
+				  "cannot export a snapshot from inside an EXCEPTION block" );
+		return;
+	}
+
+#if (PG_VERSION_NUM < 100000)
+	/* Before 10, a standby can't export snapshots (it can't assign an xid) */
+	if( RecoveryInProgress())
+	{
+		dbg_send( "x%s:%s", unpack_sql_state( ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE ),
+				  "cannot export a snapshot during recovery" );
+		return;
+	}
+#endif
+
+	if( stopSnapshot == NULL )
+	{
+		char   *snapshotId = ExportSnapshot( ActiveSnapshotSet() ? GetActiveSnapshot() : GetTransactionSnapshot());
+
+		stopSnapshot = MemoryContextStrdup( TopMemoryContext, snapshotId );
+		pfree( snapshotId );
+	}
+
+	dbg_send( "s%s", stopSnapshot );
+#else
+	dbg_send( "x%s:%s", unpack_sql_state( ERRCODE_FEATURE_NOT_SUPPORTED ),
+			  "exporting snapshots requires PostgreSQL 9.2 or later" );
+#endif
+}
+
+/* ---------------------------------------------------------------------
+ * beginStop()
+ *
+ *	Called when the target pauses. Forgets the replies cached for the
+ *	previous stop, and reports the current location to the proxy and to
+ *	any observers that are waiting for it.
+ */
+static void
+beginStop( ErrorContextCallback *frame, debugger_language_t *lang )
+{
+	int		i;
+	Oid		funcOid;
+	int		lineNumber;
+
+	stopCount++;
+	resetReplyCache();
+
+	/* The snapshot we exported at the last stop may not be the one we're running with now */
+	if( stopSnapshot != NULL )
+	{
+		pfree( stopSnapshot );
+		stopSnapshot = NULL;
+	}
+
+	/* The stack may look different this time */
+	stopFrameCount = -1;
+
+	if( stopLine == NULL )
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo( TopMemoryContext );
+
+		stopLine = makeStringInfo();
+		MemoryContextSwitchTo( oldcxt );
+	}
+	else
+		resetStringInfo( stopLine );
+
+	captureBuf = stopLine;
+	PG_TRY();
+	{
+		lang->send_cur_line( frame );
+	}
+	PG_CATCH();
+	{
+		captureBuf = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	captureBuf = NULL;
+
+	/* The location is "funcOID:lineNumber:targetName", after the length word */
+	if( stopLine->len > sizeof( uint32 ) &&
+		sscanf( stopLine->data + sizeof( uint32 ), "%u:%d", &funcOid, &lineNumber ) == 2 )
+		sessions_set_target( SESSION_PAUSED, funcOid, lineNumber );
+
+	for( i = observerCount - 1; i >= 0; i-- )
+	{
+		if( observers[i].waiting && sendToObserver( i, stopLine->data, stopLine->len ))
+		{
+			observers[i].waiting  = FALSE;
+			observers[i].lastStop = stopCount;
+		}
+	}
+
+	writen( per_session_ctx.client_w, stopLine->data, stopLine->len );
+}
+
+/* ---------------------------------------------------------------------
+ * waitForCommand()
+ *
+ *	Waits for a command from the proxy or from one of the observers, and
+ *	accepts new observers in the meantime. Sets *observer to the index of
+ *	the observer that sent the command, or -1 if it came from the proxy.
+ *	Returns NULL if pldbg_disarm_all() told us to give up the session.
+ */
+static char *
+waitForCommand( int *observer )
+{
+	*observer = -1;
+
+	for(;;)
+	{
+		fd_set	rmask;
+		int		maxfd = per_session_ctx.client_r;
+		struct timeval timeout;
+		int		i;
+
+		if( checkDisarmed())
+			return( NULL );
+
+		FD_ZERO( &rmask );
+		FD_SET( per_session_ctx.client_r, &rmask );
+
+		if( per_session_ctx.observer_listener )
+		{
+			FD_SET( per_session_ctx.observer_listener, &rmask );
+			maxfd = Max( maxfd, per_session_ctx.observer_listener );
+		}
+
+		for( i = 0; i < observerCount; i++ )
+		{
+			FD_SET( observers[i].sock, &rmask );
+			maxfd = Max( maxfd, observers[i].sock );
+		}
+
+		/* Wake up now and then to see if we've been disarmed */
+		timeout.tv_sec  = DISARM_POLL_SECS;
+		timeout.tv_usec = 0;
+
+		if( select( maxfd + 1, &rmask, NULL, NULL, &timeout ) < 0 )
+		{
+			if( errno == EINTR )
+				continue;
+			handle_socket_error();
+		}
+
+		/* The proxy comes first */
+		if( FD_ISSET( per_session_ctx.client_r, &rmask ))
+			return( dbg_read_str());
+
+		if( per_session_ctx.observer_listener && FD_ISSET( per_session_ctx.observer_listener, &rmask ))
+			acceptObserver();
+
+		/* Walk backwards, dropObserver() moves the last entry into the hole */
+		for( i = observerCount - 1; i >= 0; i-- )
+		{
+			if( FD_ISSET( observers[i].sock, &rmask ))
+			{
+				char   *command = readFromObserver( observers[i].sock );
+
+				if( command != NULL )
+				{
+					*observer = i;
+					return( command );
+				}
+
+				dropObserver( i );
+			}
+		}
+	}
+}
+
+/* ---------------------------------------------------------------------
+ * handleObserverCommand()
+ *
+ *	Executes a command sent by an observer.  Observers may ask where we're
+ *	paused (PLDBG_WAIT_FOR_STOP, which waits for the next stop if they've
+ *	seen this one already) and use the read-only commands; anything else
+ *	is a protocol violation and costs them their connection.
+ */
+static void
+handleObserverCommand( int observer, char *command, ErrorContextCallback *frame, debugger_language_t *lang )
+{
+	switch( command[0] )
+	{
+		case PLDBG_WAIT_FOR_STOP:
+		{
+			if( observers[observer].lastStop == stopCount )
+				observers[observer].waiting = TRUE;
+			else if( sendToObserver( observer, stopLine->data, stopLine->len ))
+				observers[observer].lastStop = stopCount;
+			break;
+		}
+
+		case PLDBG_PRINT_VAR:
+		case PLDBG_LIST_BREAKPOINTS:
+		case PLDBG_LIST:
+		case PLDBG_PRINT_STACK:
+		case PLDBG_INFO_VARS:
+		case PLDBG_INFO_VARS_BINARY:
+		case PLDBG_GET_TYPES:
+		{
+			StringInfo	reply = cachedReply( command, frame, lang );
+
+			sendToObserver( observer, reply->data, reply->len );
+			break;
+		}
+
+		default:
+		{
+			ereport( COMMERROR,
+					 (errmsg( "debugger observer sent command '%c', but observers are read-only", command[0] )));
+			dropObserver( observer );
+		}
+	}
+}
+
+/* ---------------------------------------------------------------------
+ * cachedReply()
+ *
+ *	Returns the (serialized) reply to a read-only command, rendering it
+ *	if nobody has asked for it since we paused (or since something that
+ *	could change the answer happened, see resetReplyCache()).
+ */
+static StringInfo
+cachedReply( char *command, ErrorContextCallback *frame, debugger_language_t *lang )
+{
+	cached_reply_t	*entry;
+	MemoryContext	 oldcxt;
+	ListCell		*lc;
+
+	foreach( lc, replyCache )
+	{
+		entry = (cached_reply_t *) lfirst( lc );
+
+		if( strcmp( entry->command, command ) == 0 )
+			return( &entry->reply );
+	}
+
+	if( replyCacheCxt == NULL )
+		replyCacheCxt = AllocSetContextCreate( TopMemoryContext, "pldebugger reply cache", ALLOCSET_DEFAULT_SIZES );
+
+	oldcxt = MemoryContextSwitchTo( replyCacheCxt );
+	entry = (cached_reply_t *) palloc( sizeof( cached_reply_t ));
+	entry->command = pstrdup( command );
+	initStringInfo( &entry->reply );
+	MemoryContextSwitchTo( oldcxt );
+
+	captureBuf = &entry->reply;
+	PG_TRY();
+	{
+		switch( command[0] )
+		{
+			case PLDBG_PRINT_VAR:
+				lang->print_var( frame, &command[2], -1 );
+				break;
+
+			case PLDBG_LIST_BREAKPOINTS:
+				send_breakpoints( lang->get_func_oid( frame ));
+				break;
+
+			case PLDBG_LIST:
+				dbg_send_src( command );
+				break;
+
+			case PLDBG_PRINT_STACK:
+				send_stack();
+				break;
+
+			case PLDBG_INFO_VARS:
+			case PLDBG_INFO_VARS_BINARY:
+			{
+				var_filter	filter;
+				ErrorContextCallback *varFrame = frame;
+				debugger_language_t  *varLang  = lang;
+
+				parseVarFilter( command, &filter );
+
+				/* Render another frame's variables without moving the focus */
+				if( filter.frameNo >= 0 )
+				{
+					if( !getStopFrame( filter.frameNo, &varFrame, &varLang ))
+					{
+						dbg_send( "%s", "" );	/* No such frame, send an empty list */
+						break;
+					}
+
+					varLang->select_frame( varFrame );
+				}
+
+				varLang->send_vars( varFrame, &filter );
+				break;
+			}
+
+			case PLDBG_GET_TYPES:
+				send_types( command, frame, lang );
+				break;
+		}
+	}
+	PG_CATCH();
+	{
+		captureBuf = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	captureBuf = NULL;
+
+	oldcxt = MemoryContextSwitchTo( replyCacheCxt );
+	replyCache = lappend( replyCache, entry );
+	MemoryContextSwitchTo( oldcxt );
+
+	return( &entry->reply );
+}
+
+/* ---------------------------------------------------------------------
+ * sendCachedReply()
+ *
+ *	Sends the reply to a read-only command to the proxy.
+ */
+static void
+sendCachedReply( char *command, ErrorContextCallback *frame, debugger_language_t *lang )
+{
+	StringInfo	reply = cachedReply( command, frame, lang );
+
+	writen( per_session_ctx.client_w, reply->data, reply->len );
+}
+
+/* ---------------------------------------------------------------------
+ * resetReplyCache()
+ *
+ *	Forgets all cached replies.  Called when we pause, and whenever the
+ *	proxy does something (deposit a value, change the focus, add or drop
+ *	a breakpoint) that could change what a read-only command returns.
+ */
+static void
+resetReplyCache( void )
+{
+	if( replyCacheCxt )
+		MemoryContextReset( replyCacheCxt );
+
+	replyCache = NIL;
+}
+
+/* ---------------------------------------------------------------------
+ * offerObservers()
+ *
+ *	Starts accepting read-only observers for this debugging session, if
+ *	we aren't already.  If that fails, observer_token stays 0.
+ */
+static void
+offerObservers( void )
+{
+	uint64	token;
+	int		listener;
+
+	if( per_session_ctx.observer_listener )
+		return;
+
+	token    = newSessionToken();
+	listener = dbgcomm_listen_for_observers( token );
+
+	if( listener < 0 )
+		return;
+
+	per_session_ctx.observer_token    = token;
+	per_session_ctx.observer_listener = listener;
+}
+
+/* ---------------------------------------------------------------------
+ * acceptObserver()
+ *
+ *	Accepts a new observer (if it knows the token and there's room).
+ */
+static void
+acceptObserver( void )
+{
+	int		sock = dbgcomm_accept_observer( per_session_ctx.observer_listener, per_session_ctx.observer_token );
+
+	if( sock < 0 )
+		return;
+
+	if( observerCount == MAX_OBSERVERS )
+	{
+		ereport( COMMERROR,
+				 (errmsg( "rejected debugger observer: too many observers (at most %d)", MAX_OBSERVERS )));
+		closesocket( sock );
+		return;
+	}
+
+	observers[observerCount].sock     = sock;
+	observers[observerCount].waiting  = FALSE;
+	observers[observerCount].lastStop = 0;
+	observerCount++;
+}
+
+/* ---------------------------------------------------------------------
+ * sendToObserver()
+ *
+ *	Writes to an observer.  Unlike writen(), a network error doesn't
+ *	longjmp() - losing an observer is no reason to stop debugging - it just
+ *	drops the observer and returns FALSE.
+ */
+static bool
+sendToObserver( int observer, const char *data, size_t len )
+{
+	while( len > 0 )
+	{
+		ssize_t	written = send( observers[observer].sock, data, len, 0 );
+
+		if( written <= 0 )
+		{
+			if( written < 0 && errno == EINTR )
+				continue;
+
+			dropObserver( observer );
+			return( FALSE );
+		}
+
+		len  -= written;
+		data += written;
+	}
+
+	return( TRUE );
+}
+
+/* ---------------------------------------------------------------------
+ * readFromObserver()
+ *
+ *	Reads a counted string from an observer, like dbg_read_str() does from
+ *	the proxy.  Returns NULL (rather than longjmp()'ing) on error.
+ */
+static char *
+readFromObserver( int sock )
+{
+	uint32	netLen;
+	uint32	len;
+	char   *result;
+	char   *buffer = (char *) &netLen;
+	size_t	remaining = sizeof( netLen );
+	bool	haveLength = FALSE;
+
+	result = NULL;
+	len    = 0;
+
+	for(;;)
+	{
+		while( remaining > 0 )
+		{
+			ssize_t	bytesRead = recv( sock, buffer, remaining, 0 );
+
+			if( bytesRead <= 0 )
+			{
+				if( bytesRead < 0 && errno == EINTR )
+					continue;
+
+				if( result )
+					pfree( result );
+				return( NULL );
+			}
+
+			remaining -= bytesRead;
+			buffer    += bytesRead;
+		}
+
+		if( haveLength )
+			break;
+
+		haveLength = TRUE;
+		len        = ntohl( netLen );
+
+		if( len >= MaxAllocSize )
+			return( NULL );
+
+		result     = palloc( len + 1 );
+		buffer     = result;
+		remaining  = len;
+	}
+
+	result[len] = '\0';
+	return( result );
+}
+
+/* ---------------------------------------------------------------------
+ * dropObserver()
+ *
+ *	Closes the connection to an observer and forgets about it.
+ */
+static void
+dropObserver( int observer )
+{
+	closesocket( observers[observer].sock );
+
+	observers[observer] = observers[--observerCount];
+}
+
+/* ---------------------------------------------------------------------
+ * closeObservers()
+ *
+ *	The debugging session is over: disconnect all observers and stop
+ *	accepting new ones.
+ */
+static void
+closeObservers( void )
+{
+	while( observerCount > 0 )
+		dropObserver( observerCount - 1 );
+
+	if( per_session_ctx.observer_listener )
+		dbgcomm_stop_observers( per_session_ctx.observer_listener );
+
+	per_session_ctx.observer_listener = 0;
+	per_session_ctx.observer_token    = 0;
+}
+
+static void
+do_deposit(ErrorContextCallback *frame, debugger_language_t *lang,
+		   char *command)
+{
+	char    	  *var_name;
+	char      	  *value;
+	char      	  *lineno_s;
+	int			   lineno;
+
+	/* command = d:var.line=expr */
+
+	var_name = command + 2;
+	value  = strchr( var_name, '=' ); /* FIXME: handle quoted identifiers here */
+	if (!value)
+	{
+		dbg_send( "%s", "f" );
+		return;
+	}
+	*value = '\0';
+	value++;
+
+	lineno_s = strchr( var_name, '.' ); /* FIXME: handle quoted identifiers here */
+	if (!lineno_s)
+	{
+		dbg_send( "%s", "f" );
+		return;
+	}
+	*lineno_s = '\0';
+	lineno_s++;
+	if (strlen(lineno_s) == 0)
+		lineno = -1;
+	else
+		lineno = atoi(lineno_s);
+
+	if (lang->do_deposit(frame, var_name, lineno, value))
 		dbg_send( "%s", "t" );
 	else
 		dbg_send( "%s", "f" );
@@ -1235,68 +2494,259 @@ static void
 select_frame(int frameNo, ErrorContextCallback **frame_p, debugger_language_t **lang_p)
 {
 	ErrorContextCallback *frame;
+	debugger_language_t *lang;
 
-	for( frame = error_context_stack; frame; frame = frame->previous )
+	if( getStopFrame( frameNo, &frame, &lang ))
 	{
-		debugger_language_t *lang = language_of_frame(frame);
-		if (!lang)
-			continue;
+		lang->select_frame(frame);
+
+		*frame_p = frame;
+		*lang_p = lang;
+	}
+
+	/* Not found. Keep frame unchanged */
+}
+
+/*
+ * getStopFrame()
+ *
+ * Finds the frameNo'th PL stack frame (counting from the top, and ignoring
+ * frames that don't belong to a language we know) and its language.  Returns
+ * FALSE if there aren't that many frames.
+ */
+static bool
+getStopFrame(int frameNo, ErrorContextCallback **frame_p, debugger_language_t **lang_p)
+{
+	if( stopFrameCount < 0 )
+	{
+		ErrorContextCallback *frame;
+		int			maxFrames = 0;
 
-		if( frameNo-- == 0 )
+		for( frame = error_context_stack; frame; frame = frame->previous )
+			maxFrames++;
+
+		if( stopFrames != NULL )
+			pfree( stopFrames );
+
+		stopFrames = (stop_frame_t *) MemoryContextAlloc( TopMemoryContext, sizeof( stop_frame_t ) * Max( maxFrames, 1 ));
+		stopFrameCount = 0;
+
+		for( frame = error_context_stack; frame; frame = frame->previous )
 		{
-			lang->select_frame(frame);
+			debugger_language_t *lang = language_of_frame(frame);
+
+			if (!lang)
+				continue;
 
-			*frame_p = frame;
-			*lang_p = lang;
+			stopFrames[stopFrameCount].frame = frame;
+			stopFrames[stopFrameCount].lang  = lang;
+			stopFrameCount++;
 		}
 	}
 
-	/* Not found. Keep frame unchanged */
+	if( frameNo < 0 || frameNo >= stopFrameCount )
+		return( FALSE );
+
+	*frame_p = stopFrames[frameNo].frame;
+	*lang_p  = stopFrames[frameNo].lang;
+
+	return( TRUE );
 }
 
 /*
  * Returns the debugger_language_t struct representing the language that
  * this stack frame belongs to. Or NULL if we don't have a handler for it.
  */
-static debugger_language_t *
-language_of_frame(ErrorContextCallback *frame)
+static debugger_language_t *
+language_of_frame(ErrorContextCallback *frame)
+{
+	debugger_language_t *lang;
+	int			i;
+
+	for (i = 0; debugger_languages[i] != NULL; i++)
+	{
+		lang = debugger_languages[i];
+		if (lang->frame_belongs_to_me(frame))
+			return lang;
+	}
+	return NULL;
+}
+
+/* ------------------------------------------------------------------
+ * send_stack()
+ *
+ *   This function sends the call stack to the debugger client.  For
+ *	 each PL/pgSQL stack frame that we find, we send the function name,
+ *	 argument names and values, and the current line number (within
+ *	 that particular invocation).
+ */
+static void
+send_stack( void )
+{
+	ErrorContextCallback * entry;
+
+	for( entry = error_context_stack; entry; entry = entry->previous )
+	{
+		/*
+		 * ignore frames we don't recognize
+		 */
+		debugger_language_t *lang = language_of_frame(entry);
+		if (lang != NULL)
+			lang->send_stack_frame(entry);
+	}
+
+	dbg_send( "%s", "" );	/* empty string indicates end of list */
+}
+
+/* ------------------------------------------------------------------
+ * parseVarFilter()
+ *
+ *   Builds the var_filter described by an 'i' or 'I' command.  Without
+ *   arguments, the command asks for every visible variable in the frame
+ *   that has the focus.  Otherwise it looks like:
+ *
+ *	i scope[@frame][:name[:name...]]
+ *
+ *   where scope is 's' to ask for only the variables in scope at the
+ *   current line (or 'a' for all of them), frame is the number of the
+ *   stack frame to look at (the focus, if not given), followed by the
+ *   names of the variables wanted (if none are given, any name will do).
+ */
+static void
+parseVarFilter( char *command, var_filter *filter )
+{
+	char   *args;
+	char   *name;
+	char   *end;
+
+	memset( filter, 0, sizeof( *filter ));
+
+	filter->binary  = ( command[0] == PLDBG_INFO_VARS_BINARY );
+	filter->frameNo = -1;
+
+	if( command[1] != ' ' )
+		return;
+
+	args = pstrdup( &command[2] );
+
+	if(( end = strchr( args, '\n' )) != NULL )
+		*end = '\0';
+
+	filter->inScopeOnly = ( args[0] == 's' );
+
+	if( args[0] != '\0' && args[1] == '@' )
+		filter->frameNo = atoi( &args[2] );
+
+	if(( name = strchr( args, ':' )) == NULL )
+		return;
+
+	filter->names = (char **) palloc( sizeof( char * ) * ( strlen( name ) + 1 ));
+
+	while( name != NULL )
+	{
+		char   *next = strchr( name + 1, ':' );
+
+		if( next != NULL )
+			*next = '\0';
+
+		filter->names[filter->nameCount++] = name + 1;
+		name = next;
+	}
+}
+
+/* ------------------------------------------------------------------
+ * send_types()
+ *
+ *   This function sends the debugger client a description of each data
+ *   type used by the variables in the given frame, skipping the first n
+ *   types we've ever described (the client says how many it already has
+ *   in the command, "T n").  Each type is sent as:
+ *
+ *	typeOID:elementTypeOID:typmod:typeName
+ */
+static void
+send_types( char *command, ErrorContextCallback *frame, debugger_language_t *lang )
 {
-	debugger_language_t *lang;
-	int			i;
+	int			known = ( strlen( command ) > 2 ) ? atoi( &command[2] ) : 0;
+	int			i = 0;
+	ListCell   *lc;
 
-	for (i = 0; debugger_languages[i] != NULL; i++)
+	lang->collect_types( frame );
+
+	foreach( lc, knownTypes )
 	{
-		lang = debugger_languages[i];
-		if (lang->frame_belongs_to_me(frame))
-			return lang;
+		if( i++ >= known )
+			dbg_send( "%s", (char *) lfirst( lc ));
 	}
-	return NULL;
+
+	dbg_send( "%s", "" );	/* empty string indicates end of list */
 }
 
 /* ------------------------------------------------------------------
- * send_stack()
+ * dbg_note_type()
  *
- *   This function sends the call stack to the debugger client.  For
- *	 each PL/pgSQL stack frame that we find, we send the function name,
- *	 argument names and values, and the current line number (within
- *	 that particular invocation).
+ *   The language handlers call this function (from collect_types) for
+ *   the type and typmod of each variable in a frame.  If we haven't
+ *   described that type with that typmod before, we add it to the end of
+ *   knownTypes.  A variable declared without a typmod is described with
+ *   the type's own (which is only ever set for a domain).
  */
-static void
-send_stack( void )
+void
+dbg_note_type( Oid typoid, int32 typmod )
 {
-	ErrorContextCallback * entry;
+	HeapTuple		typeTup;
+	Form_pg_type	typeStruct;
+	MemoryContext	oldcxt;
+	known_type_key	key;
+	char		  * typeName;
+	bool			found;
+
+	if( !OidIsValid( typoid ))
+		return;
 
-	for( entry = error_context_stack; entry; entry = entry->previous )
+	if( knownTypeHash == NULL )
 	{
-		/*
-		 * ignore frames we don't recognize
-		 */
-		debugger_language_t *lang = language_of_frame(entry);
-		if (lang != NULL)
-			lang->send_stack_frame(entry);
+		HASHCTL	ctl = {0};
+
+		ctl.keysize   = sizeof( known_type_key );
+		ctl.entrysize = sizeof( known_type_key );
+		ctl.hash      = tag_hash;
+
+		knownTypeHash = hash_create( "pldebugger known types", 32, &ctl, HASH_ELEM | HASH_FUNCTION );
 	}
 
-	dbg_send( "%s", "" );	/* empty string indicates end of list */
+	memset( &key, 0, sizeof( key ));
+	key.typoid = typoid;
+	key.typmod = typmod;
+
+	hash_search( knownTypeHash, &key, HASH_FIND, &found );
+
+	if( found )
+		return;
+
+	typeTup = SearchSysCache( TYPEOID, ObjectIdGetDatum( typoid ), 0, 0, 0 );
+
+	if( !HeapTupleIsValid( typeTup ))
+		return;
+
+	typeStruct = (Form_pg_type) GETSTRUCT( typeTup );
+
+	if( typmod >= 0 )
+		typeName = format_type_with_typemod( typoid, typmod );
+	else
+	{
+		typeName = format_type_be( typoid );
+		typmod	 = typeStruct->typtypmod;
+	}
+
+	oldcxt = MemoryContextSwitchTo( TopMemoryContext );
+	knownTypes = lappend( knownTypes, psprintf( "%u:%u:%d:%s", typoid, typeStruct->typelem, typmod, typeName ));
+	MemoryContextSwitchTo( oldcxt );
+
+	hash_search( knownTypeHash, &key, HASH_ENTER, NULL );
+
+	pfree( typeName );
+	ReleaseSysCache( typeTup );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1310,6 +2760,8 @@ send_stack( void )
 static LWLockId  breakpointLock;
 static HTAB    * globalBreakpoints = NULL;
 static HTAB    * localBreakpoints  = NULL;
+static GlobalBreakpointData * globalBreakpointData = NULL;
+static uint32	 seenGeneration = 0;	/* armedGeneration we've acted on */
 
 /*-------------------------------------------------------------------------------------
  * The size of Breakpoints is determined by globalBreakpointCount (should be a GUC)
@@ -1376,6 +2828,9 @@ initializeHashTables(void)
 
 	LWLockRelease(AddinShmemInitLock);
 
+	/* Only a pldbg_disarm_all() from now on concerns us */
+	seenGeneration = pg_atomic_read_u32(&globalBreakpointData->armedGeneration);
+
 	initLocalBreakpoints();
 	initLocalBreakCounts();
 }
@@ -1406,6 +2861,11 @@ initGlobalBreakpoints(void)
 	if (gbpd == NULL)
 		elog(ERROR, "out of shared memory");
 
+	if (!found)
+		pg_atomic_init_u32(&gbpd->armedGeneration, 0);
+
+	globalBreakpointData = gbpd;
+
 #if (PG_VERSION_NUM >= 90600)
 	if (!found)
 	{
@@ -1691,6 +3151,98 @@ BreakpointBusySession(int pid)
 	releaseLock(BP_GLOBAL);
 }
 
+/* ---------------------------------------------------------
+ * BreakpointDisarmAll()
+ *
+ * Removes every global breakpoint and bumps the armed generation,
+ * in one go, so that every backend that looks for a breakpoint
+ * after this drops its local breakpoints and its proxy, too (see
+ * checkDisarmed()). Returns the number of global breakpoints
+ * removed.
+ */
+
+int
+BreakpointDisarmAll(void)
+{
+	HASH_SEQ_STATUS status;
+	Breakpoint	   *entry;
+	int				removed = 0;
+
+	acquireLock(BP_GLOBAL, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, getBreakpointHash(BP_GLOBAL));
+
+	while((entry = (Breakpoint *) hash_seq_search(&status)))
+	{
+		breakCountDelete(BP_GLOBAL, ((BreakCountKey *)&entry->key));
+		hash_search(getBreakpointHash(BP_GLOBAL), &entry->key, HASH_REMOVE, NULL);
+		removed++;
+	}
+
+	pg_atomic_fetch_add_u32(&globalBreakpointData->armedGeneration, 1);
+
+	releaseLock(BP_GLOBAL);
+
+	return( removed );
+}
+
+/* ---------------------------------------------------------
+ * BreakpointsDisarmed()
+ *
+ * Returns TRUE if pldbg_disarm_all() has been called since
+ * this backend last acknowledged it. This is just a read of
+ * shared memory, cheap enough to do at every statement.
+ */
+
+bool
+BreakpointsDisarmed(void)
+{
+	if( localBreakpoints == NULL )
+		initializeHashTables();
+
+	return( pg_atomic_read_u32(&globalBreakpointData->armedGeneration) != seenGeneration );
+}
+
+/* ---------------------------------------------------------
+ * BreakpointAcknowledgeDisarm()
+ *
+ * Records that we've acted on the latest pldbg_disarm_all().
+ */
+
+void
+BreakpointAcknowledgeDisarm(void)
+{
+	if( localBreakpoints == NULL )
+		initializeHashTables();
+
+	seenGeneration = pg_atomic_read_u32(&globalBreakpointData->armedGeneration);
+}
+
+/* ---------------------------------------------------------
+ * clearLocalBreakpoints()
+ *
+ * Forgets all of this backend's local breakpoints.
+ */
+
+static void
+clearLocalBreakpoints(void)
+{
+	HASH_SEQ_STATUS status;
+	Breakpoint	   *entry;
+
+	acquireLock(BP_LOCAL, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, getBreakpointHash(BP_LOCAL));
+
+	while((entry = (Breakpoint *) hash_seq_search(&status)))
+	{
+		breakCountDelete(BP_LOCAL, ((BreakCountKey *)&entry->key));
+		hash_search(getBreakpointHash(BP_LOCAL), &entry->key, HASH_REMOVE, NULL);
+	}
+
+	releaseLock(BP_LOCAL);
+}
+
 /* ---------------------------------------------------------
  * BreakpointFreeSession()
  *
@@ -1979,3 +3531,357 @@ getBreakCountHash(eBreakpointScope scope)
 	else
 		return localBreakCounts;
 }
+
+/* ==========================================================================
+ * Function version tracking
+ *
+ * Breakpoints (and the per-function caches kept by the language handlers)
+ * are keyed by function OID and line number, but CREATE OR REPLACE FUNCTION
+ * keeps the OID while changing the source underneath us.  We register a
+ * syscache callback on pg_proc that bumps a per-function version number
+ * whenever a function we know about changes; caches compare the version
+ * they were built at against getFunctionVersion() and rebuild lazily.
+ *
+ * The callback can fire in the middle of just about anything, so it only
+ * marks entries stale.  The real work (re-reading the source and remapping
+ * local breakpoints) happens the next time someone asks for the version.
+ * ==========================================================================
+ */
+
+typedef struct
+{
+	Oid			functionId;		/* hash key								*/
+	uint32		hashValue;		/* PROCOID syscache hash of functionId	*/
+	uint32		version;		/* bumped whenever the pg_proc row changes */
+	bool		stale;			/* changed since we last revalidated?	*/
+	char	   *source;			/* prosrc that our line numbers refer to */
+} FunctionVersion;
+
+static HTAB	   *functionVersions = NULL;
+
+static void		functionInvalidated( Datum arg, int cacheid, uint32 hashValue );
+static char	   *copySource( Oid funcOid );
+static bool		sameSourceLine( const char *a, const char *b );
+static void		remapLocalBreakpoints( FunctionVersion *entry, char *newSource );
+
+/* ---------------------------------------------------------
+ * getFunctionVersion()
+ *
+ *	Returns a number that changes whenever the given function is
+ *	redefined.  The first call for a function starts tracking it.
+ *	If the function has changed since we last looked, we move any
+ *	local breakpoints set in it before returning.
+ */
+
+uint32
+getFunctionVersion( Oid funcOid )
+{
+	FunctionVersion	*entry;
+	bool			 found;
+
+	if( functionVersions == NULL )
+	{
+		HASHCTL	ctl = {0};
+
+		ctl.keysize   = sizeof(Oid);
+		ctl.entrysize = sizeof(FunctionVersion);
+		ctl.hash      = tag_hash;
+
+		functionVersions = hash_create("pldebugger function versions", 64, &ctl, HASH_ELEM | HASH_FUNCTION);
+
+		CacheRegisterSyscacheCallback( PROCOID, functionInvalidated, (Datum) 0 );
+	}
+
+	entry = (FunctionVersion *) hash_search( functionVersions, &funcOid, HASH_ENTER, &found );
+
+	if( !found )
+	{
+		entry->hashValue = GetSysCacheHashValue1( PROCOID, ObjectIdGetDatum( funcOid ));
+		entry->version   = 0;
+		entry->stale     = FALSE;
+		entry->source    = remapBreakpoints ? copySource( funcOid ) : NULL;
+	}
+	else if( entry->stale )
+	{
+		char	*newSource = copySource( funcOid );
+
+		entry->stale = FALSE;
+
+		if( remapBreakpoints && entry->source && newSource && strcmp( entry->source, newSource ) != 0 )
+			remapLocalBreakpoints( entry, newSource );
+
+		if( entry->source )
+			pfree( entry->source );
+
+		entry->source = remapBreakpoints ? newSource : NULL;
+
+		if( entry->source == NULL && newSource )
+			pfree( newSource );
+	}
+
+	return( entry->version );
+}
+
+/* ---------------------------------------------------------
+ * functionInvalidated()
+ *
+ *	Syscache callback for pg_proc.  A hashValue of zero means that the
+ *	whole cache was flushed, so every function we track is suspect.
+ */
+
+static void
+functionInvalidated( Datum arg, int cacheid, uint32 hashValue )
+{
+	HASH_SEQ_STATUS	 scan;
+	FunctionVersion	*entry;
+
+	if( functionVersions == NULL )
+		return;
+
+	hash_seq_init( &scan, functionVersions );
+
+	while(( entry = (FunctionVersion *) hash_seq_search( &scan )) != NULL )
+	{
+		if( hashValue == 0 || entry->hashValue == hashValue )
+		{
+			entry->version++;
+			entry->stale = TRUE;
+		}
+	}
+}
+
+/* ---------------------------------------------------------
+ * copySource()
+ *
+ *	Returns a copy of the given function's source, allocated in
+ *	TopMemoryContext, or NULL if the function no longer exists.
+ */
+
+static char *
+copySource( Oid funcOid )
+{
+	HeapTuple	tup;
+	Datum		prosrc;
+	bool		isNull;
+	char	   *result;
+
+	tup = SearchSysCache( PROCOID, ObjectIdGetDatum( funcOid ), 0, 0, 0 );
+
+	if( !HeapTupleIsValid( tup ))
+		return( NULL );
+
+	prosrc = SysCacheGetAttr( PROCOID, tup, Anum_pg_proc_prosrc, &isNull );
+
+	if( isNull )
+		result = NULL;
+	else
+		result = MemoryContextStrdup( TopMemoryContext, TextDatumGetCString( prosrc ));
+
+	ReleaseSysCache( tup );
+
+	return( result );
+}
+
+/* ---------------------------------------------------------
+ * splitSourceLines()
+ *
+ *	Splits source (in place) into lines.  Element 0 of the result is
+ *	line 1, matching the line numbers that breakpoints use.
+ */
+
+char **
+splitSourceLines( char *source, int *lineCount )
+{
+	char	  **lines;
+	int			count = 1;
+	char	   *p;
+
+	for( p = source; *p; p++ )
+		if( *p == '\n' )
+			count++;
+
+	lines = (char **) palloc( sizeof( char * ) * count );
+	lines[0] = source;
+	count = 1;
+
+	for( p = source; *p; p++ )
+	{
+		if( *p == '\n' )
+		{
+			*p = '\0';
+			lines[count++] = p + 1;
+		}
+	}
+
+	*lineCount = count;
+	return( lines );
+}
+
+/* ---------------------------------------------------------
+ * sameSourceLine()
+ *
+ *	Compares two lines of source code, ignoring leading and trailing
+ *	white space (so re-indenting a block doesn't lose breakpoints).
+ */
+
+static bool
+sameSourceLine( const char *a, const char *b )
+{
+	size_t	lenA;
+	size_t	lenB;
+
+	while( isspace((unsigned char) *a ))
+		a++;
+	while( isspace((unsigned char) *b ))
+		b++;
+
+	lenA = strlen( a );
+	lenB = strlen( b );
+
+	while( lenA > 0 && isspace((unsigned char) a[lenA - 1] ))
+		lenA--;
+	while( lenB > 0 && isspace((unsigned char) b[lenB - 1] ))
+		lenB--;
+
+	return( lenA == lenB && strncmp( a, b, lenA ) == 0 );
+}
+
+/* ---------------------------------------------------------
+ * remapLocalBreakpoints()
+ *
+ *	The given function has been replaced.  Move each local breakpoint
+ *	in it to the line in newSource whose text matches the line it was
+ *	set on (preferring the closest match), or drop it if there is no
+ *	such line - a breakpoint that silently fires somewhere else is worse
+ *	than no breakpoint at all.
+ *
+ *	Breakpoints on function entry (line -1) and on blank lines stay put.
+ *	Global breakpoints belong to the proxy and aren't touched here; the
+ *	target's local copies of them (see BreakpointBusySession()) are.
+ *
+ *	All the new lines are worked out against the old source before any
+ *	breakpoint moves, and every breakpoint that moves is deleted before
+ *	any is re-inserted, so that one breakpoint moving onto another's old
+ *	line can't clobber it.  If two breakpoints end up on the same line,
+ *	they merge into one, which is only temporary if both were.
+ */
+
+static void
+remapLocalBreakpoints( FunctionVersion *entry, char *newSource )
+{
+	HASH_SEQ_STATUS	 scan;
+	Breakpoint		*breakpoint;
+	Breakpoint		*moves;
+	int				*targets;
+	int				 moveCount = 0;
+	int				 maxMoves = 16;
+	char			**oldLines;
+	char			**newLines;
+	int				 oldCount;
+	int				 newCount;
+	char			*oldCopy = pstrdup( entry->source );
+	char			*newCopy = pstrdup( newSource );
+	int				 i;
+
+	oldLines = splitSourceLines( oldCopy, &oldCount );
+	newLines = splitSourceLines( newCopy, &newCount );
+
+	/* Collect the breakpoints first - we can't add to the hash while scanning it */
+	moves = (Breakpoint *) palloc( sizeof( Breakpoint ) * maxMoves );
+
+	BreakpointGetList( BP_LOCAL, &scan );
+
+	while(( breakpoint = (Breakpoint *) hash_seq_search( &scan )) != NULL )
+	{
+		if( breakpoint->key.functionId != entry->functionId ||
+			breakpoint->key.databaseId != MyProc->databaseId ||
+			breakpoint->key.lineNumber <= 0 )
+			continue;
+
+		if( moveCount == maxMoves )
+		{
+			maxMoves *= 2;
+			moves = (Breakpoint *) repalloc( moves, sizeof( Breakpoint ) * maxMoves );
+		}
+
+		moves[moveCount++] = *breakpoint;
+	}
+
+	BreakpointReleaseList( BP_LOCAL );
+
+	/* Work out where each breakpoint goes: 0 means it stays put, -1 that it's dropped */
+	targets = (int *) palloc0( sizeof( int ) * ( moveCount + 1 ));
+
+	for( i = 0; i < moveCount; i++ )
+	{
+		int			 line = moves[i].key.lineNumber;
+		int			 newLine = -1;
+		int			 distance;
+
+		if( line > oldCount || sameSourceLine( oldLines[line - 1], "" ))
+			continue;
+
+		if( line <= newCount && sameSourceLine( oldLines[line - 1], newLines[line - 1] ))
+			continue;
+
+		/* Search outwards from the old position for the nearest matching line */
+		for( distance = 1; newLine == -1 && ( line - distance >= 1 || line + distance <= newCount ); distance++ )
+		{
+			if( line - distance >= 1 && line - distance <= newCount &&
+				sameSourceLine( oldLines[line - 1], newLines[line - distance - 1] ))
+				newLine = line - distance;
+			else if( line + distance <= newCount &&
+					 sameSourceLine( oldLines[line - 1], newLines[line + distance - 1] ))
+				newLine = line + distance;
+		}
+
+		targets[i] = newLine;
+	}
+
+	/* Take every breakpoint that moves out of the way first... */
+	for( i = 0; i < moveCount; i++ )
+	{
+		if( targets[i] != 0 )
+			BreakpointDelete( BP_LOCAL, &moves[i].key );
+	}
+
+	/* ... then put them back on their new lines */
+	for( i = 0; i < moveCount; i++ )
+	{
+		Breakpoint	*old = &moves[i];
+		int			 line = old->key.lineNumber;
+
+		if( targets[i] == 0 )
+			continue;
+
+		if( targets[i] == -1 )
+		{
+			elog( DEBUG1, "pldebugger: dropped breakpoint at line %d of function %u, the line no longer exists",
+				  line, entry->functionId );
+			continue;
+		}
+
+		elog( DEBUG1, "pldebugger: moved breakpoint in function %u from line %d to line %d",
+			  entry->functionId, line, targets[i] );
+
+		old->key.lineNumber = targets[i];
+
+		if( !BreakpointInsert( BP_LOCAL, &old->key, &old->data ))
+		{
+			Breakpoint	*existing = BreakpointLookup( BP_LOCAL, &old->key );
+
+			elog( DEBUG1, "pldebugger: merged breakpoint from line %d of function %u with the one at line %d",
+				  line, entry->functionId, targets[i] );
+
+			if( existing != NULL )
+				existing->data.isTmp = existing->data.isTmp && old->data.isTmp;
+		}
+	}
+
+	pfree( targets );
+	pfree( moves );
+	pfree( oldLines );
+	pfree( newLines );
+	pfree( oldCopy );
+	pfree( newCopy );
+}
@@ -0,0 +1,4218 @@
+/**********************************************************************
+ * profiler.c
+ *
+ * This file contains the value profiler: it watches a variable at a
+ * given line of a function and keeps track of the values it takes on
+ * each time the line executes, without stopping the target, so you can
+ * see which values are common before deciding where to set a breakpoint.
+ *
+ * It also keeps track of the slowest invocations of a function, with
+ * their arguments and callers, so that you can reproduce the worst cases,
+ * and can record every invocation of a function to a file, so that you
+ * can replay a real workload against a new version of the function.
+ *
+ * Finally, while pldebugger.profile is on, it counts how often each line
+ * of PL code runs and how long it takes, and can save those counts in
+ * snapshots to compare one version of a function with the next, or export
+ * them to be added up with the counts of other servers.
+ *
+ * Licensed under the Artistic License v2.0, see
+ *		https://opensource.org/licenses/artistic-license-2.0
+ * for full details
+ *
+ **********************************************************************/
+
+#include "postgres.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+#include "optimizer/planner.h"
+#include "port/atomics.h"
+#include "port/pg_bswap.h"
+#include "portability/instr_time.h"
+#include "storage/fd.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+#if (PG_VERSION_NUM >= 100000)
+#include "utils/varlena.h"
+#endif
+#if (PG_VERSION_NUM >= 110000)
+#include "utils/regproc.h"
+#endif
+#if (PG_VERSION_NUM >= 130000)
+#include "common/hashfn.h"
+#endif
+#if (PG_VERSION_NUM >= 140000)
+#include "utils/timeout.h"
+#include "utils/wait_event.h"
+#endif
+
+#include "pldebugger.h"
+#include "profiler.h"
+
+/*
+ * Shared memory structure. Each value profile (a function, a line in that
+ * function and the name of a variable) has a slot of its own, so that every
+ * backend that runs the function adds to the same profile.
+ *
+ * A slot doesn't remember every value it has seen. Instead, it keeps a
+ * fixed number of counters and uses the Space-Saving algorithm (Metwally et
+ * al.): a value that already has a counter bumps it, a new value takes a
+ * free counter if there is one, and otherwise replaces the value with the
+ * smallest count, inheriting that count (plus one) as an upper bound. So
+ * any value more frequent than 1/ProfileCounters of the samples is sure to
+ * have a counter, the count of each value overestimates the truth by at
+ * most 'error', and memory doesn't grow with the number of distinct values.
+ *
+ * 'executions' counts the times the line has run, so that we only take a
+ * sample (which costs a call to the type's output function) every
+ * sampleEvery'th time. A profile only applies in the database it was
+ * created in (dbOid), since function OIDs are only unique within one.
+ *
+ * The slots are protected by getPLDebuggerLock(). Every time a profile is
+ * created or dropped we bump 'generation': backends keep a copy of the
+ * profile definitions (see refreshProfiles()) and only take the lock to
+ * re-read them when the generation changes, so that checking whether a
+ * function is profiled doesn't cost a lock.
+ */
+#define MaxValueProfiles	16		/* Number of profiles at any one time */
+#define ProfileCounters		32		/* Counters per profile */
+#define ProfileValueLen		64		/* Longer values are truncated */
+
+typedef struct
+{
+	char		value[ProfileValueLen];
+	bool		isnull;
+	uint64		count;			/* Samples with this value (or fewer) */
+	uint64		error;			/* How much count may overestimate by */
+} profile_counter_t;
+
+typedef struct
+{
+	uint32		id;				/* 0 if the slot is free */
+	Oid			dbOid;
+	Oid			funcOid;
+	int			lineNumber;
+	char		varName[NAMEDATALEN];
+	int			sampleEvery;
+	pg_atomic_uint64 executions;
+	int			nCounters;
+	profile_counter_t counters[ProfileCounters];
+} profile_slot_t;
+
+/*
+ * A slow call capture keeps the 'keep' slowest invocations of a function
+ * that we've seen, in a min-heap on usecs: calls[0] is the fastest of them,
+ * so a new invocation only has to beat that one to get in. It shares the
+ * lock and the generation counter with the value profiles, and like them
+ * only applies in the database it was created in.
+ */
+#define MaxSlowCallCaptures	16		/* Number of captures at any one time */
+#define SlowCallsKept		16		/* Most invocations a capture can keep */
+#define SlowCallTextLen		256		/* Longer arguments/callers are truncated */
+
+typedef struct
+{
+	uint64		usecs;			/* How long the invocation took */
+	TimestampTz	ended;
+	int			pid;
+	char		args[SlowCallTextLen];
+	char		callers[SlowCallTextLen];
+} slow_call_t;
+
+typedef struct
+{
+	uint32		id;				/* 0 if the slot is free */
+	Oid			dbOid;
+	Oid			funcOid;
+	int			keep;
+	int			nCalls;
+	slow_call_t	calls[SlowCallsKept];
+} slow_call_slot_t;
+
+/*
+ * A workload capture appends a record of every invocation of a function, in
+ * the database the capture was started in, to a file in ProfilerDir (under
+ * the data directory). The file starts with WorkloadMagic, followed by one
+ * record per invocation, all integers in network byte order:
+ *
+ *	int32	length of the rest of the record
+ *	int64	when the invocation started (TimestampTz)
+ *	uint32	OID of the role that made the call
+ *	int16	number of arguments, then for each argument:
+ *	  uint32	type OID (InvalidOid if we couldn't record the argument)
+ *	  byte		'b' (typsend format), 't' (text format) or 'n' (NULL)
+ *	  int32		length of the value, then the value (except for 'n')
+ *
+ * Each backend keeps the files of the captures that are running open (see
+ * localWorkloads) and writes each record with a single write() to a file
+ * opened with O_APPEND, so records from different backends don't mix.
+ *
+ * A capture stops by itself once its file would grow past MaxWorkloadBytes,
+ * or if a record can't be written (say, because the disk is full), so that
+ * a busy function can't fill up the data directory.
+ */
+#define MaxWorkloadCaptures	16		/* Number of captures at any one time */
+#define MaxWorkloadBytes	((off_t) 256 * 1024 * 1024)	/* Size limit of a workload file */
+#define ProfilerDir			"pldebugger"
+#define WorkloadMagic		"PLDBGWL1"
+
+typedef struct
+{
+	uint32		id;				/* 0 if the slot is free */
+	Oid			dbOid;
+	Oid			funcOid;
+} workload_slot_t;
+
+/*
+ * A breakpoint action list (see pldbg_set_breakpoint_actions()) is carried
+ * out by the target itself each time it reaches the line, in the database
+ * the list was set in, without a debugger. The results go into a ring
+ * buffer of the last 'keep' of them, one per action that has a result.
+ * 'actions' holds the actions one after the other, each NUL-terminated,
+ * followed by an empty string.
+ */
+#define MaxActionLists		16		/* Number of action lists at any one time */
+#define MaxActions			16		/* Actions in a list */
+#define ActionListLen		1024	/* Room for the actions of a list */
+#define ActionResultsKept	64		/* Most results a list can keep */
+#define ActionResultLen		256		/* Longer results are truncated */
+
+typedef struct
+{
+	uint64		hit;			/* Which hit of the line this came from */
+	TimestampTz	time;
+	int			pid;
+	int			action;			/* Index (from 1) into the action list */
+	bool		isnull;
+	char		result[ActionResultLen];
+} action_result_t;
+
+typedef struct
+{
+	uint32		id;				/* 0 if the slot is free */
+	Oid			dbOid;
+	Oid			funcOid;
+	int			lineNumber;
+	char		actions[ActionListLen];
+	int			keep;
+	uint64		hits;
+	uint64		counter;		/* Bumped by each 'count' action */
+	int			nResults;
+	int			nextResult;		/* Where the next result goes */
+	action_result_t results[ActionResultsKept];
+} action_slot_t;
+
+/*
+ * The line profile counts, for each line of each PL function that runs
+ * while pldebugger.profile is on, how many times it ran and how long it
+ * took (including the statements nested in it, like the body of a loop),
+ * how many buffers the SQL it ran found in (or had to read into) shared
+ * buffers, and how many errors were raised at it. Line 0 of a function
+ * stands for the function as a whole. The counts go
+ * into a shared hash table, but each backend first adds them up in a table
+ * of its own (localLineStats) and only adds those to the shared one at the
+ * end of each transaction, so that we don't take the lock every statement.
+ *
+ * A snapshot (see pldbg_profile_snapshot()) is a copy of the shared table
+ * in a file in ProfilerDir: SnapshotMagic, the number of entries, and the
+ * line_stats_t entries themselves, in this server's byte order.
+ */
+#define LineProfileEntries	8192	/* Lines we keep track of, in all */
+#define SnapshotMagic		"PLDBGPS1"
+#define SnapshotNameLen		64
+
+typedef struct
+{
+	Oid			dbOid;
+	Oid			funcOid;
+	int			lineNumber;		/* 0 for the function as a whole */
+} line_stats_key_t;
+
+typedef struct
+{
+	line_stats_key_t key;
+	uint64		count;			/* Times the line ran (or calls, for line 0) */
+	uint64		totalUsecs;
+	uint64		maxUsecs;
+	uint64		blksHit;		/* Shared and local buffer hits */
+	uint64		blksRead;		/* Shared and local buffer reads */
+	uint64		exceptions;		/* Errors raised at (or through) the line */
+} line_stats_t;
+
+static HTAB *lineStats = NULL;
+static HTAB *localLineStats = NULL;
+
+/*
+ * Alongside the line profile, we count how many times each SQL statement
+ * inside a loop runs, and how many times the loop around it is entered, so
+ * that pldbg_get_loop_queries() can point out loops that run a query per
+ * iteration (the N+1 problem). The loop entries are kept under sqlLine 0.
+ * These counts go through a backend-local table too, and are reset along
+ * with the line profile, but they aren't part of snapshots or exports.
+ */
+#define LoopQueryEntries	2048	/* Loops and queries we keep track of, in all */
+
+typedef struct
+{
+	Oid			dbOid;
+	Oid			funcOid;
+	int			loopLine;
+	int			sqlLine;		/* 0 for the loop itself */
+} loop_query_key_t;
+
+typedef struct
+{
+	loop_query_key_t key;
+	uint64		count;			/* Times the query ran (or the loop was entered) */
+	uint64		totalUsecs;		/* Time the query took, in all */
+} loop_query_t;
+
+static HTAB *loopQueries = NULL;
+static HTAB *localLoopQueries = NULL;
+
+/*
+ * The line profile also keeps track of how the cached plan of each SQL
+ * statement behaves: how often it is built, whether a custom or the generic
+ * plan is chosen, how long planning takes, and how often the statement
+ * finds its plan invalidated (see pldbg_get_plan_stats()). Lines that never
+ * use a cached plan, or never plan after their first run, cost nothing past
+ * the first. Like the loop query counts, these aren't part of snapshots or
+ * exports.
+ */
+#define PlanStatsEntries	2048	/* Lines we keep plan counts for, in all */
+
+typedef struct
+{
+	line_stats_key_t key;
+	uint64		builds;			/* Plans built (custom or generic) */
+	uint64		customPlans;	/* Times a custom plan was chosen */
+	uint64		genericPlans;	/* Times the generic plan was chosen */
+	uint64		invalidations;	/* Times the plan had been invalidated */
+	uint64		planUsecs;		/* Time spent planning, in all */
+} plan_stats_t;
+
+static HTAB *planStats = NULL;
+static HTAB *localPlanStats = NULL;
+
+uint64		planningUsecs = 0;	/* Time this backend has spent planning */
+
+static planner_hook_type prevPlannerHook = NULL;
+
+/*
+ * While a function in the line profile runs, a timer samples the event this
+ * backend is waiting on (if any) every WaitSampleMsecs, and adds that much
+ * time to waitUsage under the kind of wait it is. Each statement then gets
+ * the waits sampled while it ran (see pldbg_get_wait_stats()), so that lock
+ * contention and slow IO can be traced back to the line that caused them.
+ * Sampling needs PostgreSQL 14 or later (for periodic timeouts).
+ */
+#define WaitSampleMsecs		10
+#define WaitStatsEntries	2048	/* Lines we keep wait times for, in all */
+
+typedef struct
+{
+	line_stats_key_t key;
+	uint64		lockUsecs;		/* Heavyweight lock waits */
+	uint64		lwlockUsecs;	/* Lightweight lock waits */
+	uint64		ioUsecs;		/* IO waits */
+} wait_stats_t;
+
+static HTAB *waitStats = NULL;
+static HTAB *localWaitStats = NULL;
+
+volatile wait_usage_t waitUsage;	/* Waits this backend has sampled */
+
+#if (PG_VERSION_NUM >= 140000)
+static bool waitTimeoutRegistered = false;
+static TimeoutId waitTimeout;
+static void *waitSampleOwner = NULL;	/* Frame that started the timer */
+static int	waitSampleNestLevel = 0;	/* ... and its transaction nest level */
+#endif
+
+/*
+ * An exported profile (see pldbg_export_profile()) is a file in ProfilerDir
+ * that can be copied to another server and merged with the profiles of
+ * other servers (see pldbg_merge_profiles()). Unlike a snapshot, it is in
+ * network byte order, and it identifies functions by schema-qualified name
+ * and argument types rather than by OID, which differs from one server to
+ * the next. It holds:
+ *
+ *	ExportMagic, and the format version (uint16)
+ *	the number of servers it came from (uint32), and the system identifier
+ *	of each (uint64), so that we don't count a server twice
+ *	the number of functions (uint32), and for each function:
+ *		its identity (uint32 length, and the text)
+ *		the number of lines (uint32), and for each line:
+ *			lineNumber (int32), and count, totalUsecs, maxUsecs, blksHit,
+ *			blksRead and exceptions (uint64 each)
+ *
+ * Readers reject files written in a later version of the format.
+ */
+#define ExportMagic			"PLDBGPX1"
+#define ExportVersion		1
+#define ExportNodeSize		8			/* Bytes per node in the file */
+#define ExportLineSize		(4 + 7 * 8)	/* Bytes per line in the file */
+
+typedef struct
+{
+	char	   *func;			/* schema.name(argtypes) */
+	int			lineNumber;
+	uint64		count;
+	uint64		totalUsecs;
+	uint64		maxUsecs;
+	uint64		blksHit;
+	uint64		blksRead;
+	uint64		exceptions;
+} export_line_t;
+
+typedef struct
+{
+	int			nodeCount;
+	uint64	   *nodes;			/* System identifiers */
+	int			lineCount;
+	export_line_t *lines;
+} export_profile_t;
+
+bool		profileLines = false;	/* pldebugger.profile */
+
+typedef struct
+{
+	pg_atomic_uint32 generation;
+	uint32		nextId;
+	profile_slot_t slots[MaxValueProfiles];
+	slow_call_slot_t captures[MaxSlowCallCaptures];
+	workload_slot_t workloads[MaxWorkloadCaptures];
+	action_slot_t actionLists[MaxActionLists];
+} profiler_shared_t;
+
+static profiler_shared_t *profiler = NULL;
+
+/*
+ * Our copy of the profile definitions, current as of localGeneration.
+ */
+typedef struct
+{
+	int			slot;
+	uint32		id;
+	Oid			dbOid;
+	Oid			funcOid;
+	int			lineNumber;
+	char		varName[NAMEDATALEN];
+	int			sampleEvery;
+} profile_def_t;
+
+typedef struct
+{
+	int			slot;
+	uint32		id;
+	Oid			dbOid;
+	Oid			funcOid;
+} capture_def_t;
+
+typedef struct
+{
+	uint32		id;
+	Oid			dbOid;
+	Oid			funcOid;
+	int			fd;				/* -1 if not open yet, -2 if we couldn't open it */
+} workload_def_t;
+
+typedef struct
+{
+	int			slot;
+	uint32		id;
+	Oid			funcOid;
+	int			lineNumber;
+	char		actions[ActionListLen];
+} action_def_t;
+
+static profile_def_t localDefs[MaxValueProfiles];
+static int localDefCount = 0;
+static capture_def_t localCaptures[MaxSlowCallCaptures];
+static int localCaptureCount = 0;
+static workload_def_t localWorkloads[MaxWorkloadCaptures];
+static int localWorkloadCount = 0;
+static action_def_t localActionLists[MaxActionLists];
+static int localActionListCount = 0;
+static uint32 localGeneration = 0;
+
+/**********************************************************************
+ * Prototypes for static functions
+ **********************************************************************/
+static void profiler_init(void);
+static void refreshProfiles(void);
+static int findProfileSlot(Oid funcOid, int lineNumber, const char *varName);
+static void recordSample(profile_slot_t *slot, const char *value, bool isnull);
+static int findCaptureSlot(Oid funcOid);
+static void recordSlowCall(slow_call_slot_t *slot, uint64 usecs, const char *args, const char *callers);
+static int findWorkloadSlot(Oid funcOid);
+static void workloadFilePath(char *path, Oid dbOid, Oid funcOid);
+static void stopWorkloadCapture(workload_def_t *def);
+static int findActionSlot(Oid funcOid, int lineNumber);
+static char *parseAction(const char *action, char **argument);
+static void recordActionResult(action_slot_t *slot, uint64 hit, int action, const char *result);
+static void checkProfilePermission(Oid funcOid);
+static uint32 nextProfileId(void);
+static void flushLineStats(void);
+static void flushLoopQueries(void);
+static void flushPlanStats(void);
+static void flushWaitStats(void);
+static void stopWaitSampling(void);
+static void profilerXactCallback(XactEvent event, void *arg);
+#if (PG_VERSION_NUM >= 140000)
+static void profilerSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+									SubTransactionId parentSubid, void *arg);
+#endif
+static line_stats_t *readProfile(const char *snapshot, int *count);
+static void checkProfileName(const char *name);
+static void makeProfilerDir(void);
+static int compareDeltas(const void *a, const void *b);
+static int compareExportLines(const void *a, const void *b);
+static void readExport(const char *name, export_profile_t *profile);
+static int	readExportCount(StringInfo contents, int recordSize, const char *path);
+static void combineExport(export_profile_t *profile);
+static void writeExport(const char *name, export_profile_t *profile);
+static int compareCounters(const void *a, const void *b);
+static int compareSlowCalls(const void *a, const void *b);
+static int comparePlanStats(const void *a, const void *b);
+
+/**********************************************************************
+ * Initialization routines
+ **********************************************************************/
+
+/*
+ * Reserves the right amount of shared memory, when the library is
+ * preloaded by shared_preload_libraries.
+ */
+void
+profiler_reserve(void)
+{
+	RequestAddinShmemSpace(sizeof(profiler_shared_t));
+	RequestAddinShmemSpace(hash_estimate_size(LineProfileEntries, sizeof(line_stats_t)));
+	RequestAddinShmemSpace(hash_estimate_size(LoopQueryEntries, sizeof(loop_query_t)));
+	RequestAddinShmemSpace(hash_estimate_size(PlanStatsEntries, sizeof(plan_stats_t)));
+	RequestAddinShmemSpace(hash_estimate_size(WaitStatsEntries, sizeof(wait_stats_t)));
+}
+
+/*
+ * Initialize profile slots in shared memory.
+ */
+static void
+profiler_init(void)
+{
+	bool found;
+
+	if (profiler)
+		return;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+	profiler = ShmemInitStruct("Debugger Value Profiles", sizeof(profiler_shared_t), &found);
+	if (profiler == NULL)
+		elog(ERROR, "out of shared memory");
+
+	if (!found)
+	{
+		int i;
+
+		/* Start at 1, so that every backend reads the definitions once */
+		pg_atomic_init_u32(&profiler->generation, 1);
+		profiler->nextId = 1;
+
+		for (i = 0; i < MaxValueProfiles; i++)
+		{
+			profiler->slots[i].id = 0;
+			pg_atomic_init_u64(&profiler->slots[i].executions, 0);
+		}
+
+		for (i = 0; i < MaxSlowCallCaptures; i++)
+			profiler->captures[i].id = 0;
+
+		for (i = 0; i < MaxWorkloadCaptures; i++)
+			profiler->workloads[i].id = 0;
+
+		for (i = 0; i < MaxActionLists; i++)
+			profiler->actionLists[i].id = 0;
+	}
+
+	{
+		HASHCTL		ctl = {0};
+
+		ctl.keysize = sizeof(line_stats_key_t);
+		ctl.entrysize = sizeof(line_stats_t);
+		ctl.hash = tag_hash;
+
+		lineStats = ShmemInitHash("Debugger Line Profile", LineProfileEntries, LineProfileEntries, &ctl, HASH_ELEM | HASH_FUNCTION);
+
+		ctl.keysize = sizeof(loop_query_key_t);
+		ctl.entrysize = sizeof(loop_query_t);
+
+		loopQueries = ShmemInitHash("Debugger Loop Queries", LoopQueryEntries, LoopQueryEntries, &ctl, HASH_ELEM | HASH_FUNCTION);
+
+		ctl.keysize = sizeof(line_stats_key_t);
+		ctl.entrysize = sizeof(plan_stats_t);
+
+		planStats = ShmemInitHash("Debugger Plan Stats", PlanStatsEntries, PlanStatsEntries, &ctl, HASH_ELEM | HASH_FUNCTION);
+
+		ctl.keysize = sizeof(line_stats_key_t);
+		ctl.entrysize = sizeof(wait_stats_t);
+
+		waitStats = ShmemInitHash("Debugger Wait Stats", WaitStatsEntries, WaitStatsEntries, &ctl, HASH_ELEM | HASH_FUNCTION);
+	}
+	LWLockRelease(getPLDebuggerLock());
+}
+
+/*
+ * Re-read the profile definitions from shared memory if anybody has
+ * created or dropped a profile since we last looked.
+ */
+static void
+refreshProfiles(void)
+{
+	workload_def_t oldWorkloads[MaxWorkloadCaptures];
+	int			oldWorkloadCount;
+	int			i;
+	int			j;
+
+	profiler_init();
+
+	if (pg_atomic_read_u32(&profiler->generation) == localGeneration)
+		return;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+	localGeneration = pg_atomic_read_u32(&profiler->generation);
+	localDefCount = 0;
+
+	for (i = 0; i < MaxValueProfiles; i++)
+	{
+		profile_slot_t *slot = &profiler->slots[i];
+		profile_def_t  *def;
+
+		if (slot->id == 0 || slot->dbOid != MyDatabaseId)
+			continue;
+
+		def = &localDefs[localDefCount++];
+		def->slot = i;
+		def->id = slot->id;
+		def->dbOid = slot->dbOid;
+		def->funcOid = slot->funcOid;
+		def->lineNumber = slot->lineNumber;
+		def->sampleEvery = slot->sampleEvery;
+		strlcpy(def->varName, slot->varName, NAMEDATALEN);
+	}
+
+	localCaptureCount = 0;
+
+	for (i = 0; i < MaxSlowCallCaptures; i++)
+	{
+		slow_call_slot_t *slot = &profiler->captures[i];
+		capture_def_t  *def;
+
+		if (slot->id == 0 || slot->dbOid != MyDatabaseId)
+			continue;
+
+		def = &localCaptures[localCaptureCount++];
+		def->slot = i;
+		def->id = slot->id;
+		def->dbOid = slot->dbOid;
+		def->funcOid = slot->funcOid;
+	}
+
+	/*
+	 * Hang on to the files we already have open for workload captures that
+	 * are still running, and close the rest.
+	 */
+	oldWorkloadCount = localWorkloadCount;
+	memcpy(oldWorkloads, localWorkloads, sizeof(workload_def_t) * localWorkloadCount);
+	localWorkloadCount = 0;
+
+	for (i = 0; i < MaxWorkloadCaptures; i++)
+	{
+		workload_slot_t *slot = &profiler->workloads[i];
+		workload_def_t *def;
+
+		if (slot->id == 0 || slot->dbOid != MyDatabaseId)
+			continue;
+
+		def = &localWorkloads[localWorkloadCount++];
+		def->id = slot->id;
+		def->dbOid = slot->dbOid;
+		def->funcOid = slot->funcOid;
+		def->fd = -1;
+
+		for (j = 0; j < oldWorkloadCount; j++)
+		{
+			if (oldWorkloads[j].id == def->id)
+			{
+				def->fd = oldWorkloads[j].fd;
+				oldWorkloads[j].fd = -1;
+			}
+		}
+	}
+
+	localActionListCount = 0;
+
+	for (i = 0; i < MaxActionLists; i++)
+	{
+		action_slot_t *slot = &profiler->actionLists[i];
+		action_def_t *def;
+
+		if (slot->id == 0 || slot->dbOid != MyDatabaseId)
+			continue;
+
+		def = &localActionLists[localActionListCount++];
+		def->slot = i;
+		def->id = slot->id;
+		def->funcOid = slot->funcOid;
+		def->lineNumber = slot->lineNumber;
+		memcpy(def->actions, slot->actions, ActionListLen);
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	for (j = 0; j < oldWorkloadCount; j++)
+	{
+		if (oldWorkloads[j].fd >= 0)
+			close(oldWorkloads[j].fd);
+	}
+}
+
+/**********************************************************************
+ * Routines called by the language plugins
+ **********************************************************************/
+
+/*
+ * profiler_wants_function
+ *
+ * Returns TRUE if there's a value profile on any line of the given function.
+ * This is called every time a function starts, so it must be cheap when
+ * nothing is being profiled.
+ */
+bool
+profiler_wants_function(Oid funcOid)
+{
+	int i;
+
+	refreshProfiles();
+
+	for (i = 0; i < localDefCount; i++)
+	{
+		if (localDefs[i].funcOid == funcOid)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * profiler_sample_line
+ *
+ * Called just before the given line of a profiled function runs. For each
+ * profile on this line, counts the execution and, every sampleEvery'th time,
+ * asks 'fetch' for the variable's value and adds it to the profile.
+ */
+void
+profiler_sample_line(Oid funcOid, int lineNumber, profile_fetch_fn fetch, void *arg)
+{
+	int i;
+
+	refreshProfiles();
+
+	for (i = 0; i < localDefCount; i++)
+	{
+		profile_def_t  *def = &localDefs[i];
+		profile_slot_t *slot = &profiler->slots[def->slot];
+		char		   *value;
+		bool			isnull = false;
+
+		if (def->funcOid != funcOid || def->lineNumber != lineNumber)
+			continue;
+
+		if (pg_atomic_fetch_add_u64(&slot->executions, 1) % def->sampleEvery != 0)
+			continue;
+
+		/*
+		 * Fetch the value before we take the lock: the output function may
+		 * take a while, or even throw an error.
+		 */
+		value = fetch(arg, def->varName, &isnull);
+
+		if (value == NULL)
+			continue;
+
+		if (!isnull)
+			value[pg_mbcliplen(value, strlen(value), ProfileValueLen - 1)] = '\0';
+
+		LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+		/* Make sure nobody dropped (and reused) the slot in the meantime */
+		if (slot->id == def->id)
+			recordSample(slot, value, isnull);
+
+		LWLockRelease(getPLDebuggerLock());
+
+		pfree(value);
+	}
+}
+
+/*
+ * recordSample
+ *
+ * Adds one sample to the given profile (see the Space-Saving description
+ * above). The caller must hold getPLDebuggerLock() exclusively.
+ */
+static void
+recordSample(profile_slot_t *slot, const char *value, bool isnull)
+{
+	profile_counter_t *counter;
+	profile_counter_t *smallest = NULL;
+	int			i;
+
+	for (i = 0; i < slot->nCounters; i++)
+	{
+		counter = &slot->counters[i];
+
+		if (counter->isnull == isnull && (isnull || strcmp(counter->value, value) == 0))
+		{
+			counter->count++;
+			return;
+		}
+
+		if (smallest == NULL || counter->count < smallest->count)
+			smallest = counter;
+	}
+
+	if (slot->nCounters < ProfileCounters)
+	{
+		counter = &slot->counters[slot->nCounters++];
+		counter->count = 1;
+		counter->error = 0;
+	}
+	else
+	{
+		counter = smallest;
+		counter->error = counter->count;
+		counter->count++;
+	}
+
+	counter->isnull = isnull;
+	strlcpy(counter->value, isnull ? "" : value, ProfileValueLen);
+}
+
+/*
+ * profiler_times_function
+ *
+ * Returns TRUE if we're capturing the slowest invocations of the given
+ * function, in which case the caller should time each invocation and pass
+ * the result to profiler_record_call(). Like profiler_wants_function(), this
+ * is called every time a function starts.
+ */
+bool
+profiler_times_function(Oid funcOid)
+{
+	int i;
+
+	refreshProfiles();
+
+	for (i = 0; i < localCaptureCount; i++)
+	{
+		if (localCaptures[i].funcOid == funcOid)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * profiler_record_call
+ *
+ * Called when an invocation of a function that we're timing ends, with the
+ * number of microseconds it took. If the invocation is one of the slowest
+ * we've seen, asks 'describe' for its arguments and callers and keeps it.
+ */
+void
+profiler_record_call(Oid funcOid, uint64 usecs, call_describe_fn describe, void *arg)
+{
+	int i;
+
+	refreshProfiles();
+
+	for (i = 0; i < localCaptureCount; i++)
+	{
+		capture_def_t  *def = &localCaptures[i];
+		slow_call_slot_t *slot = &profiler->captures[def->slot];
+		char		   *args;
+		char		   *callers;
+
+		if (def->funcOid != funcOid)
+			continue;
+
+		/*
+		 * Most invocations won't be slow enough to get in, so peek at the
+		 * heap (without the lock - we check again below) before we go to
+		 * the trouble of describing this one.
+		 */
+		if (slot->nCalls >= slot->keep && usecs <= slot->calls[0].usecs)
+			continue;
+
+		describe(arg, &args, &callers);
+
+		args[pg_mbcliplen(args, strlen(args), SlowCallTextLen - 1)] = '\0';
+		callers[pg_mbcliplen(callers, strlen(callers), SlowCallTextLen - 1)] = '\0';
+
+		LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+		if (slot->id == def->id)
+			recordSlowCall(slot, usecs, args, callers);
+
+		LWLockRelease(getPLDebuggerLock());
+
+		pfree(args);
+		pfree(callers);
+	}
+}
+
+/*
+ * recordSlowCall
+ *
+ * Adds an invocation to the given capture's heap, pushing out the fastest
+ * one if the heap is full (or doing nothing if that one is slower still).
+ * The caller must hold getPLDebuggerLock() exclusively.
+ */
+static void
+recordSlowCall(slow_call_slot_t *slot, uint64 usecs, const char *args, const char *callers)
+{
+	slow_call_t *call;
+	int			i;
+
+	if (slot->nCalls < slot->keep)
+	{
+		/* Add it at the bottom and sift it up */
+		i = slot->nCalls++;
+
+		while (i > 0 && slot->calls[(i - 1) / 2].usecs > usecs)
+		{
+			slot->calls[i] = slot->calls[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+	}
+	else if (usecs > slot->calls[0].usecs)
+	{
+		/* Replace the fastest one and sift the new one down */
+		i = 0;
+
+		for (;;)
+		{
+			int			child = 2 * i + 1;
+
+			if (child >= slot->nCalls)
+				break;
+
+			if (child + 1 < slot->nCalls && slot->calls[child + 1].usecs < slot->calls[child].usecs)
+				child++;
+
+			if (slot->calls[child].usecs >= usecs)
+				break;
+
+			slot->calls[i] = slot->calls[child];
+			i = child;
+		}
+	}
+	else
+		return;
+
+	call = &slot->calls[i];
+	call->usecs = usecs;
+	call->ended = GetCurrentTimestamp();
+	call->pid = MyProcPid;
+	strlcpy(call->args, args, SlowCallTextLen);
+	strlcpy(call->callers, callers, SlowCallTextLen);
+}
+
+/*
+ * profiler_records_function
+ *
+ * Returns TRUE if we're capturing the workload of the given function, in
+ * which case the caller should pass each invocation (once its arguments
+ * have been set up) to profiler_record_workload().
+ */
+bool
+profiler_records_function(Oid funcOid)
+{
+	int i;
+
+	refreshProfiles();
+
+	for (i = 0; i < localWorkloadCount; i++)
+	{
+		if (localWorkloads[i].funcOid == funcOid)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * profiler_record_workload
+ *
+ * Appends a record of an invocation of the given function to its workload
+ * file. 'appendArgs' adds the arguments (with profiler_append_arg()) and
+ * returns how many it added.
+ */
+void
+profiler_record_workload(Oid funcOid, call_args_fn appendArgs, void *arg)
+{
+	workload_def_t *def = NULL;
+	StringInfoData buf;
+	int			countOffset;
+	uint32		length;
+	uint16		count;
+	int			i;
+
+	refreshProfiles();
+
+	for (i = 0; i < localWorkloadCount; i++)
+	{
+		if (localWorkloads[i].funcOid == funcOid)
+			def = &localWorkloads[i];
+	}
+
+	if (def == NULL || def->fd == -2)
+		return;
+
+	if (def->fd == -1)
+	{
+		char		path[MAXPGPATH];
+
+		/*
+		 * pldbg_start_workload_capture() created the file, so if it isn't
+		 * there any more, somebody removed it; don't keep trying.
+		 */
+		workloadFilePath(path, def->dbOid, def->funcOid);
+#if (PG_VERSION_NUM >= 110000)
+		def->fd = BasicOpenFile(path, O_WRONLY | O_APPEND | PG_BINARY);
+#else
+		def->fd = BasicOpenFile(path, O_WRONLY | O_APPEND | PG_BINARY, 0);
+#endif
+		if (def->fd < 0)
+		{
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not open workload file \"%s\": %m", path)));
+			def->fd = -2;
+			return;
+		}
+	}
+
+	initStringInfo(&buf);
+
+	pq_sendint32(&buf, 0);				/* Length, filled in below */
+	pq_sendint64(&buf, GetCurrentTimestamp());
+	pq_sendint32(&buf, GetOuterUserId());
+	countOffset = buf.len;
+	pq_sendint16(&buf, 0);				/* Argument count, ditto */
+
+	count = pg_hton16((uint16) appendArgs(arg, &buf));
+	memcpy(buf.data + countOffset, &count, sizeof(count));
+
+	length = pg_hton32((uint32) (buf.len - sizeof(length)));
+	memcpy(buf.data, &length, sizeof(length));
+
+	if (lseek(def->fd, 0, SEEK_END) + buf.len > MaxWorkloadBytes)
+	{
+		ereport(LOG,
+				(errmsg("stopped the workload capture of function %u, its file has reached the size limit", funcOid)));
+		stopWorkloadCapture(def);
+	}
+	else if (write(def->fd, buf.data, buf.len) != buf.len)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not write workload record for function %u, stopped the capture: %m", funcOid)));
+		stopWorkloadCapture(def);
+	}
+
+	pfree(buf.data);
+}
+
+/*
+ * Stops the given workload capture, in this backend at once (so that we
+ * only complain about it once) and in the others the next time they look.
+ */
+static void
+stopWorkloadCapture(workload_def_t *def)
+{
+	int			i;
+
+	close(def->fd);
+	def->fd = -2;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	for (i = 0; i < MaxWorkloadCaptures; i++)
+	{
+		if (profiler->workloads[i].id == def->id)
+		{
+			profiler->workloads[i].id = 0;
+			pg_atomic_fetch_add_u32(&profiler->generation, 1);
+		}
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+}
+
+/*
+ * profiler_append_arg
+ *
+ * Appends one argument to a workload record: binary is the value in its
+ * type's send format, or NULL if the type doesn't have one, in which case
+ * text is the value in its text format.
+ */
+void
+profiler_append_arg(StringInfo buf, Oid typoid, bool isnull, bytea *binary, const char *text)
+{
+	pq_sendint32(buf, typoid);
+
+	if (isnull)
+		pq_sendbyte(buf, 'n');
+	else if (binary)
+	{
+		pq_sendbyte(buf, 'b');
+		pq_sendint32(buf, VARSIZE(binary) - VARHDRSZ);
+		pq_sendbytes(buf, VARDATA(binary), VARSIZE(binary) - VARHDRSZ);
+	}
+	else
+	{
+		pq_sendbyte(buf, 't');
+		pq_sendint32(buf, strlen(text));
+		pq_sendbytes(buf, text, strlen(text));
+	}
+}
+
+/*
+ * profiler_has_actions
+ *
+ * Returns true if any line of the given function has a breakpoint action
+ * list.
+ */
+bool
+profiler_has_actions(Oid funcOid)
+{
+	int			i;
+
+	refreshProfiles();
+
+	for (i = 0; i < localActionListCount; i++)
+	{
+		if (localActionLists[i].funcOid == funcOid)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Splits an action into its keyword, which we return, and the rest, which
+ * goes into *argument (an empty string if there's nothing else). Both are
+ * palloc'd.
+ */
+static char *
+parseAction(const char *action, char **argument)
+{
+	const char *end;
+	const char *start;
+	const char *last;
+
+	while (isspace((unsigned char) *action))
+		action++;
+
+	for (end = action; *end && !isspace((unsigned char) *end); end++)
+		;
+
+	for (start = end; isspace((unsigned char) *start); start++)
+		;
+
+	for (last = start + strlen(start); last > start && isspace((unsigned char) last[-1]); last--)
+		;
+
+	*argument = pnstrdup(start, last - start);
+
+	return pnstrdup(action, end - action);
+}
+
+/*
+ * Adds a result to the ring buffer of the given action list. The caller
+ * must hold the lock.
+ */
+static void
+recordActionResult(action_slot_t *slot, uint64 hit, int action, const char *result)
+{
+	action_result_t *entry = &slot->results[slot->nextResult];
+
+	entry->hit = hit;
+	entry->time = GetCurrentTimestamp();
+	entry->pid = MyProcPid;
+	entry->action = action;
+	entry->isnull = (result == NULL);
+
+	if (result != NULL)
+	{
+		int			len = strlen(result);
+
+		if (len >= ActionResultLen)
+			len = pg_mbcliplen(result, len, ActionResultLen - 1);
+		memcpy(entry->result, result, len);
+		entry->result[len] = '\0';
+	}
+	else
+		entry->result[0] = '\0';
+
+	slot->nextResult = (slot->nextResult + 1) % slot->keep;
+	if (slot->nResults < slot->keep)
+		slot->nResults++;
+}
+
+/*
+ * profiler_run_actions
+ *
+ * Carries out the breakpoint action list (if any) of the given line, in the
+ * frame that 'arg' points to: 'vars' fetches each variable with fetch,
+ * 'stack' describes the callers with describe, and 'eval' evaluates an
+ * expression with evaluate. Returns true if the list ends with 'continue'
+ * (as it does by default), meaning that the target should carry on without
+ * stopping at this line.
+ */
+bool
+profiler_run_actions(Oid funcOid, int lineNumber, profile_fetch_fn fetch, call_describe_fn describe, action_eval_fn evaluate, void *arg)
+{
+	char		actions[ActionListLen];
+	char	   *results[MaxActions];
+	bool		counts[MaxActions];
+	bool		carryOn = true;
+	uint32		id = 0;
+	int			slotNo = -1;
+	int			nActions = 0;
+	char	   *action;
+	int			i;
+
+	refreshProfiles();
+
+	for (i = 0; i < localActionListCount; i++)
+	{
+		if (localActionLists[i].funcOid == funcOid && localActionLists[i].lineNumber == lineNumber)
+		{
+			/* Evaluating an expression may refresh localActionLists, so copy it */
+			memcpy(actions, localActionLists[i].actions, ActionListLen);
+			id = localActionLists[i].id;
+			slotNo = localActionLists[i].slot;
+			break;
+		}
+	}
+
+	if (slotNo == -1)
+		return false;
+
+	for (action = actions; *action; action += strlen(action) + 1)
+	{
+		char	   *argument;
+		char	   *keyword = parseAction(action, &argument);
+
+		results[nActions] = NULL;
+		counts[nActions] = false;
+
+		if (strcmp(keyword, "vars") == 0)
+		{
+			StringInfoData buf;
+			List	   *names = NIL;
+			ListCell   *cell;
+			const char *delimiter = "";
+
+			initStringInfo(&buf);
+
+			/*
+			 * fetch may run code of its own, so don't keep any state in
+			 * static storage (as strtok() would) while we walk the list.
+			 * The list was checked when it was set.
+			 */
+			(void) SplitIdentifierString(argument, ',', &names);
+
+			foreach(cell, names)
+			{
+				char	   *name = (char *) lfirst(cell);
+				bool		isnull = false;
+				char	   *value = fetch(arg, name, &isnull);
+
+				appendStringInfo(&buf, "%s%s=%s", delimiter, name,
+								 value == NULL ? "?" : isnull ? "NULL" : value);
+				delimiter = ", ";
+			}
+
+			list_free(names);
+			results[nActions] = buf.data;
+		}
+		else if (strcmp(keyword, "stack") == 0)
+		{
+			char	   *args;
+			char	   *callers;
+
+			describe(arg, &args, &callers);
+
+			results[nActions] = psprintf("%s:%d%s%s", format_procedure(funcOid), lineNumber,
+										 callers[0] ? " <- " : "", callers);
+		}
+		else if (strcmp(keyword, "eval") == 0)
+			results[nActions] = evaluate(arg, argument);
+		else if (strcmp(keyword, "count") == 0)
+			counts[nActions] = true;
+		else if (strcmp(keyword, "stop") == 0)
+			carryOn = false;
+
+		nActions++;
+	}
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	/* Make sure the list hasn't been dropped (or replaced) in the meantime */
+	if (profiler->actionLists[slotNo].id == id)
+	{
+		action_slot_t *slot = &profiler->actionLists[slotNo];
+		uint64		hit = ++slot->hits;
+
+		for (i = 0; i < nActions; i++)
+		{
+			if (counts[i])
+			{
+				char		counter[32];
+
+				snprintf(counter, sizeof(counter), UINT64_FORMAT, ++slot->counter);
+				recordActionResult(slot, hit, i + 1, counter);
+			}
+			else if (results[i] != NULL)
+				recordActionResult(slot, hit, i + 1, results[i]);
+		}
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	return carryOn;
+}
+
+/*
+ * profiler_prepare_lines
+ *
+ * Sets up this backend's line profile, if it hasn't been already. This has
+ * to happen before the first call to profiler_count_exception(), which runs
+ * while an error is being reported.
+ */
+void
+profiler_prepare_lines(void)
+{
+	HASHCTL		ctl = {0};
+
+	if (localLineStats != NULL)
+		return;
+
+	ctl.keysize = sizeof(line_stats_key_t);
+	ctl.entrysize = sizeof(line_stats_t);
+	ctl.hash = tag_hash;
+
+	/* Set up shared memory now, rather than at the end of the transaction */
+	profiler_init();
+
+	localLineStats = hash_create("pldebugger local line profile", 256, &ctl, HASH_ELEM | HASH_FUNCTION);
+
+	ctl.keysize = sizeof(loop_query_key_t);
+	ctl.entrysize = sizeof(loop_query_t);
+
+	localLoopQueries = hash_create("pldebugger local loop queries", 64, &ctl, HASH_ELEM | HASH_FUNCTION);
+
+	ctl.keysize = sizeof(line_stats_key_t);
+	ctl.entrysize = sizeof(plan_stats_t);
+
+	localPlanStats = hash_create("pldebugger local plan stats", 64, &ctl, HASH_ELEM | HASH_FUNCTION);
+
+	ctl.keysize = sizeof(line_stats_key_t);
+	ctl.entrysize = sizeof(wait_stats_t);
+
+	localWaitStats = hash_create("pldebugger local wait stats", 64, &ctl, HASH_ELEM | HASH_FUNCTION);
+
+	RegisterXactCallback(profilerXactCallback, NULL);
+}
+
+/*
+ * Returns this backend's entry for the given line, creating it if need be.
+ */
+static line_stats_t *
+lookupLocalLine(Oid funcOid, int lineNumber)
+{
+	line_stats_key_t key;
+	line_stats_t *entry;
+	bool		found;
+
+	memset(&key, 0, sizeof(key));
+	key.dbOid = MyDatabaseId;
+	key.funcOid = funcOid;
+	key.lineNumber = lineNumber;
+
+	entry = (line_stats_t *) hash_search(localLineStats, &key, HASH_ENTER, &found);
+
+	if (!found)
+		memset((char *) entry + sizeof(key), 0, sizeof(line_stats_t) - sizeof(key));
+
+	return entry;
+}
+
+/*
+ * profiler_count_line
+ *
+ * Adds one execution of the given line (or, for line 0, one call of the
+ * function) that took 'usecs' microseconds, and hit or read the given
+ * number of buffers, to the line profile.
+ */
+void
+profiler_count_line(Oid funcOid, int lineNumber, uint64 usecs, uint64 blksHit, uint64 blksRead)
+{
+	line_stats_t *entry;
+
+	profiler_prepare_lines();
+
+	entry = lookupLocalLine(funcOid, lineNumber);
+
+	entry->count++;
+	entry->totalUsecs += usecs;
+	if (usecs > entry->maxUsecs)
+		entry->maxUsecs = usecs;
+	entry->blksHit += blksHit;
+	entry->blksRead += blksRead;
+}
+
+/*
+ * profiler_count_exception
+ *
+ * Adds an error raised at the given line to the line profile. This is
+ * called from an error context callback, so it mustn't do much: in
+ * particular it doesn't set anything up (see profiler_prepare_lines()).
+ */
+void
+profiler_count_exception(Oid funcOid, int lineNumber)
+{
+	if (localLineStats == NULL)
+		return;
+
+	lookupLocalLine(funcOid, lineNumber)->exceptions++;
+}
+
+/*
+ * Returns this backend's entry for the given query in the given loop (or,
+ * if sqlLine is 0, for the loop itself), creating it if need be.
+ */
+static loop_query_t *
+lookupLocalLoopQuery(Oid funcOid, int loopLine, int sqlLine)
+{
+	loop_query_key_t key;
+	loop_query_t *entry;
+	bool		found;
+
+	memset(&key, 0, sizeof(key));
+	key.dbOid = MyDatabaseId;
+	key.funcOid = funcOid;
+	key.loopLine = loopLine;
+	key.sqlLine = sqlLine;
+
+	entry = (loop_query_t *) hash_search(localLoopQueries, &key, HASH_ENTER, &found);
+
+	if (!found)
+	{
+		entry->count = 0;
+		entry->totalUsecs = 0;
+	}
+
+	return entry;
+}
+
+/*
+ * profiler_count_loop_entry
+ *
+ * Adds one entry into the loop at the given line, which has SQL statements
+ * directly in its body, to the line profile.
+ */
+void
+profiler_count_loop_entry(Oid funcOid, int loopLine)
+{
+	profiler_prepare_lines();
+
+	lookupLocalLoopQuery(funcOid, loopLine, 0)->count++;
+}
+
+/*
+ * profiler_count_loop_query
+ *
+ * Adds one execution of the SQL statement at sqlLine, which is in the body
+ * of the loop at loopLine, and that took 'usecs' microseconds, to the line
+ * profile.
+ */
+void
+profiler_count_loop_query(Oid funcOid, int loopLine, int sqlLine, uint64 usecs)
+{
+	loop_query_t *entry;
+
+	profiler_prepare_lines();
+
+	entry = lookupLocalLoopQuery(funcOid, loopLine, sqlLine);
+
+	entry->count++;
+	entry->totalUsecs += usecs;
+}
+
+/*
+ * Times the planner, so that the line profile can tell how long each
+ * statement spent planning (see planningUsecs). We only look at the clock
+ * while pldebugger.profile is on.
+ */
+static PlannedStmt *
+profilerPlanner(Query *parse,
+#if (PG_VERSION_NUM >= 130000)
+				const char *queryString,
+#endif
+				int cursorOptions, ParamListInfo boundParams)
+{
+	PlannedStmt *result;
+	bool		timed = profileLines;
+	instr_time	start;
+	instr_time	elapsed;
+
+	INSTR_TIME_SET_ZERO(start);
+
+	if (timed)
+		INSTR_TIME_SET_CURRENT(start);
+
+#if (PG_VERSION_NUM >= 130000)
+	if (prevPlannerHook)
+		result = prevPlannerHook(parse, queryString, cursorOptions, boundParams);
+	else
+		result = standard_planner(parse, queryString, cursorOptions, boundParams);
+#else
+	if (prevPlannerHook)
+		result = prevPlannerHook(parse, cursorOptions, boundParams);
+	else
+		result = standard_planner(parse, cursorOptions, boundParams);
+#endif
+
+	if (timed)
+	{
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start);
+		planningUsecs += INSTR_TIME_GET_MICROSEC(elapsed);
+	}
+
+	return result;
+}
+
+/*
+ * profiler_install_hooks
+ *
+ * Installs the planner hook that keeps planningUsecs up to date. Called
+ * when the module is loaded.
+ */
+void
+profiler_install_hooks(void)
+{
+	prevPlannerHook = planner_hook;
+	planner_hook = profilerPlanner;
+}
+
+/*
+ * profiler_count_plan
+ *
+ * Adds what the cached plan of the SQL statement at the given line did
+ * while the statement ran to the line profile: the plans built, the custom
+ * and generic plans chosen, whether the plan had been invalidated when the
+ * statement started, and the time spent planning. Nothing is recorded if
+ * nothing happened.
+ */
+void
+profiler_count_plan(Oid funcOid, int lineNumber, uint64 builds, uint64 customPlans, uint64 genericPlans, bool invalidated, uint64 planUsecs)
+{
+	line_stats_key_t key;
+	plan_stats_t *entry;
+	bool		found;
+
+	if (builds == 0 && customPlans == 0 && genericPlans == 0 && !invalidated && planUsecs == 0)
+		return;
+
+	profiler_prepare_lines();
+
+	memset(&key, 0, sizeof(key));
+	key.dbOid = MyDatabaseId;
+	key.funcOid = funcOid;
+	key.lineNumber = lineNumber;
+
+	entry = (plan_stats_t *) hash_search(localPlanStats, &key, HASH_ENTER, &found);
+
+	if (!found)
+		memset((char *) entry + sizeof(key), 0, sizeof(plan_stats_t) - sizeof(key));
+
+	entry->builds += builds;
+	entry->customPlans += customPlans;
+	entry->genericPlans += genericPlans;
+	if (invalidated)
+		entry->invalidations++;
+	entry->planUsecs += planUsecs;
+}
+
+#if (PG_VERSION_NUM >= 140000)
+/*
+ * Called by the timer every WaitSampleMsecs while sampling is on. This runs
+ * in a signal handler, so all it does is add to waitUsage.
+ */
+static void
+waitSampleHandler(void)
+{
+	switch (*my_wait_event_info & 0xFF000000)
+	{
+		case PG_WAIT_LOCK:
+			waitUsage.lockUsecs += WaitSampleMsecs * 1000;
+			break;
+
+		case PG_WAIT_LWLOCK:
+			waitUsage.lwlockUsecs += WaitSampleMsecs * 1000;
+			break;
+
+		case PG_WAIT_IO:
+			waitUsage.ioUsecs += WaitSampleMsecs * 1000;
+			break;
+
+		default:
+			break;
+	}
+}
+#endif
+
+/*
+ * profiler_begin_wait_sampling
+ *
+ * Starts sampling waits, if they aren't being sampled already, on behalf
+ * of the frame 'owner' points to. Sampling goes on until that frame calls
+ * profiler_end_wait_sampling(), so the frames it calls don't start and stop
+ * the timer again. If the frame fails instead, sampling stops when the
+ * (sub)transaction that the error unwinds aborts; we note the nest level
+ * the frame began at, so that we can tell whether it was one of the frames
+ * that the abort threw out (see profilerSubXactCallback()). Otherwise, an
+ * EXCEPTION block further out would leave the timer running, and a frame
+ * that happened to be allocated at the same address could stop it.
+ */
+void
+profiler_begin_wait_sampling(void *owner)
+{
+#if (PG_VERSION_NUM >= 140000)
+	TimestampTz first;
+
+	if (!waitTimeoutRegistered)
+	{
+		waitTimeout = RegisterTimeout(USER_TIMEOUT, waitSampleHandler);
+		RegisterSubXactCallback(profilerSubXactCallback, NULL);
+		waitTimeoutRegistered = true;
+	}
+
+	/* An error may have stopped the timer without telling us */
+	if (get_timeout_active(waitTimeout))
+		return;
+
+	first = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), WaitSampleMsecs);
+
+	enable_timeout_every(waitTimeout, first, WaitSampleMsecs);
+	waitSampleOwner = owner;
+	waitSampleNestLevel = GetCurrentTransactionNestLevel();
+#endif
+}
+
+/*
+ * profiler_end_wait_sampling
+ *
+ * Stops sampling waits, if the frame 'owner' points to is the one that
+ * started it.
+ */
+void
+profiler_end_wait_sampling(void *owner)
+{
+#if (PG_VERSION_NUM >= 140000)
+	if (owner == waitSampleOwner)
+		stopWaitSampling();
+#endif
+}
+
+static void
+stopWaitSampling(void)
+{
+#if (PG_VERSION_NUM >= 140000)
+	if (waitTimeoutRegistered)
+		disable_timeout(waitTimeout, false);
+
+	waitSampleOwner = NULL;
+#endif
+}
+
+/*
+ * profiler_count_waits
+ *
+ * Adds the lock, lightweight lock and IO waits sampled while the statement
+ * at the given line ran to the line profile. Nothing is recorded if no
+ * waits were sampled.
+ */
+void
+profiler_count_waits(Oid funcOid, int lineNumber, uint64 lockUsecs, uint64 lwlockUsecs, uint64 ioUsecs)
+{
+	line_stats_key_t key;
+	wait_stats_t *entry;
+	bool		found;
+
+	if (lockUsecs == 0 && lwlockUsecs == 0 && ioUsecs == 0)
+		return;
+
+	profiler_prepare_lines();
+
+	memset(&key, 0, sizeof(key));
+	key.dbOid = MyDatabaseId;
+	key.funcOid = funcOid;
+	key.lineNumber = lineNumber;
+
+	entry = (wait_stats_t *) hash_search(localWaitStats, &key, HASH_ENTER, &found);
+
+	if (!found)
+		memset((char *) entry + sizeof(key), 0, sizeof(wait_stats_t) - sizeof(key));
+
+	entry->lockUsecs += lockUsecs;
+	entry->lwlockUsecs += lwlockUsecs;
+	entry->ioUsecs += ioUsecs;
+}
+
+/*
+ * Adds the counts we've collected in this backend to the shared line
+ * profile. If the shared table is full, counts for lines it doesn't have
+ * yet are lost.
+ */
+static void
+flushLineStats(void)
+{
+	HASH_SEQ_STATUS scan;
+	line_stats_t *local;
+
+	if (localLineStats == NULL ||
+		(hash_get_num_entries(localLineStats) == 0 &&
+		 hash_get_num_entries(localLoopQueries) == 0 &&
+		 hash_get_num_entries(localPlanStats) == 0 &&
+		 hash_get_num_entries(localWaitStats) == 0))
+		return;
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	hash_seq_init(&scan, localLineStats);
+
+	while ((local = (line_stats_t *) hash_seq_search(&scan)) != NULL)
+	{
+		line_stats_t *shared;
+		bool		found;
+
+		shared = (line_stats_t *) hash_search(lineStats, &local->key, HASH_ENTER_NULL, &found);
+
+		if (shared != NULL)
+		{
+			if (!found)
+				memset((char *) shared + sizeof(shared->key), 0, sizeof(line_stats_t) - sizeof(shared->key));
+
+			shared->count += local->count;
+			shared->totalUsecs += local->totalUsecs;
+			if (local->maxUsecs > shared->maxUsecs)
+				shared->maxUsecs = local->maxUsecs;
+			shared->blksHit += local->blksHit;
+			shared->blksRead += local->blksRead;
+			shared->exceptions += local->exceptions;
+		}
+
+		hash_search(localLineStats, &local->key, HASH_REMOVE, NULL);
+	}
+
+	flushLoopQueries();
+	flushPlanStats();
+	flushWaitStats();
+
+	LWLockRelease(getPLDebuggerLock());
+}
+
+/*
+ * Like flushLineStats(), for the loop query counts. The caller must hold
+ * getPLDebuggerLock() exclusively.
+ */
+static void
+flushLoopQueries(void)
+{
+	HASH_SEQ_STATUS scan;
+	loop_query_t *local;
+
+	hash_seq_init(&scan, localLoopQueries);
+
+	while ((local = (loop_query_t *) hash_seq_search(&scan)) != NULL)
+	{
+		loop_query_t *shared;
+		bool		found;
+
+		shared = (loop_query_t *) hash_search(loopQueries, &local->key, HASH_ENTER_NULL, &found);
+
+		if (shared != NULL)
+		{
+			if (!found)
+			{
+				shared->count = 0;
+				shared->totalUsecs = 0;
+			}
+
+			shared->count += local->count;
+			shared->totalUsecs += local->totalUsecs;
+		}
+
+		hash_search(localLoopQueries, &local->key, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * Like flushLineStats(), for the plan counts. The caller must hold
+ * getPLDebuggerLock() exclusively.
+ */
+static void
+flushPlanStats(void)
+{
+	HASH_SEQ_STATUS scan;
+	plan_stats_t *local;
+
+	hash_seq_init(&scan, localPlanStats);
+
+	while ((local = (plan_stats_t *) hash_seq_search(&scan)) != NULL)
+	{
+		plan_stats_t *shared;
+		bool		found;
+
+		shared = (plan_stats_t *) hash_search(planStats, &local->key, HASH_ENTER_NULL, &found);
+
+		if (shared != NULL)
+		{
+			if (!found)
+				memset((char *) shared + sizeof(shared->key), 0, sizeof(plan_stats_t) - sizeof(shared->key));
+
+			shared->builds += local->builds;
+			shared->customPlans += local->customPlans;
+			shared->genericPlans += local->genericPlans;
+			shared->invalidations += local->invalidations;
+			shared->planUsecs += local->planUsecs;
+		}
+
+		hash_search(localPlanStats, &local->key, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * Like flushLineStats(), for the wait times. The caller must hold
+ * getPLDebuggerLock() exclusively.
+ */
+static void
+flushWaitStats(void)
+{
+	HASH_SEQ_STATUS scan;
+	wait_stats_t *local;
+
+	hash_seq_init(&scan, localWaitStats);
+
+	while ((local = (wait_stats_t *) hash_seq_search(&scan)) != NULL)
+	{
+		wait_stats_t *shared;
+		bool		found;
+
+		shared = (wait_stats_t *) hash_search(waitStats, &local->key, HASH_ENTER_NULL, &found);
+
+		if (shared != NULL)
+		{
+			if (!found)
+				memset((char *) shared + sizeof(shared->key), 0, sizeof(wait_stats_t) - sizeof(shared->key));
+
+			shared->lockUsecs += local->lockUsecs;
+			shared->lwlockUsecs += local->lwlockUsecs;
+			shared->ioUsecs += local->ioUsecs;
+		}
+
+		hash_search(localWaitStats, &local->key, HASH_REMOVE, NULL);
+	}
+}
+
+static void
+profilerXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+			flushLineStats();
+			break;
+
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			stopWaitSampling();
+			flushLineStats();
+			break;
+
+		default:
+			break;
+	}
+}
+
+#if (PG_VERSION_NUM >= 140000)
+/*
+ * When a subtransaction aborts, the frames that began inside it are gone
+ * (an EXCEPTION block further out caught the error). If the one that
+ * started sampling waits is among them, nobody is left to stop the timer.
+ */
+static void
+profilerSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+						SubTransactionId parentSubid, void *arg)
+{
+	if (event == SUBXACT_EVENT_ABORT_SUB && waitSampleOwner != NULL &&
+		waitSampleNestLevel >= GetCurrentTransactionNestLevel())
+		stopWaitSampling();
+}
+#endif
+
+/**********************************************************************
+ * SQL-callable functions
+ **********************************************************************/
+
+/*
+ * Returns an ID for a new profile or capture, so that backends can tell
+ * when a slot has been dropped and reused. The caller must hold
+ * getPLDebuggerLock() exclusively.
+ */
+static uint32
+nextProfileId(void)
+{
+	uint32		id = profiler->nextId++;
+
+	if (profiler->nextId == 0)
+		profiler->nextId = 1;
+
+	return id;
+}
+
+/*
+ * findProfileSlot
+ *
+ * Returns the slot that holds the given profile in this database, or -1 if
+ * there isn't one. The caller must hold getPLDebuggerLock().
+ */
+static int
+findProfileSlot(Oid funcOid, int lineNumber, const char *varName)
+{
+	int i;
+
+	for (i = 0; i < MaxValueProfiles; i++)
+	{
+		profile_slot_t *slot = &profiler->slots[i];
+
+		if (slot->id != 0 && slot->dbOid == MyDatabaseId &&
+			slot->funcOid == funcOid && slot->lineNumber == lineNumber &&
+			strcmp(slot->varName, varName) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Profiling a function lets you see the values of its variables, so we
+ * require the same privileges as setting a breakpoint in it.
+ */
+static void
+checkProfilePermission(Oid funcOid)
+{
+	HeapTuple	tuple;
+	Oid			userid;
+
+	tuple = SearchSysCache(PROCOID,
+				   ObjectIdGetDatum(funcOid),
+				   0, 0, 0);
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for function %u",
+			 funcOid);
+	userid = ((Form_pg_proc) GETSTRUCT(tuple))->proowner;
+	ReleaseSysCache(tuple);
+
+	if (!superuser() && (GetUserId() != userid))
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be owner or superuser to profile a function")));
+}
+
+/*
+ * beginMaterialize
+ *
+ * Sets up a set-returning function to return its result in a tuplestore,
+ * with the given composite type as the row type. Shared with sessions.c.
+ */
+Tuplestorestate *
+beginMaterialize(FunctionCallInfo fcinfo, const char *typeName, TupleDesc *tupdesc)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
+	MemoryContext oldContext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+		!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	oldContext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	*tupdesc = CreateTupleDescCopy(RelationNameGetTupleDesc(typeName));
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = *tupdesc;
+
+	MemoryContextSwitchTo(oldContext);
+
+	return tupstore;
+}
+
+/*
+ * CREATE FUNCTION pldbg_profile_values( func OID, linenumber INTEGER, varName TEXT, sampleEvery INTEGER DEFAULT 1 ) RETURNS BOOLEAN
+ *
+ * Starts collecting the values of the given variable each time the given
+ * line of the function runs (in any backend), or every sampleEvery'th time.
+ * If the variable is already being profiled at that line, the profile is
+ * started over. Returns TRUE.
+ */
+PGDLLEXPORT Datum pldbg_profile_values(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_profile_values);
+
+Datum
+pldbg_profile_values(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	int			lineNumber = PG_GETARG_INT32(1);
+	char	   *varName = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	int			sampleEvery = PG_GETARG_INT32(3);
+	profile_slot_t *slot;
+	int			i;
+
+	if (sampleEvery < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("sampleEvery must be at least 1")));
+
+	if (strlen(varName) >= NAMEDATALEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_NAME_TOO_LONG),
+				 errmsg("variable name \"%s\" is too long", varName)));
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((i = findProfileSlot(funcOid, lineNumber, varName)) == -1)
+	{
+		for (i = 0; i < MaxValueProfiles; i++)
+		{
+			if (profiler->slots[i].id == 0)
+				break;
+		}
+
+		if (i == MaxValueProfiles)
+		{
+			LWLockRelease(getPLDebuggerLock());
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("too many value profiles"),
+					 errhint("Drop a profile with pldbg_drop_value_profile() first.")));
+		}
+	}
+
+	slot = &profiler->slots[i];
+
+	slot->id = nextProfileId();
+	slot->dbOid = MyDatabaseId;
+	slot->funcOid = funcOid;
+	slot->lineNumber = lineNumber;
+	strlcpy(slot->varName, varName, NAMEDATALEN);
+	slot->sampleEvery = sampleEvery;
+	pg_atomic_write_u64(&slot->executions, 0);
+	slot->nCounters = 0;
+
+	pg_atomic_fetch_add_u32(&profiler->generation, 1);
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * CREATE FUNCTION pldbg_drop_value_profile( func OID, linenumber INTEGER, varName TEXT ) RETURNS BOOLEAN
+ *
+ * Stops profiling the given variable at the given line and throws away
+ * what we've collected. Returns FALSE if there was no such profile.
+ */
+PGDLLEXPORT Datum pldbg_drop_value_profile(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_drop_value_profile);
+
+Datum
+pldbg_drop_value_profile(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	int			lineNumber = PG_GETARG_INT32(1);
+	char	   *varName = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	int			i;
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((i = findProfileSlot(funcOid, lineNumber, varName)) != -1)
+	{
+		profiler->slots[i].id = 0;
+		pg_atomic_fetch_add_u32(&profiler->generation, 1);
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_BOOL(i != -1);
+}
+
+/*
+ * CREATE FUNCTION pldbg_get_value_profile( func OID, linenumber INTEGER, varName TEXT ) RETURNS SETOF value_count
+ *
+ * Returns the values we've seen the most, most frequent first. 'count' is
+ * the number of samples with that value, but may be too high by as much as
+ * 'maxError' (see the Space-Saving description above); the counts add up to
+ * the number of samples taken. Values are truncated to ProfileValueLen - 1
+ * bytes, so long values that start the same are counted together.
+ */
+PGDLLEXPORT Datum pldbg_get_value_profile(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_get_value_profile);
+
+static int
+compareCounters(const void *a, const void *b)
+{
+	const profile_counter_t *ca = (const profile_counter_t *) a;
+	const profile_counter_t *cb = (const profile_counter_t *) b;
+
+	if (ca->count != cb->count)
+		return (ca->count > cb->count) ? -1 : 1;
+
+	return 0;
+}
+
+Datum
+pldbg_get_value_profile(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *srf;
+	profile_counter_t *counters;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		Oid			funcOid = PG_GETARG_OID(0);
+		int			lineNumber = PG_GETARG_INT32(1);
+		char	   *varName = text_to_cstring(PG_GETARG_TEXT_PP(2));
+		MemoryContext oldContext;
+		int			i;
+
+		checkProfilePermission(funcOid);
+
+		profiler_init();
+
+		srf = SRF_FIRSTCALL_INIT();
+
+		oldContext = MemoryContextSwitchTo(srf->multi_call_memory_ctx);
+
+		srf->attinmeta = TupleDescGetAttInMetadata(RelationNameGetTupleDesc("value_count"));
+		counters = palloc(sizeof(profile_counter_t) * ProfileCounters);
+		srf->user_fctx = counters;
+
+		MemoryContextSwitchTo(oldContext);
+
+		LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+		if ((i = findProfileSlot(funcOid, lineNumber, varName)) != -1)
+		{
+			srf->max_calls = profiler->slots[i].nCounters;
+			memcpy(counters, profiler->slots[i].counters, sizeof(profile_counter_t) * srf->max_calls);
+		}
+		else
+			srf->max_calls = 0;
+
+		LWLockRelease(getPLDebuggerLock());
+
+		qsort(counters, srf->max_calls, sizeof(profile_counter_t), compareCounters);
+	}
+
+	srf = SRF_PERCALL_SETUP();
+	counters = (profile_counter_t *) srf->user_fctx;
+
+	if (srf->call_cntr < srf->max_calls)
+	{
+		profile_counter_t *counter = &counters[srf->call_cntr];
+		char	   *values[3];
+		char		countString[32];
+		char		errorString[32];
+
+		snprintf(countString, sizeof(countString), UINT64_FORMAT, counter->count);
+		snprintf(errorString, sizeof(errorString), UINT64_FORMAT, counter->error);
+
+		values[0] = counter->isnull ? NULL : counter->value;
+		values[1] = countString;
+		values[2] = errorString;
+
+		SRF_RETURN_NEXT(srf, HeapTupleGetDatum(BuildTupleFromCStrings(srf->attinmeta, values)));
+	}
+	else
+	{
+		SRF_RETURN_DONE(srf);
+	}
+}
+
+/*
+ * findCaptureSlot
+ *
+ * Returns the slot that holds the slow call capture for the given function
+ * in this database, or -1 if there isn't one. The caller must hold
+ * getPLDebuggerLock().
+ */
+static int
+findCaptureSlot(Oid funcOid)
+{
+	int i;
+
+	for (i = 0; i < MaxSlowCallCaptures; i++)
+	{
+		slow_call_slot_t *slot = &profiler->captures[i];
+
+		if (slot->id != 0 && slot->dbOid == MyDatabaseId && slot->funcOid == funcOid)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * CREATE FUNCTION pldbg_capture_slow_calls( func OID, keep INTEGER DEFAULT 10 ) RETURNS BOOLEAN
+ *
+ * Starts keeping track of the 'keep' slowest invocations of the given
+ * function (in any backend). If we're already doing that, starts over.
+ * Only invocations that return (rather than throw an error) are counted.
+ * Returns TRUE.
+ */
+PGDLLEXPORT Datum pldbg_capture_slow_calls(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_capture_slow_calls);
+
+Datum
+pldbg_capture_slow_calls(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	int			keep = PG_GETARG_INT32(1);
+	slow_call_slot_t *slot;
+	int			i;
+
+	if (keep < 1 || keep > SlowCallsKept)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("keep must be between 1 and %d", SlowCallsKept)));
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((i = findCaptureSlot(funcOid)) == -1)
+	{
+		for (i = 0; i < MaxSlowCallCaptures; i++)
+		{
+			if (profiler->captures[i].id == 0)
+				break;
+		}
+
+		if (i == MaxSlowCallCaptures)
+		{
+			LWLockRelease(getPLDebuggerLock());
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("too many slow call captures"),
+					 errhint("Drop a capture with pldbg_drop_slow_calls() first.")));
+		}
+	}
+
+	slot = &profiler->captures[i];
+
+	slot->id = nextProfileId();
+	slot->dbOid = MyDatabaseId;
+	slot->funcOid = funcOid;
+	slot->keep = keep;
+	slot->nCalls = 0;
+
+	pg_atomic_fetch_add_u32(&profiler->generation, 1);
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * CREATE FUNCTION pldbg_drop_slow_calls( func OID ) RETURNS BOOLEAN
+ *
+ * Stops capturing slow invocations of the given function and throws away
+ * the ones we've kept. Returns FALSE if we weren't capturing them.
+ */
+PGDLLEXPORT Datum pldbg_drop_slow_calls(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_drop_slow_calls);
+
+Datum
+pldbg_drop_slow_calls(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	int			i;
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((i = findCaptureSlot(funcOid)) != -1)
+	{
+		profiler->captures[i].id = 0;
+		pg_atomic_fetch_add_u32(&profiler->generation, 1);
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_BOOL(i != -1);
+}
+
+/*
+ * CREATE FUNCTION pldbg_get_slow_calls( func OID ) RETURNS SETOF slow_call
+ *
+ * Returns the slowest invocations of the given function that we've seen,
+ * slowest first: how long each took, when it ended and in which backend,
+ * its arguments (as pldbg_get_stack() shows them, but as of the end of the
+ * invocation) and the chain of PL functions that called it, innermost
+ * first.
+ */
+PGDLLEXPORT Datum pldbg_get_slow_calls(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_get_slow_calls);
+
+static int
+compareSlowCalls(const void *a, const void *b)
+{
+	const slow_call_t *ca = (const slow_call_t *) a;
+	const slow_call_t *cb = (const slow_call_t *) b;
+
+	if (ca->usecs != cb->usecs)
+		return (ca->usecs > cb->usecs) ? -1 : 1;
+
+	return 0;
+}
+
+Datum
+pldbg_get_slow_calls(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *srf;
+	slow_call_t *calls;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		Oid			funcOid = PG_GETARG_OID(0);
+		MemoryContext oldContext;
+		int			i;
+
+		checkProfilePermission(funcOid);
+
+		profiler_init();
+
+		srf = SRF_FIRSTCALL_INIT();
+
+		oldContext = MemoryContextSwitchTo(srf->multi_call_memory_ctx);
+
+		srf->attinmeta = TupleDescGetAttInMetadata(RelationNameGetTupleDesc("slow_call"));
+		calls = palloc(sizeof(slow_call_t) * SlowCallsKept);
+		srf->user_fctx = calls;
+
+		MemoryContextSwitchTo(oldContext);
+
+		LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+		if ((i = findCaptureSlot(funcOid)) != -1)
+		{
+			srf->max_calls = profiler->captures[i].nCalls;
+			memcpy(calls, profiler->captures[i].calls, sizeof(slow_call_t) * srf->max_calls);
+		}
+		else
+			srf->max_calls = 0;
+
+		LWLockRelease(getPLDebuggerLock());
+
+		qsort(calls, srf->max_calls, sizeof(slow_call_t), compareSlowCalls);
+	}
+
+	srf = SRF_PERCALL_SETUP();
+	calls = (slow_call_t *) srf->user_fctx;
+
+	if (srf->call_cntr < srf->max_calls)
+	{
+		slow_call_t *call = &calls[srf->call_cntr];
+		char	   *values[5];
+		char		durationString[64];
+		char		pidString[16];
+
+		snprintf(durationString, sizeof(durationString), UINT64_FORMAT " microseconds", call->usecs);
+		snprintf(pidString, sizeof(pidString), "%d", call->pid);
+
+		values[0] = durationString;
+		values[1] = (char *) timestamptz_to_str(call->ended);
+		values[2] = pidString;
+		values[3] = call->args;
+		values[4] = call->callers;
+
+		SRF_RETURN_NEXT(srf, HeapTupleGetDatum(BuildTupleFromCStrings(srf->attinmeta, values)));
+	}
+	else
+	{
+		SRF_RETURN_DONE(srf);
+	}
+}
+
+/*
+ * findWorkloadSlot
+ *
+ * Returns the slot that holds the workload capture for the given function
+ * in this database, or -1 if there isn't one. The caller must hold
+ * getPLDebuggerLock().
+ */
+static int
+findWorkloadSlot(Oid funcOid)
+{
+	int i;
+
+	for (i = 0; i < MaxWorkloadCaptures; i++)
+	{
+		workload_slot_t *slot = &profiler->workloads[i];
+
+		if (slot->id != 0 && slot->dbOid == MyDatabaseId && slot->funcOid == funcOid)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * The workload file of the given function, relative to the data directory.
+ */
+static void
+workloadFilePath(char *path, Oid dbOid, Oid funcOid)
+{
+	snprintf(path, MAXPGPATH, "%s/workload_%u_%u.dat", ProfilerDir, dbOid, funcOid);
+}
+
+/*
+ * CREATE FUNCTION pldbg_start_workload_capture( func OID ) RETURNS TEXT
+ *
+ * Starts recording every invocation of the given function in this database
+ * (in any backend) to a file, throwing away anything recorded earlier.
+ * Returns the name of the file, relative to the data directory. Since the
+ * file takes up space in the data directory, only superusers can do this.
+ */
+PGDLLEXPORT Datum pldbg_start_workload_capture(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_start_workload_capture);
+
+Datum
+pldbg_start_workload_capture(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	char		path[MAXPGPATH];
+	workload_slot_t *slot;
+	int			fd;
+	int			i;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to capture a workload")));
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	/* Create (or empty) the file first, so that it's there for the recorders */
+	makeProfilerDir();
+
+	workloadFilePath(path, MyDatabaseId, funcOid);
+
+#if (PG_VERSION_NUM >= 110000)
+	fd = OpenTransientFile(path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+#else
+	fd = OpenTransientFile(path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY, S_IRUSR | S_IWUSR);
+#endif
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", path)));
+
+	if (write(fd, WorkloadMagic, strlen(WorkloadMagic)) != strlen(WorkloadMagic))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", path)));
+
+	CloseTransientFile(fd);
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((i = findWorkloadSlot(funcOid)) == -1)
+	{
+		for (i = 0; i < MaxWorkloadCaptures; i++)
+		{
+			if (profiler->workloads[i].id == 0)
+				break;
+		}
+
+		if (i == MaxWorkloadCaptures)
+		{
+			LWLockRelease(getPLDebuggerLock());
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("too many workload captures"),
+					 errhint("Stop a capture with pldbg_stop_workload_capture() first.")));
+		}
+	}
+
+	slot = &profiler->workloads[i];
+
+	slot->id = nextProfileId();
+	slot->dbOid = MyDatabaseId;
+	slot->funcOid = funcOid;
+
+	pg_atomic_fetch_add_u32(&profiler->generation, 1);
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_TEXT_P(cstring_to_text(path));
+}
+
+/*
+ * CREATE FUNCTION pldbg_stop_workload_capture( func OID ) RETURNS BOOLEAN
+ *
+ * Stops recording invocations of the given function. The file stays, so
+ * that pldbg_get_workload() can still read it. Returns FALSE if we weren't
+ * recording.
+ */
+PGDLLEXPORT Datum pldbg_stop_workload_capture(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_stop_workload_capture);
+
+Datum
+pldbg_stop_workload_capture(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	int			i;
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((i = findWorkloadSlot(funcOid)) != -1)
+	{
+		profiler->workloads[i].id = 0;
+		pg_atomic_fetch_add_u32(&profiler->generation, 1);
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_BOOL(i != -1);
+}
+
+/*
+ * CREATE FUNCTION pldbg_get_workload( func OID ) RETURNS SETOF workload_call
+ *
+ * Reads the workload file of the given function and returns, for each
+ * recorded invocation, when it started, the role that made it, and a
+ * statement that repeats the call with the same arguments, e.g.
+ *
+ *	SELECT public.f('42'::integer, NULL::text);
+ *
+ * so that a replay script (for psql, or a pgbench -f script) is just the
+ * 'call' column written out one per line.
+ */
+PGDLLEXPORT Datum pldbg_get_workload(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_get_workload);
+
+Datum
+pldbg_get_workload(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	MemoryContext oldContext;
+	MemoryContext recordContext;
+	HeapTuple	tuple;
+	Form_pg_proc procStruct;
+	char	   *callPrefix;
+	bool		isVariadic;
+	char		path[MAXPGPATH];
+	char		magic[sizeof(WorkloadMagic) - 1];
+	FILE	   *file;
+
+	checkProfilePermission(funcOid);
+
+	/* Work out how to call the function: "SELECT schema.name(" */
+	tuple = SearchSysCache(PROCOID, ObjectIdGetDatum(funcOid), 0, 0, 0);
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for function %u", funcOid);
+	procStruct = (Form_pg_proc) GETSTRUCT(tuple);
+
+	callPrefix = psprintf("%s %s(",
+#if (PG_VERSION_NUM >= 110000)
+						  procStruct->prokind == PROKIND_PROCEDURE ? "CALL" : "SELECT",
+#else
+						  "SELECT",
+#endif
+						  quote_qualified_identifier(get_namespace_name(procStruct->pronamespace),
+													 NameStr(procStruct->proname)));
+	isVariadic = OidIsValid(procStruct->provariadic);
+	ReleaseSysCache(tuple);
+
+	workloadFilePath(path, MyDatabaseId, funcOid);
+
+	if ((file = AllocateFile(path, PG_BINARY_R)) == NULL)
+	{
+		if (errno == ENOENT)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("no workload has been captured for function %u", funcOid)));
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+	}
+
+	if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+		memcmp(magic, WorkloadMagic, sizeof(magic)) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("\"%s\" is not a workload file", path)));
+
+	tupstore = beginMaterialize(fcinfo, "workload_call", &tupdesc);
+
+	recordContext = AllocSetContextCreate(CurrentMemoryContext,
+										  "pldebugger workload record",
+										  ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		uint32		length;
+		StringInfoData record;
+		StringInfoData call;
+		TimestampTz	started;
+		Oid			roleOid;
+		char	   *roleName;
+		int			nargs;
+		int			arg;
+		Datum		values[3];
+		bool		nulls[3] = {false, false, false};
+		size_t		bytesRead;
+
+		MemoryContextReset(recordContext);
+		oldContext = MemoryContextSwitchTo(recordContext);
+
+		if ((bytesRead = fread(&length, 1, sizeof(length), file)) == 0)
+			break;
+
+		/*
+		 * A short record means that the server stopped while a backend was
+		 * writing it - that can only be the last one.
+		 */
+		if (bytesRead != sizeof(length))
+			break;
+
+		length = pg_ntoh32(length);
+
+		initStringInfo(&record);
+		enlargeStringInfo(&record, length);
+
+		if (fread(record.data, 1, length, file) != length)
+			break;
+
+		record.len = length;
+
+		started = (TimestampTz) pq_getmsgint64(&record);
+		roleOid = (Oid) pq_getmsgint(&record, 4);
+		nargs = pq_getmsgint(&record, 2);
+
+		initStringInfo(&call);
+		appendStringInfoString(&call, callPrefix);
+
+		for (arg = 0; arg < nargs; arg++)
+		{
+			Oid			typoid = (Oid) pq_getmsgint(&record, 4);
+			char		format = pq_getmsgbyte(&record);
+			char	   *value = NULL;
+
+			if (format != 'n')
+			{
+				int			len = pq_getmsgint(&record, 4);
+				const char *bytes = pq_getmsgbytes(&record, len);
+
+				if (format == 'b')
+				{
+					StringInfoData binary;
+					Oid			typreceive;
+					Oid			typioparam;
+					Oid			typoutput;
+					bool		typisvarlena;
+					Datum		datum;
+
+					initStringInfo(&binary);
+					appendBinaryStringInfo(&binary, bytes, len);
+
+					getTypeBinaryInputInfo(typoid, &typreceive, &typioparam);
+					datum = OidReceiveFunctionCall(typreceive, &binary, typioparam, -1);
+
+					getTypeOutputInfo(typoid, &typoutput, &typisvarlena);
+					value = OidOutputFunctionCall(typoutput, datum);
+				}
+				else
+					value = pnstrdup(bytes, len);
+			}
+
+			if (arg > 0)
+				appendStringInfoString(&call, ", ");
+
+			if (isVariadic && arg == nargs - 1)
+				appendStringInfoString(&call, "VARIADIC ");
+
+			appendStringInfoString(&call, value ? quote_literal_cstr(value) : "NULL");
+
+			if (OidIsValid(typoid))
+				appendStringInfo(&call, "::%s", format_type_be(typoid));
+		}
+
+		appendStringInfoString(&call, ");");
+
+		values[0] = TimestampTzGetDatum(started);
+
+		if ((roleName = GetUserNameFromId(roleOid, true)) != NULL)
+			values[1] = DirectFunctionCall1(namein, CStringGetDatum(roleName));
+		else
+			nulls[1] = true;
+
+		values[2] = CStringGetTextDatum(call.data);
+
+		MemoryContextSwitchTo(oldContext);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(recordContext);
+
+	FreeFile(file);
+
+	return (Datum) 0;
+}
+
+/*
+ * findActionSlot
+ *
+ * Returns the slot that holds the action list for the given line in this
+ * database, or -1 if there isn't one. The caller must hold
+ * getPLDebuggerLock().
+ */
+static int
+findActionSlot(Oid funcOid, int lineNumber)
+{
+	int i;
+
+	for (i = 0; i < MaxActionLists; i++)
+	{
+		action_slot_t *slot = &profiler->actionLists[i];
+
+		if (slot->id != 0 && slot->dbOid == MyDatabaseId &&
+			slot->funcOid == funcOid && slot->lineNumber == lineNumber)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * CREATE FUNCTION pldbg_set_breakpoint_actions( func OID, linenumber INTEGER, actions TEXT[], keep INTEGER DEFAULT 20 ) RETURNS BOOLEAN
+ *
+ * Gives the given line an action list, which each backend that reaches the
+ * line in this database carries out, in order, without stopping. Each
+ * action is one of:
+ *
+ *	vars a, b	the values of the named variables (a comma-separated list of
+ *				identifiers, which may be double-quoted)
+ *	stack		the function and line, and the functions that called it
+ *	eval expr	the value of a SQL expression, which may refer to the
+ *				variables of the function; it runs in a subtransaction that
+ *				is always rolled back
+ *	count		how many times the line has been reached
+ *	continue	carry on (this is the default, so it's only needed for
+ *				clarity), even if a debugger has a breakpoint at the line
+ *	stop		let a debugger's breakpoint at the line stop the target
+ *
+ * 'continue' and 'stop' may only come last. The results are kept in a ring
+ * buffer of the last 'keep' of them, which pldbg_get_breakpoint_results()
+ * returns. If the line already has an action list, it's replaced (and its
+ * results thrown away). Returns TRUE.
+ */
+PGDLLEXPORT Datum pldbg_set_breakpoint_actions(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_set_breakpoint_actions);
+
+Datum
+pldbg_set_breakpoint_actions(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	int			lineNumber = PG_GETARG_INT32(1);
+	ArrayType  *actionArray = PG_GETARG_ARRAYTYPE_P(2);
+	int			keep = PG_GETARG_INT32(3);
+	Datum	   *actionTexts;
+	bool	   *actionNulls;
+	int			actionCount;
+	char		actions[ActionListLen];
+	int			len = 0;
+	action_slot_t *slot;
+	int			i;
+
+	if (keep < 1 || keep > ActionResultsKept)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("keep must be between 1 and %d", ActionResultsKept)));
+
+	deconstruct_array(actionArray, TEXTOID, -1, false, 'i', &actionTexts, &actionNulls, &actionCount);
+
+	if (actionCount == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("an action list needs at least one action")));
+
+	if (actionCount > MaxActions)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("an action list can have at most %d actions", MaxActions)));
+
+	for (i = 0; i < actionCount; i++)
+	{
+		char	   *action;
+		char	   *keyword;
+		char	   *argument;
+
+		if (actionNulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("action must not be null")));
+
+		action = TextDatumGetCString(actionTexts[i]);
+		keyword = parseAction(action, &argument);
+
+		if (strcmp(keyword, "vars") == 0 || strcmp(keyword, "eval") == 0)
+		{
+			if (argument[0] == '\0')
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("action \"%s\" needs %s", keyword,
+								strcmp(keyword, "vars") == 0 ? "variable names" : "an expression")));
+
+			if (strcmp(keyword, "vars") == 0)
+			{
+				List	   *names;
+
+				if (!SplitIdentifierString(argument, ',', &names))
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("invalid list of variable names in action \"%s\"", action)));
+				list_free(names);
+			}
+		}
+		else if (strcmp(keyword, "stack") == 0 || strcmp(keyword, "count") == 0 ||
+				 strcmp(keyword, "continue") == 0 || strcmp(keyword, "stop") == 0)
+		{
+			if (argument[0] != '\0')
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("action \"%s\" takes no arguments", keyword)));
+
+			if ((strcmp(keyword, "continue") == 0 || strcmp(keyword, "stop") == 0) &&
+				i != actionCount - 1)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("action \"%s\" must come last", keyword)));
+		}
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("unrecognized breakpoint action \"%s\"", keyword),
+					 errhint("Valid actions are vars, stack, eval, count, continue and stop.")));
+
+		/* Leave room for the terminating empty string */
+		if (len + strlen(action) + 2 > ActionListLen)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("action list is too long"),
+					 errdetail("The actions must add up to less than %d bytes.", ActionListLen - 1)));
+
+		strcpy(actions + len, action);
+		len += strlen(action) + 1;
+	}
+
+	actions[len] = '\0';
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((i = findActionSlot(funcOid, lineNumber)) == -1)
+	{
+		for (i = 0; i < MaxActionLists; i++)
+		{
+			if (profiler->actionLists[i].id == 0)
+				break;
+		}
+
+		if (i == MaxActionLists)
+		{
+			LWLockRelease(getPLDebuggerLock());
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("too many breakpoint action lists"),
+					 errhint("Drop an action list with pldbg_drop_breakpoint_actions() first.")));
+		}
+	}
+
+	slot = &profiler->actionLists[i];
+
+	slot->id = nextProfileId();
+	slot->dbOid = MyDatabaseId;
+	slot->funcOid = funcOid;
+	slot->lineNumber = lineNumber;
+	memcpy(slot->actions, actions, ActionListLen);
+	slot->keep = keep;
+	slot->hits = 0;
+	slot->counter = 0;
+	slot->nResults = 0;
+	slot->nextResult = 0;
+
+	pg_atomic_fetch_add_u32(&profiler->generation, 1);
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * CREATE FUNCTION pldbg_drop_breakpoint_actions( func OID, linenumber INTEGER ) RETURNS BOOLEAN
+ *
+ * Drops the action list of the given line, and its results. Returns FALSE
+ * if the line had no action list.
+ */
+PGDLLEXPORT Datum pldbg_drop_breakpoint_actions(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_drop_breakpoint_actions);
+
+Datum
+pldbg_drop_breakpoint_actions(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	int			lineNumber = PG_GETARG_INT32(1);
+	int			i;
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((i = findActionSlot(funcOid, lineNumber)) != -1)
+	{
+		profiler->actionLists[i].id = 0;
+		pg_atomic_fetch_add_u32(&profiler->generation, 1);
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_BOOL(i != -1);
+}
+
+/*
+ * CREATE FUNCTION pldbg_get_breakpoint_results( func OID, linenumber INTEGER ) RETURNS SETOF action_result
+ *
+ * Returns the results that the action list of the given line has kept,
+ * oldest first: which hit of the line each came from, when, in which
+ * backend, and the action that produced it. Results are truncated to
+ * ActionResultLen - 1 bytes.
+ */
+PGDLLEXPORT Datum pldbg_get_breakpoint_results(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_get_breakpoint_results);
+
+Datum
+pldbg_get_breakpoint_results(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	int			lineNumber = PG_GETARG_INT32(1);
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	action_slot_t *slot;
+	char	   *actionNames[MaxActions];
+	int			nActions = 0;
+	char	   *action;
+	int			oldest;
+	int			i;
+
+	checkProfilePermission(funcOid);
+
+	profiler_init();
+
+	tupstore = beginMaterialize(fcinfo, "action_result", &tupdesc);
+
+	/* Take a copy, so that we don't hold the lock while building the rows */
+	slot = palloc(sizeof(action_slot_t));
+
+	LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+	if ((i = findActionSlot(funcOid, lineNumber)) != -1)
+		memcpy(slot, &profiler->actionLists[i], sizeof(action_slot_t));
+
+	LWLockRelease(getPLDebuggerLock());
+
+	if (i == -1)
+		return (Datum) 0;
+
+	for (action = slot->actions; *action; action += strlen(action) + 1)
+		actionNames[nActions++] = action;
+
+	/* Once the ring buffer is full, the oldest result is the next one to go */
+	oldest = (slot->nResults < slot->keep) ? 0 : slot->nextResult;
+
+	for (i = 0; i < slot->nResults; i++)
+	{
+		action_result_t *result = &slot->results[(oldest + i) % slot->keep];
+		Datum		values[5];
+		bool		nulls[5] = {false, false, false, false, false};
+
+		values[0] = Int64GetDatum((int64) result->hit);
+		values[1] = TimestampTzGetDatum(result->time);
+		values[2] = Int32GetDatum(result->pid);
+
+		if (result->action >= 1 && result->action <= nActions)
+			values[3] = CStringGetTextDatum(actionNames[result->action - 1]);
+		else
+			nulls[3] = true;
+
+		if (result->isnull)
+			nulls[4] = true;
+		else
+			values[4] = CStringGetTextDatum(result->result);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * Snapshot and export names become part of a file name, so we keep them
+ * simple.
+ */
+static void
+checkProfileName(const char *name)
+{
+	const char *c;
+
+	if (name[0] == '\0' || strlen(name) >= SnapshotNameLen)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("profile name must be between 1 and %d characters long", SnapshotNameLen - 1)));
+
+	for (c = name; *c; c++)
+	{
+		if (!isalnum((unsigned char) *c) && *c != '_' && *c != '-')
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid profile name \"%s\"", name),
+					 errdetail("Snapshot and export names may only contain letters, digits, '_' and '-'.")));
+	}
+}
+
+static void
+makeProfilerDir(void)
+{
+#if (PG_VERSION_NUM >= 110000)
+	if (MakePGDirectory(ProfilerDir) < 0 && errno != EEXIST)
+#else
+	if (mkdir(ProfilerDir, S_IRWXU) < 0 && errno != EEXIST)
+#endif
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m", ProfilerDir)));
+}
+
+/*
+ * readProfile
+ *
+ * Returns a palloc'd copy of the line profile (of every database), and the
+ * number of entries in *count: the shared table if snapshot is NULL, or
+ * else the named snapshot.
+ */
+static line_stats_t *
+readProfile(const char *snapshot, int *count)
+{
+	line_stats_t *entries;
+
+	if (snapshot == NULL)
+	{
+		HASH_SEQ_STATUS scan;
+		line_stats_t *entry;
+		int			n = 0;
+
+		profiler_init();
+
+		LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+		entries = palloc(sizeof(line_stats_t) * (hash_get_num_entries(lineStats) + 1));
+
+		hash_seq_init(&scan, lineStats);
+
+		while ((entry = (line_stats_t *) hash_seq_search(&scan)) != NULL)
+			entries[n++] = *entry;
+
+		LWLockRelease(getPLDebuggerLock());
+
+		*count = n;
+	}
+	else
+	{
+		char		path[MAXPGPATH];
+		char		magic[sizeof(SnapshotMagic) - 1];
+		int32		n;
+		FILE	   *file;
+
+		checkProfileName(snapshot);
+
+		snprintf(path, MAXPGPATH, "%s/snapshot_%s.dat", ProfilerDir, snapshot);
+
+		if ((file = AllocateFile(path, PG_BINARY_R)) == NULL)
+		{
+			if (errno == ENOENT)
+				ereport(ERROR,
+						(errcode(ERRCODE_UNDEFINED_OBJECT),
+						 errmsg("profile snapshot \"%s\" does not exist", snapshot)));
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not open file \"%s\": %m", path)));
+		}
+
+		if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+			memcmp(magic, SnapshotMagic, sizeof(magic)) != 0 ||
+			fread(&n, 1, sizeof(n), file) != sizeof(n) || n < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("\"%s\" is not a profile snapshot", path)));
+
+		entries = palloc(sizeof(line_stats_t) * (n + 1));
+
+		if (fread(entries, sizeof(line_stats_t), n, file) != n)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("profile snapshot \"%s\" is truncated", snapshot)));
+
+		FreeFile(file);
+
+		*count = n;
+	}
+
+	return entries;
+}
+
+/*
+ * CREATE FUNCTION pldbg_get_profile() RETURNS SETOF profile_line
+ *
+ * Returns the line profile of the functions in this database: for each
+ * line, how many times it ran, the total and longest time (in
+ * milliseconds) it took, the buffers it hit and read, and the number of
+ * errors raised at it. Line 0 stands for the function as a whole.
+ * Counts are added when the transaction that ran the line ends.
+ */
+PGDLLEXPORT Datum pldbg_get_profile(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_get_profile);
+
+Datum
+pldbg_get_profile(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	line_stats_t *entries;
+	int			count;
+	int			i;
+
+	tupstore = beginMaterialize(fcinfo, "profile_line", &tupdesc);
+
+	entries = readProfile(NULL, &count);
+
+	for (i = 0; i < count; i++)
+	{
+		Datum		values[8];
+		bool		nulls[8] = {false, false, false, false, false, false, false, false};
+
+		if (entries[i].key.dbOid != MyDatabaseId)
+			continue;
+
+		values[0] = ObjectIdGetDatum(entries[i].key.funcOid);
+		values[1] = Int32GetDatum(entries[i].key.lineNumber);
+		values[2] = Int64GetDatum((int64) entries[i].count);
+		values[3] = Float8GetDatum(entries[i].totalUsecs / 1000.0);
+		values[4] = Float8GetDatum(entries[i].maxUsecs / 1000.0);
+		values[5] = Int64GetDatum((int64) entries[i].blksHit);
+		values[6] = Int64GetDatum((int64) entries[i].blksRead);
+		values[7] = Int64GetDatum((int64) entries[i].exceptions);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * CREATE FUNCTION pldbg_annotate( func OID ) RETURNS SETOF annotated_line
+ *
+ * Returns the source of the given function, one row per line, next to the
+ * line profile of that line (see pldbg_get_profile()). The profile
+ * columns are null for lines that never ran, including those that have no
+ * statement on them. Includes what this transaction ran so far.
+ */
+PGDLLEXPORT Datum pldbg_annotate(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_annotate);
+
+Datum
+pldbg_annotate(PG_FUNCTION_ARGS)
+{
+	Oid			funcOid = PG_GETARG_OID(0);
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	HeapTuple	tup;
+	char	   *source;
+	char	  **lines;
+	int			lineCount;
+	line_stats_t *entries;
+	line_stats_t **byLine;
+	int			count;
+	int			i;
+
+	tupstore = beginMaterialize(fcinfo, "annotated_line", &tupdesc);
+
+	source = findSource(funcOid, &tup);
+	ReleaseSysCache(tup);
+
+	lines = splitSourceLines(source, &lineCount);
+
+	flushLineStats();
+
+	entries = readProfile(NULL, &count);
+
+	byLine = palloc0(sizeof(line_stats_t *) * (lineCount + 1));
+
+	for (i = 0; i < count; i++)
+	{
+		line_stats_key_t *key = &entries[i].key;
+
+		if (key->dbOid == MyDatabaseId && key->funcOid == funcOid &&
+			key->lineNumber >= 1 && key->lineNumber <= lineCount)
+			byLine[key->lineNumber] = &entries[i];
+	}
+
+	for (i = 1; i <= lineCount; i++)
+	{
+		line_stats_t *entry = byLine[i];
+		Datum		values[8];
+		bool		nulls[8] = {false, false, false, false, false, false, false, false};
+
+		values[0] = Int32GetDatum(i);
+		values[1] = CStringGetTextDatum(lines[i - 1]);
+
+		if (entry == NULL)
+		{
+			memset(&nulls[2], true, sizeof(bool) * 6);
+		}
+		else
+		{
+			values[2] = Int64GetDatum((int64) entry->count);
+			values[3] = Float8GetDatum(entry->totalUsecs / 1000.0);
+			values[4] = Float8GetDatum(entry->maxUsecs / 1000.0);
+			values[5] = Int64GetDatum((int64) entry->blksHit);
+			values[6] = Int64GetDatum((int64) entry->blksRead);
+			values[7] = Int64GetDatum((int64) entry->exceptions);
+		}
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * CREATE FUNCTION pldbg_reset_profile() RETURNS VOID
+ *
+ * Throws away the line profile of the functions in this database.
+ */
+PGDLLEXPORT Datum pldbg_reset_profile(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_reset_profile);
+
+Datum
+pldbg_reset_profile(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS scan;
+	line_stats_t *entry;
+	loop_query_t *loopQuery;
+	plan_stats_t *planEntry;
+	wait_stats_t *waitEntry;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to reset the profile")));
+
+	profiler_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	hash_seq_init(&scan, lineStats);
+
+	while ((entry = (line_stats_t *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->key.dbOid == MyDatabaseId)
+			hash_search(lineStats, &entry->key, HASH_REMOVE, NULL);
+	}
+
+	hash_seq_init(&scan, loopQueries);
+
+	while ((loopQuery = (loop_query_t *) hash_seq_search(&scan)) != NULL)
+	{
+		if (loopQuery->key.dbOid == MyDatabaseId)
+			hash_search(loopQueries, &loopQuery->key, HASH_REMOVE, NULL);
+	}
+
+	hash_seq_init(&scan, planStats);
+
+	while ((planEntry = (plan_stats_t *) hash_seq_search(&scan)) != NULL)
+	{
+		if (planEntry->key.dbOid == MyDatabaseId)
+			hash_search(planStats, &planEntry->key, HASH_REMOVE, NULL);
+	}
+
+	hash_seq_init(&scan, waitStats);
+
+	while ((waitEntry = (wait_stats_t *) hash_seq_search(&scan)) != NULL)
+	{
+		if (waitEntry->key.dbOid == MyDatabaseId)
+			hash_search(waitStats, &waitEntry->key, HASH_REMOVE, NULL);
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * CREATE FUNCTION pldbg_get_loop_queries( threshold DOUBLE PRECISION DEFAULT 10 ) RETURNS SETOF loop_query
+ *
+ * Returns, from the line profile of the functions in this database, the
+ * SQL statements in the body of a loop that ran, on average, at least
+ * 'threshold' times each time the loop was entered: the usual sign of a
+ * query per row that could be a single query (or a join) instead. For each,
+ * how many times the loop was entered, how many times the statement ran,
+ * the average per entry, and the total time (in milliseconds) it took.
+ */
+PGDLLEXPORT Datum pldbg_get_loop_queries(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_get_loop_queries);
+
+Datum
+pldbg_get_loop_queries(PG_FUNCTION_ARGS)
+{
+	double		threshold = PG_GETARG_FLOAT8(0);
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	HASH_SEQ_STATUS scan;
+	loop_query_t *entry;
+	loop_query_t *entries;
+	int			count = 0;
+	int			i;
+	int			j;
+
+	tupstore = beginMaterialize(fcinfo, "loop_query", &tupdesc);
+
+	profiler_init();
+
+	/* Take a copy, so that we don't hold the lock while building the rows */
+	LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+	entries = palloc(sizeof(loop_query_t) * (hash_get_num_entries(loopQueries) + 1));
+
+	hash_seq_init(&scan, loopQueries);
+
+	while ((entry = (loop_query_t *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->key.dbOid == MyDatabaseId)
+			entries[count++] = *entry;
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	for (i = 0; i < count; i++)
+	{
+		loop_query_key_t loopKey = entries[i].key;
+		loop_query_t *loop;
+		double		perEntry;
+		Datum		values[7];
+		bool		nulls[7] = {false, false, false, false, false, false, false};
+
+		if (entries[i].key.sqlLine == 0)
+			continue;
+
+		loopKey.sqlLine = 0;
+		loop = NULL;
+
+		for (j = 0; j < count; j++)
+		{
+			if (memcmp(&entries[j].key, &loopKey, sizeof(loopKey)) == 0)
+			{
+				loop = &entries[j];
+				break;
+			}
+		}
+
+		/* We lost count of the loop (the table was full), so we can't tell */
+		if (loop == NULL || loop->count == 0)
+			continue;
+
+		perEntry = (double) entries[i].count / loop->count;
+
+		if (perEntry < threshold)
+			continue;
+
+		values[0] = ObjectIdGetDatum(entries[i].key.funcOid);
+		values[1] = Int32GetDatum(entries[i].key.loopLine);
+		values[2] = Int32GetDatum(entries[i].key.sqlLine);
+		values[3] = Int64GetDatum((int64) loop->count);
+		values[4] = Int64GetDatum((int64) entries[i].count);
+		values[5] = Float8GetDatum(perEntry);
+		values[6] = Float8GetDatum(entries[i].totalUsecs / 1000.0);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * CREATE FUNCTION pldbg_get_plan_stats() RETURNS SETOF plan_stats
+ *
+ * Returns, for each line of the functions in this database whose SQL
+ * statement has planned (or found its plan invalidated) while in the line
+ * profile, how many plans were built, how many times a custom and the
+ * generic plan were chosen, how many times the plan had been invalidated,
+ * and the time (in milliseconds) spent planning, most planning time first.
+ * Lines that keep building custom plans, or flip between custom and
+ * generic plans, are where plan caching isn't helping.
+ */
+PGDLLEXPORT Datum pldbg_get_plan_stats(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_get_plan_stats);
+
+static int
+comparePlanStats(const void *a, const void *b)
+{
+	const plan_stats_t *pa = (const plan_stats_t *) a;
+	const plan_stats_t *pb = (const plan_stats_t *) b;
+
+	if (pa->planUsecs != pb->planUsecs)
+		return (pa->planUsecs > pb->planUsecs) ? -1 : 1;
+
+	return 0;
+}
+
+Datum
+pldbg_get_plan_stats(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	HASH_SEQ_STATUS scan;
+	plan_stats_t *entry;
+	plan_stats_t *entries;
+	int			count = 0;
+	int			i;
+
+	tupstore = beginMaterialize(fcinfo, "plan_stats", &tupdesc);
+
+	profiler_init();
+
+	/* Take a copy, so that we don't hold the lock while building the rows */
+	LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+	entries = palloc(sizeof(plan_stats_t) * (hash_get_num_entries(planStats) + 1));
+
+	hash_seq_init(&scan, planStats);
+
+	while ((entry = (plan_stats_t *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->key.dbOid == MyDatabaseId)
+			entries[count++] = *entry;
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	qsort(entries, count, sizeof(plan_stats_t), comparePlanStats);
+
+	for (i = 0; i < count; i++)
+	{
+		Datum		values[7];
+		bool		nulls[7] = {false, false, false, false, false, false, false};
+
+		values[0] = ObjectIdGetDatum(entries[i].key.funcOid);
+		values[1] = Int32GetDatum(entries[i].key.lineNumber);
+		values[2] = Int64GetDatum((int64) entries[i].builds);
+		values[3] = Int64GetDatum((int64) entries[i].customPlans);
+		values[4] = Int64GetDatum((int64) entries[i].genericPlans);
+		values[5] = Int64GetDatum((int64) entries[i].invalidations);
+		values[6] = Float8GetDatum(entries[i].planUsecs / 1000.0);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * CREATE FUNCTION pldbg_get_wait_stats() RETURNS SETOF wait_stats
+ *
+ * Returns, for each line of the functions in this database that waited
+ * while in the line profile, the time (in milliseconds) it spent waiting on
+ * heavyweight locks, lightweight locks and IO, most waiting first. These
+ * are sampled, so short waits only show up once they add up, and a line's
+ * waits include those of the functions it calls.
+ */
+PGDLLEXPORT Datum pldbg_get_wait_stats(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_get_wait_stats);
+
+static int
+compareWaitStats(const void *a, const void *b)
+{
+	const wait_stats_t *wa = (const wait_stats_t *) a;
+	const wait_stats_t *wb = (const wait_stats_t *) b;
+	uint64		totalA = wa->lockUsecs + wa->lwlockUsecs + wa->ioUsecs;
+	uint64		totalB = wb->lockUsecs + wb->lwlockUsecs + wb->ioUsecs;
+
+	if (totalA != totalB)
+		return (totalA > totalB) ? -1 : 1;
+
+	return 0;
+}
+
+Datum
+pldbg_get_wait_stats(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	HASH_SEQ_STATUS scan;
+	wait_stats_t *entry;
+	wait_stats_t *entries;
+	int			count = 0;
+	int			i;
+
+	tupstore = beginMaterialize(fcinfo, "wait_stats", &tupdesc);
+
+	profiler_init();
+
+	/* Take a copy, so that we don't hold the lock while building the rows */
+	LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+	entries = palloc(sizeof(wait_stats_t) * (hash_get_num_entries(waitStats) + 1));
+
+	hash_seq_init(&scan, waitStats);
+
+	while ((entry = (wait_stats_t *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->key.dbOid == MyDatabaseId)
+			entries[count++] = *entry;
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	qsort(entries, count, sizeof(wait_stats_t), compareWaitStats);
+
+	for (i = 0; i < count; i++)
+	{
+		Datum		values[5];
+		bool		nulls[5] = {false, false, false, false, false};
+
+		values[0] = ObjectIdGetDatum(entries[i].key.funcOid);
+		values[1] = Int32GetDatum(entries[i].key.lineNumber);
+		values[2] = Float8GetDatum(entries[i].lockUsecs / 1000.0);
+		values[3] = Float8GetDatum(entries[i].lwlockUsecs / 1000.0);
+		values[4] = Float8GetDatum(entries[i].ioUsecs / 1000.0);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * CREATE FUNCTION pldbg_profile_snapshot( name TEXT ) RETURNS INTEGER
+ *
+ * Saves a copy of the line profile under the given name (replacing any
+ * earlier snapshot by that name), for pldbg_profile_diff(). Returns the
+ * number of lines saved.
+ */
+PGDLLEXPORT Datum pldbg_profile_snapshot(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_profile_snapshot);
+
+Datum
+pldbg_profile_snapshot(PG_FUNCTION_ARGS)
+{
+	char	   *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	char		path[MAXPGPATH];
+	line_stats_t *entries;
+	int32		count;
+	FILE	   *file;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to take a profile snapshot")));
+
+	checkProfileName(name);
+
+	/* Make sure the snapshot includes what this transaction ran so far */
+	flushLineStats();
+
+	entries = readProfile(NULL, &count);
+
+	makeProfilerDir();
+
+	snprintf(path, MAXPGPATH, "%s/snapshot_%s.dat", ProfilerDir, name);
+
+	if ((file = AllocateFile(path, PG_BINARY_W)) == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", path)));
+
+	if (fwrite(SnapshotMagic, 1, strlen(SnapshotMagic), file) != strlen(SnapshotMagic) ||
+		fwrite(&count, sizeof(count), 1, file) != 1 ||
+		fwrite(entries, sizeof(line_stats_t), count, file) != count ||
+		FreeFile(file) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", path)));
+
+	PG_RETURN_INT32(count);
+}
+
+/*
+ * CREATE FUNCTION pldbg_profile_diff( a TEXT, b TEXT DEFAULT NULL ) RETURNS SETOF profile_delta
+ *
+ * Compares the line profiles in two snapshots (b defaults to the current
+ * profile) of the functions in this database. For each line (and, as line
+ * 0, each function) it returns the number of executions and the mean time
+ * per execution (in milliseconds) in each, and 'regression': how much more
+ * time b spent on the line than it would have at a's speed, that is,
+ * (meanB - meanA) * countB. The worst regressions come first; lines that
+ * only a ran have a regression of 0.
+ */
+PGDLLEXPORT Datum pldbg_profile_diff(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_profile_diff);
+
+typedef struct
+{
+	line_stats_key_t key;
+	uint64		countA;
+	uint64		countB;
+	double		meanA;			/* In msec, 0 if countA is 0 */
+	double		meanB;			/* Ditto */
+	double		regression;
+} line_delta_t;
+
+static int
+compareDeltas(const void *a, const void *b)
+{
+	const line_delta_t *da = (const line_delta_t *) a;
+	const line_delta_t *db = (const line_delta_t *) b;
+
+	if (da->regression != db->regression)
+		return (da->regression > db->regression) ? -1 : 1;
+
+	return 0;
+}
+
+Datum
+pldbg_profile_diff(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	line_stats_t *a;
+	line_stats_t *b;
+	int			countA;
+	int			countB;
+	line_delta_t *deltas;
+	int			nDeltas = 0;
+	HTAB	   *byKey;
+	HASHCTL		ctl = {0};
+	int			i;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("snapshot name must not be null")));
+
+	tupstore = beginMaterialize(fcinfo, "profile_delta", &tupdesc);
+
+	a = readProfile(text_to_cstring(PG_GETARG_TEXT_PP(0)), &countA);
+	b = readProfile(PG_ARGISNULL(1) ? NULL : text_to_cstring(PG_GETARG_TEXT_PP(1)), &countB);
+
+	/* Match up the lines of a and b */
+	ctl.keysize = sizeof(line_stats_key_t);
+	ctl.entrysize = sizeof(line_delta_t);
+	ctl.hash = tag_hash;
+	ctl.hcxt = CurrentMemoryContext;
+
+	byKey = hash_create("pldebugger profile diff", countA + countB + 1, &ctl, HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	for (i = 0; i < countA + countB; i++)
+	{
+		line_stats_t *entry = (i < countA) ? &a[i] : &b[i - countA];
+		line_delta_t *delta;
+		bool		found;
+
+		if (entry->key.dbOid != MyDatabaseId || entry->count == 0)
+			continue;
+
+		delta = (line_delta_t *) hash_search(byKey, &entry->key, HASH_ENTER, &found);
+
+		if (!found)
+		{
+			delta->countA = delta->countB = 0;
+			delta->meanA = delta->meanB = 0;
+		}
+
+		if (i < countA)
+		{
+			delta->countA = entry->count;
+			delta->meanA = entry->totalUsecs / 1000.0 / entry->count;
+		}
+		else
+		{
+			delta->countB = entry->count;
+			delta->meanB = entry->totalUsecs / 1000.0 / entry->count;
+		}
+	}
+
+	deltas = palloc(sizeof(line_delta_t) * (hash_get_num_entries(byKey) + 1));
+
+	{
+		HASH_SEQ_STATUS scan;
+		line_delta_t *delta;
+
+		hash_seq_init(&scan, byKey);
+
+		while ((delta = (line_delta_t *) hash_seq_search(&scan)) != NULL)
+		{
+			delta->regression = (delta->meanB - delta->meanA) * delta->countB;
+			deltas[nDeltas++] = *delta;
+		}
+	}
+
+	qsort(deltas, nDeltas, sizeof(line_delta_t), compareDeltas);
+
+	for (i = 0; i < nDeltas; i++)
+	{
+		Datum		values[7];
+		bool		nulls[7] = {false, false, false, false, false, false, false};
+
+		values[0] = ObjectIdGetDatum(deltas[i].key.funcOid);
+		values[1] = Int32GetDatum(deltas[i].key.lineNumber);
+		values[2] = Int64GetDatum((int64) deltas[i].countA);
+		values[3] = Int64GetDatum((int64) deltas[i].countB);
+		values[4] = Float8GetDatum(deltas[i].meanA);
+		values[5] = Float8GetDatum(deltas[i].meanB);
+		values[6] = Float8GetDatum(deltas[i].regression);
+
+		nulls[4] = (deltas[i].countA == 0);
+		nulls[5] = (deltas[i].countB == 0);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	hash_destroy(byKey);
+
+	return (Datum) 0;
+}
+
+/*
+ * CREATE FUNCTION pldbg_export_profile( name TEXT ) RETURNS INTEGER
+ *
+ * Exports the line profile of the functions in this database to the file
+ * pldebugger/profile_<name>.dat in the data directory, in a format that
+ * pldbg_merge_profiles() can merge with the profiles of other servers.
+ * Returns the number of lines exported. Functions that have been dropped
+ * are left out.
+ */
+PGDLLEXPORT Datum pldbg_export_profile(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_export_profile);
+
+Datum
+pldbg_export_profile(PG_FUNCTION_ARGS)
+{
+	char	   *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	export_profile_t profile;
+	uint64		node = GetSystemIdentifier();
+	line_stats_t *entries;
+	int			count;
+	int			i;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to export the profile")));
+
+	checkProfileName(name);
+
+	flushLineStats();
+
+	entries = readProfile(NULL, &count);
+
+	profile.nodeCount = 1;
+	profile.nodes = &node;
+	profile.lineCount = 0;
+	profile.lines = palloc(sizeof(export_line_t) * (count + 1));
+
+	for (i = 0; i < count; i++)
+	{
+		export_line_t *line = &profile.lines[profile.lineCount];
+
+		if (entries[i].key.dbOid != MyDatabaseId ||
+			!SearchSysCacheExists1(PROCOID, ObjectIdGetDatum(entries[i].key.funcOid)))
+			continue;
+
+		line->func = format_procedure_qualified(entries[i].key.funcOid);
+		line->lineNumber = entries[i].key.lineNumber;
+		line->count = entries[i].count;
+		line->totalUsecs = entries[i].totalUsecs;
+		line->maxUsecs = entries[i].maxUsecs;
+		line->blksHit = entries[i].blksHit;
+		line->blksRead = entries[i].blksRead;
+		line->exceptions = entries[i].exceptions;
+
+		profile.lineCount++;
+	}
+
+	combineExport(&profile);
+	writeExport(name, &profile);
+
+	PG_RETURN_INT32(profile.lineCount);
+}
+
+/*
+ * CREATE FUNCTION pldbg_merge_profiles( name TEXT, sources TEXT[] ) RETURNS INTEGER
+ *
+ * Adds up the exported profiles named in sources (which may themselves be
+ * merged profiles), usually exported by different servers and copied into
+ * this server's pldebugger directory, and exports the result under the
+ * given name. Returns the number of lines in the result. It is an error to
+ * include the profile of a server more than once.
+ */
+PGDLLEXPORT Datum pldbg_merge_profiles(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_merge_profiles);
+
+Datum
+pldbg_merge_profiles(PG_FUNCTION_ARGS)
+{
+	char	   *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	ArrayType  *sources = PG_GETARG_ARRAYTYPE_P(1);
+	Datum	   *sourceNames;
+	bool	   *sourceNulls;
+	int			sourceCount;
+	export_profile_t profile;
+	int			i;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to merge profiles")));
+
+	checkProfileName(name);
+
+	deconstruct_array(sources, TEXTOID, -1, false, 'i', &sourceNames, &sourceNulls, &sourceCount);
+
+	profile.nodeCount = 0;
+	profile.nodes = NULL;
+	profile.lineCount = 0;
+	profile.lines = NULL;
+
+	/* Read them all before we write anything, in case name is one of them */
+	for (i = 0; i < sourceCount; i++)
+	{
+		if (sourceNulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("profile name must not be null")));
+
+		readExport(TextDatumGetCString(sourceNames[i]), &profile);
+	}
+
+	combineExport(&profile);
+	writeExport(name, &profile);
+
+	PG_RETURN_INT32(profile.lineCount);
+}
+
+/*
+ * CREATE FUNCTION pldbg_read_profile( name TEXT ) RETURNS SETOF exported_line
+ *
+ * Returns the contents of an exported (or merged) profile: for each line
+ * of each function, the same counts as pldbg_get_profile().
+ */
+PGDLLEXPORT Datum pldbg_read_profile(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_read_profile);
+
+Datum
+pldbg_read_profile(PG_FUNCTION_ARGS)
+{
+	char	   *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	export_profile_t profile;
+	int			i;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to read an exported profile")));
+
+	tupstore = beginMaterialize(fcinfo, "exported_line", &tupdesc);
+
+	profile.nodeCount = 0;
+	profile.nodes = NULL;
+	profile.lineCount = 0;
+	profile.lines = NULL;
+
+	readExport(name, &profile);
+
+	for (i = 0; i < profile.lineCount; i++)
+	{
+		export_line_t *line = &profile.lines[i];
+		Datum		values[8];
+		bool		nulls[8] = {false, false, false, false, false, false, false, false};
+
+		values[0] = CStringGetTextDatum(line->func);
+		values[1] = Int32GetDatum(line->lineNumber);
+		values[2] = Int64GetDatum((int64) line->count);
+		values[3] = Float8GetDatum(line->totalUsecs / 1000.0);
+		values[4] = Float8GetDatum(line->maxUsecs / 1000.0);
+		values[5] = Int64GetDatum((int64) line->blksHit);
+		values[6] = Int64GetDatum((int64) line->blksRead);
+		values[7] = Int64GetDatum((int64) line->exceptions);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * Reads the named exported profile and adds its servers and lines to
+ * *profile (without combining its lines with the ones already there).
+ */
+static void
+readExport(const char *name, export_profile_t *profile)
+{
+	char		path[MAXPGPATH];
+	StringInfoData contents;
+	FILE	   *file;
+	char		buffer[8192];
+	size_t		bytesRead;
+	int			version;
+	int			nodeCount;
+	int			funcCount;
+	int			i;
+
+	checkProfileName(name);
+
+	snprintf(path, MAXPGPATH, "%s/profile_%s.dat", ProfilerDir, name);
+
+	if ((file = AllocateFile(path, PG_BINARY_R)) == NULL)
+	{
+		if (errno == ENOENT)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("exported profile \"%s\" does not exist", name)));
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+	}
+
+	initStringInfo(&contents);
+
+	while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		appendBinaryStringInfo(&contents, buffer, bytesRead);
+
+	if (ferror(file))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", path)));
+
+	FreeFile(file);
+
+	if (contents.len < strlen(ExportMagic) ||
+		memcmp(contents.data, ExportMagic, strlen(ExportMagic)) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("\"%s\" is not an exported profile", path)));
+
+	contents.cursor = strlen(ExportMagic);
+
+	/* pq_getmsg*() complain if the file is truncated */
+	version = pq_getmsgint(&contents, 2);
+
+	if (version > ExportVersion)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("exported profile \"%s\" is in a newer format (version %d) than this server understands", name, version)));
+
+	nodeCount = readExportCount(&contents, ExportNodeSize, path);
+
+	profile->nodes = profile->nodes
+		? repalloc(profile->nodes, sizeof(uint64) * (profile->nodeCount + nodeCount + 1))
+		: palloc(sizeof(uint64) * (nodeCount + 1));
+
+	for (i = 0; i < nodeCount; i++)
+	{
+		uint64		node = (uint64) pq_getmsgint64(&contents);
+		int			j;
+
+		for (j = 0; j < profile->nodeCount; j++)
+		{
+			if (profile->nodes[j] == node)
+				ereport(ERROR,
+						(errcode(ERRCODE_DUPLICATE_OBJECT),
+						 errmsg("exported profile \"%s\" includes the profile of server " UINT64_FORMAT " again", name, node)));
+		}
+
+		profile->nodes[profile->nodeCount++] = node;
+	}
+
+	funcCount = pq_getmsgint(&contents, 4);
+
+	for (i = 0; i < funcCount; i++)
+	{
+		int			funcLen = pq_getmsgint(&contents, 4);
+		char	   *func = pnstrdup(pq_getmsgbytes(&contents, funcLen), funcLen);
+		int			lineCount = readExportCount(&contents, ExportLineSize, path);
+		int			j;
+
+		profile->lines = profile->lines
+			? repalloc(profile->lines, sizeof(export_line_t) * (profile->lineCount + lineCount + 1))
+			: palloc(sizeof(export_line_t) * (lineCount + 1));
+
+		for (j = 0; j < lineCount; j++)
+		{
+			export_line_t *line = &profile->lines[profile->lineCount++];
+
+			line->func = func;
+			line->lineNumber = pq_getmsgint(&contents, 4);
+			line->count = (uint64) pq_getmsgint64(&contents);
+			line->totalUsecs = (uint64) pq_getmsgint64(&contents);
+			line->maxUsecs = (uint64) pq_getmsgint64(&contents);
+			line->blksHit = (uint64) pq_getmsgint64(&contents);
+			line->blksRead = (uint64) pq_getmsgint64(&contents);
+			line->exceptions = (uint64) pq_getmsgint64(&contents);
+		}
+	}
+
+	pfree(contents.data);
+}
+
+/*
+ * Reads the number of records that follow in an exported profile, and
+ * checks that the rest of the file has room for that many records of
+ * recordSize bytes, before the caller allocates space for them.
+ */
+static int
+readExportCount(StringInfo contents, int recordSize, const char *path)
+{
+	int			count = (int) pq_getmsgint(contents, 4);
+
+	if (count < 0 || count > (contents->len - contents->cursor) / recordSize)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("\"%s\" is not an exported profile", path)));
+
+	return count;
+}
+
+static int
+compareExportLines(const void *a, const void *b)
+{
+	const export_line_t *la = (const export_line_t *) a;
+	const export_line_t *lb = (const export_line_t *) b;
+	int			result = strcmp(la->func, lb->func);
+
+	if (result != 0)
+		return result;
+
+	return (la->lineNumber > lb->lineNumber) - (la->lineNumber < lb->lineNumber);
+}
+
+/*
+ * Sorts the lines of *profile by function and line number, and adds up
+ * those that are for the same line.
+ */
+static void
+combineExport(export_profile_t *profile)
+{
+	int			n = 0;
+	int			i;
+
+	if (profile->lineCount == 0)
+		return;
+
+	qsort(profile->lines, profile->lineCount, sizeof(export_line_t), compareExportLines);
+
+	for (i = 1; i < profile->lineCount; i++)
+	{
+		export_line_t *into = &profile->lines[n];
+		export_line_t *line = &profile->lines[i];
+
+		if (compareExportLines(into, line) != 0)
+		{
+			profile->lines[++n] = *line;
+			continue;
+		}
+
+		into->count += line->count;
+		into->totalUsecs += line->totalUsecs;
+		if (line->maxUsecs > into->maxUsecs)
+			into->maxUsecs = line->maxUsecs;
+		into->blksHit += line->blksHit;
+		into->blksRead += line->blksRead;
+		into->exceptions += line->exceptions;
+	}
+
+	profile->lineCount = n + 1;
+}
+
+/*
+ * Writes *profile, whose lines must be combined (see combineExport()), to
+ * the named exported profile, replacing any earlier one by that name.
+ */
+static void
+writeExport(const char *name, export_profile_t *profile)
+{
+	char		path[MAXPGPATH];
+	StringInfoData buf;
+	FILE	   *file;
+	int			i;
+
+	initStringInfo(&buf);
+
+	appendBinaryStringInfo(&buf, ExportMagic, strlen(ExportMagic));
+	pq_sendint16(&buf, ExportVersion);
+
+	pq_sendint32(&buf, profile->nodeCount);
+	for (i = 0; i < profile->nodeCount; i++)
+		pq_sendint64(&buf, profile->nodes[i]);
+
+	/* Count the functions, which are in runs of lines now */
+	{
+		int			funcCount = 0;
+
+		for (i = 0; i < profile->lineCount; i++)
+		{
+			if (i == 0 || strcmp(profile->lines[i].func, profile->lines[i - 1].func) != 0)
+				funcCount++;
+		}
+
+		pq_sendint32(&buf, funcCount);
+	}
+
+	for (i = 0; i < profile->lineCount;)
+	{
+		const char *func = profile->lines[i].func;
+		int			end;
+
+		for (end = i; end < profile->lineCount && strcmp(profile->lines[end].func, func) == 0; end++)
+			;
+
+		pq_sendint32(&buf, strlen(func));
+		pq_sendbytes(&buf, func, strlen(func));
+		pq_sendint32(&buf, end - i);
+
+		for (; i < end; i++)
+		{
+			export_line_t *line = &profile->lines[i];
+
+			pq_sendint32(&buf, line->lineNumber);
+			pq_sendint64(&buf, line->count);
+			pq_sendint64(&buf, line->totalUsecs);
+			pq_sendint64(&buf, line->maxUsecs);
+			pq_sendint64(&buf, line->blksHit);
+			pq_sendint64(&buf, line->blksRead);
+			pq_sendint64(&buf, line->exceptions);
+		}
+	}
+
+	makeProfilerDir();
+
+	snprintf(path, MAXPGPATH, "%s/profile_%s.dat", ProfilerDir, name);
+
+	if ((file = AllocateFile(path, PG_BINARY_W)) == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", path)));
+
+	if (fwrite(buf.data, 1, buf.len, file) != buf.len || FreeFile(file) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", path)));
+
+	pfree(buf.data);
+}
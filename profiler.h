@@ -0,0 +1,90 @@
+/*
+ * profiler.h
+ *
+ * This file defines the interface between the language plugins and the
+ * profiler, which keeps track of the values a variable takes on at a given
+ * line and of the slowest invocations of a function, records the
+ * invocations of a function for replay, and carries out breakpoint action
+ * lists, without stopping the target. It also keeps the line profile (see
+ * pldebugger.profile).
+ *
+ * Licensed under the Artistic License v2.0, see
+ *		https://opensource.org/licenses/artistic-license-2.0
+ * for full details
+ */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "lib/stringinfo.h"
+
+/*
+ * Called by profiler_sample_line() to fetch the value of the named variable
+ * in the frame that 'arg' points to. Returns the value as text (anything
+ * will do if *isnull is set), or NULL if the frame has no variable by that
+ * name.
+ */
+typedef char *(*profile_fetch_fn)(void *arg, const char *varName, bool *isnull);
+
+/*
+ * Called by profiler_record_call() to describe the invocation that 'arg'
+ * points to: its arguments and the chain of functions that called it, as
+ * palloc'd strings.
+ */
+typedef void (*call_describe_fn)(void *arg, char **args, char **callers);
+
+/*
+ * Called by profiler_record_workload() to append the arguments of the
+ * invocation that 'arg' points to, with profiler_append_arg(). Returns the
+ * number of arguments appended.
+ */
+typedef int (*call_args_fn)(void *arg, StringInfo buf);
+
+/*
+ * Called by profiler_run_actions() to evaluate a SQL expression in the
+ * frame that 'arg' points to. Returns the value as text, NULL if the value
+ * is null, or the error message if it couldn't be evaluated.
+ */
+typedef char *(*action_eval_fn)(void *arg, const char *expression);
+
+/*
+ * The waits this backend has sampled so far, by kind, in microseconds. A
+ * statement's waits are the difference between its start and its end.
+ */
+typedef struct
+{
+	uint64		lockUsecs;
+	uint64		lwlockUsecs;
+	uint64		ioUsecs;
+} wait_usage_t;
+
+extern bool profileLines;
+extern uint64 planningUsecs;
+extern volatile wait_usage_t waitUsage;
+
+extern void profiler_reserve(void);
+extern void profiler_install_hooks(void);
+
+extern bool profiler_wants_function(Oid funcOid);
+extern void profiler_sample_line(Oid funcOid, int lineNumber, profile_fetch_fn fetch, void *arg);
+
+extern bool profiler_times_function(Oid funcOid);
+extern void profiler_record_call(Oid funcOid, uint64 usecs, call_describe_fn describe, void *arg);
+
+extern bool profiler_records_function(Oid funcOid);
+extern void profiler_record_workload(Oid funcOid, call_args_fn appendArgs, void *arg);
+extern void profiler_append_arg(StringInfo buf, Oid typoid, bool isnull, bytea *binary, const char *text);
+
+extern bool profiler_has_actions(Oid funcOid);
+extern bool profiler_run_actions(Oid funcOid, int lineNumber, profile_fetch_fn fetch, call_describe_fn describe, action_eval_fn evaluate, void *arg);
+
+extern void profiler_prepare_lines(void);
+extern void profiler_count_line(Oid funcOid, int lineNumber, uint64 usecs, uint64 blksHit, uint64 blksRead);
+extern void profiler_count_exception(Oid funcOid, int lineNumber);
+extern void profiler_count_loop_entry(Oid funcOid, int loopLine);
+extern void profiler_count_loop_query(Oid funcOid, int loopLine, int sqlLine, uint64 usecs);
+extern void profiler_count_plan(Oid funcOid, int lineNumber, uint64 builds, uint64 customPlans, uint64 genericPlans, bool invalidated, uint64 planUsecs);
+extern void profiler_begin_wait_sampling(void *owner);
+extern void profiler_end_wait_sampling(void *owner);
+extern void profiler_count_waits(Oid funcOid, int lineNumber, uint64 lockUsecs, uint64 lwlockUsecs, uint64 ioUsecs);
+
+#endif
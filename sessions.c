@@ -0,0 +1,438 @@
+/**********************************************************************
+ * sessions.c
+ *
+ * This file contains the session registry: every debugging proxy and
+ * every target that attaches to one registers in a table in shared
+ * memory, saying who it's talking to, what state it's in and, for a
+ * target, where it's paused. The proxies' own session handles are local
+ * to their backends, so without it there's no telling who's debugging
+ * what, or which forgotten target is sitting on its locks.
+ * pldbg_sessions() lists the table.
+ *
+ * Licensed under the Artistic License v2.0, see
+ *		https://opensource.org/licenses/artistic-license-2.0
+ * for full details
+ *
+ **********************************************************************/
+
+#include "postgres.h"
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/procarray.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#include "pldebugger.h"
+#include "sessions.h"
+
+/*
+ * One slot per proxy session or target. A backend can hold any number of
+ * proxy slots, but at most one target slot. The slots are protected by
+ * getPLDebuggerLock(); each backend only ever changes its own, and frees
+ * them all when it exits. Session tokens are deliberately not kept here,
+ * since anyone who can read the registry could then take over a session.
+ *
+ * The registry is only there to be looked at: if it fills up, sessions
+ * that don't fit in it work just the same, they just don't show up.
+ */
+#define MaxDebugSessions	64
+
+typedef struct
+{
+	int			pid;			/* owning backend, 0 if the slot is free */
+	bool		isProxy;		/* proxy session, or target? */
+	int			peerPid;		/* proxy: the target's pid, 0 if none yet */
+	session_state_t state;
+	Oid			databaseId;
+	Oid			userId;
+	Oid			funcOid;		/* target: where it stopped last */
+	int			lineNumber;
+	TimestampTz stateSince;
+	TimestampTz pausedSince;	/* 0 unless the target is paused */
+} session_slot_t;
+
+static session_slot_t *sessionSlots = NULL;
+
+static int	targetSlot = -1;		/* this backend's target slot, if any */
+
+static const char *const stateNames[] = {
+	"listening",
+	"attached",
+	"observing",
+	"paused",
+	"running"
+};
+
+static void sessions_init(void);
+static int	claimSlot(bool isProxy);
+static void releaseSlot(int slot);
+static void sessionsAtExit(int code, Datum arg);
+
+/*
+ * Reserves the right amount of shared memory, when the library is
+ * preloaded by shared_preload_libraries.
+ */
+void
+sessions_reserve(void)
+{
+	RequestAddinShmemSpace(sizeof(session_slot_t) * MaxDebugSessions);
+}
+
+/*
+ * Initialize the session registry in shared memory.
+ */
+static void
+sessions_init(void)
+{
+	bool		found;
+
+	if (sessionSlots)
+		return;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+	sessionSlots = ShmemInitStruct("Debugger Sessions", sizeof(session_slot_t) * MaxDebugSessions, &found);
+	if (sessionSlots == NULL)
+		elog(ERROR, "out of shared memory");
+
+	if (!found)
+	{
+		int			i;
+
+		for (i = 0; i < MaxDebugSessions; i++)
+			sessionSlots[i].pid = 0;
+	}
+	LWLockRelease(getPLDebuggerLock());
+
+	on_shmem_exit(sessionsAtExit, (Datum) 0);
+}
+
+/*
+ * Takes a free slot for this backend, or returns -1 if there's none. The
+ * caller must hold getPLDebuggerLock() exclusively.
+ */
+static int
+claimSlot(bool isProxy)
+{
+	int			i;
+
+	for (i = 0; i < MaxDebugSessions; i++)
+	{
+		session_slot_t *slot = &sessionSlots[i];
+
+		if (slot->pid != 0)
+			continue;
+
+		slot->pid = MyProcPid;
+		slot->isProxy = isProxy;
+		slot->peerPid = 0;
+		slot->databaseId = MyDatabaseId;
+		slot->userId = GetUserId();
+		slot->funcOid = InvalidOid;
+		slot->lineNumber = 0;
+		slot->pausedSince = 0;
+
+		return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Frees the given slot, if it's (still) ours. The caller must hold
+ * getPLDebuggerLock() exclusively.
+ */
+static void
+releaseSlot(int slot)
+{
+	if (slot >= 0 && slot < MaxDebugSessions && sessionSlots[slot].pid == MyProcPid)
+		sessionSlots[slot].pid = 0;
+}
+
+/*
+ * Frees all of this backend's slots when it exits, however it exits.
+ */
+static void
+sessionsAtExit(int code, Datum arg)
+{
+	int			i;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	for (i = 0; i < MaxDebugSessions; i++)
+		releaseSlot(i);
+
+	LWLockRelease(getPLDebuggerLock());
+
+	targetSlot = -1;
+}
+
+/*
+ * sessions_add_proxy
+ *
+ * Registers a new proxy session, talking to the given target (or 0 if it
+ * isn't connected to one yet). Returns the slot to pass to
+ * sessions_set_proxy() and sessions_drop_proxy(), or -1 if the registry is
+ * full.
+ */
+int
+sessions_add_proxy(session_state_t state, int targetPid)
+{
+	int			slot;
+
+	sessions_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if ((slot = claimSlot(true)) != -1)
+	{
+		sessionSlots[slot].peerPid = targetPid;
+		sessionSlots[slot].state = state;
+		sessionSlots[slot].stateSince = GetCurrentTimestamp();
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	return slot;
+}
+
+/*
+ * sessions_set_proxy
+ *
+ * Records that the given proxy session is now in the given state, talking
+ * to the given target.
+ */
+void
+sessions_set_proxy(int slot, session_state_t state, int targetPid)
+{
+	if (slot < 0 || sessionSlots == NULL)
+		return;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if (sessionSlots[slot].pid == MyProcPid)
+	{
+		sessionSlots[slot].peerPid = targetPid;
+		sessionSlots[slot].state = state;
+		sessionSlots[slot].stateSince = GetCurrentTimestamp();
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+}
+
+/*
+ * sessions_drop_proxy
+ *
+ * Removes the given proxy session from the registry.
+ */
+void
+sessions_drop_proxy(int slot)
+{
+	if (slot < 0 || sessionSlots == NULL)
+		return;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+	releaseSlot(slot);
+	LWLockRelease(getPLDebuggerLock());
+}
+
+/*
+ * sessions_set_target
+ *
+ * Records that this backend, as a debugging target, is now in the given
+ * state, registering it if it isn't already. If funcOid is valid, the
+ * target is at the given line of that function; otherwise it's wherever it
+ * was before. The pause time is kept until the target runs again, so that
+ * a target waiting for a proxy to reattach still shows how long it's been
+ * holding on to its locks.
+ */
+void
+sessions_set_target(session_state_t state, Oid funcOid, int lineNumber)
+{
+	session_slot_t *slot;
+	TimestampTz now;
+
+	sessions_init();
+
+	now = GetCurrentTimestamp();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+
+	if (targetSlot == -1 || sessionSlots[targetSlot].pid != MyProcPid)
+		targetSlot = claimSlot(false);
+
+	if (targetSlot != -1)
+	{
+		slot = &sessionSlots[targetSlot];
+
+		if (OidIsValid(funcOid))
+		{
+			slot->funcOid = funcOid;
+			slot->lineNumber = lineNumber;
+		}
+
+		if (state == SESSION_PAUSED && (slot->pausedSince == 0 || OidIsValid(funcOid)))
+			slot->pausedSince = now;
+		else if (state == SESSION_RUNNING || state == SESSION_ATTACHED)
+			slot->pausedSince = 0;
+
+		slot->state = state;
+		slot->stateSince = now;
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+}
+
+/*
+ * sessions_drop_target
+ *
+ * Removes this backend's target entry from the registry, once it has no
+ * proxy any more.
+ */
+void
+sessions_drop_target(void)
+{
+	if (targetSlot == -1)
+		return;
+
+	LWLockAcquire(getPLDebuggerLock(), LW_EXCLUSIVE);
+	releaseSlot(targetSlot);
+	LWLockRelease(getPLDebuggerLock());
+
+	targetSlot = -1;
+}
+
+/*
+ * sessions_wake_targets
+ *
+ * Sets the latch of every registered target, so that one that's waiting
+ * for a proxy, or for commands from one, looks up from what it's doing
+ * (see pldbg_disarm_all()). Returns the number of targets woken.
+ */
+int
+sessions_wake_targets(void)
+{
+	int			pids[MaxDebugSessions];
+	int			nPids = 0;
+	int			i;
+
+	sessions_init();
+
+	LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+
+	for (i = 0; i < MaxDebugSessions; i++)
+	{
+		if (sessionSlots[i].pid != 0 && !sessionSlots[i].isProxy)
+			pids[nPids++] = sessionSlots[i].pid;
+	}
+
+	LWLockRelease(getPLDebuggerLock());
+
+	for (i = 0; i < nPids; i++)
+	{
+		PGPROC	   *proc = BackendPidGetProc(pids[i]);
+
+		if (proc != NULL)
+			SetLatch(&proc->procLatch);
+	}
+
+	return nPids;
+}
+
+/*
+ * CREATE FUNCTION pldbg_sessions() RETURNS SETOF debug_session
+ *
+ * Lists the debugging sessions in all backends: one row for each proxy
+ * session (kind 'proxy') and one for each target attached to a proxy
+ * (kind 'target'), with the pid of the backend at the other end. A target
+ * that's been paused for a long time holds on to its locks all that time;
+ * pg_terminate_backend(pid) on it, or on its proxy, ends the session.
+ *
+ * Only superusers see where other users' targets are paused.
+ */
+PGDLLEXPORT Datum pldbg_sessions(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pldbg_sessions);
+
+Datum
+pldbg_sessions(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	session_slot_t *slots;
+	int			i;
+
+	tupstore = beginMaterialize(fcinfo, "debug_session", &tupdesc);
+
+	sessions_init();
+
+	/* Take a copy, so that we don't hold the lock while building the rows */
+	slots = palloc(sizeof(session_slot_t) * MaxDebugSessions);
+
+	LWLockAcquire(getPLDebuggerLock(), LW_SHARED);
+	memcpy(slots, sessionSlots, sizeof(session_slot_t) * MaxDebugSessions);
+	LWLockRelease(getPLDebuggerLock());
+
+	for (i = 0; i < MaxDebugSessions; i++)
+	{
+		session_slot_t *slot = &slots[i];
+		Datum		values[10];
+		bool		nulls[10] = {false, false, false, false, false, false, false, false, false, false};
+		int			peerPid = slot->peerPid;
+		int			j;
+
+		if (slot->pid == 0)
+			continue;
+
+		/* A target doesn't know its proxy's pid; the proxy's slot does */
+		if (!slot->isProxy)
+		{
+			for (j = 0; j < MaxDebugSessions; j++)
+			{
+				if (slots[j].pid != 0 && slots[j].isProxy && slots[j].peerPid == slot->pid &&
+					slots[j].state != SESSION_OBSERVING)
+				{
+					peerPid = slots[j].pid;
+					break;
+				}
+			}
+		}
+
+		values[0] = Int32GetDatum(slot->pid);
+		values[1] = CStringGetTextDatum(slot->isProxy ? "proxy" : "target");
+
+		if (peerPid != 0)
+			values[2] = Int32GetDatum(peerPid);
+		else
+			nulls[2] = true;
+
+		values[3] = CStringGetTextDatum(stateNames[slot->state]);
+		values[4] = ObjectIdGetDatum(slot->databaseId);
+		values[5] = ObjectIdGetDatum(slot->userId);
+
+		if (OidIsValid(slot->funcOid) && (superuser() || GetUserId() == slot->userId))
+		{
+			values[6] = ObjectIdGetDatum(slot->funcOid);
+			values[7] = Int32GetDatum(slot->lineNumber);
+		}
+		else
+			nulls[6] = nulls[7] = true;
+
+		values[8] = TimestampTzGetDatum(slot->stateSince);
+
+		if (slot->pausedSince != 0)
+			values[9] = TimestampTzGetDatum(slot->pausedSince);
+		else
+			nulls[9] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
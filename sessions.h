@@ -0,0 +1,35 @@
+/*
+ * sessions.h
+ *
+ * This file defines the interface to the session registry, which keeps
+ * track of every debugging proxy and every target attached to one, across
+ * all backends, so that pldbg_sessions() can list them.
+ *
+ * Licensed under the Artistic License v2.0, see
+ *		https://opensource.org/licenses/artistic-license-2.0
+ * for full details
+ */
+#ifndef SESSIONS_H
+#define SESSIONS_H
+
+typedef enum
+{
+	SESSION_LISTENING,			/* waiting for the other end to connect */
+	SESSION_ATTACHED,			/* connected, target hasn't stopped yet */
+	SESSION_OBSERVING,			/* proxy watching someone else's session */
+	SESSION_PAUSED,				/* target stopped, waiting for commands */
+	SESSION_RUNNING				/* target carrying on until the next stop */
+} session_state_t;
+
+extern void sessions_reserve(void);
+
+extern int	sessions_add_proxy(session_state_t state, int targetPid);
+extern void sessions_set_proxy(int slot, session_state_t state, int targetPid);
+extern void sessions_drop_proxy(int slot);
+
+extern void sessions_set_target(session_state_t state, Oid funcOid, int lineNumber);
+extern void sessions_drop_target(void);
+
+extern int	sessions_wake_targets(void);
+
+#endif
@@ -0,0 +1,527 @@
+/**********************************************************************
+ * spans.c
+ *
+ * This file contains the span exporter: while pldebugger.trace_spans is
+ * on, each invocation of a PL function (and, if it's set to 'statements',
+ * each statement in it) is reported as a span, so that tracing tools can
+ * see inside PL code. Spans carry the trace context that the application
+ * passes in pldebugger.traceparent, so they show up in the trace of the
+ * request that ran them.
+ *
+ * Licensed under the Artistic License v2.0, see
+ *		https://opensource.org/licenses/artistic-license-2.0
+ * for full details
+ *
+ **********************************************************************/
+
+#include "postgres.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "access/xact.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "port/pg_crc32c.h"
+#include "storage/fd.h"
+#include "utils/json.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#if (PG_VERSION_NUM >= 150000)
+#include "common/pg_prng.h"
+#endif
+
+#include "spans.h"
+
+/*
+ * Spans are written as JSON lines, one object per span, with the fields
+ * named as in OpenTelemetry: traceId, spanId, parentSpanId (unless it's a
+ * root span), name, kind, startTimeUnixNano, endTimeUnixNano, attributes
+ * and (for a failed span) status. kind and status.code are OpenTelemetry's
+ * enum values: every span is SpanKindInternal, and whether it's a function
+ * or a statement is the pldebugger.kind attribute. Each backend collects them in a buffer of its own and writes
+ * the buffer out at the end of each transaction, or when it fills up. If
+ * it can't write them out, the spans are dropped: the buffer never grows
+ * beyond SpanBufferSize, and a collector that can't keep up never holds
+ * up the backend.
+ *
+ * pldebugger.span_destination is either a file (relative to the data
+ * directory) to append the spans to, or SocketPrefix and the path of a
+ * unix-domain datagram socket to send each batch of spans to.
+ *
+ * A call or statement that fails never reaches spans_end(), so we keep a
+ * stack of the spans that have begun and not ended (openSpans), and end
+ * them ourselves, with an error status, when the (sub)transaction they
+ * started in aborts. The language plugin tells us which spans an error is
+ * passing through (see spans_fail()), from an error context callback; that
+ * is how we tell an abort caused by an error from a procedure's ROLLBACK,
+ * which leaves the spans of the procedure running.
+ */
+#define SpanBufferSize		(64 * 1024)
+#define SpanKindInternal	1		/* OpenTelemetry SPAN_KIND_INTERNAL */
+#define StatusCodeError		2		/* OpenTelemetry STATUS_CODE_ERROR */
+#define SocketPrefix		"unix:"
+#define TraceParentLen		55		/* "00-" traceId "-" parentId "-" flags */
+
+int			traceSpans = SPANS_OFF;	/* pldebugger.trace_spans */
+char	   *traceParent = NULL;		/* pldebugger.traceparent */
+char	   *spanDestination = NULL;	/* pldebugger.span_destination */
+
+const struct config_enum_entry traceSpansOptions[] = {
+	{"off", SPANS_OFF, false},
+	{"functions", SPANS_FUNCTIONS, false},
+	{"statements", SPANS_STATEMENTS, false},
+	{NULL, 0, false}
+};
+
+typedef struct
+{
+	span_t	   *owner;			/* The caller's span_t */
+	span_t		copy;			/* ... as it was when it began */
+	const char *kind;			/* "function" or "statement" */
+	const char *name;			/* Function signature (lives as long as the function) */
+	Oid			funcOid;
+	int			lineNumber;
+	int			nestLevel;		/* Transaction nest level the span began at */
+	int			sqlerrcode;		/* Error passing through the span, or 0 */
+} open_span_t;
+
+static StringInfo spanBuffer = NULL;
+static int	spanSocket = -1;
+static bool reportedFailure = false;	/* Complained about a failed write? */
+static open_span_t *openSpans = NULL;
+static int	openSpanCount = 0;
+static int	openSpanMax = 0;
+
+static uint64 randomId(void);
+static int64 unixNanos(TimestampTz ts);
+static bool writeSpans(const char *destination, const char *data, int len);
+static void flushSpans(void);
+static void spansXactCallback(XactEvent event, void *arg);
+static void spansSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+								 SubTransactionId parentSubid, void *arg);
+static int	findOpenSpan(span_t *span);
+static void dropOpenSpan(int i);
+static void emitSpan(span_t *span, open_span_t *open, bool failed);
+static void failOpenSpans(int nestLevel);
+
+/*
+ * spans_check_traceparent
+ *
+ * GUC check hook for pldebugger.traceparent: the value must be empty or a
+ * W3C traceparent, "00-<32 hex digits>-<16 hex digits>-<2 hex digits>",
+ * with a trace id and a parent id that aren't all zeros.
+ */
+bool
+spans_check_traceparent(char **newval, void **extra, GucSource source)
+{
+	const char *value = *newval;
+	int			i;
+
+	if (value == NULL || value[0] == '\0')
+		return true;
+
+	if (strlen(value) == TraceParentLen && value[2] == '-' && value[35] == '-' && value[52] == '-')
+	{
+		for (i = 0; i < TraceParentLen; i++)
+		{
+			if (i == 2 || i == 35 || i == 52)
+				continue;
+			if (!isxdigit((unsigned char) value[i]))
+				break;
+		}
+
+		if (i == TraceParentLen && strspn(value + 3, "0") < 32 && strspn(value + 36, "0") < 16)
+			return true;
+	}
+
+	GUC_check_errdetail("A traceparent has the form \"00-<32 hex digits>-<16 hex digits>-<2 hex digits>\".");
+	return false;
+}
+
+/*
+ * Returns a random, non-zero span (or half a trace) id. These only need
+ * to be unique, not unguessable.
+ */
+static uint64
+randomId(void)
+{
+	uint64		id;
+
+	do
+	{
+#if (PG_VERSION_NUM >= 150000)
+		id = pg_prng_uint64(&pg_global_prng_state);
+#else
+		id = ((uint64) random() << 33) ^ ((uint64) random() << 2) ^ (uint64) random();
+#endif
+	} while (id == 0);
+
+	return id;
+}
+
+/*
+ * spans_begin
+ *
+ * Starts a span. kind is "function" or "statement"; lineNumber is the line
+ * of a statement, and ignored for a function. If parent is NULL, this is
+ * the outermost span of the call, and its parent is the one named in
+ * pldebugger.traceparent (or, if that isn't set, it starts a trace of its
+ * own). If args isn't NULL, the
+ * span records a digest of it, so that you can tell calls with the same
+ * arguments apart without exporting the arguments themselves.
+ */
+void
+spans_begin(span_t *span, const span_t *parent, const char *args,
+			const char *kind, const char *name, Oid funcOid, int lineNumber)
+{
+	open_span_t *open;
+	int			i;
+
+	if (parent != NULL)
+	{
+		memcpy(span->traceId, parent->traceId, sizeof(span->traceId));
+		memcpy(span->parentId, parent->spanId, sizeof(span->parentId));
+	}
+	else if (traceParent != NULL && traceParent[0] != '\0')
+	{
+		/* spans_check_traceparent() made sure this is well-formed */
+		memcpy(span->traceId, traceParent + 3, 32);
+		span->traceId[32] = '\0';
+		memcpy(span->parentId, traceParent + 36, 16);
+		span->parentId[16] = '\0';
+	}
+	else
+	{
+		snprintf(span->traceId, sizeof(span->traceId), "%016" INT64_MODIFIER "x%016" INT64_MODIFIER "x",
+				 randomId(), randomId());
+		span->parentId[0] = '\0';
+	}
+
+	snprintf(span->spanId, sizeof(span->spanId), "%016" INT64_MODIFIER "x", randomId());
+
+	span->argsDigest = 0;
+
+	if (args != NULL)
+	{
+		pg_crc32c	crc;
+
+		INIT_CRC32C(crc);
+		COMP_CRC32C(crc, args, strlen(args));
+		FIN_CRC32C(crc);
+
+		span->argsDigest = crc;
+	}
+
+	span->start = GetCurrentTimestamp();
+
+	if (openSpans == NULL)
+	{
+		openSpanMax = 16;
+		openSpans = (open_span_t *) MemoryContextAlloc(TopMemoryContext, sizeof(open_span_t) * openSpanMax);
+
+		RegisterXactCallback(spansXactCallback, NULL);
+		RegisterSubXactCallback(spansSubXactCallback, NULL);
+	}
+	else if (openSpanCount == openSpanMax)
+	{
+		openSpanMax *= 2;
+		openSpans = (open_span_t *) repalloc(openSpans, sizeof(open_span_t) * openSpanMax);
+	}
+
+	/* If the span never ended (and we didn't see why), forget about it */
+	if ((i = findOpenSpan(span)) != -1)
+		dropOpenSpan(i);
+
+	open = &openSpans[openSpanCount++];
+	open->owner = span;
+	open->copy = *span;
+	open->kind = kind;
+	open->name = name;
+	open->funcOid = funcOid;
+	open->lineNumber = lineNumber;
+	open->nestLevel = GetCurrentTransactionNestLevel();
+	open->sqlerrcode = 0;
+}
+
+/*
+ * Returns the index of the given span in openSpans, or -1. The one we want
+ * is almost always the last.
+ */
+static int
+findOpenSpan(span_t *span)
+{
+	int			i;
+
+	for (i = openSpanCount - 1; i >= 0; i--)
+	{
+		if (openSpans[i].owner == span)
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+dropOpenSpan(int i)
+{
+	memmove(&openSpans[i], &openSpans[i + 1], sizeof(open_span_t) * (openSpanCount - i - 1));
+	openSpanCount--;
+}
+
+/*
+ * spans_fail
+ *
+ * Notes that the given error is passing through the given span. Called
+ * from an error context callback, so this doesn't do much.
+ */
+void
+spans_fail(span_t *span, int sqlerrcode)
+{
+	int			i;
+
+	if (span->start == 0 || (i = findOpenSpan(span)) == -1)
+		return;
+
+	openSpans[i].sqlerrcode = sqlerrcode;
+}
+
+static int64
+unixNanos(TimestampTz ts)
+{
+	return (ts + ((int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY)) * 1000;
+}
+
+/*
+ * spans_end
+ *
+ * Ends the given span, and adds it to the batch of spans to export.
+ */
+void
+spans_end(span_t *span)
+{
+	int			i;
+
+	if (span->start == 0 || (i = findOpenSpan(span)) == -1)
+		return;
+
+	emitSpan(span, &openSpans[i], false);
+	dropOpenSpan(i);
+}
+
+/*
+ * Ends every open span that began at or inside the given transaction nest
+ * level, as failed: the calls and statements they belong to have been
+ * thrown out by an error. Their span_t's may have been freed along with
+ * them, so we work from our copies.
+ */
+static void
+failOpenSpans(int nestLevel)
+{
+	while (openSpanCount > 0 && openSpans[openSpanCount - 1].nestLevel >= nestLevel)
+	{
+		open_span_t *open = &openSpans[openSpanCount - 1];
+
+		emitSpan(&open->copy, open, true);
+		openSpanCount--;
+	}
+}
+
+/*
+ * Adds the given span, which ends now, to the batch of spans to export.
+ */
+static void
+emitSpan(span_t *span, open_span_t *open, bool failed)
+{
+	TimestampTz end = GetCurrentTimestamp();
+	StringInfoData line;
+	const char *kind = open->kind;
+	const char *name = open->name;
+	Oid			funcOid = open->funcOid;
+	int			lineNumber = open->lineNumber;
+
+	initStringInfo(&line);
+
+	appendStringInfo(&line, "{\"traceId\":\"%s\",\"spanId\":\"%s\"", span->traceId, span->spanId);
+	if (span->parentId[0] != '\0')
+		appendStringInfo(&line, ",\"parentSpanId\":\"%s\"", span->parentId);
+	appendStringInfoString(&line, ",\"name\":");
+	escape_json(&line, name);
+	appendStringInfo(&line, ",\"kind\":%d,\"startTimeUnixNano\":\"" INT64_FORMAT "\",\"endTimeUnixNano\":\"" INT64_FORMAT "\"",
+					 SpanKindInternal, unixNanos(span->start), unixNanos(end));
+	appendStringInfo(&line, ",\"attributes\":{\"pldebugger.kind\":\"%s\",\"process.pid\":%d,\"db.oid\":%u,\"function.oid\":%u",
+					 kind, MyProcPid, MyDatabaseId, funcOid);
+	if (strcmp(kind, "statement") == 0)
+		appendStringInfo(&line, ",\"line\":%d", lineNumber);
+	else
+		appendStringInfo(&line, ",\"args.digest\":\"%08x\"", span->argsDigest);
+	appendStringInfoChar(&line, '}');
+	if (failed)
+	{
+		if (open->sqlerrcode != 0)
+			appendStringInfo(&line, ",\"status\":{\"code\":%d,\"message\":\"SQLSTATE %s\"}",
+							 StatusCodeError, unpack_sql_state(open->sqlerrcode));
+		else
+			appendStringInfo(&line, ",\"status\":{\"code\":%d}", StatusCodeError);
+	}
+	appendStringInfoString(&line, "}\n");
+
+	span->start = 0;
+
+	if (spanBuffer == NULL)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+		spanBuffer = makeStringInfo();
+		enlargeStringInfo(spanBuffer, SpanBufferSize);
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	if (spanBuffer->len + line.len > SpanBufferSize)
+		flushSpans();
+
+	/* A span too big for the buffer on its own is dropped */
+	if (line.len <= SpanBufferSize)
+		appendBinaryStringInfo(spanBuffer, line.data, line.len);
+
+	pfree(line.data);
+}
+
+/*
+ * Writes a batch of spans to the given destination (see above). Returns
+ * false, with errno set, if that didn't work.
+ */
+static bool
+writeSpans(const char *destination, const char *data, int len)
+{
+#ifndef WIN32
+	if (strncmp(destination, SocketPrefix, strlen(SocketPrefix)) == 0)
+	{
+		const char *path = destination + strlen(SocketPrefix);
+		struct sockaddr_un addr;
+
+		if (strlen(path) >= sizeof(addr.sun_path))
+		{
+			errno = ENAMETOOLONG;
+			return false;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, path);
+
+		if (spanSocket < 0 && (spanSocket = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+			return false;
+
+		/* Don't wait for a collector that can't keep up */
+		return sendto(spanSocket, data, len, MSG_DONTWAIT, (struct sockaddr *) &addr, sizeof(addr)) == len;
+	}
+	else
+#endif
+	{
+		int			fd;
+		bool		result;
+
+#if (PG_VERSION_NUM >= 110000)
+		fd = BasicOpenFile(destination, O_WRONLY | O_APPEND | O_CREAT | PG_BINARY);
+#else
+		fd = BasicOpenFile((char *) destination, O_WRONLY | O_APPEND | O_CREAT | PG_BINARY, S_IRUSR | S_IWUSR);
+#endif
+		if (fd < 0)
+			return false;
+
+		result = (write(fd, data, len) == len);
+
+		if (close(fd) != 0)
+			result = false;
+
+		return result;
+	}
+}
+
+/*
+ * Exports the spans we've collected, or drops them if we can't.
+ */
+static void
+flushSpans(void)
+{
+	if (spanBuffer == NULL || spanBuffer->len == 0)
+		return;
+
+	if (spanDestination != NULL && spanDestination[0] != '\0' &&
+		!writeSpans(spanDestination, spanBuffer->data, spanBuffer->len) && !reportedFailure)
+	{
+		/* Only complain once per backend, or we'd flood the log */
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not export spans to \"%s\": %m", spanDestination),
+				 errdetail("Spans that can't be exported are dropped.")));
+		reportedFailure = true;
+	}
+
+	resetStringInfo(spanBuffer);
+}
+
+static void
+spansXactCallback(XactEvent event, void *arg)
+{
+	int			i;
+
+	switch (event)
+	{
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+
+			/*
+			 * If an error got us here, every call we were in is gone. If not,
+			 * a procedure rolled back, and carries on.
+			 */
+			for (i = 0; i < openSpanCount; i++)
+			{
+				if (openSpans[i].sqlerrcode != 0)
+				{
+					failOpenSpans(0);
+					break;
+				}
+			}
+			flushSpans();
+			break;
+
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+			flushSpans();
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*
+ * When a subtransaction aborts, the calls and statements that began inside
+ * it are gone (the error was caught further out), and the ones that began
+ * outside it, which the error passed through, carry on.
+ */
+static void
+spansSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+					 SubTransactionId parentSubid, void *arg)
+{
+	int			i;
+
+	if (event != SUBXACT_EVENT_ABORT_SUB)
+		return;
+
+	failOpenSpans(GetCurrentTransactionNestLevel());
+
+	for (i = 0; i < openSpanCount; i++)
+		openSpans[i].sqlerrcode = 0;
+}
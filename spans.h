@@ -0,0 +1,49 @@
+/*
+ * spans.h
+ *
+ * This file defines the interface between the language plugins and the
+ * span exporter, which reports each invocation of a PL function (and,
+ * optionally, each statement in it) as a tracing span (see
+ * pldebugger.trace_spans).
+ *
+ * Licensed under the Artistic License v2.0, see
+ *		https://opensource.org/licenses/artistic-license-2.0
+ * for full details
+ */
+#ifndef SPANS_H
+#define SPANS_H
+
+#include "datatype/timestamp.h"
+#include "utils/guc.h"
+
+/* Values of pldebugger.trace_spans */
+typedef enum
+{
+	SPANS_OFF,
+	SPANS_FUNCTIONS,
+	SPANS_STATEMENTS
+} spans_level_t;
+
+typedef struct
+{
+	char		traceId[33];	/* 32 hex digits */
+	char		spanId[17];		/* 16 hex digits */
+	char		parentId[17];	/* 16 hex digits, or empty for a root span */
+	uint32		argsDigest;		/* CRC-32C of the arguments, as text */
+	TimestampTz start;			/* 0 if the span hasn't started */
+} span_t;
+
+extern int	traceSpans;
+extern char *traceParent;
+extern char *spanDestination;
+
+extern const struct config_enum_entry traceSpansOptions[];
+
+extern bool spans_check_traceparent(char **newval, void **extra, GucSource source);
+
+extern void spans_begin(span_t *span, const span_t *parent, const char *args,
+						const char *kind, const char *name, Oid funcOid, int lineNumber);
+extern void spans_end(span_t *span);
+extern void spans_fail(span_t *span, int sqlerrcode);
+
+#endif
@@ -10,26 +10,78 @@
 DROP FUNCTION pldbg_get_target_info(TEXT, "char");
 DROP FUNCTION pldbg_wait_for_target(INTEGER);
 DROP FUNCTION pldbg_wait_for_breakpoint(INTEGER);
+DROP FUNCTION pldbg_stop_workload_capture(OID);
 DROP FUNCTION pldbg_step_over(INTEGER);
+DROP FUNCTION pldbg_step_many(INTEGER, INTEGER, INTEGER, BOOLEAN);
 DROP FUNCTION pldbg_step_into(INTEGER);
+DROP FUNCTION pldbg_start_workload_capture(OID);
 DROP FUNCTION pldbg_set_global_breakpoint(INTEGER, OID, INTEGER, INTEGER);
+DROP FUNCTION pldbg_set_breakpoint_actions(OID, INTEGER, TEXT[], INTEGER);
 DROP FUNCTION pldbg_set_breakpoint(INTEGER, OID, INTEGER);
+DROP FUNCTION pldbg_sessions();
 DROP FUNCTION pldbg_select_frame(INTEGER, INTEGER);
+DROP FUNCTION pldbg_reset_profile();
+DROP FUNCTION pldbg_reattach(BIGINT);
+DROP FUNCTION pldbg_read_profile(TEXT);
+DROP FUNCTION pldbg_query_in_target(INTEGER, TEXT, INTEGER, INTEGER);
+DROP FUNCTION pldbg_profile_values(OID, INTEGER, TEXT, INTEGER);
+DROP FUNCTION pldbg_profile_snapshot(TEXT);
+DROP FUNCTION pldbg_profile_diff(TEXT, TEXT);
+DROP FUNCTION pldbg_merge_profiles(TEXT, TEXT[]);
+DROP FUNCTION pldbg_get_workload(OID);
+DROP FUNCTION pldbg_get_wait_stats();
+DROP FUNCTION pldbg_get_variables_binary(INTEGER);
+DROP FUNCTION pldbg_get_variables(INTEGER, TEXT[], BOOLEAN);
+DROP FUNCTION pldbg_get_frame_variables(INTEGER, INTEGER);
 DROP FUNCTION pldbg_get_variables(INTEGER);
+DROP FUNCTION pldbg_get_value_profile(OID, INTEGER, TEXT);
+DROP FUNCTION pldbg_get_types(INTEGER);
+DROP FUNCTION pldbg_get_session_token(INTEGER);
 DROP FUNCTION pldbg_get_proxy_info();
+DROP FUNCTION pldbg_get_profile();
+DROP FUNCTION pldbg_get_plan_stats();
+DROP FUNCTION pldbg_get_observer_token(INTEGER);
 DROP FUNCTION pldbg_get_stack(INTEGER);
 DROP FUNCTION pldbg_get_source(INTEGER, OID);
+DROP FUNCTION pldbg_get_slow_calls(OID);
+DROP FUNCTION pldbg_get_loop_queries(DOUBLE PRECISION);
 DROP FUNCTION pldbg_get_breakpoints(INTEGER);
+DROP FUNCTION pldbg_get_breakpoint_results(OID, INTEGER);
+DROP FUNCTION pldbg_export_snapshot(INTEGER);
+DROP FUNCTION pldbg_export_profile(TEXT);
+DROP FUNCTION pldbg_explain_current(INTEGER, BOOLEAN);
+DROP FUNCTION pldbg_drop_value_profile(OID, INTEGER, TEXT);
+DROP FUNCTION pldbg_drop_slow_calls(OID);
+DROP FUNCTION pldbg_drop_breakpoint_actions(OID, INTEGER);
 DROP FUNCTION pldbg_drop_breakpoint(INTEGER, OID, INTEGER);
+DROP FUNCTION pldbg_disarm_all();
 DROP FUNCTION pldbg_deposit_value(INTEGER, TEXT, INTEGER, TEXT);
 DROP FUNCTION pldbg_create_listener();
 DROP FUNCTION pldbg_continue(INTEGER);
+DROP FUNCTION pldbg_capture_slow_calls(OID, INTEGER);
 DROP FUNCTION pldbg_attach_to_port(INTEGER);
+DROP FUNCTION pldbg_attach_observer(BIGINT);
+DROP FUNCTION pldbg_annotate(OID);
 DROP FUNCTION pldbg_abort_target(INTEGER);
 DROP FUNCTION pldbg_oid_debug(OID);
 DROP FUNCTION plpgsql_oid_debug(OID);
 
+DROP TYPE wait_stats;
+DROP TYPE plan_stats;
+DROP TYPE loop_query;
+DROP TYPE debug_session;
+DROP TYPE step_result;
+DROP TYPE action_result;
+DROP TYPE exported_line;
+DROP TYPE annotated_line;
+DROP TYPE profile_delta;
+DROP TYPE profile_line;
+DROP TYPE workload_call;
+DROP TYPE slow_call;
+DROP TYPE value_count;
+DROP TYPE typeinfo;
 DROP TYPE proxyInfo;
+DROP TYPE var_binary;
 DROP TYPE var;
 DROP TYPE targetinfo;
 DROP TYPE frame;